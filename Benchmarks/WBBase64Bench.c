@@ -0,0 +1,221 @@
+/*
+ *  WBBase64Bench.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// Base64 throughput benchmark.
+//
+// Measures encode and decode MB/s for both charsets, padded and unpadded
+// output, several payload sizes, and line-wrapped (MIME) input, using the
+// vectorized codec and the reference scalar codec. It then compares the
+// buffer API with the CFData one (when CoreFoundation is available), from
+// 16 bytes to 64 MB.
+//
+// It only depends on the buffer API, so it builds with any C toolchain:
+//
+//   cc -std=c11 -D_POSIX_C_SOURCE=200809L -O2 -ISources/Functions
+//      Benchmarks/WBBase64Bench.c Sources/Functions/WBBase64.c
+//      -o base64-bench -lpthread
+//
+// Usage: base64-bench [-s] [seconds per measure]
+//   -s  only run the scalar codec.
+
+#include "WBBase64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void _WBBenchFill(UInt8 *bytes, size_t length) {
+  uint32_t seed = 0x9e3779b9;
+  for (size_t idx = 0; idx < length; ++idx) {
+    seed = seed * 1664525 + 1013904223;
+    bytes[idx] = (UInt8)(seed >> 24);
+  }
+}
+
+// Insert a CRLF every 76 characters, as MIME does.
+static size_t _WBBenchWrap(const UInt8 *src, size_t length, UInt8 *dest) {
+  size_t out = 0;
+  for (size_t idx = 0; idx < length; ++idx) {
+    if (idx && idx % 76 == 0) {
+      dest[out++] = '\r';
+      dest[out++] = '\n';
+    }
+    dest[out++] = src[idx];
+  }
+  return out;
+}
+
+// Runs |block| until |duration| elapsed, and stores in |mbps| the throughput
+// of |length| bytes per iteration.
+#define WB_BENCH_MEASURE(mbps, duration, length, block) do { \
+  size_t __iterations = 0; \
+  double __start = _WBBenchNow(), __elapsed; \
+  do { \
+    block; \
+    __iterations++; \
+  } while ((__elapsed = _WBBenchNow() - __start) < (duration)); \
+  mbps = ((double)(length) * (double)__iterations) / (__elapsed * 1024 * 1024); \
+} while (0)
+
+static const CFIndex kWBBenchSizes[] = { 64, 1024, 64 * 1024, 4 * 1024 * 1024 };
+
+static void _WBBenchRun(const char *codec, double duration) {
+  CFIndex maxSize = kWBBenchSizes[sizeof(kWBBenchSizes) / sizeof(*kWBBenchSizes) - 1];
+  CFIndex maxEncoded = WBBase64GetEncodedLength(maxSize, true);
+  UInt8 *plain = malloc(maxSize);
+  UInt8 *encoded = malloc(maxEncoded);
+  UInt8 *wrapped = malloc(maxEncoded + (maxEncoded / 76 + 1) * 2);
+  UInt8 *decoded = malloc(WBBase64GetMaxDecodedLength(maxEncoded + (maxEncoded / 76 + 1) * 2));
+  if (!plain || !encoded || !wrapped || !decoded) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  _WBBenchFill(plain, maxSize);
+
+  static const struct {
+    const char *name;
+    WBBase64Charset charset;
+    bool padded;
+  } kVariants[] = {
+    { "rfc",            kWBBase64CharsetRFC,     true },
+    { "websafe",        kWBBase64CharsetWebSafe, true },
+    { "websafe-nopad",  kWBBase64CharsetWebSafe, false },
+  };
+
+  for (size_t v = 0; v < sizeof(kVariants) / sizeof(*kVariants); ++v) {
+    for (size_t s = 0; s < sizeof(kWBBenchSizes) / sizeof(*kWBBenchSizes); ++s) {
+      CFIndex size = kWBBenchSizes[s];
+      CFIndex elen = WBBase64GetEncodedLength(size, kVariants[v].padded);
+      CFIndex dlen = WBBase64GetMaxDecodedLength(elen);
+      CFIndex result = 0;
+
+      double enc, dec;
+      WB_BENCH_MEASURE(enc, duration, size, {
+        result = WBBase64EncodeToBuffer(plain, size, encoded, elen, kVariants[v].charset, kVariants[v].padded);
+      });
+      if (result != elen) {
+        fprintf(stderr, "encoding failed (%s, %ld)\n", kVariants[v].name, (long)size);
+        exit(1);
+      }
+      WB_BENCH_MEASURE(dec, duration, size, {
+        result = WBBase64DecodeToBuffer(encoded, elen, decoded, dlen, kVariants[v].charset, kVariants[v].padded);
+      });
+      if (result != size || memcmp(plain, decoded, size) != 0) {
+        fprintf(stderr, "decoding failed (%s, %ld)\n", kVariants[v].name, (long)size);
+        exit(1);
+      }
+      printf("%-6s %-14s %8ld B  encode %8.1f MB/s  decode %8.1f MB/s\n",
+             codec, kVariants[v].name, (long)size, enc, dec);
+    }
+  }
+
+  // Line-wrapped input goes through the scalar whitespace handling.
+  for (size_t s = 0; s < sizeof(kWBBenchSizes) / sizeof(*kWBBenchSizes); ++s) {
+    CFIndex size = kWBBenchSizes[s];
+    CFIndex elen = WBBase64EncodeToBuffer(plain, size, encoded, maxEncoded, kWBBase64CharsetRFC, true);
+    CFIndex wlen = (CFIndex)_WBBenchWrap(encoded, (size_t)elen, wrapped);
+    CFIndex dlen = WBBase64GetMaxDecodedLength(wlen);
+    CFIndex result = 0;
+    double dec;
+    WB_BENCH_MEASURE(dec, duration, size, {
+      result = WBBase64DecodeToBuffer(wrapped, wlen, decoded, dlen, kWBBase64CharsetRFC, true);
+    });
+    if (result != size || memcmp(plain, decoded, size) != 0) {
+      fprintf(stderr, "decoding failed (mime, %ld)\n", (long)size);
+      exit(1);
+    }
+    printf("%-6s %-14s %8ld B  %-22s decode %8.1f MB/s\n", codec, "mime", (long)size, "", dec);
+  }
+
+  free(decoded);
+  free(wrapped);
+  free(encoded);
+  free(plain);
+}
+
+// Buffer API against the CFData API, which allocates the result.
+static const CFIndex kWBBenchAPISizes[] = { 16, 256, 4096, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024 };
+
+static void _WBBenchRunAPIs(double duration) {
+  CFIndex maxSize = kWBBenchAPISizes[sizeof(kWBBenchAPISizes) / sizeof(*kWBBenchAPISizes) - 1];
+  CFIndex maxEncoded = WBBase64GetEncodedLength(maxSize, true);
+  UInt8 *plain = malloc(maxSize);
+  UInt8 *encoded = malloc(maxEncoded);
+  UInt8 *decoded = malloc(WBBase64GetMaxDecodedLength(maxEncoded));
+  if (!plain || !encoded || !decoded) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  _WBBenchFill(plain, maxSize);
+
+  for (size_t s = 0; s < sizeof(kWBBenchAPISizes) / sizeof(*kWBBenchAPISizes); ++s) {
+    CFIndex size = kWBBenchAPISizes[s];
+    CFIndex elen = WBBase64GetEncodedLength(size, true);
+    CFIndex dlen = WBBase64GetMaxDecodedLength(elen);
+    CFIndex result = 0;
+
+    double enc, dec;
+    WB_BENCH_MEASURE(enc, duration, size, {
+      result = WBBase64EncodeToBuffer(plain, size, encoded, elen, kWBBase64CharsetRFC, true);
+    });
+    WB_BENCH_MEASURE(dec, duration, size, {
+      result = WBBase64DecodeToBuffer(encoded, elen, decoded, dlen, kWBBase64CharsetRFC, true);
+    });
+    if (result != size || memcmp(plain, decoded, size) != 0) {
+      fprintf(stderr, "decoding failed (buffer, %ld)\n", (long)size);
+      exit(1);
+    }
+    printf("%-6s %-14s %8ld B  encode %8.1f MB/s  decode %8.1f MB/s\n", "api", "buffer", (long)size, enc, dec);
+
+#if WB_BASE64_HAS_COREFOUNDATION
+    WB_BENCH_MEASURE(enc, duration, size, {
+      CFRelease(WBBase64CreateDataByEncodingBytes(plain, size));
+    });
+    WB_BENCH_MEASURE(dec, duration, size, {
+      CFRelease(WBBase64CreateDataByDecodingBytes(encoded, elen));
+    });
+    printf("%-6s %-14s %8ld B  encode %8.1f MB/s  decode %8.1f MB/s\n", "api", "cfdata", (long)size, enc, dec);
+#endif
+  }
+
+  free(decoded);
+  free(encoded);
+  free(plain);
+}
+
+int main(int argc, char **argv) {
+  bool scalarOnly = false;
+  double duration = 0.25;
+  for (int idx = 1; idx < argc; ++idx) {
+    if (strcmp(argv[idx], "-s") == 0)
+      scalarOnly = true;
+    else
+      duration = atof(argv[idx]);
+  }
+  if (duration <= 0) {
+    fprintf(stderr, "usage: %s [-s] [seconds per measure]\n", argv[0]);
+    return 1;
+  }
+
+  if (!scalarOnly && WBBase64GetVectorCodecName()) {
+    _WBBenchRun(WBBase64GetVectorCodecName(), duration);
+    _WBBenchRunAPIs(duration);
+  }
+  WBBase64SetVectorCodecEnabled(false);
+  _WBBenchRun("scalar", duration);
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ *  WBBase64Fuzz.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// libFuzzer entry point for the Base64 decoder.
+//
+// Each input is decoded with both charsets by the vectorized and the scalar
+// codec, which must agree. Successfully decoded payloads are then encoded
+// again and decoded back, which must round-trip. When CoreFoundation is
+// available, WBBase64CreateDataByDecodingBytes() is checked against the
+// buffer API too.
+//
+// With libFuzzer:
+//
+//   clang -g -O1 -fsanitize=fuzzer,address,undefined -ISources/Functions
+//      Benchmarks/WBBase64Fuzz.c Sources/Functions/WBBase64.c -o base64-fuzz
+//
+// With any C toolchain, define WB_BASE64_FUZZ_MAIN to get a driver that
+// replays the files passed on the command line (a corpus or crash files):
+//
+//   cc -std=c11 -g -DWB_BASE64_FUZZ_MAIN -ISources/Functions
+//      Benchmarks/WBBase64Fuzz.c Sources/Functions/WBBase64.c
+//      -o base64-fuzz -lpthread
+
+#include "WBBase64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void _WBFuzzCheck(bool test, const char *message) {
+  if (!test) {
+    fprintf(stderr, "Base64 fuzz failure: %s\n", message);
+    abort();
+  }
+}
+
+static CFIndex _WBFuzzDecode(const uint8_t *data, CFIndex size, UInt8 *dest, CFIndex destLength,
+                             WBBase64Charset charset, bool requirePadding, bool vector) {
+  bool previous = WBBase64SetVectorCodecEnabled(vector);
+  memset(dest, 0, (size_t)destLength);
+  CFIndex length = WBBase64DecodeToBuffer(data, size, dest, destLength, charset, requirePadding);
+  WBBase64SetVectorCodecEnabled(previous);
+  return length;
+}
+
+static void _WBFuzzRoundTrip(const UInt8 *plain, CFIndex length, WBBase64Charset charset, bool padded) {
+  CFIndex elen = WBBase64GetEncodedLength(length, padded);
+  UInt8 *encoded = malloc((size_t)elen);
+  UInt8 *decoded = calloc(1, (size_t)WBBase64GetMaxDecodedLength(elen));
+  _WBFuzzCheck(encoded && decoded, "out of memory");
+
+  _WBFuzzCheck(WBBase64EncodeToBuffer(plain, length, encoded, elen, charset, padded) == elen,
+               "encoded length mismatch");
+  CFIndex dlen = WBBase64DecodeToBuffer(encoded, elen, decoded, WBBase64GetMaxDecodedLength(elen), charset, padded);
+  _WBFuzzCheck(dlen == length && memcmp(plain, decoded, (size_t)length) == 0, "round-trip mismatch");
+
+  free(decoded);
+  free(encoded);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (!size)
+    return 0;
+
+  CFIndex length = (CFIndex)size;
+  CFIndex maxLength = WBBase64GetMaxDecodedLength(length);
+  UInt8 *scalar = malloc((size_t)maxLength);
+  UInt8 *vector = malloc((size_t)maxLength);
+  _WBFuzzCheck(scalar && vector, "out of memory");
+
+  static const WBBase64Charset kCharsets[] = { kWBBase64CharsetRFC, kWBBase64CharsetWebSafe };
+  for (size_t idx = 0; idx < 2; ++idx) {
+    WBBase64Charset charset = kCharsets[idx];
+    bool requirePadding = charset == kWBBase64CharsetRFC;
+
+    CFIndex slen = _WBFuzzDecode(data, length, scalar, maxLength, charset, requirePadding, false);
+    CFIndex vlen = _WBFuzzDecode(data, length, vector, maxLength, charset, requirePadding, true);
+    _WBFuzzCheck(slen == vlen, "vector and scalar decoded length differ");
+    _WBFuzzCheck(memcmp(scalar, vector, (size_t)slen) == 0, "vector and scalar decoded bytes differ");
+
+#if WB_BASE64_HAS_COREFOUNDATION
+    CFDataRef cfdata = charset == kWBBase64CharsetRFC ? WBBase64CreateDataByDecodingBytes(data, length)
+                                                      : WBWSBase64CreateDataByDecodingBytes(data, length);
+    /* the buffer API returns 0 both for errors and for whitespace only input */
+    _WBFuzzCheck(cfdata != NULL || slen == 0, "CFData and buffer decoding differ");
+    if (cfdata) {
+      _WBFuzzCheck(CFDataGetLength(cfdata) == slen &&
+                   memcmp(CFDataGetBytePtr(cfdata), scalar, (size_t)slen) == 0, "CFData and buffer decoding differ");
+      CFRelease(cfdata);
+    }
+#endif
+
+    if (slen > 0) {
+      _WBFuzzRoundTrip(scalar, slen, charset, true);
+      _WBFuzzRoundTrip(scalar, slen, charset, false);
+    }
+  }
+  // Arbitrary bytes must round-trip too.
+  _WBFuzzRoundTrip(data, length, kWBBase64CharsetRFC, true);
+  _WBFuzzRoundTrip(data, length, kWBBase64CharsetWebSafe, false);
+
+  free(vector);
+  free(scalar);
+  return 0;
+}
+
+#if defined(WB_BASE64_FUZZ_MAIN)
+int main(int argc, char **argv) {
+  for (int idx = 1; idx < argc; ++idx) {
+    FILE *f = fopen(argv[idx], "rb");
+    if (!f) {
+      perror(argv[idx]);
+      return 1;
+    }
+    uint8_t *buffer = NULL;
+    size_t length = 0, capacity = 0, count;
+    do {
+      if (length == capacity) {
+        capacity = capacity ? capacity * 2 : 4096;
+        buffer = realloc(buffer, capacity);
+        _WBFuzzCheck(buffer != NULL, "out of memory");
+      }
+      count = fread(buffer + length, 1, capacity - length, f);
+      length += count;
+    } while (count > 0);
+    fclose(f);
+
+    LLVMFuzzerTestOneInput(buffer, length);
+    free(buffer);
+  }
+  return 0;
+}
+#endif
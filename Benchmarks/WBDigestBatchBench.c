@@ -0,0 +1,101 @@
+/*
+ *  WBDigestBatchBench.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBDigestDataBatch throughput benchmark.
+//
+// Hashes 1M chunks of 64 to 4096 bytes, as a dedup store would do, once
+// with a WBDigestData() loop and once with WBDigestDataBatch(), checks that
+// the digests are the same, and reports MB/s for each.
+//
+//   cc -std=c11 -D_POSIX_C_SOURCE=200809L -O2 -ISources/Security
+//      Benchmarks/WBDigestBatchBench.c Sources/Security/WBDigestFunctions.c
+//      Sources/Security/WBDigestBackend.c -o digest-batch-bench -lpthread
+//
+// Usage: digest-batch-bench [-a algorithm] [chunks]
+
+#include "WBDigestFunctions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { kWBBenchPoolSize = 8 * 1024 * 1024 };
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+  size_t count = 1024 * 1024;
+  const char *name = "sha256";
+  for (int idx = 1; idx < argc; ++idx) {
+    if (strcmp(argv[idx], "-a") == 0 && idx + 1 < argc)
+      name = argv[++idx];
+    else
+      count = strtoul(argv[idx], NULL, 10);
+  }
+  WBDigestAlgorithm algo = WBDigestGetAlgorithmByName(name);
+  if (algo == kWBDigestUndefined || count == 0) {
+    fprintf(stderr, "usage: %s [-a algorithm] [chunks]\n", argv[0]);
+    return 1;
+  }
+
+  const size_t length = WBDigestGetOutputSize(algo);
+  const void **buffers = malloc(count * sizeof(*buffers));
+  size_t *lengths = malloc(count * sizeof(*lengths));
+  uint8_t *pool = malloc(kWBBenchPoolSize);
+  uint8_t *serial = malloc(count * length);
+  uint8_t *batch = malloc(count * length);
+  if (!buffers || !lengths || !pool || !serial || !batch) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  uint32_t seed = 0x9e3779b9;
+  for (size_t idx = 0; idx < kWBBenchPoolSize; ++idx) {
+    seed = seed * 1664525 + 1013904223;
+    pool[idx] = (uint8_t)(seed >> 24);
+  }
+  size_t total = 0;
+  for (size_t idx = 0; idx < count; ++idx) {
+    seed = seed * 1664525 + 1013904223;
+    lengths[idx] = 64 + (seed >> 8) % 4032;
+    seed = seed * 1664525 + 1013904223;
+    buffers[idx] = pool + (seed >> 4) % (kWBBenchPoolSize - lengths[idx]);
+    total += lengths[idx];
+  }
+
+  double start = _WBBenchNow();
+  for (size_t idx = 0; idx < count; ++idx)
+    WBDigestData(buffers[idx], lengths[idx], algo, serial + idx * length);
+  double single = _WBBenchNow() - start;
+
+  start = _WBBenchNow();
+  WBDigestDataBatch(algo, buffers, lengths, count, batch);
+  double batched = _WBBenchNow() - start;
+
+  int result = memcmp(serial, batch, count * length) == 0 ? 0 : 1;
+  if (result)
+    fprintf(stderr, "WBDigestDataBatch and WBDigestData digests differ\n");
+
+  double mb = (double)total / (1024 * 1024);
+  printf("%s of %zu chunks (%.1f MB): WBDigestData %8.1f MB/s, WBDigestDataBatch %8.1f MB/s\n",
+         name, count, mb, mb / single, mb / batched);
+
+  free(batch);
+  free(serial);
+  free(pool);
+  free(lengths);
+  free(buffers);
+  return result;
+}
@@ -0,0 +1,216 @@
+/*
+ *  WBDigestBench.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// Digest backend benchmark.
+//
+// Checks the portable backend against known answers, then measures its
+// MB/s on large buffers for each algorithm. On Apple platforms the same
+// buffers are hashed with CommonCrypto, which must give the same digests.
+// Elsewhere, define WB_DIGEST_BENCH_OPENSSL to compare with OpenSSL.
+//
+//   cc -std=c11 -D_POSIX_C_SOURCE=200809L -O2 -ISources/Security
+//      Benchmarks/WBDigestBench.c Sources/Security/WBDigestBackend.c
+//      -o digest-bench -lpthread
+//
+// Usage: digest-bench [seconds per measure]
+
+#include "WBDigestBackend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__APPLE__)
+#  include <CommonCrypto/CommonDigest.h>
+#  define WB_DIGEST_BENCH_REFERENCE "CommonCrypto"
+#elif defined(WB_DIGEST_BENCH_OPENSSL)
+#  include <openssl/evp.h>
+#  define WB_DIGEST_BENCH_REFERENCE "OpenSSL"
+#endif
+
+typedef struct _WBBenchDigest {
+  const char *name;
+  size_t length;
+  int (*digest)(const void *data, size_t length, uint8_t *md);
+#if defined(WB_DIGEST_BENCH_REFERENCE)
+  int (*reference)(const void *data, size_t length, uint8_t *md);
+#endif
+} WBBenchDigest;
+
+#define WB_BENCH_BACKEND(algo, ctxt) \
+static int _WBBench##algo(const void *data, size_t length, uint8_t *md) { \
+  ctxt c; \
+  WB##algo##Init(&c); \
+  WB##algo##Update(&c, data, length); \
+  return WB##algo##Final(md, &c); \
+}
+
+WB_BENCH_BACKEND(MD5, WBMD5Context)
+WB_BENCH_BACKEND(SHA1, WBSHA1Context)
+WB_BENCH_BACKEND(SHA224, WBSHA256Context)
+WB_BENCH_BACKEND(SHA256, WBSHA256Context)
+WB_BENCH_BACKEND(SHA384, WBSHA512Context)
+WB_BENCH_BACKEND(SHA512, WBSHA512Context)
+
+#if defined(__APPLE__)
+// CC_LONG is 32 bits, so large buffers are fed in pieces.
+#define WB_BENCH_REFERENCE(algo, ctxt) \
+static int _WBReference##algo(const void *data, size_t length, uint8_t *md) { \
+  ctxt c; \
+  CC_##algo##_Init(&c); \
+  for (size_t offset = 0; offset < length; offset += 1 << 30) { \
+    size_t count = length - offset < (1 << 30) ? length - offset : (1 << 30); \
+    CC_##algo##_Update(&c, (const uint8_t *)data + offset, (CC_LONG)count); \
+  } \
+  return CC_##algo##_Final(md, &c); \
+}
+WB_BENCH_REFERENCE(MD5, CC_MD5_CTX)
+WB_BENCH_REFERENCE(SHA1, CC_SHA1_CTX)
+WB_BENCH_REFERENCE(SHA224, CC_SHA256_CTX)
+WB_BENCH_REFERENCE(SHA256, CC_SHA256_CTX)
+WB_BENCH_REFERENCE(SHA384, CC_SHA512_CTX)
+WB_BENCH_REFERENCE(SHA512, CC_SHA512_CTX)
+#elif defined(WB_DIGEST_BENCH_OPENSSL)
+#define WB_BENCH_REFERENCE(algo, md_function) \
+static int _WBReference##algo(const void *data, size_t length, uint8_t *md) { \
+  return EVP_Digest(data, length, md, NULL, md_function(), NULL); \
+}
+WB_BENCH_REFERENCE(MD5, EVP_md5)
+WB_BENCH_REFERENCE(SHA1, EVP_sha1)
+WB_BENCH_REFERENCE(SHA224, EVP_sha224)
+WB_BENCH_REFERENCE(SHA256, EVP_sha256)
+WB_BENCH_REFERENCE(SHA384, EVP_sha384)
+WB_BENCH_REFERENCE(SHA512, EVP_sha512)
+#endif
+
+#if defined(WB_DIGEST_BENCH_REFERENCE)
+#  define WB_BENCH_DIGEST(str, algo, length) { str, length, _WBBench##algo, _WBReference##algo }
+#else
+#  define WB_BENCH_DIGEST(str, algo, length) { str, length, _WBBench##algo }
+#endif
+
+static const WBBenchDigest kDigests[] = {
+  WB_BENCH_DIGEST("md5", MD5, 16),
+  WB_BENCH_DIGEST("sha1", SHA1, 20),
+  WB_BENCH_DIGEST("sha224", SHA224, 28),
+  WB_BENCH_DIGEST("sha256", SHA256, 32),
+  WB_BENCH_DIGEST("sha384", SHA384, 48),
+  WB_BENCH_DIGEST("sha512", SHA512, 64),
+};
+
+// Digests of "", "abc" and one million "a".
+static const char *kKnownAnswers[][3] = {
+  { "d41d8cd98f00b204e9800998ecf8427e", "900150983cd24fb0d6963f7d28e17f72", "7707d6ae4e027c70eea2a935c2296f21" },
+  { "da39a3ee5e6b4b0d3255bfef95601890afd80709", "a9993e364706816aba3e25717850c26c9cd0d89d",
+    "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+  { "d14a028c2a3a2bc9476102bb288234c415a2b01f828ea62ac5b3e42f", "23097d223405d8228642a477bda255b32aadbce4bda0b3f7e36c9da7",
+    "20794655980c91d8bbb4c1ea97618a4bf03f42581948b2ee4ee7ad67" },
+  { "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+  { "38b060a751ac96384cd9327eb1b1e36a21fdb71114be07434c0cc7bf63f6e1da274edebfe76f65fbd51ad2f14898b95b",
+    "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a43ff5bed8086072ba1e7cc2358baeca134c825a7",
+    "9d0e1809716474cb086e834e310a4a1ced149e9c00f248527972cec5704c2a5b07b8b3dc38ecc4ebae97ddd87f3d8985" },
+  { "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e",
+    "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f",
+    "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973ebde0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b" },
+};
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void _WBBenchFill(uint8_t *bytes, size_t length) {
+  uint32_t seed = 0x9e3779b9;
+  for (size_t idx = 0; idx < length; ++idx) {
+    seed = seed * 1664525 + 1013904223;
+    bytes[idx] = (uint8_t)(seed >> 24);
+  }
+}
+
+static void _WBBenchHex(const uint8_t *md, size_t length, char *str) {
+  static const char kHex[] = "0123456789abcdef";
+  for (size_t idx = 0; idx < length; ++idx) {
+    str[idx * 2] = kHex[md[idx] >> 4];
+    str[idx * 2 + 1] = kHex[md[idx] & 0xf];
+  }
+  str[length * 2] = '\0';
+}
+
+static double _WBBenchMeasure(int (*digest)(const void *, size_t, uint8_t *), const uint8_t *data, size_t length,
+                              double duration) {
+  uint8_t md[64];
+  size_t total = 0;
+  double start = _WBBenchNow(), elapsed;
+  do {
+    digest(data, length, md);
+    total += length;
+  } while ((elapsed = _WBBenchNow() - start) < duration);
+  return (double)total / elapsed / (1024 * 1024);
+}
+
+int main(int argc, char **argv) {
+  double duration = argc > 1 ? atof(argv[1]) : 1;
+  if (duration <= 0)
+    duration = 1;
+
+  const size_t kMillion = 1000 * 1000;
+  const size_t kLarge = 64 * 1024 * 1024;
+  uint8_t *data = malloc(kLarge);
+  if (!data)
+    return 1;
+
+  int failures = 0;
+  memset(data, 'a', kMillion);
+  const struct { const void *data; size_t length; } inputs[3] = { { "", 0 }, { "abc", 3 }, { data, kMillion } };
+  for (size_t idx = 0; idx < sizeof(kDigests) / sizeof(*kDigests); ++idx) {
+    for (size_t input = 0; input < 3; ++input) {
+      uint8_t md[64];
+      char hex[129];
+      kDigests[idx].digest(inputs[input].data, inputs[input].length, md);
+      _WBBenchHex(md, kDigests[idx].length, hex);
+      if (strcmp(hex, kKnownAnswers[idx][input]) != 0) {
+        fprintf(stderr, "%s: wrong digest for input %zu: %s\n", kDigests[idx].name, input, hex);
+        failures++;
+      }
+    }
+  }
+
+  _WBBenchFill(data, kLarge);
+  printf("implementation: %s\n", WBDigestBackendGetImplementation());
+#if defined(WB_DIGEST_BENCH_REFERENCE)
+  printf("%-8s %12s %12s\n", "", "backend", WB_DIGEST_BENCH_REFERENCE);
+#else
+  printf("%-8s %12s\n", "", "backend");
+#endif
+  for (size_t idx = 0; idx < sizeof(kDigests) / sizeof(*kDigests); ++idx) {
+    const WBBenchDigest *digest = &kDigests[idx];
+    printf("%-8s %7.0f MB/s", digest->name, _WBBenchMeasure(digest->digest, data, kLarge, duration));
+#if defined(WB_DIGEST_BENCH_REFERENCE)
+    printf(" %7.0f MB/s", _WBBenchMeasure(digest->reference, data, kLarge, duration));
+
+    // odd length, so the tail goes through the padding
+    uint8_t md[64], expected[64];
+    digest->digest(data + 1, kLarge - 1, md);
+    digest->reference(data + 1, kLarge - 1, expected);
+    if (memcmp(md, expected, digest->length) != 0) {
+      fprintf(stderr, "%s: digest differs from " WB_DIGEST_BENCH_REFERENCE "\n", digest->name);
+      failures++;
+    }
+#endif
+    printf("\n");
+  }
+
+  free(data);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/*
+ *  WBDigestFileBench.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBDigestFile throughput benchmark.
+//
+// Hashes a file with each WBDigestFileWithStrategy() strategy, checks they
+// all give the same digest, and reports GB/s. Without a path, a temporary
+// file of the given size (1 GB by default) is created first. When the
+// platform supports it (posix_fadvise), the file is evicted from the cache
+// before each measure, else the numbers are for a warm cache.
+//
+//   cc -std=c11 -D_POSIX_C_SOURCE=200809L -O2 -ISources/Security
+//      Benchmarks/WBDigestFileBench.c Sources/Security/WBDigestFunctions.c
+//      Sources/Security/WBDigestBackend.c -o digest-file-bench -lpthread
+//
+// Usage: digest-file-bench [-a algorithm] [-s size in MB] [path]
+
+#include "WBDigestFunctions.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void _WBBenchEvict(const char *path) {
+#if defined(POSIX_FADV_DONTNEED)
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#else
+  (void)path;
+#endif
+}
+
+static off_t _WBBenchCreateFile(char *path, size_t megabytes) {
+  const char *tmp = getenv("TMPDIR");
+  snprintf(path, 1024, "%s/wbdigest-bench-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return -1;
+
+  const size_t size = 1024 * 1024;
+  uint8_t *buffer = malloc(size);
+  uint32_t seed = 0x9e3779b9;
+  off_t total = 0;
+  for (size_t mb = 0; buffer && mb < megabytes; ++mb) {
+    for (size_t idx = 0; idx < size; ++idx) {
+      seed = seed * 1664525 + 1013904223;
+      buffer[idx] = (uint8_t)(seed >> 24);
+    }
+    if (write(fd, buffer, size) != (ssize_t)size)
+      break;
+    total += size;
+  }
+  free(buffer);
+  fsync(fd);
+  close(fd);
+  return total;
+}
+
+int main(int argc, char **argv) {
+  WBDigestAlgorithm algo = kWBDigestSHA256;
+  size_t megabytes = 1024;
+  int ch;
+  while ((ch = getopt(argc, argv, "a:s:")) != -1) {
+    switch (ch) {
+      case 'a':
+        algo = WBDigestGetAlgorithmByName(optarg);
+        break;
+      case 's':
+        megabytes = (size_t)strtoul(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-a algorithm] [-s size in MB] [path]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (kWBDigestUndefined == algo) {
+    fprintf(stderr, "unsupported algorithm\n");
+    return 1;
+  }
+
+  char path[1024];
+  bool temporary = optind >= argc;
+  off_t size;
+  if (temporary) {
+    size = _WBBenchCreateFile(path, megabytes);
+  } else {
+    snprintf(path, sizeof(path), "%s", argv[optind]);
+    FILE *f = fopen(path, "rb");
+    size = f && fseeko(f, 0, SEEK_END) == 0 ? ftello(f) : -1;
+    if (f)
+      fclose(f);
+  }
+  if (size <= 0) {
+    fprintf(stderr, "cannot create or read %s\n", path);
+    return 1;
+  }
+
+  static const struct { WBDigestFileStrategy strategy; const char *name; } kStrategies[] = {
+    { kWBDigestFileRead, "read" },
+    { kWBDigestFileMap, "mmap" },
+    { kWBDigestFileDirectIO, "direct" },
+    { kWBDigestFileThreaded, "threaded" },
+  };
+  uint8_t reference[WB_DIGEST_MAX_LENGTH];
+  size_t length = WBDigestGetOutputSize(algo);
+  int failures = 0;
+  printf("%.2f GB\n", (double)size / (1024 * 1024 * 1024));
+  for (size_t idx = 0; idx < sizeof(kStrategies) / sizeof(*kStrategies); ++idx) {
+    uint8_t md[WB_DIGEST_MAX_LENGTH];
+    _WBBenchEvict(path);
+    double start = _WBBenchNow();
+    int err = WBDigestFileWithStrategy(path, algo, kStrategies[idx].strategy, md);
+    double elapsed = _WBBenchNow() - start;
+    if (err <= 0) {
+      fprintf(stderr, "%s: failed\n", kStrategies[idx].name);
+      failures++;
+      continue;
+    }
+    if (0 == idx) {
+      memcpy(reference, md, length);
+    } else if (memcmp(reference, md, length) != 0) {
+      fprintf(stderr, "%s: digest mismatch\n", kStrategies[idx].name);
+      failures++;
+    }
+    printf("%-10s %6.2f GB/s\n", kStrategies[idx].name, (double)size / elapsed / (1024 * 1024 * 1024));
+  }
+
+  if (temporary)
+    unlink(path);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+/*
+ *  WBDigestSmallBench.cpp
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// Small message digest benchmark.
+//
+// For messages of at most 64 bytes, the compression function is cheap and
+// the cost of the runtime dispatch (algorithm lookup, context clearing,
+// indirect calls) shows. This compares, in ns per message, WBDigestData(),
+// the WBDigestInit/Update/Final functions and wb::Digest<Algo>.
+//
+//   cc -std=c11 -D_POSIX_C_SOURCE=200809L -O2 -c
+//      Sources/Security/WBDigestFunctions.c Sources/Security/WBDigestBackend.c
+//   c++ -std=c++11 -O2 -ISources/Security Benchmarks/WBDigestSmallBench.cpp
+//      WBDigestFunctions.o WBDigestBackend.o -o digest-small-bench -lpthread
+//
+// Usage: digest-small-bench [iterations]
+
+#include "WBDigest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Each message digest is fed in the next message, so the calls cannot be optimized away.
+template <WBDigestAlgorithm Algo>
+static double _WBBenchTemplate(uint8_t *message, size_t length, size_t iterations) {
+  double start = _WBBenchNow();
+  for (size_t idx = 0; idx < iterations; ++idx)
+    wb::Digest<Algo>::digest(message, length, message);
+  return (_WBBenchNow() - start) * 1e9 / iterations;
+}
+
+static double _WBBenchData(WBDigestAlgorithm algo, uint8_t *message, size_t length, size_t iterations) {
+  double start = _WBBenchNow();
+  for (size_t idx = 0; idx < iterations; ++idx)
+    WBDigestData(message, length, algo, message);
+  return (_WBBenchNow() - start) * 1e9 / iterations;
+}
+
+static double _WBBenchContext(WBDigestAlgorithm algo, uint8_t *message, size_t length, size_t iterations) {
+  double start = _WBBenchNow();
+  for (size_t idx = 0; idx < iterations; ++idx) {
+    WBDigestContext ctxt;
+    WBDigestInit(algo, &ctxt);
+    WBDigestUpdate(&ctxt, message, length);
+    WBDigestFinal(&ctxt, message);
+  }
+  return (_WBBenchNow() - start) * 1e9 / iterations;
+}
+
+template <WBDigestAlgorithm Algo>
+static int _WBBenchAlgorithm(const char *name, size_t iterations) {
+  static const size_t kLengths[] = { 0, 16, 32, 55, 64 };
+  int failures = 0;
+  for (size_t idx = 0; idx < sizeof(kLengths) / sizeof(*kLengths); ++idx) {
+    const size_t length = kLengths[idx];
+    uint8_t message[WB_DIGEST_MAX_LENGTH + 64] = { 0 };
+
+    // same digests through both APIs
+    uint8_t expected[WB_DIGEST_MAX_LENGTH], md[WB_DIGEST_MAX_LENGTH];
+    WBDigestData(message, length, Algo, expected);
+    wb::Digest<Algo> digest;
+    digest.update(message, length);
+    digest.final(md);
+    if (memcmp(md, expected, wb::Digest<Algo>::length) != 0) {
+      fprintf(stderr, "%s: digest mismatch for %zu bytes\n", name, length);
+      failures++;
+    }
+
+    double data = _WBBenchData(Algo, message, length, iterations);
+    double context = _WBBenchContext(Algo, message, length, iterations);
+    double templ = _WBBenchTemplate<Algo>(message, length, iterations);
+    printf("%-8s %4zu B %10.1f %10.1f %10.1f ns\n", name, length, data, context, templ);
+  }
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  size_t iterations = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 2000000;
+  if (!iterations)
+    iterations = 2000000;
+
+  printf("%-8s %6s %10s %10s %10s\n", "", "", "data", "context", "template");
+  int failures = 0;
+  failures += _WBBenchAlgorithm<kWBDigestMD5>("md5", iterations);
+  failures += _WBBenchAlgorithm<kWBDigestSHA1>("sha1", iterations);
+  failures += _WBBenchAlgorithm<kWBDigestSHA256>("sha256", iterations);
+  failures += _WBBenchAlgorithm<kWBDigestSHA512>("sha512", iterations);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+/*
+ *  WBIcnsFormatBench.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// icns RLE codec benchmark.
+//
+// Encodes and decodes 'it32' elements (128 x 128) of an icon like image, and
+// compares the decoder with a byte per byte PackBits decoder.
+// Reports MB/s of decoded planes, then writes the elements in a container,
+// parses it back and checks that every element decodes to the source pixels.
+//
+// It only depends on the C library, so it builds with any C toolchain:
+//
+//   cc -std=c11 -D_POSIX_C_SOURCE=200809L -O2 -ISources/Icons
+//      Benchmarks/WBIcnsFormatBench.c Sources/Icons/WBIcnsFormat.c Sources/Icons/WBIcnsPixels.c -o icns-format-bench
+//
+// Usage: icns-format-bench [iterations]
+
+#include "WBIcnsFormat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { kSize = 128, kPixels = kSize * kSize, kElements = 64 };
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* An icon like image: flat areas, gradients and noisy edges */
+static void _WBBenchFillARGB(uint8_t *argb, size_t size, uint32_t seed) {
+  for (size_t y = 0; y < size; ++y) {
+    for (size_t x = 0; x < size; ++x) {
+      uint8_t *pixel = argb + (y * size + x) * 4;
+      seed = seed * 1664525 + 1013904223;
+      size_t dx = x > size / 2 ? x - size / 2 : size / 2 - x;
+      size_t dy = y > size / 2 ? y - size / 2 : size / 2 - y;
+      size_t radius = dx * dx + dy * dy, limit = size * size / 5;
+      if (radius > limit + size) {
+        memset(pixel, 0, 4);
+      } else if (radius > limit) {
+        pixel[0] = (uint8_t)(seed >> 24);
+        pixel[1] = (uint8_t)(seed >> 16);
+        pixel[2] = (uint8_t)(seed >> 8);
+        pixel[3] = (uint8_t)seed;
+      } else {
+        pixel[0] = 255;
+        pixel[1] = (uint8_t)(y < size / 3 ? 40 : 200);
+        pixel[2] = (uint8_t)(x * 255 / size);
+        pixel[3] = (uint8_t)(y < size / 3 ? 220 : 60 + ((seed >> 24) & 1));
+      }
+    }
+  }
+}
+
+/* Byte per byte decoder */
+static size_t _WBBenchScalarDecode(const uint8_t *src, size_t srcLength, uint8_t *dst, size_t length) {
+  size_t in = 0, out = 0;
+  while (out < length) {
+    if (in >= srcLength)
+      return 0;
+    size_t packet = src[in++];
+    if (packet < 0x80) {
+      if (packet + 1 > srcLength - in || packet + 1 > length - out)
+        return 0;
+      for (size_t idx = 0; idx <= packet; ++idx)
+        dst[out++] = src[in++];
+    } else {
+      if (in >= srcLength || packet - 125 > length - out)
+        return 0;
+      uint8_t value = src[in++];
+      for (size_t idx = 0; idx < packet - 125; ++idx)
+        dst[out++] = value;
+    }
+  }
+  return in;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 200;
+  if (iterations < 1)
+    return 1;
+
+  int failures = 0;
+  size_t maxLength = WBIcnsElementMaxEncodedLength('it32');
+  uint8_t *argb = malloc(kElements * kPixels * 4);
+  uint8_t *encoded = malloc(kElements * maxLength);
+  uint8_t *decoded = malloc(kPixels * 4);
+  uint8_t *planes = malloc(kPixels * 3);
+  WBIcnsElement elements[kElements * 2];
+  for (size_t idx = 0; idx < kElements; ++idx)
+    _WBBenchFillARGB(argb + idx * kPixels * 4, kSize, (uint32_t)idx * 0x9e3779b9);
+
+  /* Encode */
+  double start = _WBBenchNow();
+  size_t total = 0;
+  for (int iter = 0; iter < iterations; ++iter) {
+    total = 0;
+    for (size_t idx = 0; idx < kElements; ++idx) {
+      elements[idx].type = 'it32';
+      elements[idx].data = encoded + idx * maxLength;
+      elements[idx].length = WBIcnsEncodeElement('it32', argb + idx * kPixels * 4, encoded + idx * maxLength);
+      total += elements[idx].length;
+    }
+  }
+  double elapsed = _WBBenchNow() - start;
+  double megabytes = (double)kElements * kPixels * 3 * iterations / 1e6;
+  printf("encode            %8.1f MB/s   (ratio %.2f)\n", megabytes / elapsed, (double)total / (kElements * kPixels * 3));
+
+  /* Decode the planes, byte per byte and vectorized */
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (size_t idx = 0; idx < kElements; ++idx) {
+      const uint8_t *data = elements[idx].data + 4;
+      size_t length = elements[idx].length - 4;
+      for (size_t plane = 0; plane < 3; ++plane) {
+        size_t used = _WBBenchScalarDecode(data, length, planes + plane * kPixels, kPixels);
+        data += used;
+        length -= used;
+      }
+    }
+  }
+  double scalar = _WBBenchNow() - start;
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (size_t idx = 0; idx < kElements; ++idx)
+      WBIcnsDecodeElementPlanes('it32', elements[idx].data, elements[idx].length, NULL, planes, planes + kPixels, planes + kPixels * 2);
+  }
+  double vector = _WBBenchNow() - start;
+  printf("decode planes     byte %8.1f MB/s   vector %8.1f MB/s   x%.1f\n", megabytes / scalar, megabytes / vector, scalar / vector);
+
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (size_t idx = 0; idx < kElements; ++idx)
+      WBIcnsDecodeElement('it32', elements[idx].data, elements[idx].length, decoded);
+  }
+  printf("decode ARGB       %8.1f MB/s\n", megabytes / (_WBBenchNow() - start));
+
+  /* Container round trip, with masks */
+  uint8_t *masks = malloc(kElements * kPixels);
+  for (size_t idx = 0; idx < kElements; ++idx) {
+    elements[kElements + idx].type = 't8mk';
+    elements[kElements + idx].data = masks + idx * kPixels;
+    elements[kElements + idx].length = WBIcnsEncodeElement('t8mk', argb + idx * kPixels * 4, masks + idx * kPixels);
+  }
+  size_t length = WBIcnsContainerLength(elements, kElements * 2);
+  uint8_t *container = malloc(length);
+  WBIcnsElement parsed[kElements * 2];
+  size_t count = 0;
+  if (WBIcnsWriteContainer(elements, kElements * 2, container) != length ||
+      !WBIcnsReadContainer(container, length, parsed, kElements * 2, &count) || count != kElements * 2) {
+    fprintf(stderr, "container round trip failed\n");
+    failures++;
+  } else {
+    for (size_t idx = 0; idx < kElements; ++idx) {
+      if (!WBIcnsDecodeElement(parsed[idx].type, parsed[idx].data, parsed[idx].length, decoded) ||
+          !WBIcnsDecodeElement(parsed[kElements + idx].type, parsed[kElements + idx].data, parsed[kElements + idx].length, decoded) ||
+          memcmp(decoded, argb + idx * kPixels * 4, kPixels * 4)) {
+        fprintf(stderr, "element %zu does not match the source pixels\n", idx);
+        failures++;
+      }
+    }
+  }
+
+  free(container);
+  free(masks);
+  free(planes);
+  free(decoded);
+  free(encoded);
+  free(argb);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+/*
+ *  WBIcnsPixelsBench.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// icns pixel conversion benchmark.
+//
+// Converts a 1024 x 1024 bitmap to ARGB (icns 32 bits data) for several source
+// layouts, and ARGB to premultiplied planes (icns data to bitmap), with the
+// vectorized kernels and with the former per pixel code (layout tests and
+// floating point division for each pixel). Reports Mpixels/s.
+// The former code rounds some values down one step too far, so the outputs
+// are compared with a tolerance of 1.
+//
+// It only depends on the C library, so it builds with any C toolchain:
+//
+//   cc -std=c11 -D_POSIX_C_SOURCE=200809L -O2 -ISources/Icons
+//      Benchmarks/WBIcnsPixelsBench.c Sources/Icons/WBIcnsPixels.c -o icns-pixels-bench
+//
+// Usage: icns-pixels-bench [iterations]
+
+#include "WBIcnsPixels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { kSize = 1024, kPixels = kSize * kSize };
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* An icon like image: mostly opaque or transparent, with antialiased edges */
+static void _WBBenchFillPremultipliedRGBA(uint8_t *rgba, size_t pixels) {
+  uint32_t seed = 0x9e3779b9;
+  for (size_t idx = 0; idx < pixels; ++idx) {
+    seed = seed * 1664525 + 1013904223;
+    uint8_t alpha = (seed >> 24) < 200 ? 255 : (seed >> 24) < 240 ? 0 : (uint8_t)(seed >> 8);
+    for (int c = 0; c < 3; ++c)
+      rgba[idx * 4 + c] = (uint8_t)(((seed >> (c * 8)) & 0xff) * alpha / 255);
+    rgba[idx * 4 + 3] = alpha;
+  }
+}
+
+#pragma mark Former code
+/* WBIconFamilyGet32BitDataForBitmap RGB case */
+static void _WBBenchLegacyRGB(uint8_t *src[], int isPlanar, int alpha, int alphaFirst, int premult,
+                              size_t width, size_t height, size_t skip, uint8_t *dest) {
+  for (size_t i = 0; i < height; i++) {
+    for (size_t j = 0; j < width; j++) {
+      uint8_t alphaPix = (alpha) ? ((isPlanar) ? *(src[3]++) : (alphaFirst) ? *(src[0]++) : *(src[0] + 3)) : 0;
+      double oneOverAlpha = (alphaPix && premult) ? 255. / alphaPix : 1;
+      *(dest++) = alphaPix;
+      *(dest++) = *(src[0]++) * oneOverAlpha;
+      *(dest++) = ((isPlanar) ? *(src[1]++) : *(src[0]++)) * oneOverAlpha;
+      *(dest++) = ((isPlanar) ? *(src[2]++) : *(src[0]++)) * oneOverAlpha;
+      if (alpha && !alphaFirst) src[0]++;
+    }
+    src[0] += skip;
+    if (isPlanar) { src[1] += skip; src[2] += skip; if (alpha) src[3] += skip; }
+  }
+}
+
+/* WBIconFamilyBitmapDataFor32BitData */
+static void _WBBenchLegacyPlanes(const uint8_t *bytes, size_t pixels, uint8_t *planes[]) {
+  uint8_t *r = malloc(pixels), *g = malloc(pixels), *b = malloc(pixels), *a = malloc(pixels);
+  for (size_t i = 0; i < pixels; i++) {
+    a[i] = *(bytes++);
+    double alpha = a[i] / 255.;
+    r[i] = *(bytes++) * alpha;
+    g[i] = *(bytes++) * alpha;
+    b[i] = *(bytes++) * alpha;
+  }
+  planes[0] = r;
+  planes[1] = g;
+  planes[2] = b;
+  planes[3] = a;
+}
+
+#pragma mark -
+static int _WBBenchCompare(const char *name, const uint8_t *expected, const uint8_t *actual, size_t length) {
+  for (size_t idx = 0; idx < length; ++idx) {
+    int delta = (int)actual[idx] - (int)expected[idx];
+    if (delta < -1 || delta > 1) {
+      fprintf(stderr, "%s: outputs differ at %zu (%d != %d)\n", name, idx, actual[idx], expected[idx]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void _WBBenchReport(const char *name, double legacy, double vector, int iterations) {
+  printf("%-28s former %8.1f Mpx/s   vector %8.1f Mpx/s   x%.1f\n", name,
+         kPixels * (double)iterations / legacy / 1e6, kPixels * (double)iterations / vector / 1e6, legacy / vector);
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20;
+  if (iterations < 1)
+    return 1;
+
+  int failures = 0;
+  uint8_t *rgba = malloc(kPixels * 4);
+  uint8_t *expected = malloc(kPixels * 4);
+  uint8_t *argb = malloc(kPixels * 4);
+  uint8_t *planes[4];
+  for (int idx = 0; idx < 4; ++idx)
+    planes[idx] = malloc(kPixels);
+  _WBBenchFillPremultipliedRGBA(rgba, kPixels);
+
+  /* Interleaved premultiplied RGBA, the common NSBitmapImageRep layout */
+  double start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter) {
+    uint8_t *src[5] = { rgba };
+    _WBBenchLegacyRGB(src, 0, 1, 0, 1, kSize, kSize, 0, expected);
+  }
+  double legacy = _WBBenchNow() - start;
+  WBIcnsPixelLayout layout = { 3, true, false, false, true };
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter)
+    WBIcnsConvertToARGB(&layout, (const uint8_t * const[]){ rgba }, kSize * 4, kSize, kSize, argb);
+  _WBBenchReport("RGBA premultiplied", legacy, _WBBenchNow() - start, iterations);
+  failures += _WBBenchCompare("RGBA premultiplied", expected, argb, kPixels * 4);
+
+  /* Non premultiplied RGBA */
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter) {
+    uint8_t *src[5] = { rgba };
+    _WBBenchLegacyRGB(src, 0, 1, 0, 0, kSize, kSize, 0, expected);
+  }
+  legacy = _WBBenchNow() - start;
+  layout.premultiplied = false;
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter)
+    WBIcnsConvertToARGB(&layout, (const uint8_t * const[]){ rgba }, kSize * 4, kSize, kSize, argb);
+  _WBBenchReport("RGBA", legacy, _WBBenchNow() - start, iterations);
+  failures += _WBBenchCompare("RGBA", expected, argb, kPixels * 4);
+
+  /* Planar ARGB (the former code skips a red byte per pixel with planar alpha last layouts) */
+  WBIcnsDeinterleaveARGB(argb, kPixels, false, planes[0], planes[1], planes[2], planes[3]);
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter) {
+    /* the former code moves the alpha plane at the end */
+    uint8_t *src[5] = { planes[1], planes[2], planes[3], planes[0] };
+    _WBBenchLegacyRGB(src, 1, 1, 1, 1, kSize, kSize, 0, expected);
+  }
+  legacy = _WBBenchNow() - start;
+  layout = (WBIcnsPixelLayout){ 3, true, true, true, true };
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter)
+    WBIcnsConvertToARGB(&layout, (const uint8_t * const *)planes, kSize, kSize, kSize, argb);
+  _WBBenchReport("planar ARGB premultiplied", legacy, _WBBenchNow() - start, iterations);
+  failures += _WBBenchCompare("planar ARGB premultiplied", expected, argb, kPixels * 4);
+
+  /* ARGB to premultiplied planes */
+  WBIcnsSwizzleRGBAToARGB(rgba, argb, kPixels);
+  uint8_t *legacyPlanes[4];
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter) {
+    _WBBenchLegacyPlanes(argb, kPixels, legacyPlanes);
+    for (int idx = 0; idx < 4; ++idx) {
+      if (iter + 1 < iterations)
+        free(legacyPlanes[idx]);
+    }
+  }
+  legacy = _WBBenchNow() - start;
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter)
+    WBIcnsDeinterleaveARGB(argb, kPixels, true, planes[3], planes[0], planes[1], planes[2]);
+  _WBBenchReport("ARGB to premultiplied planes", legacy, _WBBenchNow() - start, iterations);
+  for (int idx = 0; idx < 4; ++idx) {
+    failures += _WBBenchCompare("ARGB to premultiplied planes", legacyPlanes[idx], planes[idx], kPixels);
+    free(legacyPlanes[idx]);
+  }
+
+  for (int idx = 0; idx < 4; ++idx)
+    free(planes[idx]);
+  free(rgba);
+  free(expected);
+  free(argb);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/*
+ *  WBIconFamilyBench.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBIconFamily generation benchmark.
+//
+// Builds the full family (16 to 1024 pixels, data and masks) from a 1024 x 1024
+// image with -setIconFamilyElements:fromImage: (scale pyramid and concurrent
+// encoding), and the way the former implementation did: the image is rescaled
+// by the delegate for each size, then each element is set one after another.
+// Reports the wall time of both, and checks that every element is readable.
+//
+//   clang -fobjc-arc -O2 -F<build products dir> -framework Cocoa
+//      -framework WonderBox Benchmarks/WBIconFamilyBench.m -o icon-family-bench
+//
+// Usage: icon-family-bench [iterations]
+
+#import <WonderBox/WBIconFamily.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const struct {
+  OSType type;
+  CGFloat size;
+  BOOL mask;
+} kElements[] = {
+  { kIconServices1024PixelDataARGB, 1024, NO },
+  { kIconServices512PixelDataARGB, 512, NO },
+  { kIconServices256PixelDataARGB, 256, NO },
+  { kThumbnail32BitData, 128, NO }, { kThumbnail8BitMask, 128, YES },
+  { kHuge32BitData, 48, NO }, { kHuge8BitMask, 48, YES },
+  { kLarge32BitData, 32, NO }, { kLarge8BitMask, 32, YES },
+  { kSmall32BitData, 16, NO }, { kSmall8BitMask, 16, YES },
+};
+
+enum { kElementCount = sizeof(kElements) / sizeof(*kElements) };
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static NSBitmapImageRep *_WBBenchDrawImage(NSImage *image, NSSize size) {
+  NSBitmapImageRep *bitmap = [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL
+                                                                     pixelsWide:size.width
+                                                                     pixelsHigh:size.height
+                                                                  bitsPerSample:8
+                                                                samplesPerPixel:4
+                                                                       hasAlpha:YES
+                                                                       isPlanar:NO
+                                                                 colorSpaceName:NSDeviceRGBColorSpace
+                                                                    bytesPerRow:0
+                                                                   bitsPerPixel:32];
+  [NSGraphicsContext saveGraphicsState];
+  NSGraphicsContext *ctxt = [NSGraphicsContext graphicsContextWithBitmapImageRep:bitmap];
+  [NSGraphicsContext setCurrentContext:ctxt];
+  [ctxt setImageInterpolation:NSImageInterpolationHigh];
+  [image drawInRect:NSMakeRect(0, 0, size.width, size.height) fromRect:NSZeroRect operation:NSCompositeCopy fraction:1];
+  [NSGraphicsContext restoreGraphicsState];
+  return bitmap;
+}
+
+/* An icon like image: a rounded shape with a gradient and some text */
+static NSImage *_WBBenchSourceImage(void) {
+  NSImage *image = [[NSImage alloc] initWithSize:NSMakeSize(1024, 1024)];
+  [image lockFocus];
+  NSBezierPath *path = [NSBezierPath bezierPathWithRoundedRect:NSMakeRect(64, 64, 896, 896) xRadius:160 yRadius:160];
+  NSGradient *gradient = [[NSGradient alloc] initWithStartingColor:[NSColor colorWithDeviceRed:.1 green:.4 blue:.9 alpha:1]
+                                                       endingColor:[NSColor colorWithDeviceRed:.6 green:.9 blue:1 alpha:.8]];
+  [gradient drawInBezierPath:path angle:90];
+  [[NSColor whiteColor] set];
+  [path setLineWidth:24];
+  [path stroke];
+  [@"WB" drawAtPoint:NSMakePoint(240, 300) withAttributes:@{ NSFontAttributeName: [NSFont boldSystemFontOfSize:420],
+                                                            NSForegroundColorAttributeName: [NSColor whiteColor] }];
+  [image unlockFocus];
+  return image;
+}
+
+@interface WBBenchScaler : NSObject
+@end
+
+@implementation WBBenchScaler
+- (NSBitmapImageRep *)iconFamily:(WBIconFamily *)aFamily shouldScaleImage:(NSImage *)anImage toSize:(NSSize)size {
+  return _WBBenchDrawImage(anImage, size);
+}
+@end
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 10;
+  if (iterations < 1)
+    return 1;
+
+  int failures = 0;
+  @autoreleasepool {
+    NSImage *image = _WBBenchSourceImage();
+    WBBenchScaler *scaler = [[WBBenchScaler alloc] init];
+
+    /* Former: one rescale per size, elements set one after another */
+    WBIconFamily *former = nil;
+    double start = _WBBenchNow();
+    for (int iter = 0; iter < iterations; ++iter) {
+      @autoreleasepool {
+        former = [[WBIconFamily alloc] init];
+        [former setDelegate:scaler];
+        NSBitmapImageRep *bitmap = nil;
+        for (NSUInteger idx = 0; idx < kElementCount; ++idx) {
+          if (!bitmap || [bitmap pixelsWide] != kElements[idx].size)
+            bitmap = [former scaleImage:image toSize:NSMakeSize(kElements[idx].size, kElements[idx].size)];
+          [former setIconFamilyElement:kElements[idx].type fromBitmap:bitmap];
+        }
+      }
+    }
+    double legacy = _WBBenchNow() - start;
+
+    WBIconFamily *family = nil;
+    NSUInteger count = 0;
+    start = _WBBenchNow();
+    for (int iter = 0; iter < iterations; ++iter) {
+      @autoreleasepool {
+        family = [[WBIconFamily alloc] init];
+        count = [family setIconFamilyElements:kWBSelectorAll fromImage:image];
+      }
+    }
+    double pyramid = _WBBenchNow() - start;
+    printf("former  %8.1f ms   pyramid %8.1f ms   x%.1f\n", legacy * 1e3 / iterations, pyramid * 1e3 / iterations, legacy / pyramid);
+
+    if (count != kElementCount) {
+      fprintf(stderr, "%lu elements set, expected %d\n", (unsigned long)count, kElementCount);
+      failures++;
+    }
+    for (NSUInteger idx = 0; idx < kElementCount; ++idx) {
+      NSString *type = NSFileTypeForHFSTypeCode(kElements[idx].type);
+      if (![family dataForIconFamilyElement:kElements[idx].type]) {
+        fprintf(stderr, "missing element %s\n", [type UTF8String]);
+        failures++;
+      } else if (kElements[idx].size <= 128) {
+        /* both families are filtered differently, but must look alike */
+        NSBitmapImageRep *bitmap = [family bitmapForIconFamilyElement:kElements[idx].type withMask:YES];
+        NSBitmapImageRep *reference = [former bitmapForIconFamilyElement:kElements[idx].type withMask:YES];
+        if (!bitmap || !reference) {
+          fprintf(stderr, "cannot decode element %s\n", [type UTF8String]);
+          failures++;
+          continue;
+        }
+        NSUInteger length = kElements[idx].size * kElements[idx].size, delta = 0;
+        const uint8_t *plane = [bitmap bitmapData], *expected = [reference bitmapData];
+        for (NSUInteger pixel = 0; pixel < length; ++pixel)
+          delta += plane[pixel] > expected[pixel] ? plane[pixel] - expected[pixel] : expected[pixel] - plane[pixel];
+        if (delta / length > 8) {
+          fprintf(stderr, "element %s differs (mean delta %lu)\n", [type UTF8String], (unsigned long)(delta / length));
+          failures++;
+        }
+      }
+    }
+  }
+  return failures ? 1 : 0;
+}
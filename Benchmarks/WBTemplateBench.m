@@ -0,0 +1,122 @@
+/*
+ *  WBTemplateBench.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBTemplate rendering benchmark.
+//
+// Writes a small report template (a header, a row block with a nested cell
+// block), then renders it a number of times (10000 by default, 20 rows of 4
+// cells each) with WBTemplate -stringRepresentation and with
+// WBTemplateRenderer, and reports the time per render. Both outputs must be
+// identical.
+//
+//   clang -fobjc-arc -O2 -F<build products dir> -framework Foundation
+//      -framework WonderBox Benchmarks/WBTemplateBench.m -o template-bench
+//
+// Usage: template-bench [render count]
+
+#import <WonderBox/WBCompiledTemplate.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static NSString * const kTemplate =
+  @"<html><head><title>@title!</title></head>\n<body>\n<h1>@title!</h1>\n<table>\n"
+  @"@Start:row!\n<tr class=\"@class!\"><th>@name!</th>"
+  @"@Start:cell!<td>@value!</td>@End!"
+  @"</tr>\n@End!\n</table>\n<p>@footer!</p>\n</body></html>\n";
+
+enum { kRows = 20, kCells = 4 };
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+  NSUInteger count = argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : 10000;
+  if (count < 1)
+    return 1;
+
+  int failures = 0;
+  @autoreleasepool {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"template-bench.html"];
+    [kTemplate writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+
+    NSMutableArray *values = [NSMutableArray array];
+    for (NSUInteger idx = 0; idx < kRows * kCells; ++idx)
+      [values addObject:[NSString stringWithFormat:@"%lu.%02lu €", (unsigned long)idx * 37, (unsigned long)idx % 100]];
+
+    NSString *reference = nil;
+    WBTemplate *tpl = [[WBTemplate alloc] initWithContentsOfFile:path encoding:NSUTF8StringEncoding];
+    [tpl load];
+    WBTemplate *row = [tpl blockWithName:@"row"];
+    WBTemplate *cell = [tpl blockWithName:@"cell"];
+    double start = _WBBenchNow();
+    for (NSUInteger iter = 0; iter < count; ++iter) {
+      @autoreleasepool {
+        [tpl setVariable:@"Report" forKey:@"title"];
+        [tpl setVariable:@"Generated" forKey:@"footer"];
+        for (NSUInteger r = 0; r < kRows; ++r) {
+          [row setVariable:(r % 2) ? @"odd" : @"even" forKey:@"class"];
+          [row setVariable:values[r] forKey:@"name"];
+          for (NSUInteger c = 0; c < kCells; ++c) {
+            [cell setVariable:values[r * kCells + c] forKey:@"value"];
+            [cell dumpBlock];
+          }
+          [row dumpBlock];
+        }
+        NSString *output = [tpl stringRepresentation];
+        [tpl reset];
+        if (!reference)
+          reference = output;
+      }
+    }
+    double elapsed = _WBBenchNow() - start;
+    printf("%-12s %8.2f us/render\n", "WBTemplate", elapsed * 1e6 / count);
+
+    WBCompiledTemplate *compiled = [[WBCompiledTemplate alloc] initWithContentsOfFile:path encoding:NSUTF8StringEncoding];
+    WBTemplateRenderer *renderer = [[WBTemplateRenderer alloc] initWithTemplate:compiled];
+    NSUInteger rowBlock = [compiled indexOfBlock:@"row"], cellBlock = [compiled indexOfBlock:@"cell"];
+    NSUInteger title = [compiled slotOfVariable:@"title" inBlock:kWBTemplateRootBlock];
+    NSUInteger footer = [compiled slotOfVariable:@"footer" inBlock:kWBTemplateRootBlock];
+    NSUInteger klass = [compiled slotOfVariable:@"class" inBlock:rowBlock];
+    NSUInteger name = [compiled slotOfVariable:@"name" inBlock:rowBlock];
+    NSUInteger value = [compiled slotOfVariable:@"value" inBlock:cellBlock];
+    NSData *output = nil;
+    start = _WBBenchNow();
+    for (NSUInteger iter = 0; iter < count; ++iter) {
+      @autoreleasepool {
+        [renderer setString:@"Report" forSlot:title];
+        [renderer setString:@"Generated" forSlot:footer];
+        for (NSUInteger r = 0; r < kRows; ++r) {
+          [renderer setString:(r % 2) ? @"odd" : @"even" forSlot:klass];
+          [renderer setString:values[r] forSlot:name];
+          for (NSUInteger c = 0; c < kCells; ++c) {
+            [renderer setString:values[r * kCells + c] forSlot:value];
+            [renderer dumpBlock:cellBlock];
+          }
+          [renderer dumpBlock:rowBlock];
+        }
+        output = [renderer renderedData];
+      }
+    }
+    elapsed = _WBBenchNow() - start;
+    printf("%-12s %8.2f us/render\n", "compiled", elapsed * 1e6 / count);
+
+    if (![[[NSString alloc] initWithData:output encoding:NSUTF8StringEncoding] isEqualToString:reference]) {
+      fprintf(stderr, "outputs differ\n");
+      failures++;
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,138 @@
+/*
+ *  WBTemplateRowsBench.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBTemplateRenderer bulk rendering benchmark.
+//
+// Renders a CSV like row block of 10 variables a number of times (1000000 by
+// default) with -dumpBlock:rows:columns:, -dumpBlock:rows:function:context:
+// and, for reference, with -setUTF8String:length:forSlot: and -dumpBlock:.
+// Reports rows per second. All outputs must be identical.
+//
+//   clang -fobjc-arc -O2 -F<build products dir> -framework Foundation
+//      -framework WonderBox Benchmarks/WBTemplateRowsBench.m -o template-rows-bench
+//
+// Usage: template-rows-bench [row count]
+
+#import <WonderBox/WBCompiledTemplate.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static NSString * const kTemplate =
+  @"id;name;city;zip;phone;mail;date;amount;currency;status\n"
+  @"@Start:row!@id!;@name!;@city!;@zip!;@phone!;@mail!;@date!;@amount!;@currency!;@status!\n@End!";
+
+static NSString * const kVariables[] = {
+  @"id", @"name", @"city", @"zip", @"phone", @"mail", @"date", @"amount", @"currency", @"status",
+};
+
+enum { kColumns = 10, kDistinct = 1024 };
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+typedef struct _WBBenchRows {
+  /* kDistinct values by column, indexed by slot - first slot */
+  WBTemplateValue *values[kColumns];
+} WBBenchRows;
+
+static BOOL _WBBenchRow(NSUInteger row, WBTemplateValue *values, void *context) {
+  const WBBenchRows *rows = context;
+  for (NSUInteger column = 0; column < kColumns; ++column)
+    values[column] = rows->values[column][row % kDistinct];
+  return YES;
+}
+
+int main(int argc, char **argv) {
+  NSUInteger count = argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : 1000000;
+  if (count < 1)
+    return 1;
+
+  int failures = 0;
+  @autoreleasepool {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"template-rows-bench.csv"];
+    [kTemplate writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    WBCompiledTemplate *compiled = [[WBCompiledTemplate alloc] initWithContentsOfFile:path encoding:NSUTF8StringEncoding];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    NSUInteger block = [compiled indexOfBlock:@"row"];
+    NSRange slots = [compiled slotRangeOfBlock:block];
+    if (NSNotFound == block || kColumns != slots.length) {
+      fprintf(stderr, "cannot compile template\n");
+      return 1;
+    }
+
+    WBBenchRows rows = {};
+    for (NSUInteger variable = 0; variable < kColumns; ++variable) {
+      NSUInteger column = [compiled slotOfVariable:kVariables[variable] inBlock:block] - slots.location;
+      rows.values[column] = calloc(kDistinct, sizeof(WBTemplateValue));
+      for (NSUInteger idx = 0; idx < kDistinct; ++idx) {
+        char *value = NULL;
+        int length = asprintf(&value, "%s-%lu", [kVariables[variable] UTF8String], (unsigned long)(idx * 7919 % 100003));
+        rows.values[column][idx] = (WBTemplateValue){ value, (NSUInteger)length };
+      }
+    }
+    /* columns of count values */
+    const WBTemplateValue *columns[kColumns];
+    for (NSUInteger column = 0; column < kColumns; ++column) {
+      WBTemplateValue *values = malloc(count * sizeof(*values));
+      for (NSUInteger row = 0; row < count; ++row)
+        values[row] = rows.values[column][row % kDistinct];
+      columns[column] = values;
+    }
+
+    WBTemplateRenderer *renderer = [[WBTemplateRenderer alloc] initWithTemplate:compiled];
+    double start = _WBBenchNow();
+    for (NSUInteger row = 0; row < count; ++row) {
+      for (NSUInteger column = 0; column < kColumns; ++column) {
+        const WBTemplateValue *value = &rows.values[column][row % kDistinct];
+        [renderer setUTF8String:value->bytes length:value->length forSlot:slots.location + column];
+      }
+      [renderer dumpBlock:block];
+    }
+    NSData *reference = [renderer renderedData];
+    double elapsed = _WBBenchNow() - start;
+    printf("%-10s %12.0f rows/s\n", "dumpBlock", count / elapsed);
+
+    start = _WBBenchNow();
+    [renderer dumpBlock:block rows:count columns:columns];
+    NSData *output = [renderer renderedData];
+    elapsed = _WBBenchNow() - start;
+    printf("%-10s %12.0f rows/s\n", "columns", count / elapsed);
+    if (![output isEqualToData:reference]) {
+      fprintf(stderr, "columns output differs\n");
+      failures++;
+    }
+
+    start = _WBBenchNow();
+    if ([renderer dumpBlock:block rows:count function:_WBBenchRow context:&rows] != count) {
+      fprintf(stderr, "missing rows\n");
+      failures++;
+    }
+    output = [renderer renderedData];
+    elapsed = _WBBenchNow() - start;
+    printf("%-10s %12.0f rows/s\n", "function", count / elapsed);
+    if (![output isEqualToData:reference]) {
+      fprintf(stderr, "function output differs\n");
+      failures++;
+    }
+
+    for (NSUInteger column = 0; column < kColumns; ++column) {
+      for (NSUInteger idx = 0; idx < kDistinct; ++idx)
+        free((void *)rows.values[column][idx].bytes);
+      free(rows.values[column]);
+      free((void *)columns[column]);
+    }
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+/*
+ *  WBTextLinesBench.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBTextGetCountOfLines() and WBTextConvertLineEnding() benchmark.
+//
+// Counts the lines of, and converts to LF, a 4 MB text with mixed line
+// endings (CR, LF, CR LF and LINE SEPARATOR), stored as UTF-16 and as ASCII,
+// with the vector scanners and with the former implementations
+// (CFStringGetLineBounds() per line, CFStringReplace() per line break).
+// Reports MB/s. All results must be identical.
+//
+//   cc -std=c11 -D_POSIX_C_SOURCE=200809L -O2 -F<build products dir> -framework CoreFoundation
+//      -framework WonderBox Benchmarks/WBTextLinesBench.c -o text-lines-bench
+//
+// Usage: text-lines-bench [iterations]
+
+#include <WonderBox/WBTextFunctions.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { kTextLength = 4 * 1024 * 1024 };
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+#pragma mark Former code
+static CFIndex _WBBenchLegacyCountOfLines(CFStringRef str) {
+  CFIndex lines = 0;
+  CFIndex stringLength = CFStringGetLength(str);
+  for (CFIndex idx = 0; idx < stringLength; lines++)
+    CFStringGetLineBounds(str, CFRangeMake(idx, 0), NULL, &idx, NULL);
+  return lines;
+}
+
+static CFIndex _WBBenchLegacyConvertLineEnding(CFMutableStringRef str, CFStringRef endOfLine) {
+  CFIndex position = 0, idx = 0, count = 0;
+  CFIndex eol = CFStringGetLength(endOfLine);
+  CFIndex length = CFStringGetLength(str);
+
+  UniChar ch;
+  CFStringInlineBuffer buffer;
+  CFStringInitInlineBuffer(str, &buffer, CFRangeMake(0, length));
+  while ((ch = CFStringGetCharacterFromInlineBuffer(&buffer, idx))) {
+    CFRange range = CFRangeMake(kCFNotFound, 0);
+    if (kWBCarriageReturnCharacter == ch) {
+      range.length = 1;
+      range.location = idx;
+      ch = CFStringGetCharacterFromInlineBuffer(&buffer, idx + 1);
+      if (kWBNewlineCharacter == ch) {
+        idx++;
+        range.length = 2;
+      }
+    } else if (kWBNewlineCharacter == ch || kWBLineSeparatorCharacter == ch || kWBParagraphSeparatorCharacter == ch) {
+      range.length = 1;
+      range.location = idx;
+    }
+    idx++;
+    if (range.location != kCFNotFound) {
+      count++;
+      range.location += position;
+      CFIndex delta = eol - range.length;
+      CFStringReplace(str, range, endOfLine);
+      if (delta != 0) {
+        idx += delta;
+        length += delta;
+        position += idx;
+        CFStringInitInlineBuffer(str, &buffer, CFRangeMake(position, length - position));
+        idx = 0;
+      }
+    }
+  }
+  return count;
+}
+
+#pragma mark -
+/* Lines of 0 to 120 characters */
+static UniChar *_WBBenchCreateText(CFIndex length, bool ascii) {
+  static const UniChar kBreaks[][2] = { { '\n' }, { '\r', '\n' }, { '\r' }, { kWBLineSeparatorCharacter } };
+  UniChar *text = malloc(length * sizeof(*text));
+  uint32_t seed = 0x9e3779b9;
+  for (CFIndex idx = 0; idx < length;) {
+    seed = seed * 1664525 + 1013904223;
+    CFIndex line = (seed >> 8) % 121;
+    for (CFIndex c = 0; c < line && idx < length; ++c, ++idx)
+      text[idx] = (UniChar)('a' + (idx + c) % 26);
+    const UniChar *brk = kBreaks[ascii ? (seed >> 24) % 3 : (seed >> 24) % 4];
+    for (CFIndex c = 0; c < 2 && brk[c] && idx < length; ++c)
+      text[idx++] = brk[c];
+  }
+  return text;
+}
+
+static int _WBBenchRun(const char *name, CFStringRef text, int iterations) {
+  int failures = 0;
+  double mb = (double)CFStringGetLength(text) * iterations / 1e6;
+
+  CFIndex expected = 0, lines = 0;
+  double start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter)
+    expected = _WBBenchLegacyCountOfLines(text);
+  double legacy = _WBBenchNow() - start;
+  start = _WBBenchNow();
+  for (int iter = 0; iter < iterations; ++iter)
+    lines = WBTextGetCountOfLines(text);
+  double vector = _WBBenchNow() - start;
+  printf("%-6s lines     former %8.1f MB/s   vector %8.1f MB/s   x%.1f\n", name, mb / legacy, mb / vector, legacy / vector);
+  if (lines != expected) {
+    fprintf(stderr, "%s: %ld lines, expected %ld\n", name, (long)lines, (long)expected);
+    failures++;
+  }
+
+  /* the former conversion is quadratic, so it runs once */
+  CFMutableStringRef reference = CFStringCreateMutableCopy(kCFAllocatorDefault, 0, text);
+  start = _WBBenchNow();
+  CFIndex count = _WBBenchLegacyConvertLineEnding(reference, CFSTR("\n"));
+  legacy = _WBBenchNow() - start;
+
+  CFMutableStringRef converted = NULL;
+  CFIndex result = 0;
+  vector = 0;
+  for (int iter = 0; iter < iterations; ++iter) {
+    if (converted)
+      CFRelease(converted);
+    converted = CFStringCreateMutableCopy(kCFAllocatorDefault, 0, text);
+    start = _WBBenchNow();
+    result = WBTextConvertLineEnding(converted, CFSTR("\n"));
+    vector += _WBBenchNow() - start;
+  }
+  mb /= iterations;
+  printf("%-6s convert   former %8.1f MB/s   vector %8.1f MB/s   x%.1f\n", name, mb / legacy, mb * iterations / vector, legacy * iterations / vector);
+  if (result != count || !CFEqual(converted, reference)) {
+    fprintf(stderr, "%s: converted strings differ\n", name);
+    failures++;
+  }
+  CFRelease(converted);
+  CFRelease(reference);
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 10;
+  if (iterations < 1)
+    return 1;
+
+  int failures = 0;
+  UniChar *chars = _WBBenchCreateText(kTextLength, false);
+  CFStringRef text = CFStringCreateWithCharacters(kCFAllocatorDefault, chars, kTextLength);
+  failures += _WBBenchRun("UTF-16", text, iterations);
+  CFRelease(text);
+  free(chars);
+
+  chars = _WBBenchCreateText(kTextLength, true);
+  char *ascii = malloc(kTextLength);
+  for (CFIndex idx = 0; idx < kTextLength; ++idx)
+    ascii[idx] = (char)chars[idx];
+  text = CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)ascii, kTextLength, kCFStringEncodingASCII, false);
+  failures += _WBBenchRun("ASCII", text, iterations);
+  CFRelease(text);
+  free(ascii);
+  free(chars);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+/*
+ *  WBTreeArchiveBench.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBTreeArchiver benchmark.
+//
+// Builds a tree of named nodes (1M nodes by default, names taken from a small
+// set like file extensions), then archives and restores it with
+// NSKeyedArchiver and WBTreeArchiver, and reports the archive sizes and the
+// times. It also measures opening a mapped archive and restoring the first
+// level only.
+//
+//   clang -fobjc-arc -O2 -F<build products dir> -framework Foundation
+//      -framework WonderBox Benchmarks/WBTreeArchiveBench.m -o tree-archive-bench
+//
+// Usage: tree-archive-bench [node count]
+
+#import <WonderBox/WBTreeArchive.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+@interface WBBenchItem : WBTreeNode <NSCoding, WBTreeArchiving>
+@property(nonatomic, copy) NSString *name;
+@property(nonatomic) int64_t size;
+@end
+
+@implementation WBBenchItem
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+  [super encodeWithCoder:coder];
+  [coder encodeObject:_name forKey:@"name"];
+  [coder encodeInt64:_size forKey:@"size"];
+}
+
+- (instancetype)initWithCoder:(NSCoder *)coder {
+  if (self = [super initWithCoder:coder]) {
+    _name = [coder decodeObjectForKey:@"name"];
+    _size = [coder decodeInt64ForKey:@"size"];
+  }
+  return self;
+}
+
+- (void)encodeWithTreeArchiver:(WBTreeArchiver *)archiver {
+  [archiver encodeString:_name];
+  [archiver encodeInteger:_size];
+}
+
+- (instancetype)initWithTreeUnarchiver:(WBTreeUnarchiver *)unarchiver {
+  if (self = [super init]) {
+    _name = [unarchiver decodeString];
+    _size = [unarchiver decodeInteger];
+  }
+  return self;
+}
+
+@end
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static NSUInteger _WBBenchCount(WBTreeNode *node) {
+  NSUInteger count = 1;
+  for (WBTreeNode *child in node)
+    count += _WBBenchCount(child);
+  return count;
+}
+
+static void _WBBenchInitialize(WBTreeNode *node, void *payload, void *context) {
+  static NSString * const kNames[] = { @"Info.plist", @"main.m", @"README", @"icon.png", @"Makefile", @"index.html" };
+  WBBenchItem *item = (WBBenchItem *)node;
+  uintptr_t idx = (uintptr_t)payload;
+  item.name = kNames[idx % 6];
+  item.size = (int64_t)(idx * 2654435761u % 100000);
+}
+
+int main(int argc, char **argv) {
+  NSUInteger count = argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : 1000000;
+  if (count < 2)
+    return 1;
+
+  WBTreeNodeRecord *records = malloc(count * sizeof(*records));
+  uint32_t seed = 0x9e3779b9;
+  records[0].parent = NSNotFound;
+  records[0].payload = NULL;
+  NSUInteger parent = 0;
+  for (NSUInteger idx = 1; idx < count; ++parent) {
+    seed = seed * 1664525 + 1013904223;
+    for (NSUInteger children = 1 + (seed >> 8) % 32; children > 0 && idx < count; --children, ++idx) {
+      records[idx].parent = parent;
+      records[idx].payload = (void *)(uintptr_t)idx;
+    }
+  }
+
+  int failures = 0;
+  @autoreleasepool {
+    WBBenchItem *root = [WBBenchItem nodeWithRecords:records count:count initializer:_WBBenchInitialize context:NULL];
+    free(records);
+
+    NSData *keyed, *compact;
+    @autoreleasepool {
+      double start = _WBBenchNow();
+      keyed = [NSKeyedArchiver archivedDataWithRootObject:root];
+      double archive = _WBBenchNow() - start;
+      start = _WBBenchNow();
+      WBTreeNode *copy = [NSKeyedUnarchiver unarchiveObjectWithData:keyed];
+      double restore = _WBBenchNow() - start;
+      if (_WBBenchCount(copy) != count)
+        failures++;
+      printf("%-8s %10lu bytes, archive %6.3f s, restore %6.3f s\n", "keyed",
+             (unsigned long)[keyed length], archive, restore);
+    }
+
+    @autoreleasepool {
+      double start = _WBBenchNow();
+      compact = [WBTreeArchiver archivedDataWithRootNode:root];
+      double archive = _WBBenchNow() - start;
+      start = _WBBenchNow();
+      WBTreeUnarchiver *unarchiver = [[WBTreeUnarchiver alloc] initWithData:compact error:NULL];
+      WBTreeNode *copy = [unarchiver rootNode];
+      double restore = _WBBenchNow() - start;
+      if (_WBBenchCount(copy) != count)
+        failures++;
+      printf("%-8s %10lu bytes, archive %6.3f s, restore %6.3f s\n", "compact",
+             (unsigned long)[compact length], archive, restore);
+    }
+
+    @autoreleasepool {
+      NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"tree-archive-bench.wbta"];
+      [compact writeToFile:path atomically:NO];
+      double start = _WBBenchNow();
+      WBTreeUnarchiver *unarchiver = [[WBTreeUnarchiver alloc] initWithContentsOfFile:path error:NULL];
+      WBTreeNode *top = [unarchiver nodeWithReference:[unarchiver rootReference] depth:1];
+      double open = _WBBenchNow() - start;
+      if ([top count] != [root count])
+        failures++;
+      printf("%-8s open and restore first level %6.3f ms\n", "mapped", open * 1e3);
+      [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    }
+  }
+  if (failures)
+    fprintf(stderr, "wrong node count\n");
+  return failures ? 1 : 0;
+}
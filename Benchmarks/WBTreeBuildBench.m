@@ -0,0 +1,146 @@
+/*
+ *  WBTreeBuildBench.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBTreeNode bulk building benchmark.
+//
+// Generates a file system like snapshot (5M nodes by default, directories of
+// 1 to 200 entries, a few very large ones), then builds it with -appendChild:,
+// +nodeWithRecords:count:initializer:context: and
+// +nodeWithStream:initializer:context:, and measures each build and the
+// release of the whole tree.
+//
+//   clang -fobjc-arc -O2 -F<build products dir> -framework Foundation
+//      -framework WonderBox Benchmarks/WBTreeBuildBench.m -o tree-build-bench
+//
+// Usage: tree-build-bench [node count]
+
+#import <WonderBox/WBTreeNode.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+typedef struct _WBBenchStream {
+  const WBTreeNodeRecord *records;
+  const NSUInteger *depths;
+  NSUInteger count;
+  NSUInteger position;
+} WBBenchStream;
+
+static BOOL _WBBenchNext(NSUInteger *depth, void **payload, void *context) {
+  WBBenchStream *stream = context;
+  if (stream->position >= stream->count)
+    return NO;
+  *depth = stream->depths[stream->position];
+  *payload = stream->records[stream->position].payload;
+  stream->position++;
+  return YES;
+}
+
+static NSUInteger _WBBenchCount(WBTreeNode *node) {
+  NSUInteger count = 1;
+  for (WBTreeNode *child = [node firstChild]; child; child = [child nextSibling])
+    count += _WBBenchCount(child);
+  return count;
+}
+
+int main(int argc, char **argv) {
+  NSUInteger count = argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : 5000000;
+  if (count < 1)
+    return 1;
+
+  // pre-order records: each directory is followed by its whole content.
+  WBTreeNodeRecord *records = malloc(count * sizeof(*records));
+  NSUInteger *depths = malloc(count * sizeof(*depths));
+  NSUInteger *stack = malloc(count * sizeof(*stack));
+  NSUInteger *remaining = malloc(count * sizeof(*remaining));
+  uint32_t seed = 0x9e3779b9;
+  NSUInteger top = 0;
+  records[0].parent = NSNotFound;
+  depths[0] = 0;
+  stack[0] = 0;
+  remaining[0] = count - 1;
+  for (NSUInteger idx = 1; idx < count; ++idx) {
+    while (top > 0 && 0 == remaining[top])
+      top--;
+    records[idx].parent = stack[top];
+    records[idx].payload = NULL;
+    depths[idx] = top + 1;
+    remaining[top]--;
+    seed = seed * 1664525 + 1013904223;
+    // one entry out of 8 is a directory.
+    if (0 == (seed >> 8) % 8 && top < 64) {
+      seed = seed * 1664525 + 1013904223;
+      NSUInteger entries = 0 == (seed >> 8) % 1000 ? 200000 : 1 + (seed >> 8) % 200;
+      stack[++top] = idx;
+      remaining[top] = entries;
+    }
+  }
+  free(remaining);
+  free(stack);
+
+  int failures = 0;
+  @autoreleasepool {
+    double start = _WBBenchNow();
+    WBTreeNode * __unsafe_unretained *nodes = (WBTreeNode * __unsafe_unretained *)malloc(count * sizeof(*nodes));
+    WBTreeNode *root = [WBTreeNode node];
+    nodes[0] = root;
+    for (NSUInteger idx = 1; idx < count; ++idx) {
+      WBTreeNode *node = [WBTreeNode node];
+      [nodes[records[idx].parent] appendChild:node];
+      nodes[idx] = node;
+    }
+    free(nodes);
+    double append = _WBBenchNow() - start;
+    if (_WBBenchCount(root) != count)
+      failures++;
+    start = _WBBenchNow();
+    root = nil;
+    double release = _WBBenchNow() - start;
+    printf("%-10s build %6.3f s, release %6.3f s\n", "append", append, release);
+  }
+
+  @autoreleasepool {
+    double start = _WBBenchNow();
+    WBTreeNode *root = [WBTreeNode nodeWithRecords:records count:count initializer:NULL context:NULL];
+    double build = _WBBenchNow() - start;
+    if (_WBBenchCount(root) != count)
+      failures++;
+    start = _WBBenchNow();
+    root = nil;
+    double release = _WBBenchNow() - start;
+    printf("%-10s build %6.3f s, release %6.3f s\n", "records", build, release);
+  }
+
+  @autoreleasepool {
+    WBBenchStream stream = { records, depths, count, 0 };
+    double start = _WBBenchNow();
+    WBTreeNode *root = [WBTreeNode nodeWithStream:_WBBenchNext initializer:NULL context:&stream];
+    double build = _WBBenchNow() - start;
+    if (_WBBenchCount(root) != count)
+      failures++;
+    start = _WBBenchNow();
+    root = nil;
+    double release = _WBBenchNow() - start;
+    printf("%-10s build %6.3f s, release %6.3f s\n", "stream", build, release);
+  }
+
+  free(depths);
+  free(records);
+  if (failures)
+    fprintf(stderr, "wrong node count\n");
+  return failures ? 1 : 0;
+}
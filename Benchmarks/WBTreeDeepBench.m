@@ -0,0 +1,141 @@
+/*
+ *  WBTreeDeepBench.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBTreeNode deep operations benchmark.
+//
+// Builds a tree of named nodes (2M by default), then sorts each level with
+// -sortUsingSelector: recursively on one thread and with -deepSortUsingSelector:,
+// checks that both give the same order, and measures a deep visit done
+// recursively and with -visitDescendantsUsingFunction:context:.
+//
+//   clang -fobjc-arc -O2 -F<build products dir> -framework Foundation
+//      -framework WonderBox Benchmarks/WBTreeDeepBench.m -o tree-deep-bench
+//
+// Usage: tree-deep-bench [node count]
+
+#import <WonderBox/WBTreeNode.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+@interface WBBenchNode : WBTreeNode
+@property(nonatomic, copy) NSString *name;
+@property(nonatomic) NSUInteger size;
+@end
+
+@implementation WBBenchNode
+- (NSComparisonResult)compare:(WBBenchNode *)other {
+  return [_name compare:other->_name];
+}
+@end
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void _WBBenchSetName(WBBenchNode *node, void *payload, void *context) {
+  node.name = [NSString stringWithFormat:@"file-%08lx", (unsigned long)(uintptr_t)payload];
+}
+
+static void _WBBenchSortSerial(WBTreeNode *node) {
+  [node sortUsingSelector:@selector(compare:)];
+  for (WBTreeNode *child in node)
+    _WBBenchSortSerial(child);
+}
+
+static void _WBBenchVisit(WBBenchNode *node, void *context) {
+  node.size = node.name.length;
+}
+
+static void _WBBenchVisitSerial(WBTreeNode *node) {
+  for (WBBenchNode *child in node) {
+    _WBBenchVisit(child, NULL);
+    _WBBenchVisitSerial(child);
+  }
+}
+
+static WBTreeNode *_WBBenchCreateTree(const WBTreeNodeRecord *records, NSUInteger count) {
+  return [WBBenchNode nodeWithRecords:records count:count initializer:(WBTreeNodeInitializer)_WBBenchSetName context:NULL];
+}
+
+static bool _WBBenchSameOrder(WBTreeNode *a, WBTreeNode *b) {
+  WBTreeTraversal ta, tb;
+  WBTreeNode * __unsafe_unretained na[256], * __unsafe_unretained nb[256];
+  WBTreeTraversalInitialize(a, kWBTreeTraversalPreOrder, NULL, NULL, &ta);
+  WBTreeTraversalInitialize(b, kWBTreeTraversalPreOrder, NULL, NULL, &tb);
+  bool same = true;
+  NSUInteger ca, cb;
+  do {
+    ca = WBTreeTraversalGetNodes(&ta, na, 256);
+    cb = WBTreeTraversalGetNodes(&tb, nb, 256);
+    same = ca == cb;
+    for (NSUInteger idx = 0; same && idx < ca; ++idx)
+      same = [((WBBenchNode *)na[idx]).name isEqualToString:((WBBenchNode *)nb[idx]).name];
+  } while (same && ca > 0);
+  WBTreeTraversalDestroy(&ta);
+  WBTreeTraversalDestroy(&tb);
+  return same;
+}
+
+int main(int argc, char **argv) {
+  NSUInteger count = argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : 2000000;
+  if (count < 2)
+    return 1;
+
+  // 1 to 256 children per directory, random names.
+  WBTreeNodeRecord *records = malloc(count * sizeof(*records));
+  uint32_t seed = 0x9e3779b9;
+  records[0].parent = NSNotFound;
+  records[0].payload = NULL;
+  NSUInteger parent = 0;
+  for (NSUInteger idx = 1; idx < count; ++parent) {
+    seed = seed * 1664525 + 1013904223;
+    for (NSUInteger children = 1 + (seed >> 8) % 256; children > 0 && idx < count; --children, ++idx) {
+      seed = seed * 1664525 + 1013904223;
+      records[idx].parent = parent;
+      records[idx].payload = (void *)(uintptr_t)seed;
+    }
+  }
+
+  int failures = 0;
+  @autoreleasepool {
+    WBTreeNode *serial = _WBBenchCreateTree(records, count);
+    WBTreeNode *concurrent = _WBBenchCreateTree(records, count);
+
+    double start = _WBBenchNow();
+    _WBBenchSortSerial(serial);
+    double sort = _WBBenchNow() - start;
+
+    start = _WBBenchNow();
+    [concurrent deepSortUsingSelector:@selector(compare:)];
+    double deepSort = _WBBenchNow() - start;
+    if (!_WBBenchSameOrder(serial, concurrent)) {
+      fprintf(stderr, "sort results differ\n");
+      failures++;
+    }
+
+    start = _WBBenchNow();
+    _WBBenchVisitSerial(serial);
+    double visit = _WBBenchNow() - start;
+
+    start = _WBBenchNow();
+    [concurrent visitDescendantsUsingFunction:(void (*)(id, void *))_WBBenchVisit context:NULL];
+    double deepVisit = _WBBenchNow() - start;
+
+    printf("%lu nodes, %lu CPUs\n", (unsigned long)count, (unsigned long)[[NSProcessInfo processInfo] activeProcessorCount]);
+    printf("sort  serial %6.3f s, deep %6.3f s\n", sort, deepSort);
+    printf("visit serial %6.3f s, deep %6.3f s\n", visit, deepVisit);
+  }
+  free(records);
+  return failures ? 1 : 0;
+}
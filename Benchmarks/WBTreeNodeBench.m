@@ -0,0 +1,121 @@
+/*
+ *  WBTreeNodeBench.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBTreeNode wide fan-out benchmark.
+//
+// For 10^3 to 10^6 children, measures -appendChild:, random -childAtIndex:
+// and -indexOfChild: accesses, then the same accesses after inserting and
+// removing a child in the middle of the list. The "walk" column is the cost
+// of reaching the same children by following -nextSibling, which is what
+// index based accesses used to do (measured on fewer lookups for large trees).
+//
+//   clang -fobjc-arc -O2 -F<build products dir> -framework Foundation
+//      -framework WonderBox Benchmarks/WBTreeNodeBench.m -o tree-node-bench
+//
+// Usage: tree-node-bench [max children]
+
+#import <WonderBox/WBTreeNode.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint32_t _WBBenchRandom(uint32_t *seed) {
+  *seed = *seed * 1664525 + 1013904223;
+  return *seed >> 8;
+}
+
+static void _WBBenchPrint(const char *name, double seconds, NSUInteger count) {
+  printf(" %10s %8.1f ns", name, seconds * 1e9 / count);
+}
+
+int main(int argc, char **argv) {
+  NSUInteger limit = argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : 1000000;
+  int failures = 0;
+  @autoreleasepool {
+    for (NSUInteger count = 1000; count <= limit; count *= 10) {
+      @autoreleasepool {
+        const NSUInteger lookups = 1000000;
+        NSMutableArray *nodes = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger idx = 0; idx < count; ++idx)
+          [nodes addObject:[WBTreeNode node]];
+
+        WBTreeNode *root = [WBTreeNode node];
+        double start = _WBBenchNow();
+        for (WBTreeNode *node in nodes)
+          [root appendChild:node];
+        double append = _WBBenchNow() - start;
+
+        uint32_t seed = 0x9e3779b9;
+        NSUInteger checksum = 0;
+        start = _WBBenchNow();
+        for (NSUInteger idx = 0; idx < lookups; ++idx)
+          checksum += (NSUInteger)(__bridge void *)[root childAtIndex:_WBBenchRandom(&seed) % count];
+        double access = _WBBenchNow() - start;
+
+        seed = 0x9e3779b9;
+        start = _WBBenchNow();
+        for (NSUInteger idx = 0; idx < lookups; ++idx) {
+          NSUInteger position = _WBBenchRandom(&seed) % count;
+          if ([root indexOfChild:nodes[position]] != position)
+            failures++;
+        }
+        double lookup = _WBBenchNow() - start;
+
+        // each mutation invalidates the index after the mutated child.
+        const NSUInteger mutations = 100;
+        start = _WBBenchNow();
+        for (NSUInteger idx = 0; idx < mutations; ++idx) {
+          NSUInteger position = _WBBenchRandom(&seed) % count;
+          WBTreeNode *node = [WBTreeNode node];
+          [root insertChild:node atIndex:position];
+          checksum += (NSUInteger)(__bridge void *)[root childAtIndex:_WBBenchRandom(&seed) % count];
+          [node remove];
+          if ([root indexOfChild:nodes[position]] != position)
+            failures++;
+        }
+        double mutate = _WBBenchNow() - start;
+
+        // walking the sibling list, on enough lookups to get a stable measure.
+        const NSUInteger walks = MAX((NSUInteger)10, lookups / count);
+        start = _WBBenchNow();
+        for (NSUInteger idx = 0; idx < walks; ++idx) {
+          NSUInteger position = _WBBenchRandom(&seed) % count;
+          WBTreeNode *node = [root firstChild];
+          while (position-- > 0)
+            node = [node nextSibling];
+          checksum += (NSUInteger)(__bridge void *)node;
+        }
+        double walk = _WBBenchNow() - start;
+
+        if ([root count] != count || [root lastChild] != [nodes lastObject])
+          failures++;
+
+        printf("%8lu children:", (unsigned long)count);
+        _WBBenchPrint("append", append, count);
+        _WBBenchPrint("index", access, lookups);
+        _WBBenchPrint("indexOf", lookup, lookups);
+        _WBBenchPrint("mutation", mutate, mutations);
+        _WBBenchPrint("walk", walk, walks);
+        printf("  (%lx)\n", (unsigned long)(checksum & 0xf));
+        [root removeAllChildren];
+      }
+    }
+  }
+  if (failures)
+    fprintf(stderr, "%d wrong indexes\n", failures);
+  return failures ? 1 : 0;
+}
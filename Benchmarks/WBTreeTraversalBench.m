@@ -0,0 +1,105 @@
+/*
+ *  WBTreeTraversalBench.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+// WBTreeNode deep traversal benchmark.
+//
+// Builds a tree (2M nodes by default, 1 to 64 children per node), then walks
+// it with -deepChildEnumerator (-nextObject and fast enumeration) and with
+// WBTreeTraversalGetNodes() in each order, and reports ns per node. Every
+// walk must visit all the nodes.
+//
+//   clang -fobjc-arc -O2 -F<build products dir> -framework Foundation
+//      -framework WonderBox Benchmarks/WBTreeTraversalBench.m -o tree-traversal-bench
+//
+// Usage: tree-traversal-bench [node count]
+
+#import <WonderBox/WBTreeNode.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double _WBBenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void _WBBenchReport(const char *name, double elapsed, NSUInteger visited, NSUInteger expected, int *failures) {
+  printf("%-16s %6.2f ns/node\n", name, elapsed * 1e9 / expected);
+  if (visited != expected) {
+    fprintf(stderr, "%s: %lu nodes visited instead of %lu\n", name, (unsigned long)visited, (unsigned long)expected);
+    (*failures)++;
+  }
+}
+
+int main(int argc, char **argv) {
+  NSUInteger count = argc > 1 ? (NSUInteger)strtoul(argv[1], NULL, 10) : 2000000;
+  if (count < 2)
+    return 1;
+
+  // breadth first records: each node gets 1 to 64 children until count is reached.
+  WBTreeNodeRecord *records = malloc(count * sizeof(*records));
+  uint32_t seed = 0x9e3779b9;
+  records[0].parent = NSNotFound;
+  NSUInteger parent = 0;
+  for (NSUInteger idx = 1; idx < count; ++parent) {
+    seed = seed * 1664525 + 1013904223;
+    for (NSUInteger children = 1 + (seed >> 8) % 64; children > 0 && idx < count; --children, ++idx) {
+      records[idx].parent = parent;
+      records[idx].payload = NULL;
+    }
+  }
+
+  int failures = 0;
+  @autoreleasepool {
+    WBTreeNode *root = [WBTreeNode nodeWithRecords:records count:count initializer:NULL context:NULL];
+    const NSUInteger expected = count - 1;
+    NSUInteger visited = 0;
+
+    @autoreleasepool {
+      NSEnumerator *nodes = [root deepChildEnumerator];
+      double start = _WBBenchNow();
+      while ([nodes nextObject])
+        visited++;
+      _WBBenchReport("nextObject", _WBBenchNow() - start, visited, expected, &failures);
+    }
+
+    @autoreleasepool {
+      visited = 0;
+      double start = _WBBenchNow();
+      for (WBTreeNode *node in [root deepChildEnumerator]) {
+        (void)node;
+        visited++;
+      }
+      _WBBenchReport("for in", _WBBenchNow() - start, visited, expected, &failures);
+    }
+
+    static const struct { WBTreeTraversalOrder order; const char *name; } kOrders[] = {
+      { kWBTreeTraversalPreOrder, "pre-order" },
+      { kWBTreeTraversalPostOrder, "post-order" },
+      { kWBTreeTraversalBreadthFirst, "breadth first" },
+    };
+    WBTreeNode * __unsafe_unretained buffer[256];
+    for (size_t idx = 0; idx < sizeof(kOrders) / sizeof(*kOrders); ++idx) {
+      visited = 0;
+      double start = _WBBenchNow();
+      WBTreeTraversal traversal;
+      WBTreeTraversalInitialize(root, kOrders[idx].order, NULL, NULL, &traversal);
+      NSUInteger batch;
+      while ((batch = WBTreeTraversalGetNodes(&traversal, buffer, 256)))
+        visited += batch;
+      WBTreeTraversalDestroy(&traversal);
+      _WBBenchReport(kOrders[idx].name, _WBBenchNow() - start, visited, expected, &failures);
+    }
+  }
+  free(records);
+  return failures ? 1 : 0;
+}
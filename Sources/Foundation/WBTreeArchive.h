@@ -0,0 +1,96 @@
+/*
+ *  WBTreeArchive.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+/*!
+ @header WBTreeArchive
+ @abstract Compact binary archives of WBTreeNode hierarchies.
+ @discussion An archive contains a string table followed by the nodes in pre-order.
+ Each node is stored as its class (an index in the string table), its children count,
+ its payload and, if it has children, the size of its children records, so a reader
+ can skip a whole subtree. Integers are stored as varints, and strings are stored once.
+ Node classes that adopt WBTreeArchiving store their content in the payload. Others are
+ restored using -init.
+*/
+
+#import <WonderBox/WBTreeNode.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class WBTreeArchiver, WBTreeUnarchiver;
+
+@protocol WBTreeArchiving <NSObject>
+- (void)encodeWithTreeArchiver:(WBTreeArchiver *)archiver;
+- (nullable instancetype)initWithTreeUnarchiver:(WBTreeUnarchiver *)unarchiver;
+@end
+
+/* Offset of a node in an archive. */
+typedef uint64_t WBTreeArchiveNodeRef;
+
+enum {
+  kWBTreeArchiveInvalidNode = 0,
+};
+
+// MARK: Archiver
+WB_OBJC_EXPORT
+@interface WBTreeArchiver : NSObject
+
++ (NSData *)archivedDataWithRootNode:(WBTreeNode *)root;
+
+- (void)encodeUnsignedInteger:(uint64_t)value;
+- (void)encodeInteger:(int64_t)value;
+- (void)encodeDouble:(double)value;
+/* Strings are interned: each distinct string is stored once per archive */
+- (void)encodeString:(nullable NSString *)string;
+- (void)encodeBytes:(nullable const void *)bytes length:(NSUInteger)length;
+
+@end
+
+// MARK: Unarchiver
+/*!
+ @abstract Reads an archive and creates nodes on demand.
+ @discussion Nodes can be restored all at once using -rootNode, or a subtree at a time,
+ walking the archive using node references. Archive content is checked, and a corrupted
+ archive results in nil nodes, never in a read outside of the archive.
+ */
+WB_OBJC_EXPORT
+@interface WBTreeUnarchiver : NSObject
+
+- (nullable instancetype)initWithData:(NSData *)data error:(NSError * __autoreleasing *)error;
+/* The file is mapped, so only the nodes that are restored are read. */
+- (nullable instancetype)initWithContentsOfFile:(NSString *)path error:(NSError * __autoreleasing *)error;
+
+/* Total number of nodes in the archive */
+@property(nonatomic, readonly) NSUInteger nodeCount;
+
+@property(nonatomic, readonly) WBTreeArchiveNodeRef rootReference;
+
+- (NSUInteger)countOfChildrenOfNode:(WBTreeArchiveNodeRef)node;
+/* Returns kWBTreeArchiveInvalidNode if index is out of bounds */
+- (WBTreeArchiveNodeRef)referenceOfChildAtIndex:(NSUInteger)index ofNode:(WBTreeArchiveNodeRef)node;
+
+/*!
+ @abstract Restores a node and its descendants down to depth levels.
+ @param depth 0 to restore only the node, NSUIntegerMax to restore the whole subtree.
+ @result nil if the archive is corrupted.
+ */
+- (nullable __kindof WBTreeNode *)nodeWithReference:(WBTreeArchiveNodeRef)node depth:(NSUInteger)depth;
+
+/* Restores the whole tree */
+- (nullable __kindof WBTreeNode *)rootNode;
+
+/* To use in -initWithTreeUnarchiver:. Values must be decoded in the order they were encoded. */
+- (uint64_t)decodeUnsignedInteger;
+- (int64_t)decodeInteger;
+- (double)decodeDouble;
+- (nullable NSString *)decodeString;
+- (nullable const void *)decodeBytesWithLength:(NSUInteger *)length;
+
+@end
+
+NS_ASSUME_NONNULL_END
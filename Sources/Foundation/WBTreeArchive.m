@@ -0,0 +1,556 @@
+/*
+ *  WBTreeArchive.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#import <WonderBox/WBTreeArchive.h>
+
+/* Defined in WBTreeNode.m: appends a new node without sending notification */
+WB_PRIVATE void WBTreeNodeAppendNewChild(WBTreeNode *parent, WBTreeNode *child);
+
+/*
+ archive := magic ("WBTA") | version (1 byte) | 3 reserved bytes
+            | varint string count | strings (varint length | UTF-8 bytes)
+            | varint node count | root record
+ record  := varint class (string index) | varint children count
+            | varint payload length | payload
+            | if children count > 0: varint children length (5 bytes) | children records
+ */
+static const uint8_t kWBTreeArchiveMagic[4] = { 'W', 'B', 'T', 'A' };
+enum {
+  kWBTreeArchiveVersion = 1,
+  kWBTreeArchiveHeaderLength = 8,
+  /* children length is written before the children, and updated afterward */
+  kWBTreeArchivePaddedLength = 5,
+};
+
+WB_INLINE
+void _WBTreeArchiveAppendVarint(NSMutableData *data, uint64_t value) {
+  uint8_t buffer[10];
+  size_t length = 0;
+  while (value >= 0x80) {
+    buffer[length++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  buffer[length++] = (uint8_t)value;
+  [data appendBytes:buffer length:length];
+}
+
+WB_INLINE
+bool _WBTreeArchiveReadVarint(const uint8_t **bytes, const uint8_t *end, uint64_t *value) {
+  const uint8_t *ptr = *bytes;
+  uint64_t result = 0;
+  for (unsigned shift = 0; shift < 64 && ptr < end; shift += 7) {
+    uint8_t byte = *ptr++;
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *bytes = ptr;
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Siblings that remain to be encoded */
+typedef struct _WBTreeArchiveFrame {
+  __unsafe_unretained WBTreeNode *node;
+  NSUInteger offset;
+} WBTreeArchiveFrame;
+
+#pragma mark -
+@implementation WBTreeArchiver {
+  NSMutableData *wb_nodes;
+  NSMutableData *wb_strings;
+  NSMutableData *wb_payload;
+  NSMutableDictionary *wb_indexes;
+  NSUInteger wb_stringCount;
+  NSUInteger wb_nodeCount;
+  /* Last encoded class */
+  __unsafe_unretained Class wb_class;
+  uint64_t wb_classIndex;
+  BOOL wb_classArchiving;
+  BOOL wb_archiving;
+}
+
+- (instancetype)init {
+  if (self = [super init]) {
+    wb_nodes = [[NSMutableData alloc] init];
+    wb_strings = [[NSMutableData alloc] init];
+    wb_payload = [[NSMutableData alloc] init];
+    wb_indexes = [[NSMutableDictionary alloc] init];
+  }
+  return self;
+}
+
+- (uint64_t)wb_indexOfString:(NSString *)string {
+  NSNumber *index = wb_indexes[string];
+  if (index)
+    return [index unsignedLongLongValue];
+
+  NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+  _WBTreeArchiveAppendVarint(wb_strings, length);
+  NSUInteger offset = [wb_strings length];
+  [wb_strings setLength:offset + length];
+  [string getBytes:(uint8_t *)[wb_strings mutableBytes] + offset maxLength:length usedLength:NULL
+          encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, [string length]) remainingRange:NULL];
+  wb_indexes[string] = @(wb_stringCount);
+  return wb_stringCount++;
+}
+
+/* Writes the node record. If the node has children, returns the offset of the children length, else NSNotFound */
+- (NSUInteger)wb_encodeRecord:(WBTreeNode *)node {
+  Class cls = [node class];
+  if (cls != wb_class) {
+    wb_classIndex = [self wb_indexOfString:NSStringFromClass(cls)];
+    wb_classArchiving = [cls conformsToProtocol:@protocol(WBTreeArchiving)];
+    wb_class = cls;
+  }
+  NSUInteger count = [node count];
+  _WBTreeArchiveAppendVarint(wb_nodes, wb_classIndex);
+  _WBTreeArchiveAppendVarint(wb_nodes, count);
+
+  [wb_payload setLength:0];
+  if (wb_classArchiving)
+    [(id<WBTreeArchiving>)node encodeWithTreeArchiver:self];
+  _WBTreeArchiveAppendVarint(wb_nodes, [wb_payload length]);
+  [wb_nodes appendData:wb_payload];
+  wb_nodeCount++;
+
+  if (0 == count)
+    return NSNotFound;
+  NSUInteger offset = [wb_nodes length];
+  [wb_nodes increaseLengthBy:kWBTreeArchivePaddedLength];
+  return offset;
+}
+
+/* Updates the children length once all children are written */
+- (void)wb_setChildrenLengthAtOffset:(NSUInteger)offset {
+  uint64_t length = [wb_nodes length] - offset - kWBTreeArchivePaddedLength;
+  if (length >> (7 * kWBTreeArchivePaddedLength))
+    SPXThrowException(NSInvalidArgumentException, @"Tree too large to be archived.");
+  uint8_t *bytes = (uint8_t *)[wb_nodes mutableBytes] + offset;
+  for (NSUInteger idx = 0; idx < kWBTreeArchivePaddedLength - 1; ++idx)
+    bytes[idx] = (uint8_t)((length >> (7 * idx)) & 0x7f) | 0x80;
+  bytes[kWBTreeArchivePaddedLength - 1] = (uint8_t)(length >> (7 * (kWBTreeArchivePaddedLength - 1)));
+}
+
+/* Pre-order walk with an explicit stack, so deep trees cannot overflow the call stack */
+- (void)wb_encodeNode:(WBTreeNode *)root {
+  NSUInteger offset = [self wb_encodeRecord:root];
+  if (NSNotFound == offset)
+    return;
+
+  /* the node to encode next at each level, and the offset of its parent children length.
+   NSMutableData, so the stack is not leaked if a node raises while encoding. */
+  NSMutableData *stack = [NSMutableData data];
+  WBTreeArchiveFrame frame = { [root firstChild], offset };
+  for (;;) {
+    if (!frame.node) {
+      [self wb_setChildrenLengthAtOffset:frame.offset];
+      NSUInteger length = [stack length];
+      if (0 == length)
+        break;
+      [stack getBytes:&frame range:NSMakeRange(length - sizeof(frame), sizeof(frame))];
+      [stack setLength:length - sizeof(frame)];
+      continue;
+    }
+    __unsafe_unretained WBTreeNode *node = frame.node;
+    frame.node = [node nextSibling];
+    offset = [self wb_encodeRecord:node];
+    if (NSNotFound != offset) {
+      [stack appendBytes:&frame length:sizeof(frame)];
+      frame = (WBTreeArchiveFrame){ [node firstChild], offset };
+    }
+  }
+}
+
++ (NSData *)archivedDataWithRootNode:(WBTreeNode *)root {
+  NSParameterAssert(root);
+  WBTreeArchiver *archiver = [[self alloc] init];
+  archiver->wb_archiving = YES;
+  [archiver wb_encodeNode:root];
+  archiver->wb_archiving = NO;
+
+  NSMutableData *archive = [NSMutableData dataWithCapacity:kWBTreeArchiveHeaderLength + 20 +
+                            [archiver->wb_strings length] + [archiver->wb_nodes length]];
+  const uint8_t header[kWBTreeArchiveHeaderLength] = {
+    kWBTreeArchiveMagic[0], kWBTreeArchiveMagic[1], kWBTreeArchiveMagic[2], kWBTreeArchiveMagic[3],
+    kWBTreeArchiveVersion, 0, 0, 0,
+  };
+  [archive appendBytes:header length:kWBTreeArchiveHeaderLength];
+  _WBTreeArchiveAppendVarint(archive, archiver->wb_stringCount);
+  [archive appendData:archiver->wb_strings];
+  _WBTreeArchiveAppendVarint(archive, archiver->wb_nodeCount);
+  [archive appendData:archiver->wb_nodes];
+  return archive;
+}
+
+#pragma mark Payload
+- (void)encodeUnsignedInteger:(uint64_t)value {
+  NSAssert(wb_archiving, @"must be called from -encodeWithTreeArchiver:");
+  _WBTreeArchiveAppendVarint(wb_payload, value);
+}
+
+- (void)encodeInteger:(int64_t)value {
+  /* zigzag, so small negative values are short too */
+  [self encodeUnsignedInteger:((uint64_t)value << 1) ^ (uint64_t)(value >> 63)];
+}
+
+- (void)encodeDouble:(double)value {
+  NSAssert(wb_archiving, @"must be called from -encodeWithTreeArchiver:");
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bits = OSSwapHostToLittleInt64(bits);
+  [wb_payload appendBytes:&bits length:sizeof(bits)];
+}
+
+- (void)encodeString:(NSString *)string {
+  /* 0 is nil */
+  [self encodeUnsignedInteger:string ? [self wb_indexOfString:string] + 1 : 0];
+}
+
+- (void)encodeBytes:(const void *)bytes length:(NSUInteger)length {
+  [self encodeUnsignedInteger:length];
+  if (length)
+    [wb_payload appendBytes:bytes length:length];
+}
+
+@end
+
+#pragma mark -
+typedef struct _WBTreeArchiveRecord {
+  uint64_t cls;
+  uint64_t count;
+  const uint8_t *payload;
+  const uint8_t *payloadEnd;
+  const uint8_t *children;
+  /* end of the record, including the children */
+  const uint8_t *end;
+} WBTreeArchiveRecord;
+
+static
+bool _WBTreeArchiveReadRecord(const uint8_t *bytes, const uint8_t *end, WBTreeArchiveRecord *record) {
+  uint64_t length;
+  if (!_WBTreeArchiveReadVarint(&bytes, end, &record->cls) ||
+      !_WBTreeArchiveReadVarint(&bytes, end, &record->count) ||
+      !_WBTreeArchiveReadVarint(&bytes, end, &length) || length > (uint64_t)(end - bytes))
+    return false;
+  record->payload = bytes;
+  record->payloadEnd = bytes + length;
+  bytes += length;
+  if (record->count > 0) {
+    /* each child takes at least 3 bytes */
+    if (!_WBTreeArchiveReadVarint(&bytes, end, &length) || length > (uint64_t)(end - bytes) || record->count > length / 3)
+      return false;
+    record->children = bytes;
+    bytes += length;
+  } else {
+    record->children = bytes;
+  }
+  record->end = bytes;
+  return true;
+}
+
+@implementation WBTreeUnarchiver {
+  NSData *wb_data;
+  const uint8_t *wb_bytes;
+  const uint8_t *wb_end;
+  const uint8_t *wb_nodes;
+
+  /* offsets of the strings, and strings already created (retained) */
+  const uint8_t **wb_strings;
+  void **wb_cache;
+  NSUInteger wb_stringCount;
+  NSUInteger wb_nodeCount;
+
+  /* payload of the node being restored */
+  const uint8_t *wb_cursor;
+  const uint8_t *wb_payloadEnd;
+  BOOL wb_failed;
+
+  /* Last restored class */
+  uint64_t wb_classIndex;
+  __unsafe_unretained Class wb_class;
+  BOOL wb_classArchiving;
+}
+
+static NSError *_WBTreeArchiveCorruptedError(void) {
+  return [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:nil];
+}
+
+- (instancetype)initWithData:(NSData *)data error:(NSError * __autoreleasing *)error {
+  NSParameterAssert(data);
+  if (self = [super init]) {
+    wb_data = data;
+    wb_bytes = [data bytes];
+    wb_end = wb_bytes + [data length];
+
+    const uint8_t *bytes = wb_bytes;
+    uint64_t count;
+    if ([data length] < kWBTreeArchiveHeaderLength || memcmp(bytes, kWBTreeArchiveMagic, 4) != 0 ||
+        bytes[4] != kWBTreeArchiveVersion)
+      goto corrupted;
+    bytes += kWBTreeArchiveHeaderLength;
+
+    /* a string takes at least one byte */
+    if (!_WBTreeArchiveReadVarint(&bytes, wb_end, &count) || count > (uint64_t)(wb_end - bytes))
+      goto corrupted;
+    wb_stringCount = (NSUInteger)count;
+    if (wb_stringCount) {
+      wb_strings = malloc(wb_stringCount * sizeof(*wb_strings));
+      wb_cache = calloc(wb_stringCount, sizeof(*wb_cache));
+      if (!wb_strings || !wb_cache)
+        goto corrupted;
+    }
+    for (NSUInteger idx = 0; idx < wb_stringCount; ++idx) {
+      uint64_t length;
+      wb_strings[idx] = bytes;
+      if (!_WBTreeArchiveReadVarint(&bytes, wb_end, &length) || length > (uint64_t)(wb_end - bytes))
+        goto corrupted;
+      bytes += length;
+    }
+    if (!_WBTreeArchiveReadVarint(&bytes, wb_end, &count) || count > (uint64_t)(wb_end - bytes) / 3 || bytes == wb_end)
+      goto corrupted;
+    wb_nodeCount = (NSUInteger)count;
+    wb_nodes = bytes;
+  }
+  return self;
+
+corrupted:
+  if (error)
+    *error = _WBTreeArchiveCorruptedError();
+  return nil;
+}
+
+- (instancetype)initWithContentsOfFile:(NSString *)path error:(NSError * __autoreleasing *)error {
+  NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:error];
+  if (!data)
+    return nil;
+  return [self initWithData:data error:error];
+}
+
+- (void)dealloc {
+  for (NSUInteger idx = 0; wb_cache && idx < wb_stringCount; ++idx) {
+    if (wb_cache[idx])
+      CFRelease(wb_cache[idx]);
+  }
+  free(wb_cache);
+  free(wb_strings);
+}
+
+#pragma mark -
+- (NSUInteger)nodeCount {
+  return wb_nodeCount;
+}
+
+- (WBTreeArchiveNodeRef)rootReference {
+  return (WBTreeArchiveNodeRef)(wb_nodes - wb_bytes);
+}
+
+- (BOOL)wb_getRecord:(WBTreeArchiveRecord *)record ofNode:(WBTreeArchiveNodeRef)node {
+  if (node < (WBTreeArchiveNodeRef)(wb_nodes - wb_bytes) || node >= (WBTreeArchiveNodeRef)(wb_end - wb_bytes))
+    return NO;
+  return _WBTreeArchiveReadRecord(wb_bytes + node, wb_end, record);
+}
+
+- (NSUInteger)countOfChildrenOfNode:(WBTreeArchiveNodeRef)node {
+  WBTreeArchiveRecord record;
+  return [self wb_getRecord:&record ofNode:node] ? (NSUInteger)record.count : 0;
+}
+
+- (WBTreeArchiveNodeRef)referenceOfChildAtIndex:(NSUInteger)index ofNode:(WBTreeArchiveNodeRef)node {
+  WBTreeArchiveRecord record;
+  if (![self wb_getRecord:&record ofNode:node] || index >= record.count)
+    return kWBTreeArchiveInvalidNode;
+  const uint8_t *child = record.children;
+  while (index-- > 0) {
+    WBTreeArchiveRecord sibling;
+    if (!_WBTreeArchiveReadRecord(child, record.end, &sibling))
+      return kWBTreeArchiveInvalidNode;
+    child = sibling.end;
+  }
+  return (WBTreeArchiveNodeRef)(child - wb_bytes);
+}
+
+- (NSString *)wb_stringAtIndex:(uint64_t)index {
+  if (index >= wb_stringCount)
+    return nil;
+  if (!wb_cache[index]) {
+    const uint8_t *bytes = wb_strings[index];
+    uint64_t length;
+    /* Already checked while opening the archive */
+    _WBTreeArchiveReadVarint(&bytes, wb_end, &length);
+    NSString *string = [[NSString alloc] initWithBytes:bytes length:(NSUInteger)length encoding:NSUTF8StringEncoding];
+    if (!string)
+      return nil;
+    wb_cache[index] = (__bridge_retained void *)string;
+  }
+  return (__bridge NSString *)wb_cache[index];
+}
+
+- (Class)wb_classAtIndex:(uint64_t)index {
+  if (!wb_class || index != wb_classIndex) {
+    NSString *name = [self wb_stringAtIndex:index];
+    Class cls = name ? NSClassFromString(name) : Nil;
+    /* Only creates tree nodes */
+    if (!cls || ![cls isSubclassOfClass:[WBTreeNode class]])
+      return Nil;
+    wb_class = cls;
+    wb_classIndex = index;
+    wb_classArchiving = [cls conformsToProtocol:@protocol(WBTreeArchiving)];
+  }
+  return wb_class;
+}
+
+static
+WBTreeNode *_WBTreeUnarchiverCreateNode(WBTreeUnarchiver *self, const uint8_t *bytes, const uint8_t *end,
+                                        WBTreeArchiveRecord *record) {
+  if (!_WBTreeArchiveReadRecord(bytes, end, record))
+    return nil;
+  Class cls = [self wb_classAtIndex:record->cls];
+  if (!cls)
+    return nil;
+
+  WBTreeNode *node;
+  if (self->wb_classArchiving) {
+    self->wb_cursor = record->payload;
+    self->wb_payloadEnd = record->payloadEnd;
+    node = [(id<WBTreeArchiving>)[cls alloc] initWithTreeUnarchiver:self];
+    self->wb_cursor = self->wb_payloadEnd = NULL;
+    if (self->wb_failed)
+      return nil;
+  } else {
+    node = [[cls alloc] init];
+  }
+  return node;
+}
+
+/* Children of a node that remain to be created */
+typedef struct _WBTreeUnarchiverFrame {
+  __unsafe_unretained WBTreeNode *node;
+  const uint8_t *child;
+  const uint8_t *end;
+  uint64_t remaining;
+  NSUInteger depth;
+} WBTreeUnarchiverFrame;
+
+/* Creates the tree depth first using an explicit stack, so deeply nested archives cannot overflow the call stack */
+static
+WBTreeNode *_WBTreeUnarchiverCreateTree(WBTreeUnarchiver *self, const uint8_t *bytes, const uint8_t *end, NSUInteger depth) {
+  WBTreeArchiveRecord record;
+  WBTreeNode *root = _WBTreeUnarchiverCreateNode(self, bytes, end, &record);
+  if (!root || 0 == depth || 0 == record.count)
+    return root;
+
+  NSUInteger count = 0, capacity = 0;
+  WBTreeUnarchiverFrame *stack = NULL;
+  WBTreeUnarchiverFrame frame = { root, record.children, record.end, record.count, depth - 1 };
+  for (;;) {
+    if (0 == frame.remaining) {
+      if (0 == count)
+        break;
+      frame = stack[--count];
+      continue;
+    }
+    WBTreeNode *node = _WBTreeUnarchiverCreateNode(self, frame.child, frame.end, &record);
+    if (!node) {
+      root = nil;
+      break;
+    }
+    WBTreeNodeAppendNewChild(frame.node, node);
+    frame.child = record.end;
+    frame.remaining--;
+    if (frame.depth > 0 && record.count > 0) {
+      if (count == capacity) {
+        NSUInteger size = MAX(capacity * 2, (NSUInteger)64);
+        WBTreeUnarchiverFrame *tmp = realloc(stack, size * sizeof(*stack));
+        if (!tmp) {
+          root = nil;
+          break;
+        }
+        stack = tmp;
+        capacity = size;
+      }
+      stack[count++] = frame;
+      frame = (WBTreeUnarchiverFrame){ node, record.children, record.end, record.count, frame.depth - 1 };
+    }
+  }
+  free(stack);
+  return root;
+}
+
+- (WBTreeNode *)nodeWithReference:(WBTreeArchiveNodeRef)ref depth:(NSUInteger)depth {
+  if (ref < (WBTreeArchiveNodeRef)(wb_nodes - wb_bytes) || ref >= (WBTreeArchiveNodeRef)(wb_end - wb_bytes))
+    return nil;
+  wb_failed = NO;
+  WBTreeNode *node = _WBTreeUnarchiverCreateTree(self, wb_bytes + ref, wb_end, depth);
+  wb_failed = NO;
+  return node;
+}
+
+- (WBTreeNode *)rootNode {
+  return [self nodeWithReference:[self rootReference] depth:NSUIntegerMax];
+}
+
+#pragma mark Payload
+- (uint64_t)decodeUnsignedInteger {
+  NSAssert(wb_cursor, @"must be called from -initWithTreeUnarchiver:");
+  uint64_t value;
+  if (wb_failed || !_WBTreeArchiveReadVarint(&wb_cursor, wb_payloadEnd, &value)) {
+    wb_failed = YES;
+    return 0;
+  }
+  return value;
+}
+
+- (int64_t)decodeInteger {
+  uint64_t value = [self decodeUnsignedInteger];
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+- (double)decodeDouble {
+  NSAssert(wb_cursor, @"must be called from -initWithTreeUnarchiver:");
+  uint64_t bits;
+  if (wb_failed || wb_payloadEnd - wb_cursor < (ptrdiff_t)sizeof(bits)) {
+    wb_failed = YES;
+    return 0;
+  }
+  memcpy(&bits, wb_cursor, sizeof(bits));
+  wb_cursor += sizeof(bits);
+  bits = OSSwapLittleToHostInt64(bits);
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+- (NSString *)decodeString {
+  uint64_t index = [self decodeUnsignedInteger];
+  if (0 == index)
+    return nil;
+  NSString *string = [self wb_stringAtIndex:index - 1];
+  if (!string)
+    wb_failed = YES;
+  return string;
+}
+
+- (const void *)decodeBytesWithLength:(NSUInteger *)length {
+  NSParameterAssert(length);
+  uint64_t count = [self decodeUnsignedInteger];
+  if (wb_failed || count > (uint64_t)(wb_payloadEnd - wb_cursor)) {
+    wb_failed = YES;
+    *length = 0;
+    return NULL;
+  }
+  const void *bytes = wb_cursor;
+  wb_cursor += count;
+  *length = (NSUInteger)count;
+  return count ? bytes : NULL;
+}
+
+@end
@@ -0,0 +1,94 @@
+/*
+ *  WBTreeDiff.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+/*!
+ @header WBTreeDiff
+ @abstract Computes the changes between two WBTreeNode hierarchies.
+ @discussion Children of matching parents are matched by key. Matched children are then
+ compared recursively, so an unchanged subtree only costs a key per node. Sibling lists are
+ matched using a hash table, and moves are computed from the longest increasing subsequence
+ of the kept children, so comparing two sibling lists runs in O(n log n).
+*/
+
+#import <WonderBox/WBTreeNode.h>
+
+enum {
+  kWBTreeDiffInsert = kWBTreeOperationInsert,
+  kWBTreeDiffRemove = kWBTreeOperationRemove,
+  /* The node is kept, but its content changed */
+  kWBTreeDiffUpdate = kWBTreeOperationReplace,
+  kWBTreeDiffMove = 4,
+};
+typedef uint32_t WBTreeDiffOperation;
+
+/*!
+ @abstract A change of a parent children list.
+ @discussion Indexes follow the NSTableView batch update convention: fromIndex is the
+ index in the old children list, and index, the index in the new one.
+ To apply the changes of a parent, remove the removed and moved nodes in decreasing fromIndex
+ order, then insert the inserted and moved nodes in increasing index order.
+ @field operation The change.
+ @field parent The parent in the old tree, nil for an update of the root.
+ @field fromIndex Remove, move and update: the index in the old children. NSNotFound for insert.
+ @field index Insert, move and update: the index in the new children. NSNotFound for remove.
+ @field node Remove, move and update: the node in the old tree. nil for insert.
+ @field newNode Insert, move and update: the node in the new tree. nil for remove.
+ */
+typedef struct _WBTreeDiffChange {
+  WBTreeDiffOperation operation;
+  __unsafe_unretained WBTreeNode *parent;
+  NSUInteger fromIndex;
+  NSUInteger index;
+  __unsafe_unretained WBTreeNode *node;
+  __unsafe_unretained WBTreeNode *newNode;
+} WBTreeDiffChange;
+
+/* Returns the key that identifies node among its siblings, or nil if the node never matches.
+ Keys must implement -hash and -isEqual:, and should be unique among siblings. Siblings with the
+ same key are matched in order: the first old one with the first new one, and so on. */
+typedef id (*WBTreeDiffKeyFunction)(__kindof WBTreeNode *node, void *context);
+/* Returns YES if the content of two matching nodes differs. Children are not part of the content. */
+typedef BOOL (*WBTreeDiffCompareFunction)(__kindof WBTreeNode *oldNode, __kindof WBTreeNode *newNode, void *context);
+/* Copies the content of newNode into oldNode, if it differs. */
+typedef void (*WBTreeDiffUpdateFunction)(__kindof WBTreeNode *oldNode, __kindof WBTreeNode *newNode, void *context);
+
+typedef void (*WBTreeDiffHandler)(const WBTreeDiffChange *change, void *context);
+
+/*!
+ @function
+ @abstract   Reports the changes needed to turn oldRoot hierarchy into newRoot one.
+ @discussion The roots always match. For each parent, changes are reported as removes in decreasing
+ fromIndex order, moves, inserts in increasing index order, and updates. Then the children that
+ match are compared. Nodes under an inserted or removed node are not reported.
+ The trees must not be mutated until the function returns.
+ @param      compare Optional. If NULL, no update is reported.
+ */
+WB_EXPORT
+void WBTreeDiffCompute(WBTreeNode *oldRoot, WBTreeNode *newRoot,
+                       WBTreeDiffKeyFunction key, WBTreeDiffCompareFunction compare,
+                       WBTreeDiffHandler handler, void *context);
+
+@interface WBTreeNode (WBTreeDiff)
+
+/*!
+ @method
+ @abstract   Updates the receiver hierarchy so it matches node hierarchy.
+ @discussion Nodes that match are kept (and moved if needed), so only the changed rows of an outline
+ view showing the receiver are updated. Changes go through -removeChildAtIndex: and -insertChild:atIndex:,
+ so subclasses send their usual notifications. Inserted nodes are taken from node hierarchy, which
+ should not be used afterward.
+ @param      node The new hierarchy.
+ @param      key Returns the node keys.
+ @param      update Optional. Called for the receiver and each kept node, with the matching node.
+ @param      context Passed to key and update.
+ */
+- (void)mergeNode:(WBTreeNode *)node keyFunction:(WBTreeDiffKeyFunction)key
+   updateFunction:(WBTreeDiffUpdateFunction)update context:(void *)context;
+
+@end
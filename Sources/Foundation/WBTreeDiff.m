@@ -0,0 +1,303 @@
+/*
+ *  WBTreeDiff.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#import <WonderBox/WBTreeDiff.h>
+
+enum {
+  /* Shorter old children lists are matched by comparing the keys */
+  kWBTreeDiffHashThreshold = 16,
+};
+
+typedef struct _WBTreeDiffSiblings {
+  NSUInteger oldCount;
+  NSUInteger newCount;
+  WBTreeNode * __unsafe_unretained *oldNodes;
+  WBTreeNode * __unsafe_unretained *newNodes;
+  /* NSNotFound for removed and inserted nodes */
+  NSUInteger *oldToNew;
+  NSUInteger *newToOld;
+  /* Kept nodes that do not move */
+  bool *stable;
+} WBTreeDiffSiblings;
+
+static
+void _WBTreeDiffSiblingsInit(WBTreeDiffSiblings *siblings, WBTreeNode *oldParent, WBTreeNode *newParent) {
+  NSUInteger oldCount = [oldParent count], newCount = [newParent count];
+  size_t size = (oldCount + newCount) * (sizeof(void *) + sizeof(NSUInteger)) + oldCount * sizeof(bool);
+  void *buffer = malloc(size ? size : 1);
+  if (!buffer)
+    SPXThrowException(NSMallocException, @"Cannot allocate diff buffer.");
+
+  siblings->oldCount = oldCount;
+  siblings->newCount = newCount;
+  siblings->oldNodes = (WBTreeNode * __unsafe_unretained *)buffer;
+  siblings->newNodes = siblings->oldNodes + oldCount;
+  siblings->oldToNew = (NSUInteger *)(siblings->newNodes + newCount);
+  siblings->newToOld = siblings->oldToNew + oldCount;
+  siblings->stable = (bool *)(siblings->newToOld + newCount);
+
+  NSUInteger idx = 0;
+  for (WBTreeNode *child in oldParent) {
+    siblings->oldToNew[idx] = NSNotFound;
+    siblings->stable[idx] = false;
+    siblings->oldNodes[idx++] = child;
+  }
+  idx = 0;
+  for (WBTreeNode *child in newParent) {
+    siblings->newToOld[idx] = NSNotFound;
+    siblings->newNodes[idx++] = child;
+  }
+}
+
+WB_INLINE
+void _WBTreeDiffSiblingsDestroy(WBTreeDiffSiblings *siblings) {
+  /* all arrays share the same buffer */
+  free(siblings->oldNodes);
+}
+
+WB_INLINE
+void _WBTreeDiffLink(WBTreeDiffSiblings *siblings, NSUInteger oldIdx, NSUInteger newIdx) {
+  siblings->oldToNew[oldIdx] = newIdx;
+  siblings->newToOld[newIdx] = oldIdx;
+}
+
+/* Marks the longest run of kept nodes that are in the same order in both lists as stable. */
+static
+void _WBTreeDiffFindStable(WBTreeDiffSiblings *siblings) {
+  const NSUInteger *oldToNew = siblings->oldToNew;
+  /* tails[l]: old index of the smallest end of an increasing sequence of length l + 1 */
+  NSUInteger *tails = malloc(2 * siblings->oldCount * sizeof(*tails));
+  if (!tails)
+    SPXThrowException(NSMallocException, @"Cannot allocate diff buffer.");
+  NSUInteger *previous = tails + siblings->oldCount;
+
+  NSUInteger length = 0;
+  for (NSUInteger idx = 0; idx < siblings->oldCount; ++idx) {
+    NSUInteger target = oldToNew[idx];
+    if (NSNotFound == target)
+      continue;
+    NSUInteger lo = length;
+    /* Fast path for unchanged lists */
+    if (length > 0 && oldToNew[tails[length - 1]] > target) {
+      lo = 0;
+      NSUInteger hi = length - 1;
+      while (lo < hi) {
+        NSUInteger mid = lo + (hi - lo) / 2;
+        if (oldToNew[tails[mid]] < target)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+    }
+    previous[idx] = lo > 0 ? tails[lo - 1] : NSNotFound;
+    tails[lo] = idx;
+    if (lo == length)
+      length++;
+  }
+  for (NSUInteger idx = length > 0 ? tails[length - 1] : NSNotFound; idx != NSNotFound; idx = previous[idx])
+    siblings->stable[idx] = true;
+  free(tails);
+}
+
+static
+void _WBTreeDiffMatch(WBTreeDiffSiblings *siblings, WBTreeDiffKeyFunction key, void *context) {
+  if (0 == siblings->oldCount || 0 == siblings->newCount)
+    return;
+
+  @autoreleasepool {
+    if (siblings->oldCount < kWBTreeDiffHashThreshold) {
+      id keys[kWBTreeDiffHashThreshold];
+      for (NSUInteger idx = 0; idx < siblings->oldCount; ++idx)
+        keys[idx] = key(siblings->oldNodes[idx], context);
+      for (NSUInteger idx = 0; idx < siblings->newCount; ++idx) {
+        id value = key(siblings->newNodes[idx], context);
+        if (!value)
+          continue;
+        for (NSUInteger old = 0; old < siblings->oldCount; ++old) {
+          if (NSNotFound == siblings->oldToNew[old] && [value isEqual:keys[old]]) {
+            _WBTreeDiffLink(siblings, old, idx);
+            break;
+          }
+        }
+      }
+    } else {
+      /* key -> old index + 1 of the first unmatched node with this key. As in the linear search,
+       duplicated keys are matched in order: next[old] is the next old node with the same key. */
+      NSUInteger *next = malloc(siblings->oldCount * sizeof(*next));
+      if (!next)
+        SPXThrowException(NSMallocException, @"Cannot allocate diff buffer.");
+      CFMutableDictionaryRef indexes = CFDictionaryCreateMutable(kCFAllocatorDefault, siblings->oldCount,
+                                                                 &kCFTypeDictionaryKeyCallBacks, NULL);
+      if (!indexes) {
+        free(next);
+        SPXThrowException(NSMallocException, @"Cannot allocate diff buffer.");
+      }
+      for (NSUInteger idx = siblings->oldCount; idx-- > 0;) {
+        id value = key(siblings->oldNodes[idx], context);
+        if (!value)
+          continue;
+        const void *position;
+        next[idx] = CFDictionaryGetValueIfPresent(indexes, (__bridge CFTypeRef)value, &position) ?
+          (NSUInteger)(uintptr_t)position - 1 : NSNotFound;
+        CFDictionarySetValue(indexes, (__bridge CFTypeRef)value, (const void *)(uintptr_t)(idx + 1));
+      }
+      for (NSUInteger idx = 0; idx < siblings->newCount; ++idx) {
+        id value = key(siblings->newNodes[idx], context);
+        const void *position;
+        if (value && CFDictionaryGetValueIfPresent(indexes, (__bridge CFTypeRef)value, &position)) {
+          NSUInteger old = (NSUInteger)(uintptr_t)position - 1;
+          _WBTreeDiffLink(siblings, old, idx);
+          if (NSNotFound != next[old])
+            CFDictionarySetValue(indexes, (__bridge CFTypeRef)value, (const void *)(uintptr_t)(next[old] + 1));
+          else
+            CFDictionaryRemoveValue(indexes, (__bridge CFTypeRef)value);
+        }
+      }
+      free(next);
+      CFRelease(indexes);
+    }
+  }
+  _WBTreeDiffFindStable(siblings);
+}
+
+#pragma mark -
+typedef struct _WBTreeDiffContext {
+  WBTreeDiffKeyFunction key;
+  WBTreeDiffCompareFunction compare;
+  WBTreeDiffHandler handler;
+  void *context;
+} WBTreeDiffContext;
+
+static
+void _WBTreeDiffComputeChildren(WBTreeNode *oldParent, WBTreeNode *newParent, const WBTreeDiffContext *ctxt) {
+  if (![oldParent hasChildren] && ![newParent hasChildren])
+    return;
+
+  WBTreeDiffSiblings siblings;
+  _WBTreeDiffSiblingsInit(&siblings, oldParent, newParent);
+  _WBTreeDiffMatch(&siblings, ctxt->key, ctxt->context);
+
+  WBTreeDiffChange change = { .parent = oldParent };
+  change.operation = kWBTreeDiffRemove;
+  change.index = NSNotFound;
+  change.newNode = nil;
+  for (NSUInteger idx = siblings.oldCount; idx-- > 0;) {
+    if (NSNotFound == siblings.oldToNew[idx]) {
+      change.fromIndex = idx;
+      change.node = siblings.oldNodes[idx];
+      ctxt->handler(&change, ctxt->context);
+    }
+  }
+
+  change.operation = kWBTreeDiffMove;
+  for (NSUInteger idx = 0; idx < siblings.newCount; ++idx) {
+    NSUInteger old = siblings.newToOld[idx];
+    if (NSNotFound != old && !siblings.stable[old]) {
+      change.fromIndex = old;
+      change.index = idx;
+      change.node = siblings.oldNodes[old];
+      change.newNode = siblings.newNodes[idx];
+      ctxt->handler(&change, ctxt->context);
+    }
+  }
+
+  change.operation = kWBTreeDiffInsert;
+  change.fromIndex = NSNotFound;
+  change.node = nil;
+  for (NSUInteger idx = 0; idx < siblings.newCount; ++idx) {
+    if (NSNotFound == siblings.newToOld[idx]) {
+      change.index = idx;
+      change.newNode = siblings.newNodes[idx];
+      ctxt->handler(&change, ctxt->context);
+    }
+  }
+
+  if (ctxt->compare) {
+    change.operation = kWBTreeDiffUpdate;
+    for (NSUInteger idx = 0; idx < siblings.newCount; ++idx) {
+      NSUInteger old = siblings.newToOld[idx];
+      if (NSNotFound != old && ctxt->compare(siblings.oldNodes[old], siblings.newNodes[idx], ctxt->context)) {
+        change.fromIndex = old;
+        change.index = idx;
+        change.node = siblings.oldNodes[old];
+        change.newNode = siblings.newNodes[idx];
+        ctxt->handler(&change, ctxt->context);
+      }
+    }
+  }
+
+  for (NSUInteger idx = 0; idx < siblings.newCount; ++idx) {
+    NSUInteger old = siblings.newToOld[idx];
+    if (NSNotFound != old)
+      _WBTreeDiffComputeChildren(siblings.oldNodes[old], siblings.newNodes[idx], ctxt);
+  }
+  _WBTreeDiffSiblingsDestroy(&siblings);
+}
+
+void WBTreeDiffCompute(WBTreeNode *oldRoot, WBTreeNode *newRoot,
+                       WBTreeDiffKeyFunction key, WBTreeDiffCompareFunction compare,
+                       WBTreeDiffHandler handler, void *context) {
+  NSCParameterAssert(oldRoot && newRoot && key && handler);
+  WBTreeDiffContext ctxt = { key, compare, handler, context };
+  if (compare && compare(oldRoot, newRoot, context)) {
+    WBTreeDiffChange change = { kWBTreeDiffUpdate, nil, NSNotFound, NSNotFound, oldRoot, newRoot };
+    handler(&change, context);
+  }
+  _WBTreeDiffComputeChildren(oldRoot, newRoot, &ctxt);
+}
+
+#pragma mark -
+@implementation WBTreeNode (WBTreeDiff)
+
+static
+void _WBTreeDiffMerge(WBTreeNode *oldParent, WBTreeNode *newParent,
+                      WBTreeDiffKeyFunction key, WBTreeDiffUpdateFunction update, void *context) {
+  if (update)
+    update(oldParent, newParent, context);
+  if (![oldParent hasChildren] && ![newParent hasChildren])
+    return;
+
+  WBTreeDiffSiblings siblings;
+  _WBTreeDiffSiblingsInit(&siblings, oldParent, newParent);
+  _WBTreeDiffMatch(&siblings, key, context);
+
+  /* Keep the nodes alive while they are moved */
+  NS_VALID_UNTIL_END_OF_SCOPE NSArray *oldChildren = [oldParent children];
+  NS_VALID_UNTIL_END_OF_SCOPE NSArray *newChildren = [newParent children];
+
+  for (NSUInteger idx = siblings.oldCount; idx-- > 0;) {
+    if (NSNotFound == siblings.oldToNew[idx] || !siblings.stable[idx])
+      [oldParent removeChildAtIndex:idx];
+  }
+  [newParent removeAllChildren];
+  for (NSUInteger idx = 0; idx < siblings.newCount; ++idx) {
+    NSUInteger old = siblings.newToOld[idx];
+    if (NSNotFound == old)
+      [oldParent insertChild:siblings.newNodes[idx] atIndex:idx];
+    else if (!siblings.stable[old])
+      [oldParent insertChild:siblings.oldNodes[old] atIndex:idx];
+  }
+
+  for (NSUInteger idx = 0; idx < siblings.newCount; ++idx) {
+    NSUInteger old = siblings.newToOld[idx];
+    if (NSNotFound != old)
+      _WBTreeDiffMerge(siblings.oldNodes[old], siblings.newNodes[idx], key, update, context);
+  }
+  _WBTreeDiffSiblingsDestroy(&siblings);
+}
+
+- (void)mergeNode:(WBTreeNode *)node keyFunction:(WBTreeDiffKeyFunction)key
+   updateFunction:(WBTreeDiffUpdateFunction)update context:(void *)context {
+  NSParameterAssert(node && key);
+  NSParameterAssert(node != self);
+  _WBTreeDiffMerge(self, node, key, update, context);
+}
+
+@end
@@ -19,9 +19,15 @@
     @class
     @abstract Tree structure.
     @discussion Tree node class to implements Tree structure.
+    The children count and the last child are cached, and nodes with many children
+    maintain an index, so that index based accesses do not walk the children list.
+    As this index is updated lazily, concurrent reads of a node must be synchronized like writes.
+    Releasing a node releases its children iteratively, so a whole tree can be freed with a single release,
+    whatever the number of siblings.
+    Fast enumeration of a node enumerates its children. To walk a whole tree, use WBTreeTraversal.
 */
 WB_OBJC_EXPORT
-@interface WBTreeNode : NSObject <NSCopying, NSCoding>
+@interface WBTreeNode : NSObject <NSCopying, NSCoding, NSFastEnumeration>
 #pragma mark Initializer
 + (instancetype)node;
 - (instancetype)init;
@@ -42,12 +48,15 @@ WB_OBJC_EXPORT
 /*!
   @method
  @abstract   Returns the child of a tree at the specified index.
+ @discussion Constant time, except after a mutation, which requires to reindex the children after the mutated one.
  @result     The child tree at <i>index</i>.
  */
 - (__kindof WBTreeNode *)childAtIndex:(NSUInteger)index;
 /*!
  @method
  @abstract   Get index of child in receiver children array.
+ @discussion Constant time when <em>child</em> uses the default isEqual: implementation.
+ Else the children are compared using isEqual:.
  @result     The index of <em>child</em>.
  */
 - (NSUInteger)indexOfChild:(WBTreeNode *)child;
@@ -91,6 +100,7 @@ WB_OBJC_EXPORT
 /*!
   @method
  @abstract   Returns an enumerator that enumerate full tree content.
+ @discussion The enumerator supports fast enumeration. WBTreeTraversal functions are faster on large trees.
  @result     Returns an NSEnumerator.
 */
 - (NSEnumerator *)deepChildEnumerator;
@@ -249,6 +259,53 @@ WB_OBJC_EXPORT
  */
 - (void)sortUsingFunction:(NSInteger (*)(id, id, void *))compare context:(void *)context;
 
+#pragma mark -
+#pragma mark Deep Operations
+/*!
+  @method
+ @abstract   Sorts the children of the receiver and of all its descendants.
+ @discussion On large trees, the children lists are sorted concurrently, so the comparator must be thread safe.
+ Each list is sorted as -sortUsingSelector: does, so the result does not depend on the number of threads.
+ The sorted lists are then applied on the calling thread using -setSortedChildren:.
+ Raises an NSMallocException, without changing the tree, if the working buffers cannot be allocated.
+ @param      comparator (description)
+ */
+- (void)deepSortUsingSelector:(SEL)comparator;
+/*!
+  @method
+ @abstract   Sorts the children of the receiver and of all its descendants.
+ @discussion See -deepSortUsingSelector:.
+ @param      sortDescriptors (description)
+ */
+- (void)deepSortUsingDescriptors:(NSArray *)sortDescriptors;
+/*!
+  @method
+ @abstract   Sorts the children of the receiver and of all its descendants.
+ @discussion See -deepSortUsingSelector:.
+ @param      compare (description)
+ @param      context (description)
+ */
+- (void)deepSortUsingFunction:(NSInteger (*)(id, id, void *))compare context:(void *)context;
+
+/*!
+  @method
+ @abstract   Calls function once for each descendant of the receiver.
+ @discussion On large trees, function is called concurrently and in no particular order.
+ It must not mutate the tree, and should only update the node it receives.
+ The children index of the receiver and its descendants are built before function is called, so function
+ may use -childAtIndex: and -indexOfChild: on them, and -index on the descendants, but not on other nodes.
+ @param      function The function to call.
+ @param      context Passed to function.
+ */
+- (void)visitDescendantsUsingFunction:(void (*)(id node, void *context))function context:(void *)context;
+/*!
+  @method
+ @abstract   Calls block once for each descendant of the receiver.
+ @discussion See -visitDescendantsUsingFunction:context:.
+ @param      block The block to call.
+ */
+- (void)visitDescendantsUsingBlock:(void (^)(id node))block;
+
 #pragma mark Protected
 - (void)setParent:(WBTreeNode *)parent;
 
@@ -271,3 +328,110 @@ typedef enum {
 - (void)performOperation:(WBTreeOperation)op atIndex:(NSUInteger)index withChild:(WBTreeNode *)child;
 
 @end
+
+#pragma mark -
+#pragma mark Bulk Building
+/*!
+ @abstract Describes a node for +nodeWithRecords:count:initializer:context:.
+ @field parent Index of the parent record. Must be less than the record index, or NSNotFound for the root (first) record.
+ @field payload Passed to the initializer function.
+*/
+typedef struct _WBTreeNodeRecord {
+  NSUInteger parent;
+  void *payload;
+} WBTreeNodeRecord;
+
+/* Called once per created node, in creation order */
+typedef void (*WBTreeNodeInitializer)(__kindof WBTreeNode *node, void *payload, void *context);
+
+/* Returns the next node of a depth first (pre-order) walk: the depth (0 for the root) and the payload.
+ Returns NO when the walk is done. */
+typedef BOOL (*WBTreeNodeStream)(NSUInteger *depth, void **payload, void *context);
+
+@interface WBTreeNode (WBTreeBuilder)
+
+/*!
+ @method
+ @abstract   Creates a whole tree of receiver instances in a single pass.
+ @discussion Nodes are created using -init and linked directly, without going through -performOperation:atIndex:withChild:,
+ so subclasses do not send notifications and do not register undo while building.
+ Siblings are ordered as the records. Throws an NSInvalidArgumentException if a record parent is invalid.
+ @param      records The node records. The first one is the root.
+ @param      count The number of records.
+ @param      initializer An optional function called for each node with its record payload.
+ @result     The root of the tree, or nil if count is 0.
+ */
++ (instancetype)nodeWithRecords:(const WBTreeNodeRecord *)records count:(NSUInteger)count
+                    initializer:(WBTreeNodeInitializer)initializer context:(void *)context;
+
+/*!
+ @method
+ @abstract   Creates a whole tree of receiver instances from a depth first walk.
+ @discussion See +nodeWithRecords:count:initializer:context:. The first node must have a depth of 0, and the depth of
+ the following ones must be between 1 and the previous node depth + 1.
+ @param      stream The function that returns the nodes.
+ @param      initializer An optional function called for each node with its payload.
+ @result     The root of the tree, or nil if the stream is empty.
+ */
++ (instancetype)nodeWithStream:(WBTreeNodeStream)stream
+                   initializer:(WBTreeNodeInitializer)initializer context:(void *)context;
+
+@end
+
+#pragma mark -
+#pragma mark Tree Traversal
+enum {
+  kWBTreeTraversalPreOrder = 0,
+  kWBTreeTraversalPostOrder = 1,
+  kWBTreeTraversalBreadthFirst = 2,
+};
+typedef uint32_t WBTreeTraversalOrder;
+
+enum {
+  kWBTreeVisitContinue = 0,
+  /* The node is returned, but not its descendants */
+  kWBTreeVisitSkipChildren = 1,
+  /* The node is not returned, and the traversal ends */
+  kWBTreeVisitStop = 2,
+};
+typedef uint32_t WBTreeVisitResult;
+
+/* Called when a node is reached, before any of its descendants, whatever the traversal order */
+typedef WBTreeVisitResult (*WBTreeTraversalFilter)(__kindof WBTreeNode *node, void *context);
+
+/*!
+ @abstract
+   WBTreeTraversal traversal;
+   WBTreeTraversalInitialize(root, kWBTreeTraversalPreOrder, NULL, NULL, &traversal);
+   WBTreeNode * __unsafe_unretained nodes[256];
+   NSUInteger count;
+   while ((count = WBTreeTraversalGetNodes(&traversal, nodes, 256))) {
+     // Do something with nodes.
+   }
+   WBTreeTraversalDestroy(&traversal);
+ @discussion Iterates over the descendants of a node (not including the node itself) without
+ allocating or sending message per node. The tree must not be mutated while it is traversed,
+ and the root must be retained until the traversal is destroyed.
+ */
+typedef struct _WBTreeTraversal {
+  // @private
+  void *_root;
+  void *_node;
+  WBTreeTraversalOrder _order;
+  WBTreeTraversalFilter _filter;
+  void *_context;
+  /* breadth first pending parents */
+  void **_queue;
+  NSUInteger _head, _tail, _capacity;
+} WBTreeTraversal;
+
+WB_EXPORT
+void WBTreeTraversalInitialize(WBTreeNode *root, WBTreeTraversalOrder order,
+                               WBTreeTraversalFilter filter, void *context, WBTreeTraversal *traversal);
+
+/* Fills nodes with up to count nodes. Returns 0 when the traversal is done. */
+WB_EXPORT
+NSUInteger WBTreeTraversalGetNodes(WBTreeTraversal *traversal, WBTreeNode * __unsafe_unretained *nodes, NSUInteger count);
+
+WB_EXPORT
+void WBTreeTraversalDestroy(WBTreeTraversal *traversal);
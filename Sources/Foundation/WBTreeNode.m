@@ -24,11 +24,133 @@
 }
 @end
 
+/* Children are not indexed below this count: walking the list is fast enough */
+enum {
+  kWBTreeNodeIndexThreshold = 32,
+};
+
+/* Children index of nodes with many children.
+ The first 'valid' entries of nodes are up to date, and the wb_position of these children
+ is their index. Mutations truncate 'valid' to the first changed index, and the index
+ is completed on demand, so appending or changing the last children is cheap. */
+typedef struct _WBTreeNodeIndex {
+  NSUInteger valid;
+  NSUInteger capacity;
+  WBTreeNode * __unsafe_unretained *nodes;
+} WBTreeNodeIndex;
+
+static IMP sWBObjectIsEqual = NULL;
+
+/* Used by WBTreeUnarchiver */
+WB_PRIVATE void WBTreeNodeAppendNewChild(WBTreeNode *parent, WBTreeNode *child);
+
 #pragma mark -
 @implementation WBTreeNode {
   WBTreeNode *wb_child;
   WBTreeNode *wb_sibling;
   __unsafe_unretained WBTreeNode *wb_parent;
+
+  NSUInteger wb_count;
+  __unsafe_unretained WBTreeNode *wb_last;
+  /* incremented each time the children list changes (fast enumeration mutation check) */
+  unsigned long wb_mutations;
+  /* index in parent, valid only if the parent index says so */
+  NSUInteger wb_position;
+  WBTreeNodeIndex *wb_index;
+}
+
+#pragma mark Children Index
+WB_INLINE
+void _WBTreeNodeInvalidateIndex(WBTreeNode *parent, NSUInteger position) {
+  if (parent->wb_index && parent->wb_index->valid > position)
+    parent->wb_index->valid = position;
+}
+
+/* Returns NSNotFound if the position of child is not known */
+WB_INLINE
+NSUInteger _WBTreeNodeIndexedPosition(WBTreeNode *parent, WBTreeNode *child) {
+  const WBTreeNodeIndex *index = parent->wb_index;
+  NSUInteger position = child->wb_position;
+  if (index && position < index->valid && index->nodes[position] == child)
+    return position;
+  return NSNotFound;
+}
+
+/* Makes sure the first count entries of the index are valid. Returns NULL if the node is not indexed. */
+static
+WBTreeNodeIndex *_WBTreeNodeUpdateIndex(WBTreeNode *parent, NSUInteger count) {
+  WBTreeNodeIndex *index = parent->wb_index;
+  if (!index) {
+    if (parent->wb_count < kWBTreeNodeIndexThreshold)
+      return NULL;
+    index = parent->wb_index = calloc(1, sizeof(*index));
+    if (!index)
+      return NULL;
+  }
+  if (index->valid < count) {
+    if (index->capacity < parent->wb_count) {
+      NSUInteger capacity = parent->wb_count + parent->wb_count / 2;
+      WBTreeNode * __unsafe_unretained *nodes = (WBTreeNode * __unsafe_unretained *)realloc(index->nodes, capacity * sizeof(*nodes));
+      if (!nodes)
+        return NULL;
+      index->nodes = nodes;
+      index->capacity = capacity;
+    }
+    NSUInteger position = index->valid;
+    __unsafe_unretained WBTreeNode *node = position > 0 ? index->nodes[position - 1]->wb_sibling : parent->wb_child;
+    while (node && position < count) {
+      node->wb_position = position;
+      index->nodes[position++] = node;
+      node = node->wb_sibling;
+    }
+    NSCAssert(position == count, @"inconsistent children count");
+    index->valid = position;
+  }
+  return index;
+}
+
+/* Appends a node without sibling. Does not require to invalidate the index. */
+WB_INLINE
+void _WBTreeNodeLinkChild(WBTreeNode *parent, WBTreeNode *child) {
+  child->wb_parent = parent;
+  if (parent->wb_last)
+    parent->wb_last->wb_sibling = child;
+  else
+    parent->wb_child = child;
+  parent->wb_last = child;
+  parent->wb_count++;
+  parent->wb_mutations++;
+}
+
+/* Appends a new node without notification. */
+void WBTreeNodeAppendNewChild(WBTreeNode *parent, WBTreeNode *child) {
+  NSCParameterAssert(child && !child->wb_parent && !child->wb_sibling);
+  _WBTreeNodeLinkChild(parent, child);
+}
+
++ (void)initialize {
+  if ([WBTreeNode class] == self) {
+    sWBObjectIsEqual = [NSObject instanceMethodForSelector:@selector(isEqual:)];
+  }
+}
+
+- (void)dealloc {
+  if (wb_index) {
+    free(wb_index->nodes);
+    free(wb_index);
+  }
+  /* Detach children one by one, else releasing a child releases its next sibling recursively,
+   and a long children list overflows the stack */
+  WBTreeNode *child = wb_child;
+  wb_child = nil;
+  while (child) {
+    WBTreeNode *sibling = child->wb_sibling;
+    if (child->wb_parent == self) {
+      child->wb_parent = nil;
+      child->wb_sibling = nil;
+    }
+    child = sibling;
+  }
 }
 
 #pragma mark Protocol Implementation
@@ -38,8 +160,11 @@
     wb_sibling = [aCoder decodeObjectForKey:@"Sibling"];
     id children = [aCoder decodeObjectForKey:@"Children"];
     /* Just have to restore first child. Other objects are sibling of first child */
-    if ([children count])
+    if ([children count]) {
       wb_child =  [children objectAtIndex:0];
+      wb_last = [children lastObject];
+      wb_count = [children count];
+    }
   }
   return self;
 }
@@ -67,6 +192,8 @@
       child = child->wb_sibling;
       sibling = sibling->wb_sibling;
     }
+    copy->wb_last = child;
+    copy->wb_count = wb_count;
   }
   return copy;
 }
@@ -89,6 +216,86 @@
     wb_parent, (unsigned long)[self count], wb_sibling];
 }
 
+#pragma mark Bulk Building
++ (instancetype)nodeWithRecords:(const WBTreeNodeRecord *)records count:(NSUInteger)count
+                    initializer:(WBTreeNodeInitializer)initializer context:(void *)context {
+  if (!count)
+    return nil;
+  /* Check first, so nothing is leaked if the records are invalid */
+  if (NSNotFound != records[0].parent)
+    SPXThrowException(NSInvalidArgumentException, @"The first record must be the root.");
+  for (NSUInteger idx = 1; idx < count; ++idx) {
+    if (records[idx].parent >= idx)
+      SPXThrowException(NSInvalidArgumentException, @"Record %lu parent (%lu) must precede it.",
+                        (unsigned long)idx, (unsigned long)records[idx].parent);
+  }
+
+  WBTreeNode * __unsafe_unretained *nodes = (WBTreeNode * __unsafe_unretained *)malloc(count * sizeof(*nodes));
+  if (!nodes)
+    return nil;
+
+  WBTreeNode *root = [[self alloc] init];
+  if (initializer)
+    initializer(root, records[0].payload, context);
+  nodes[0] = root;
+  for (NSUInteger idx = 1; idx < count; ++idx) {
+    WBTreeNode *node = [[self alloc] init];
+    if (initializer)
+      initializer(node, records[idx].payload, context);
+    _WBTreeNodeLinkChild(nodes[records[idx].parent], node);
+    nodes[idx] = node;
+  }
+  free(nodes);
+  return root;
+}
+
++ (instancetype)nodeWithStream:(WBTreeNodeStream)stream
+                   initializer:(WBTreeNodeInitializer)initializer context:(void *)context {
+  NSParameterAssert(stream);
+  void *payload = NULL;
+  NSUInteger depth = 0;
+  if (!stream(&depth, &payload, context))
+    return nil;
+  if (depth != 0)
+    SPXThrowException(NSInvalidArgumentException, @"The first node must be the root.");
+
+  /* ancestors of the current node */
+  NSUInteger capacity = 64;
+  WBTreeNode * __unsafe_unretained *parents = (WBTreeNode * __unsafe_unretained *)malloc(capacity * sizeof(*parents));
+  if (!parents)
+    return nil;
+
+  WBTreeNode *root = [[self alloc] init];
+  if (initializer)
+    initializer(root, payload, context);
+  parents[0] = root;
+  NSUInteger current = 0;
+  while (stream(&depth, &payload, context)) {
+    if (depth < 1 || depth > current + 1) {
+      free(parents);
+      SPXThrowException(NSInvalidArgumentException, @"Invalid node depth %lu after depth %lu.",
+                        (unsigned long)depth, (unsigned long)current);
+    }
+    if (depth >= capacity) {
+      capacity *= 2;
+      WBTreeNode * __unsafe_unretained *tmp = (WBTreeNode * __unsafe_unretained *)realloc(parents, capacity * sizeof(*parents));
+      if (!tmp) {
+        free(parents);
+        return nil;
+      }
+      parents = tmp;
+    }
+    WBTreeNode *node = [[self alloc] init];
+    if (initializer)
+      initializer(node, payload, context);
+    _WBTreeNodeLinkChild(parents[depth - 1], node);
+    parents[depth] = node;
+    current = depth;
+  }
+  free(parents);
+  return root;
+}
+
 #pragma mark -
 - (__kindof WBTreeNode *)parent {
   return wb_parent;
@@ -137,13 +344,7 @@
 
 #pragma mark Child access
 - (NSUInteger)count {
-  NSUInteger cnt = 0;
-  WBTreeNode *node = wb_child;
-  while (node) {
-    cnt++;
-    node = node->wb_sibling;
-  }
-  return cnt;
+  return wb_count;
 }
 - (BOOL)hasChildren {
   return wb_child != nil;
@@ -154,13 +355,7 @@
 }
 
 - (__kindof WBTreeNode *)lastChild {
-  WBTreeNode *last = nil;
-  if (wb_child) {
-    last = wb_child;
-    while (last->wb_sibling)
-      last = last->wb_sibling;
-  }
-  return last;
+  return wb_last;
 }
 
 /* Must return a mutable array for sort functions */
@@ -175,6 +370,11 @@
 }
 
 - (__kindof WBTreeNode *)childAtIndex:(NSUInteger)anIndex {
+  if (anIndex < wb_count) {
+    WBTreeNodeIndex *index = _WBTreeNodeUpdateIndex(self, anIndex + 1);
+    if (index)
+      return index->nodes[anIndex];
+  }
   WBTreeNode *node = wb_child;
   NSUInteger idx = anIndex;
   while (node) {
@@ -191,6 +391,15 @@
     NSUInteger idx = 0;
     WBTreeNode *child = wb_child;
     BOOL (*isEqual)(id, SEL, id) = (BOOL(*)(id, SEL, id))[aChild methodForSelector:@selector(isEqual:)];
+    /* With the default isEqual:, the child can only match itself */
+    if ((IMP)isEqual == sWBObjectIsEqual) {
+      idx = _WBTreeNodeIndexedPosition(self, aChild);
+      if (NSNotFound == idx && _WBTreeNodeUpdateIndex(self, wb_count))
+        idx = _WBTreeNodeIndexedPosition(self, aChild);
+      if (NSNotFound != idx)
+        return idx;
+      idx = 0;
+    }
     do {
       if (isEqual(aChild, @selector(isEqual:), child)) {
         return idx;
@@ -248,15 +457,20 @@
   }
 
   /* If child is a subtree, find last node and set parents */
+  NSUInteger added = 0, removed = 0;
   WBTreeNode *last = child;
   if (last) {
     [last setParent:self];
+    added++;
     while (last->wb_sibling) {
       last = last->wb_sibling;
       NSAssert(nil == last->wb_parent, @"Should not append node with parent not nil");
       [last setParent:self];
+      added++;
     }
   }
+  /* Last child if the inserted nodes are not at the end */
+  __unsafe_unretained WBTreeNode *tail = wb_last;
   /* append and has 0 child, or anIndex == 0 and insert or replace */
   if ((0 == anIndex && op != kWBTreeOperationAppend) || (op == kWBTreeOperationAppend && !wb_child)) {
     switch (op) {
@@ -279,12 +493,16 @@
             /* No need to retain. wb_remove release only self */
             last->wb_sibling = wb_child->wb_sibling;
           }
+          if (wb_child == wb_last)
+            tail = nil;
+          removed++;
           [wb_child wb_remove];
         }
         break;
     }
     /* Retain at end to avoid leak when raise an exception */
     wb_child = child;
+    _WBTreeNodeInvalidateIndex(self, 0);
   } else {
     WBTreeNode *previous = (op == kWBTreeOperationAppend) ? [self lastChild] : [self childAtIndex:anIndex -1];
     WBTreeNode *current = previous ? previous->wb_sibling : nil;
@@ -300,12 +518,15 @@
           SPXThrowException(NSRangeException, @"index (%lu) beyond bounds (%lu)",
                             (unsigned long)anIndex, (unsigned long)[self count]);
         } else {
+          if (current == wb_last)
+            tail = previous;
           if (last) {
             last->wb_sibling = current->wb_sibling;
           } else {
             previous->wb_sibling = current->wb_sibling;
             previous = nil;
           }
+          removed++;
           [current wb_remove];
         }
         break;
@@ -315,7 +536,13 @@
     /* Retain at end to avoid leak when raise an exception */
     if (previous)
       previous->wb_sibling = child;
+    /* appended nodes are indexed on demand */
+    if (op != kWBTreeOperationAppend)
+      _WBTreeNodeInvalidateIndex(self, anIndex);
   }
+  wb_count = wb_count + added - removed;
+  wb_last = (last && !last->wb_sibling) ? last : tail;
+  wb_mutations++;
 }
 
 #pragma mark Nodes Methods
@@ -354,6 +581,10 @@
     nextChild = sibling;
   }
   wb_child = nil;
+  wb_last = nil;
+  wb_count = 0;
+  wb_mutations++;
+  _WBTreeNodeInvalidateIndex(self, 0);
 }
 
 #pragma mark -
@@ -365,26 +596,46 @@
   if (sibling->wb_parent) {
     SPXThrowException(NSInvalidArgumentException, @"Cannot append newChild with parent.");
   }
-  [sibling setParent:self->wb_parent];
+  WBTreeNode *parent = self->wb_parent;
+  NSUInteger position = _WBTreeNodeIndexedPosition(parent, self);
+  [sibling setParent:parent];
   sibling->wb_sibling = self->wb_sibling;
   self->wb_sibling = sibling;
+
+  parent->wb_count++;
+  parent->wb_mutations++;
+  if (parent->wb_last == self)
+    parent->wb_last = sibling;
+  _WBTreeNodeInvalidateIndex(parent, NSNotFound != position ? position + 1 : 0);
 }
 
 - (void)remove {
   NSParameterAssert(wb_parent);
   if (wb_parent) {
-    if (self == wb_parent->wb_child) {
-      wb_parent->wb_child = wb_sibling;
+    WBTreeNode *parent = wb_parent;
+    WBTreeNode *previous = nil;
+    NSUInteger position = _WBTreeNodeIndexedPosition(parent, self);
+    if (self == parent->wb_child) {
+      parent->wb_child = wb_sibling;
+      position = 0;
+    } else if (NSNotFound != position) {
+      previous = parent->wb_index->nodes[position - 1];
+      previous->wb_sibling = wb_sibling;
     } else {
-      WBTreeNode *previous = nil;
       /* Search previous node */
-      for (previous = wb_parent->wb_child; previous; previous = previous->wb_sibling) {
+      for (previous = parent->wb_child; previous; previous = previous->wb_sibling) {
         if (previous->wb_sibling == self) {
           previous->wb_sibling = wb_sibling;
           break;
         }
       }
+      position = 0;
     }
+    parent->wb_count--;
+    parent->wb_mutations++;
+    if (parent->wb_last == self)
+      parent->wb_last = previous;
+    _WBTreeNodeInvalidateIndex(parent, position);
     [self wb_remove];
   }
 }
@@ -394,12 +645,20 @@
   NSEnumerator *children = [ordered objectEnumerator];
   WBTreeNode *child = nil;
   WBTreeNode *sibling;
+  NSUInteger count = 0;
   while (sibling = [children nextObject]) {
     sibling->wb_sibling = nil;
     if (child) child->wb_sibling = sibling;
     else self->wb_child = sibling;
     child = sibling;
+    count++;
   }
+  if (child) {
+    wb_last = child;
+    wb_count = count;
+  }
+  wb_mutations++;
+  _WBTreeNodeInvalidateIndex(self, 0);
 }
 
 - (void)sortUsingSelector:(SEL)comparator {
@@ -429,6 +688,330 @@
   }
 }
 
+#pragma mark Tree Traversal
+/* Nodes are never retained while walking the tree: the caller owns the root */
+static
+NSUInteger _WBTreeNodeGetSiblings(void **cursor, WBTreeNode * __unsafe_unretained *nodes, NSUInteger count) {
+  __unsafe_unretained WBTreeNode *node = (__bridge WBTreeNode *)*cursor;
+  NSUInteger idx = 0;
+  while (node && idx < count) {
+    nodes[idx++] = node;
+    node = node->wb_sibling;
+  }
+  *cursor = (__bridge void *)node;
+  return idx;
+}
+
+/* Pre-order walk of root descendants, starting at cursor */
+static
+NSUInteger _WBTreeNodeGetPreOrder(__unsafe_unretained WBTreeNode *root, void **cursor, WBTreeTraversalFilter filter, void *context,
+                                  WBTreeNode * __unsafe_unretained *nodes, NSUInteger count) {
+  __unsafe_unretained WBTreeNode *node = (__bridge WBTreeNode *)*cursor;
+  NSUInteger idx = 0;
+  while (node && idx < count) {
+    WBTreeVisitResult result = filter ? filter(node, context) : kWBTreeVisitContinue;
+    if (kWBTreeVisitStop == result) {
+      node = nil;
+      break;
+    }
+    nodes[idx++] = node;
+    if (kWBTreeVisitContinue == result && node->wb_child) {
+      node = node->wb_child;
+    } else {
+      /* Go up until a node has a next sibling */
+      while (node != root && !node->wb_sibling)
+        node = node->wb_parent;
+      node = node != root ? node->wb_sibling : nil;
+    }
+  }
+  *cursor = (__bridge void *)node;
+  return idx;
+}
+
+/* Returns the first node of node subtree in post-order, or NULL if the filter stops the traversal */
+static
+void *_WBTreeNodeGetFirstPostOrder(__unsafe_unretained WBTreeNode *node, WBTreeTraversalFilter filter, void *context) {
+  for (;;) {
+    WBTreeVisitResult result = filter ? filter(node, context) : kWBTreeVisitContinue;
+    if (kWBTreeVisitStop == result)
+      return NULL;
+    if (kWBTreeVisitContinue != result || !node->wb_child)
+      return (__bridge void *)node;
+    node = node->wb_child;
+  }
+}
+
+static
+NSUInteger _WBTreeNodeGetPostOrder(WBTreeTraversal *traversal, WBTreeNode * __unsafe_unretained *nodes, NSUInteger count) {
+  __unsafe_unretained WBTreeNode *root = (__bridge WBTreeNode *)traversal->_root;
+  void *node = traversal->_node;
+  NSUInteger idx = 0;
+  while (node && idx < count) {
+    __unsafe_unretained WBTreeNode *current = (__bridge WBTreeNode *)node;
+    nodes[idx++] = current;
+    if (current->wb_sibling)
+      node = _WBTreeNodeGetFirstPostOrder(current->wb_sibling, traversal->_filter, traversal->_context);
+    else
+      node = current->wb_parent != root ? (__bridge void *)current->wb_parent : NULL;
+  }
+  traversal->_node = node;
+  return idx;
+}
+
+static
+bool _WBTreeTraversalEnqueue(WBTreeTraversal *traversal, void *node) {
+  if (traversal->_tail == traversal->_capacity) {
+    if (traversal->_head > 0 && traversal->_head >= traversal->_capacity / 2) {
+      memmove(traversal->_queue, traversal->_queue + traversal->_head, (traversal->_tail - traversal->_head) * sizeof(void *));
+      traversal->_tail -= traversal->_head;
+      traversal->_head = 0;
+    } else {
+      NSUInteger capacity = MAX(traversal->_capacity * 2, (NSUInteger)64);
+      void **queue = realloc(traversal->_queue, capacity * sizeof(void *));
+      if (!queue)
+        return false;
+      traversal->_queue = queue;
+      traversal->_capacity = capacity;
+    }
+  }
+  traversal->_queue[traversal->_tail++] = node;
+  return true;
+}
+
+static
+NSUInteger _WBTreeNodeGetBreadthFirst(WBTreeTraversal *traversal, WBTreeNode * __unsafe_unretained *nodes, NSUInteger count) {
+  __unsafe_unretained WBTreeNode *node = (__bridge WBTreeNode *)traversal->_node;
+  NSUInteger idx = 0;
+  while (idx < count) {
+    if (!node) {
+      /* Next parent whose children have not been visited yet */
+      if (traversal->_head == traversal->_tail)
+        break;
+      __unsafe_unretained WBTreeNode *parent = (__bridge WBTreeNode *)traversal->_queue[traversal->_head++];
+      if (traversal->_head == traversal->_tail)
+        traversal->_head = traversal->_tail = 0;
+      node = parent->wb_child;
+      continue;
+    }
+    WBTreeVisitResult result = traversal->_filter ? traversal->_filter(node, traversal->_context) : kWBTreeVisitContinue;
+    if (kWBTreeVisitStop == result) {
+      node = nil;
+      traversal->_head = traversal->_tail = 0;
+      break;
+    }
+    nodes[idx++] = node;
+    if (kWBTreeVisitContinue == result && node->wb_child && !_WBTreeTraversalEnqueue(traversal, (__bridge void *)node)) {
+      node = nil;
+      traversal->_head = traversal->_tail = 0;
+      break;
+    }
+    node = node->wb_sibling;
+  }
+  traversal->_node = (__bridge void *)node;
+  return idx;
+}
+
+void WBTreeTraversalInitialize(WBTreeNode *root, WBTreeTraversalOrder order,
+                               WBTreeTraversalFilter filter, void *context, WBTreeTraversal *traversal) {
+  NSCParameterAssert(traversal);
+  bzero(traversal, sizeof(*traversal));
+  traversal->_root = (__bridge void *)root;
+  traversal->_order = order;
+  traversal->_filter = filter;
+  traversal->_context = context;
+  if (root && root->wb_child) {
+    if (kWBTreeTraversalPostOrder == order)
+      traversal->_node = _WBTreeNodeGetFirstPostOrder(root->wb_child, filter, context);
+    else
+      traversal->_node = (__bridge void *)root->wb_child;
+  }
+}
+
+NSUInteger WBTreeTraversalGetNodes(WBTreeTraversal *traversal, WBTreeNode * __unsafe_unretained *nodes, NSUInteger count) {
+  NSCParameterAssert(traversal && (nodes || !count));
+  switch (traversal->_order) {
+    case kWBTreeTraversalPreOrder:
+      return _WBTreeNodeGetPreOrder((__bridge WBTreeNode *)traversal->_root, &traversal->_node,
+                                    traversal->_filter, traversal->_context, nodes, count);
+    case kWBTreeTraversalPostOrder:
+      return _WBTreeNodeGetPostOrder(traversal, nodes, count);
+    case kWBTreeTraversalBreadthFirst:
+      return _WBTreeNodeGetBreadthFirst(traversal, nodes, count);
+  }
+  return 0;
+}
+
+void WBTreeTraversalDestroy(WBTreeTraversal *traversal) {
+  if (traversal) {
+    free(traversal->_queue);
+    bzero(traversal, sizeof(*traversal));
+  }
+}
+
+#pragma mark Deep Operations
+/* Below this number of nodes, deep operations run on the calling thread */
+enum {
+  kWBTreeNodeConcurrentThreshold = 16 * 1024,
+  /* Nodes visited by each concurrent task */
+  kWBTreeNodeConcurrentBatch = 1024,
+};
+
+static
+bool _WBTreeNodeCollectAppend(void ***nodes, NSUInteger *count, NSUInteger *capacity, void *node) {
+  if (*count == *capacity) {
+    NSUInteger size = MAX(*capacity * 2, (NSUInteger)256);
+    void **tmp = realloc(*nodes, size * sizeof(void *));
+    if (!tmp)
+      return false;
+    *nodes = tmp;
+    *capacity = size;
+  }
+  (*nodes)[(*count)++] = node;
+  return true;
+}
+
+/* Returns the descendants of root in pre-order, or only the nodes that have at least 2 children (including root).
+ total is the number of nodes in the tree. Returns NULL if there is no node to return, and raises if out of memory. */
+static
+void **_WBTreeNodeCollect(WBTreeNode *root, bool parents, NSUInteger *count, NSUInteger *total) {
+  void **nodes = NULL;
+  NSUInteger capacity = 0;
+  *count = 0;
+  *total = 1;
+  if (parents && root->wb_child && root->wb_child->wb_sibling) {
+    if (!_WBTreeNodeCollectAppend(&nodes, count, &capacity, (__bridge void *)root))
+      SPXThrowException(NSMallocException, @"Cannot allocate node buffer.");
+  }
+
+  NSUInteger length;
+  WBTreeTraversal traversal;
+  WBTreeNode * __unsafe_unretained buffer[256];
+  WBTreeTraversalInitialize(root, kWBTreeTraversalPreOrder, NULL, NULL, &traversal);
+  while ((length = WBTreeTraversalGetNodes(&traversal, buffer, 256))) {
+    *total += length;
+    for (NSUInteger idx = 0; idx < length; ++idx) {
+      __unsafe_unretained WBTreeNode *node = buffer[idx];
+      if (parents && (!node->wb_child || !node->wb_child->wb_sibling))
+        continue;
+      if (!_WBTreeNodeCollectAppend(&nodes, count, &capacity, (__bridge void *)node)) {
+        WBTreeTraversalDestroy(&traversal);
+        free(nodes);
+        *count = 0;
+        SPXThrowException(NSMallocException, @"Cannot allocate node buffer.");
+      }
+    }
+  }
+  WBTreeTraversalDestroy(&traversal);
+  return nodes;
+}
+
+- (void)wb_deepSort:(void (^)(NSMutableArray *children))sort {
+  NSUInteger count, total;
+  void **parents = _WBTreeNodeCollect(self, true, &count, &total);
+  if (!parents)
+    return;
+
+  /* Sort the children lists, and apply them afterward on the calling thread,
+   so subclasses send notifications and register undo as usual */
+  void **sorted = calloc(count, sizeof(void *));
+  if (!sorted) {
+    free(parents);
+    SPXThrowException(NSMallocException, @"Cannot allocate node buffer.");
+  }
+  void (^work)(size_t) = ^(size_t idx) {
+    @autoreleasepool {
+      NSMutableArray *children = (NSMutableArray *)[(__bridge WBTreeNode *)parents[idx] children];
+      sort(children);
+      sorted[idx] = (__bridge_retained void *)children;
+    }
+  };
+  if (total < kWBTreeNodeConcurrentThreshold) {
+    for (NSUInteger idx = 0; idx < count; ++idx)
+      work(idx);
+  } else {
+    dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), work);
+  }
+  for (NSUInteger idx = 0; idx < count; ++idx)
+    [(__bridge WBTreeNode *)parents[idx] setSortedChildren:(__bridge_transfer NSArray *)sorted[idx]];
+  free(sorted);
+  free(parents);
+}
+
+- (void)deepSortUsingSelector:(SEL)comparator {
+  [self wb_deepSort:^(NSMutableArray *children) {
+    [children sortUsingSelector:comparator];
+  }];
+}
+
+- (void)deepSortUsingDescriptors:(NSArray *)sortDescriptors {
+  [self wb_deepSort:^(NSMutableArray *children) {
+    [children sortUsingDescriptors:sortDescriptors];
+  }];
+}
+
+- (void)deepSortUsingFunction:(NSInteger (*)(id, id, void *))compare context:(void *)context {
+  [self wb_deepSort:^(NSMutableArray *children) {
+    [children sortUsingFunction:compare context:context];
+  }];
+}
+
+- (void)visitDescendantsUsingFunction:(void (*)(id node, void *context))function context:(void *)context {
+  NSParameterAssert(function);
+  NSUInteger count, total;
+  void **nodes = _WBTreeNodeCollect(self, false, &count, &total);
+  if (!nodes)
+    return;
+
+  if (count < kWBTreeNodeConcurrentThreshold) {
+    for (NSUInteger idx = 0; idx < count; ++idx)
+      function((__bridge id)nodes[idx], context);
+  } else {
+    /* index access updates the parent children index: build them all before going concurrent */
+    _WBTreeNodeUpdateIndex(self, wb_count);
+    for (NSUInteger idx = 0; idx < count; ++idx) {
+      __unsafe_unretained WBTreeNode *node = (__bridge WBTreeNode *)nodes[idx];
+      _WBTreeNodeUpdateIndex(node, node->wb_count);
+    }
+    dispatch_apply((count + kWBTreeNodeConcurrentBatch - 1) / kWBTreeNodeConcurrentBatch,
+                   dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t batch) {
+      @autoreleasepool {
+        NSUInteger end = MIN(count, (batch + 1) * kWBTreeNodeConcurrentBatch);
+        for (NSUInteger idx = batch * kWBTreeNodeConcurrentBatch; idx < end; ++idx)
+          function((__bridge id)nodes[idx], context);
+      }
+    });
+  }
+  free(nodes);
+}
+
+static
+void _WBTreeNodeVisitBlock(id node, void *context) {
+  void (^block)(id) = (__bridge void (^)(id))context;
+  block(node);
+}
+
+- (void)visitDescendantsUsingBlock:(void (^)(id node))block {
+  NSParameterAssert(block);
+  [self visitDescendantsUsingFunction:_WBTreeNodeVisitBlock context:(__bridge void *)block];
+}
+
+#pragma mark Fast Enumeration
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state objects:(id __unsafe_unretained [])buffer count:(NSUInteger)len {
+  void *cursor;
+  if (0 == state->state) {
+    state->state = 1;
+    /* adding, removing, replacing or sorting children is a mutation */
+    state->mutationsPtr = &wb_mutations;
+    cursor = (__bridge void *)wb_child;
+  } else {
+    cursor = (void *)state->extra[0];
+  }
+  NSUInteger count = _WBTreeNodeGetSiblings(&cursor, (WBTreeNode * __unsafe_unretained *)buffer, len);
+  state->extra[0] = (unsigned long)cursor;
+  state->itemsPtr = buffer;
+  return count;
+}
+
 @end
 
 #pragma mark -
@@ -450,6 +1033,25 @@
   return node;
 }
 
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state objects:(id __unsafe_unretained [])buffer count:(NSUInteger)len {
+  if (0 == state->state) {
+    state->state = 1;
+    state->mutationsPtr = &state->extra[0];
+  }
+  void *cursor = (__bridge void *)wb_node;
+  NSUInteger count = [self getNodes:(WBTreeNode * __unsafe_unretained *)buffer count:len cursor:&cursor];
+  wb_node = (__bridge WBTreeNode *)cursor;
+  /* Keep the root alive until the returned nodes have been used */
+  if (0 == count)
+    wb_root = nil;
+  state->itemsPtr = buffer;
+  return count;
+}
+
+- (NSUInteger)getNodes:(WBTreeNode * __unsafe_unretained *)nodes count:(NSUInteger)count cursor:(void **)cursor {
+  return _WBTreeNodeGetSiblings(cursor, nodes, count);
+}
+
 - (NSArray *)allObjects {
   if (!wb_node) { return [NSArray array]; }
 
@@ -491,6 +1093,10 @@
   return node;
 }
 
+- (NSUInteger)getNodes:(WBTreeNode * __unsafe_unretained *)nodes count:(NSUInteger)count cursor:(void **)cursor {
+  return _WBTreeNodeGetPreOrder(wb_root, cursor, NULL, NULL, nodes, count);
+}
+
 - (NSArray *)allObjects {
   if (!wb_node) { return [NSArray array]; }
 
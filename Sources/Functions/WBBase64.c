@@ -8,7 +8,30 @@
  *  This file is distributed under the MIT License. See LICENSE.TXT for details.
  */
 
-#import <WonderBox/WBBase64.h>
+#if __has_include(<WonderBox/WBBase64.h>)
+#  include <WonderBox/WBBase64.h>
+#else
+#  include "WBBase64.h"
+#endif
+
+#include <string.h>
+#include <pthread.h>
+
+#if !defined(spx_assert)
+#  include <assert.h>
+#  define spx_assert(test, message) assert((test) && (message))
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  if defined(__APPLE__)
+#    include <sys/sysctl.h>
+#  endif
+#  define WB_BASE64_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define WB_BASE64_NEON 1
+#endif
 
 static const char *kBase64EncodeChars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char *kWebSafeBase64EncodeChars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
@@ -180,20 +203,32 @@ bool IsSpace(unsigned char c) {
 }
 
 // Calculate how long the data will be once it's base64 encoded.
+// |lineLength| is the number of characters per line (0 for a single line),
+// each line but the last one being followed by a CRLF.
 //
 // Returns:
 //   The guessed encoded length for a source length
 //
 WB_INLINE
-CFIndex CalcEncodedLength(CFIndex srcLen, bool padded) {
+CFIndex CalcEncodedLength(CFIndex srcLen, bool padded, CFIndex lineLength) {
   CFIndex intermediate_result = 8 * srcLen + 5;
   CFIndex len = intermediate_result / 6;
   if (padded) {
     len = ((len + 3) / 4) * 4;
   }
+  if (lineLength > 0 && len > 0) {
+    len += (len - 1) / lineLength * 2;
+  }
   return len;
 }
 
+// Line lengths must be a multiple of 4, so line breaks are always
+// between two quanta.
+WB_INLINE
+bool IsValidLineLength(CFIndex lineLength) {
+  return lineLength >= 0 && (lineLength % 4) == 0;
+}
+
 // Tries to calculate how long the data will be once it's base64 decoded.
 // Unlike the above, this is always an upperbound, since the source data
 // could have spaces and might end with the padding characters on them.
@@ -206,24 +241,352 @@ CFIndex GuessDecodedLength(CFIndex srcLen) {
   return (srcLen + 3) / 4 * 3;
 }
 
+#pragma mark Vector Codecs
+//
+// Vectorized kernels only process whole blocks made of alphabet characters.
+// They stop at the first block they cannot handle (whitespace, padding,
+// invalid or NUL characters, short destination) and return the number of
+// source bytes consumed, so the scalar code can take over from there. As a
+// block always contains whole 4-character quanta, the scalar decoder is in
+// its initial state when it resumes.
+//
+typedef struct _WBBase64VectorCodec {
+  const char *name;
+  // Returns the number of source bytes consumed (a multiple of 3).
+  CFIndex (*encode)(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, const char *charset);
+  // Returns the number of source characters consumed (a multiple of 4).
+  CFIndex (*decode)(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, UInt8 c62, UInt8 c63);
+} WBBase64VectorCodec;
+
+#if defined(WB_BASE64_X86)
+
+#define WB_SSSE3 __attribute__((__target__("ssse3")))
+#define WB_AVX2 __attribute__((__target__("avx2")))
+
+// Translate 6 bits indices into ASCII (see Wojciech Muła and Daniel Lemire,
+// "Faster Base64 Encoding and Decoding Using AVX2 Instructions").
+// Indices are reduced to an offset table entry:
+//   0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+WB_SSSE3 WB_INLINE
+__m128i _WBBase64EncodeTranslate128(__m128i indices, __m128i offsets) {
+  __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  reduced = _mm_or_si128(reduced, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+  return _mm_add_epi8(_mm_shuffle_epi8(offsets, reduced), indices);
+}
+
+WB_SSSE3
+static CFIndex _WBBase64EncodeSSSE3(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, const char *charset) {
+  const UInt8 *start = src;
+  const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        (char)(charset[62] - 62), (char)(charset[63] - 63), 'A', 0, 0);
+  // Reads 16 bytes to consume 12
+  while (srcLen >= 16 && destLen >= 16) {
+    __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle);
+    __m128i hi = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i lo = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    _mm_storeu_si128((__m128i *)dest, _WBBase64EncodeTranslate128(_mm_or_si128(hi, lo), offsets));
+    src += 12;
+    srcLen -= 12;
+    dest += 16;
+    destLen -= 16;
+  }
+  return src - start;
+}
+
+// Returns the value of each character, and set valid to false if the vector contains
+// anything else than alphabet characters.
+WB_SSSE3 WB_INLINE
+__m128i _WBBase64DecodeTranslate128(__m128i in, UInt8 c62, UInt8 c63, bool *valid) {
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+  __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+  __m128i is62 = _mm_cmpeq_epi8(in, _mm_set1_epi8((char)c62));
+  __m128i is63 = _mm_cmpeq_epi8(in, _mm_set1_epi8((char)c63));
+  __m128i mask = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, is62)), is63);
+  *valid = _mm_movemask_epi8(mask) == 0xffff;
+
+  __m128i shift = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')), _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+  shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+  shift = _mm_or_si128(shift, _mm_and_si128(is62, _mm_set1_epi8((char)(62 - c62))));
+  shift = _mm_or_si128(shift, _mm_and_si128(is63, _mm_set1_epi8((char)(63 - c63))));
+  return _mm_add_epi8(in, shift);
+}
+
+// Pack 4 x 6 bits values into 3 bytes in each 32 bits word (lanes 0-11, 12-15 are zeroed).
+WB_SSSE3 WB_INLINE
+__m128i _WBBase64DecodePack128(__m128i values) {
+  __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+WB_SSSE3
+static CFIndex _WBBase64DecodeSSSE3(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, UInt8 c62, UInt8 c63) {
+  const UInt8 *start = src;
+  // Writes 16 bytes (last 4 are zero) to produce 12
+  while (srcLen >= 16 && destLen >= 16) {
+    bool valid;
+    __m128i values = _WBBase64DecodeTranslate128(_mm_loadu_si128((const __m128i *)src), c62, c63, &valid);
+    if (!valid)
+      break;
+    _mm_storeu_si128((__m128i *)dest, _WBBase64DecodePack128(values));
+    src += 16;
+    srcLen -= 16;
+    dest += 12;
+    destLen -= 12;
+  }
+  return src - start;
+}
+
+// The AVX2 loops only process the bulk of the input and clear the upper
+// halves of the registers (vzeroupper) before returning, so the SSSE3 kernel
+// that finishes the job does not pay the AVX to SSE transition penalty.
+WB_AVX2
+static CFIndex _WBBase64EncodeAVX2Loop(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, const char *charset) {
+  const UInt8 *start = src;
+  const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                           1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           (char)(charset[62] - 62), (char)(charset[63] - 63), 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           (char)(charset[62] - 62), (char)(charset[63] - 63), 'A', 0, 0);
+  // Reads 28 bytes (two overlapping 16 bytes loads) to consume 24
+  while (srcLen >= 28 && destLen >= 32) {
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)),
+                                         _mm_loadu_si128((const __m128i *)(src + 12)), 1);
+    in = _mm256_shuffle_epi8(in, shuffle);
+    __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+    __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(hi, lo);
+    __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    reduced = _mm256_or_si256(reduced, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+    _mm256_storeu_si256((__m256i *)dest, _mm256_add_epi8(_mm256_shuffle_epi8(offsets, reduced), indices));
+    src += 24;
+    srcLen -= 24;
+    dest += 32;
+    destLen -= 32;
+  }
+  _mm256_zeroupper();
+  return src - start;
+}
+
+WB_AVX2
+static CFIndex _WBBase64DecodeAVX2Loop(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, UInt8 c62, UInt8 c63) {
+  const UInt8 *start = src;
+  // Writes 32 bytes (last 8 are zero) to produce 24
+  while (srcLen >= 32 && destLen >= 32) {
+    __m256i in = _mm256_loadu_si256((const __m256i *)src);
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+    __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+    __m256i is62 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8((char)c62));
+    __m256i is63 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8((char)c63));
+    __m256i mask = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, is62)), is63);
+    if (_mm256_movemask_epi8(mask) != -1)
+      break;
+
+    __m256i shift = _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')), _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+    shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+    shift = _mm256_or_si256(shift, _mm256_and_si256(is62, _mm256_set1_epi8((char)(62 - c62))));
+    shift = _mm256_or_si256(shift, _mm256_and_si256(is63, _mm256_set1_epi8((char)(63 - c63))));
+
+    __m256i merged = _mm256_maddubs_epi16(_mm256_add_epi8(in, shift), _mm256_set1_epi32(0x01400140));
+    merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    merged = _mm256_shuffle_epi8(merged, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    // Move the 12 bytes of the high lane next to the low lane ones (word 3 is zero).
+    merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 3));
+    _mm256_storeu_si256((__m256i *)dest, merged);
+    src += 32;
+    srcLen -= 32;
+    dest += 24;
+    destLen -= 24;
+  }
+  _mm256_zeroupper();
+  return src - start;
+}
+
+// Below this length, the 256 bits loops do not pay for themselves, and the
+// SSSE3 kernel is used alone.
+enum {
+  kWBBase64AVX2EncodeThreshold = 128,
+  kWBBase64AVX2DecodeThreshold = 128,
+};
+
+static CFIndex _WBBase64EncodeAVX2(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, const char *charset) {
+  CFIndex consumed = 0;
+  if (srcLen >= kWBBase64AVX2EncodeThreshold)
+    consumed = _WBBase64EncodeAVX2Loop(src, srcLen, dest, destLen, charset);
+  // Finish with the 128 bits kernel
+  return consumed + _WBBase64EncodeSSSE3(src + consumed, srcLen - consumed, dest + consumed / 3 * 4, destLen - consumed / 3 * 4, charset);
+}
+
+static CFIndex _WBBase64DecodeAVX2(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, UInt8 c62, UInt8 c63) {
+  CFIndex consumed = 0;
+  if (srcLen >= kWBBase64AVX2DecodeThreshold)
+    consumed = _WBBase64DecodeAVX2Loop(src, srcLen, dest, destLen, c62, c63);
+  return consumed + _WBBase64DecodeSSSE3(src + consumed, srcLen - consumed, dest + consumed / 4 * 3, destLen - consumed / 4 * 3, c62, c63);
+}
+
+static const WBBase64VectorCodec _WBBase64SSSE3Codec = { "ssse3", _WBBase64EncodeSSSE3, _WBBase64DecodeSSSE3 };
+static const WBBase64VectorCodec _WBBase64AVX2Codec = { "avx2", _WBBase64EncodeAVX2, _WBBase64DecodeAVX2 };
+
+static bool _WBBase64CPUSupports(const char *feature) {
+#if defined(__APPLE__)
+  /* hw.optional.supplementalsse3, hw.optional.avx2_0 */
+  int value = 0;
+  size_t length = sizeof(value);
+  const char *name = (0 == strcmp(feature, "avx2")) ? "hw.optional.avx2_0" : "hw.optional.supplementalsse3";
+  return sysctlbyname(name, &value, &length, NULL, 0) == 0 && value;
+#else
+  return (0 == strcmp(feature, "avx2")) ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#elif defined(WB_BASE64_NEON)
+
+static CFIndex _WBBase64EncodeNEON(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, const char *charset) {
+  const UInt8 *start = src;
+  const uint8x16_t mask = vdupq_n_u8(0x3f);
+  uint8x16x4_t table;
+  table.val[0] = vld1q_u8((const uint8_t *)charset);
+  table.val[1] = vld1q_u8((const uint8_t *)charset + 16);
+  table.val[2] = vld1q_u8((const uint8_t *)charset + 32);
+  table.val[3] = vld1q_u8((const uint8_t *)charset + 48);
+  // 48 bytes -> 64 characters
+  while (srcLen >= 48 && destLen >= 64) {
+    uint8x16x3_t in = vld3q_u8(src);
+    uint8x16x4_t out;
+    out.val[0] = vshrq_n_u8(in.val[0], 2);
+    out.val[1] = vorrq_u8(vshrq_n_u8(in.val[1], 4), vandq_u8(vshlq_n_u8(in.val[0], 4), mask));
+    out.val[2] = vorrq_u8(vshrq_n_u8(in.val[2], 6), vandq_u8(vshlq_n_u8(in.val[1], 2), mask));
+    out.val[3] = vandq_u8(in.val[2], mask);
+    out.val[0] = vqtbl4q_u8(table, out.val[0]);
+    out.val[1] = vqtbl4q_u8(table, out.val[1]);
+    out.val[2] = vqtbl4q_u8(table, out.val[2]);
+    out.val[3] = vqtbl4q_u8(table, out.val[3]);
+    vst4q_u8(dest, out);
+    src += 48;
+    srcLen -= 48;
+    dest += 64;
+    destLen -= 64;
+  }
+  return src - start;
+}
+
+WB_INLINE
+uint8x16_t _WBBase64DecodeTranslateNEON(uint8x16_t in, UInt8 c62, UInt8 c63, uint8x16_t *valid) {
+  uint8x16_t upper = vcltq_u8(vsubq_u8(in, vdupq_n_u8('A')), vdupq_n_u8(26));
+  uint8x16_t lower = vcltq_u8(vsubq_u8(in, vdupq_n_u8('a')), vdupq_n_u8(26));
+  uint8x16_t digit = vcltq_u8(vsubq_u8(in, vdupq_n_u8('0')), vdupq_n_u8(10));
+  uint8x16_t is62 = vceqq_u8(in, vdupq_n_u8(c62));
+  uint8x16_t is63 = vceqq_u8(in, vdupq_n_u8(c63));
+  *valid = vandq_u8(*valid, vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, is62)), is63));
+
+  uint8x16_t shift = vorrq_u8(vandq_u8(upper, vdupq_n_u8((UInt8)-'A')), vandq_u8(lower, vdupq_n_u8((UInt8)(26 - 'a'))));
+  shift = vorrq_u8(shift, vandq_u8(digit, vdupq_n_u8((UInt8)(52 - '0'))));
+  shift = vorrq_u8(shift, vandq_u8(is62, vdupq_n_u8((UInt8)(62 - c62))));
+  shift = vorrq_u8(shift, vandq_u8(is63, vdupq_n_u8((UInt8)(63 - c63))));
+  return vaddq_u8(in, shift);
+}
+
+static CFIndex _WBBase64DecodeNEON(const UInt8 *src, CFIndex srcLen, UInt8 *dest, CFIndex destLen, UInt8 c62, UInt8 c63) {
+  const UInt8 *start = src;
+  // 64 characters -> 48 bytes
+  while (srcLen >= 64 && destLen >= 48) {
+    uint8x16x4_t in = vld4q_u8(src);
+    uint8x16_t valid = vdupq_n_u8(0xff);
+    in.val[0] = _WBBase64DecodeTranslateNEON(in.val[0], c62, c63, &valid);
+    in.val[1] = _WBBase64DecodeTranslateNEON(in.val[1], c62, c63, &valid);
+    in.val[2] = _WBBase64DecodeTranslateNEON(in.val[2], c62, c63, &valid);
+    in.val[3] = _WBBase64DecodeTranslateNEON(in.val[3], c62, c63, &valid);
+    if (vminvq_u8(valid) != 0xff)
+      break;
+
+    uint8x16x3_t out;
+    out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+    out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+    out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+    vst3q_u8(dest, out);
+    src += 64;
+    srcLen -= 64;
+    dest += 48;
+    destLen -= 48;
+  }
+  return src - start;
+}
+
+static const WBBase64VectorCodec _WBBase64NEONCodec = { "neon", _WBBase64EncodeNEON, _WBBase64DecodeNEON };
+
+#endif
+
+static bool sWBBase64VectorCodecEnabled = true;
+static const WBBase64VectorCodec *sWBBase64VectorCodec = NULL;
+static pthread_once_t sWBBase64VectorCodecOnce = PTHREAD_ONCE_INIT;
+
+static void _WBBase64SelectVectorCodec(void) {
+#if defined(WB_BASE64_X86)
+  if (_WBBase64CPUSupports("avx2"))
+    sWBBase64VectorCodec = &_WBBase64AVX2Codec;
+  else if (_WBBase64CPUSupports("ssse3"))
+    sWBBase64VectorCodec = &_WBBase64SSSE3Codec;
+#elif defined(WB_BASE64_NEON)
+  sWBBase64VectorCodec = &_WBBase64NEONCodec;
+#endif
+}
+
+WB_INLINE
+const WBBase64VectorCodec *_WBBase64GetVectorCodec(void) {
+  if (!sWBBase64VectorCodecEnabled)
+    return NULL;
+  pthread_once(&sWBBase64VectorCodecOnce, _WBBase64SelectVectorCodec);
+  return sWBBase64VectorCodec;
+}
+
+bool WBBase64SetVectorCodecEnabled(bool enabled) {
+  bool previous = sWBBase64VectorCodecEnabled;
+  sWBBase64VectorCodecEnabled = enabled;
+  return previous;
+}
+
+const char *WBBase64GetVectorCodecName(void) {
+  const WBBase64VectorCodec *codec = _WBBase64GetVectorCodec();
+  return codec ? codec->name : NULL;
+}
+
+#pragma mark -
+#if WB_BASE64_HAS_COREFOUNDATION
 static
 CFDataRef _WBBase64CreateDataByEncodingBytes(const void *bytes, CFIndex length,
-                                             const char *charset, bool padded);
+                                             const char *charset, bool padded, CFIndex lineLength);
 static
 CFDataRef _WBBase64CreateDataByDecodingBytes(const void *bytes, CFIndex length,
                                              const char *charset, bool requirePadding);
+#endif
 
 static
 CFIndex _WBBase64EncodeBytes(const char *srcBytes, CFIndex srcLen,
                              UInt8 *destBytes, CFIndex destLen,
                              const char *charset, bool padded);
 
+static
+CFIndex _WBBase64EncodeLines(const char *srcBytes, CFIndex srcLen,
+                             UInt8 *destBytes, CFIndex destLen,
+                             const char *charset, bool padded,
+                             CFIndex lineLength, CFIndex *column);
+
 static
 CFIndex _WBBase64DecodeBytes(const char *srcBytes, CFIndex srcLen,
                              UInt8 *destBytes, CFIndex destLen,
                              const char *charset, bool requirePadding);
 
 
+#if WB_BASE64_HAS_COREFOUNDATION
+
 //
 // Standard Base64 (RFC) handling
 //
@@ -232,7 +595,7 @@ CFDataRef WBBase64CreateDataByEncodingData(CFDataRef data) {
   if (!data) return NULL;
   return _WBBase64CreateDataByEncodingBytes(CFDataGetBytePtr(data),
                                             CFDataGetLength(data),
-                                            kBase64EncodeChars, true);
+                                            kBase64EncodeChars, true, 0);
 }
 
 CFDataRef WBBase64CreateDataByDecodingData(CFDataRef data) {
@@ -243,7 +606,18 @@ CFDataRef WBBase64CreateDataByDecodingData(CFDataRef data) {
 }
 
 CFDataRef WBBase64CreateDataByEncodingBytes(const void *bytes, CFIndex length) {
-  return _WBBase64CreateDataByEncodingBytes(bytes, length, kBase64EncodeChars, true);
+  return _WBBase64CreateDataByEncodingBytes(bytes, length, kBase64EncodeChars, true, 0);
+}
+
+CFDataRef WBBase64CreateDataByEncodingDataWithLineLength(CFDataRef data, CFIndex lineLength) {
+  if (!data) return NULL;
+  return _WBBase64CreateDataByEncodingBytes(CFDataGetBytePtr(data),
+                                            CFDataGetLength(data),
+                                            kBase64EncodeChars, true, lineLength);
+}
+
+CFDataRef WBBase64CreateDataByEncodingBytesWithLineLength(const void *bytes, CFIndex length, CFIndex lineLength) {
+  return _WBBase64CreateDataByEncodingBytes(bytes, length, kBase64EncodeChars, true, lineLength);
 }
 
 CFDataRef WBBase64CreateDataByDecodingBytes(const void *bytes, CFIndex length) {
@@ -255,7 +629,7 @@ CFStringRef WBBase64CreateStringByEncodingData(CFDataRef data) {
   CFStringRef result = NULL;
   CFDataRef converted = _WBBase64CreateDataByEncodingBytes(CFDataGetBytePtr(data),
                                                            CFDataGetLength(data),
-                                                           kBase64EncodeChars, true);
+                                                           kBase64EncodeChars, true, 0);
   if (converted) {
     result = CFStringCreateWithBytes(kCFAllocatorDefault, CFDataGetBytePtr(converted),
                                      CFDataGetLength(converted), kCFStringEncodingASCII, false);
@@ -267,7 +641,7 @@ CFStringRef WBBase64CreateStringByEncodingData(CFDataRef data) {
 CFStringRef WBBase64CreateStringByEncodingBytes(const void *bytes, CFIndex length) {
   CFStringRef result = nil;
   CFDataRef converted = _WBBase64CreateDataByEncodingBytes(bytes, length,
-                                                           kBase64EncodeChars, true);
+                                                           kBase64EncodeChars, true, 0);
   if (converted) {
     result = CFStringCreateWithBytes(kCFAllocatorDefault, CFDataGetBytePtr(converted),
                                      CFDataGetLength(converted), kCFStringEncodingASCII, false);
@@ -303,7 +677,7 @@ CFDataRef WBWSBase64CreateDataByEncodingData(CFDataRef data, bool padded) {
   if (!data) return NULL;
   return _WBBase64CreateDataByEncodingBytes(CFDataGetBytePtr(data),
                                             CFDataGetLength(data),
-                                            kWebSafeBase64EncodeChars, padded);
+                                            kWebSafeBase64EncodeChars, padded, 0);
 }
 
 CFDataRef WBWSBase64CreateDataByDecodingData(CFDataRef data) {
@@ -314,7 +688,7 @@ CFDataRef WBWSBase64CreateDataByDecodingData(CFDataRef data) {
 }
 
 CFDataRef WBWSBase64CreateDataByEncodingBytes(const void *bytes, CFIndex length, bool padded) {
-  return _WBBase64CreateDataByEncodingBytes(bytes, length, kWebSafeBase64EncodeChars, padded);
+  return _WBBase64CreateDataByEncodingBytes(bytes, length, kWebSafeBase64EncodeChars, padded, 0);
 }
 
 CFDataRef WBWSBase64CreateDataByDecodingBytes(const void *bytes, CFIndex length) {
@@ -326,7 +700,7 @@ CFStringRef WBWSBase64CreateStringByEncodingData(CFDataRef data, bool padded) {
   CFStringRef result = NULL;
   CFDataRef converted = _WBBase64CreateDataByEncodingBytes(CFDataGetBytePtr(data),
                                                            CFDataGetLength(data),
-                                                           kWebSafeBase64EncodeChars, padded);
+                                                           kWebSafeBase64EncodeChars, padded, 0);
   if (converted) {
     result = CFStringCreateWithBytes(kCFAllocatorDefault, CFDataGetBytePtr(converted),
                                      CFDataGetLength(converted), kCFStringEncodingASCII, false);
@@ -338,7 +712,7 @@ CFStringRef WBWSBase64CreateStringByEncodingData(CFDataRef data, bool padded) {
 CFStringRef WBWSBase64CreateStringByEncodingBytes(const void *bytes, CFIndex length, bool padded) {
   CFStringRef result = nil;
   CFDataRef converted = _WBBase64CreateDataByEncodingBytes(bytes, length,
-                                                           kWebSafeBase64EncodeChars, padded);
+                                                           kWebSafeBase64EncodeChars, padded, 0);
   if (converted) {
     result = CFStringCreateWithBytes(kCFAllocatorDefault, CFDataGetBytePtr(converted),
                                      CFDataGetLength(converted), kCFStringEncodingASCII, false);
@@ -361,8 +735,265 @@ CFDataRef WBWSBase64CreateDataByDecodingString(CFStringRef string) {
   return result;
 }
 
+#endif /* WB_BASE64_HAS_COREFOUNDATION */
+
+#pragma mark Buffers
+CFIndex WBBase64GetEncodedLength(CFIndex length, bool padded) {
+  return length > 0 ? CalcEncodedLength(length, padded, 0) : 0;
+}
+
+CFIndex WBBase64GetWrappedEncodedLength(CFIndex length, bool padded, CFIndex lineLength) {
+  if (length <= 0 || !IsValidLineLength(lineLength)) return 0;
+  return CalcEncodedLength(length, padded, lineLength);
+}
+
+CFIndex WBBase64GetMaxDecodedLength(CFIndex length) {
+  return length > 0 ? GuessDecodedLength(length) : 0;
+}
+
+CFIndex WBBase64EncodeToBuffer(const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength,
+                               WBBase64Charset charset, bool padded) {
+  if (length <= 0 || destLength < CalcEncodedLength(length, padded, 0))
+    return 0;
+  return _WBBase64EncodeBytes(bytes, length, dest, destLength,
+                              charset == kWBBase64CharsetWebSafe ? kWebSafeBase64EncodeChars : kBase64EncodeChars,
+                              padded);
+}
+
+CFIndex WBBase64EncodeToBufferWithLineLength(const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength,
+                                             WBBase64Charset charset, bool padded, CFIndex lineLength) {
+  if (length <= 0 || !IsValidLineLength(lineLength) || destLength < CalcEncodedLength(length, padded, lineLength))
+    return 0;
+  CFIndex column = 0;
+  return _WBBase64EncodeLines(bytes, length, dest, destLength,
+                              charset == kWBBase64CharsetWebSafe ? kWebSafeBase64EncodeChars : kBase64EncodeChars,
+                              padded, lineLength, &column);
+}
+
+CFIndex WBBase64DecodeToBuffer(const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength,
+                               WBBase64Charset charset, bool requirePadding) {
+  /* The decoder writes partial bytes ahead of the output */
+  if (length <= 0 || destLength < GuessDecodedLength(length))
+    return 0;
+  CFIndex result = _WBBase64DecodeBytes(bytes, length, dest, destLength,
+                                        charset == kWBBase64CharsetWebSafe ? kWebSafeBase64DecodeChars : kBase64DecodeChars,
+                                        requirePadding);
+  return result > 0 ? result : 0;
+}
+
+#pragma mark Streaming
+// Must fit in the 16 bytes of WBBase64Encoder, so the charset is stored as
+// a WBBase64Charset and not as a table pointer.
+typedef struct _WBPrivateBase64Encoder {
+  uint8_t charset;
+  bool padded;
+  uint8_t count;
+  UInt8 pending[3];
+  uint32_t lineLength;
+  uint32_t column; // characters written on the current line
+} WBPrivateBase64Encoder;
+
+WB_INLINE
+const char *_WBBase64EncoderCharset(const WBPrivateBase64Encoder *ctxt) {
+  return (ctxt->charset == kWBBase64CharsetWebSafe) ? kWebSafeBase64EncodeChars : kBase64EncodeChars;
+}
+
+enum {
+  kWBBase64DecoderData = 0,
+  kWBBase64DecoderPadding, // got '=' after 2 characters, expecting another one.
+  kWBBase64DecoderPadded, // only whitespace is allowed.
+  kWBBase64DecoderError,
+};
+
+typedef struct _WBPrivateBase64Decoder {
+  const char *charset;
+  bool requirePadding;
+  bool terminated; // NUL character found
+  uint8_t phase;
+  uint8_t state; // position in the current 4-characters quantum
+  UInt8 bits; // pending bits of the next byte
+} WBPrivateBase64Decoder;
+
+void WBBase64EncoderInit(WBBase64Encoder *c, WBBase64Charset charset, bool padded) {
+  static_assert(sizeof(*c) >= sizeof(WBPrivateBase64Encoder), "inconsistent declaration");
+  WBPrivateBase64Encoder *ctxt = (WBPrivateBase64Encoder *)c;
+  memset(ctxt, 0, sizeof(*ctxt));
+  ctxt->charset = (uint8_t)charset;
+  ctxt->padded = padded;
+}
+
+bool WBBase64EncoderSetLineLength(WBBase64Encoder *c, CFIndex lineLength) {
+  WBPrivateBase64Encoder *ctxt = (WBPrivateBase64Encoder *)c;
+  if (!IsValidLineLength(lineLength) || lineLength > UINT32_MAX) return false;
+  ctxt->lineLength = (uint32_t)lineLength;
+  return true;
+}
+
+CFIndex WBBase64EncoderUpdate(WBBase64Encoder *c, const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength) {
+  WBPrivateBase64Encoder *ctxt = (WBPrivateBase64Encoder *)c;
+  if (length < 0 || (length > 0 && !bytes)) return -1;
+  CFIndex maxLength = (ctxt->count + length) / 3 * 4;
+  if (ctxt->lineLength > 0)
+    maxLength += (maxLength / ctxt->lineLength + 1) * 2;
+  if (destLength < maxLength) return -1;
+
+  CFIndex written = 0;
+  CFIndex column = ctxt->column;
+  const UInt8 *src = bytes;
+  /* complete the pending block first */
+  if (ctxt->count > 0) {
+    while (ctxt->count < 3 && length > 0) {
+      ctxt->pending[ctxt->count++] = *src++;
+      length--;
+    }
+    if (ctxt->count < 3)
+      return 0;
+    written = _WBBase64EncodeLines((const char *)ctxt->pending, 3, dest, destLength,
+                                   _WBBase64EncoderCharset(ctxt), false, ctxt->lineLength, &column);
+    ctxt->count = 0;
+  }
+  /* whole blocks */
+  CFIndex blocks = length / 3 * 3;
+  if (blocks > 0) {
+    written += _WBBase64EncodeLines((const char *)src, blocks, dest + written, destLength - written,
+                                    _WBBase64EncoderCharset(ctxt), false, ctxt->lineLength, &column);
+    src += blocks;
+    length -= blocks;
+  }
+  /* and keep the tail for later */
+  while (length-- > 0)
+    ctxt->pending[ctxt->count++] = *src++;
+
+  ctxt->column = (uint32_t)column;
+  return written;
+}
+
+CFIndex WBBase64EncoderFinal(WBBase64Encoder *c, UInt8 *dest, CFIndex destLength) {
+  WBPrivateBase64Encoder *ctxt = (WBPrivateBase64Encoder *)c;
+  if (0 == ctxt->count) return 0;
+  if (destLength < CalcEncodedLength(ctxt->count, ctxt->padded, 0) + (ctxt->lineLength > 0 ? 2 : 0)) return -1;
+  CFIndex column = ctxt->column;
+  CFIndex written = _WBBase64EncodeLines((const char *)ctxt->pending, ctxt->count, dest, destLength,
+                                         _WBBase64EncoderCharset(ctxt), ctxt->padded, ctxt->lineLength, &column);
+  ctxt->column = (uint32_t)column;
+  ctxt->count = 0;
+  return written;
+}
+
+void WBBase64DecoderInit(WBBase64Decoder *c, WBBase64Charset charset, bool requirePadding) {
+  static_assert(sizeof(*c) >= sizeof(WBPrivateBase64Decoder), "inconsistent declaration");
+  WBPrivateBase64Decoder *ctxt = (WBPrivateBase64Decoder *)c;
+  memset(ctxt, 0, sizeof(*ctxt));
+  ctxt->charset = (charset == kWBBase64CharsetWebSafe) ? kWebSafeBase64DecodeChars : kBase64DecodeChars;
+  ctxt->requirePadding = requirePadding;
+}
+
+CFIndex WBBase64DecoderUpdate(WBBase64Decoder *c, const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength) {
+  WBPrivateBase64Decoder *ctxt = (WBPrivateBase64Decoder *)c;
+  if (length < 0 || (length > 0 && !bytes) || ctxt->phase == kWBBase64DecoderError) return -1;
+  if (destLength < GuessDecodedLength(length)) return -1;
+
+  CFIndex destIndex = 0;
+  const UInt8 *src = bytes;
+  const UInt8 *end = src + length;
+  const char *charset = ctxt->charset;
+  const WBBase64VectorCodec *codec = _WBBase64GetVectorCodec();
+  const UInt8 c62 = (charset == kWebSafeBase64DecodeChars) ? '-' : '+';
+  const UInt8 c63 = (charset == kWebSafeBase64DecodeChars) ? '_' : '/';
+  while (src < end && !ctxt->terminated) {
+    if (codec && ctxt->state == 0 && ctxt->phase == kWBBase64DecoderData) {
+      CFIndex consumed = codec->decode(src, end - src, dest + destIndex, destLength - destIndex, c62, c63);
+      src += consumed;
+      destIndex += consumed / 4 * 3;
+      if (src == end)
+        break;
+    }
+
+    UInt8 ch = *src++;
+    switch (ctxt->phase) {
+      case kWBBase64DecoderData: {
+        if (0 == ch) {
+          ctxt->terminated = true;
+          break;
+        }
+        if (IsSpace(ch))
+          break;
+        if (ch == kBase64PaddingChar) {
+          // Invalid '=' in first or second position
+          if (ctxt->state < 2)
+            ctxt->phase = kWBBase64DecoderError;
+          else
+            ctxt->phase = (ctxt->state == 2) ? kWBBase64DecoderPadding : kWBBase64DecoderPadded;
+          break;
+        }
+        int decode = charset[ch];
+        if (decode == kBase64InvalidChar) {
+          ctxt->phase = kWBBase64DecoderError;
+          break;
+        }
+        // Same state machine than _WBBase64DecodeBytes(), except that
+        // the partial byte is kept in the context.
+        switch (ctxt->state) {
+          case 0:
+            ctxt->bits = (UInt8)(decode << 2);
+            ctxt->state = 1;
+            break;
+          case 1:
+            dest[destIndex++] = ctxt->bits | (UInt8)(decode >> 4);
+            ctxt->bits = (UInt8)((decode & 0x0f) << 4);
+            ctxt->state = 2;
+            break;
+          case 2:
+            dest[destIndex++] = ctxt->bits | (UInt8)(decode >> 2);
+            ctxt->bits = (UInt8)((decode & 0x03) << 6);
+            ctxt->state = 3;
+            break;
+          case 3:
+            dest[destIndex++] = ctxt->bits | (UInt8)decode;
+            ctxt->bits = 0;
+            ctxt->state = 0;
+            break;
+        }
+      }
+        break;
+      case kWBBase64DecoderPadding:
+        if (ch == kBase64PaddingChar)
+          ctxt->phase = kWBBase64DecoderPadded;
+        else if (!IsSpace(ch))
+          ctxt->phase = kWBBase64DecoderError;
+        break;
+      case kWBBase64DecoderPadded:
+        if (0 == ch)
+          ctxt->terminated = true;
+        else if (!IsSpace(ch))
+          ctxt->phase = kWBBase64DecoderError;
+        break;
+    }
+    if (ctxt->phase == kWBBase64DecoderError)
+      return -1;
+  }
+  return destIndex;
+}
+
+bool WBBase64DecoderFinal(WBBase64Decoder *c) {
+  WBPrivateBase64Decoder *ctxt = (WBPrivateBase64Decoder *)c;
+  switch (ctxt->phase) {
+    case kWBBase64DecoderData:
+      // Without padding, states 2 and 3 are okay when it is not required.
+      if (ctxt->requirePadding ? ctxt->state != 0 : ctxt->state == 1)
+        return false;
+      break;
+    case kWBBase64DecoderPadded:
+      break;
+    default:
+      return false;
+  }
+  // Reject carefully crafted input with trailing bits past the real length.
+  return ctxt->bits == 0;
+}
 
 #pragma mark -
+#if WB_BASE64_HAS_COREFOUNDATION
 //
 // baseEncode:length:charset:padded:
 //
@@ -375,17 +1006,19 @@ CFDataRef WBWSBase64CreateDataByDecodingString(CFStringRef string) {
 //   an autorelease NSData with the encoded data, nil if any error.
 //
 CFDataRef _WBBase64CreateDataByEncodingBytes(const void *bytes, CFIndex length,
-                                             const char *charset, bool padded) {
+                                             const char *charset, bool padded, CFIndex lineLength) {
+  if (!IsValidLineLength(lineLength)) return NULL;
   // how big could it be?
-  CFIndex maxLength = CalcEncodedLength(length, padded);
+  CFIndex maxLength = CalcEncodedLength(length, padded, lineLength);
   // make space
   CFMutableDataRef result = CFDataCreateMutable(kCFAllocatorDefault, maxLength);
   CFDataSetLength(result, maxLength);
   // do it
-  CFIndex finalLength = _WBBase64EncodeBytes(bytes, length,
+  CFIndex column = 0;
+  CFIndex finalLength = _WBBase64EncodeLines(bytes, length,
                                              CFDataGetMutableBytePtr(result),
                                              CFDataGetLength(result),
-                                             charset, padded);
+                                             charset, padded, lineLength, &column);
   if (finalLength) {
     spx_assert(finalLength == maxLength, "how did we calc the length wrong?");
   } else {
@@ -419,7 +1052,7 @@ CFDataRef _WBBase64CreateDataByDecodingBytes(const void *bytes, CFIndex length,
                                              CFDataGetMutableBytePtr(result),
                                              CFDataGetLength(result),
                                              charset, requirePadding);
-  if (finalLength) {
+  if (finalLength >= 0) {
     if (finalLength != maxLength) {
       // resize down to how big it was
       CFDataSetLength(result, finalLength);
@@ -431,6 +1064,7 @@ CFDataRef _WBBase64CreateDataByDecodingBytes(const void *bytes, CFIndex length,
   }
   return result;
 }
+#endif /* WB_BASE64_HAS_COREFOUNDATION */
 
 //
 // baseEncode:srcLen:destBytes:destLen:charset:padded:
@@ -453,6 +1087,16 @@ CFIndex _WBBase64EncodeBytes(const char *srcBytes, CFIndex srcLen,
   UInt8 *curDest = destBytes;
   const unsigned char *curSrc = (const unsigned char *)(srcBytes);
 
+  // Bulk of the work using the vector unit if available
+  const WBBase64VectorCodec *codec = _WBBase64GetVectorCodec();
+  if (codec) {
+    CFIndex consumed = codec->encode(curSrc, srcLen, curDest, destLen, charset);
+    curSrc += consumed;
+    srcLen -= consumed;
+    curDest += consumed / 3 * 4;
+    destLen -= consumed / 3 * 4;
+  }
+
   // Three bytes of data encodes to four characters of cyphertext.
   // So we can pump through three-byte chunks atomically.
   while (srcLen > 2) {
@@ -511,27 +1155,87 @@ CFIndex _WBBase64EncodeBytes(const char *srcBytes, CFIndex srcLen,
   return (curDest - destBytes);
 }
 
+//
+// baseEncode:srcLen:destBytes:destLen:charset:padded:lineLength:column:
+//
+// Encodes the buffer, inserting a CRLF each |lineLength| characters while
+// encoding, so the output does not have to be copied again to wrap it. No
+// line break is written after the last line. |column| is the number of
+// characters already written on the current line, and is updated, so the
+// streaming encoder can carry it across calls.
+//
+// Returns:
+//   the length of the encoded data (with line breaks).  zero if any error.
+//
+CFIndex _WBBase64EncodeLines(const char *srcBytes, CFIndex srcLen,
+                             UInt8 *destBytes, CFIndex destLen,
+                             const char *charset, bool padded,
+                             CFIndex lineLength, CFIndex *column) {
+  if (lineLength <= 0)
+    return _WBBase64EncodeBytes(srcBytes, srcLen, destBytes, destLen, charset, padded);
+
+  CFIndex written = 0;
+  while (srcLen > 0) {
+    if (*column >= lineLength) {
+      if (destLen - written < 2)
+        return 0;
+      destBytes[written++] = '\r';
+      destBytes[written++] = '\n';
+      *column = 0;
+    }
+    // whole quanta until the end of the line. Only the last chunk
+    // may be partial, and so padded.
+    CFIndex chunk = (lineLength - *column) / 4 * 3;
+    if (chunk > srcLen)
+      chunk = srcLen;
+    CFIndex count = _WBBase64EncodeBytes(srcBytes, chunk, destBytes + written, destLen - written, charset, padded);
+    if (!count)
+      return 0;
+    srcBytes += chunk;
+    srcLen -= chunk;
+    written += count;
+    *column += count;
+  }
+  return written;
+}
+
 //
 // baseDecode:srcLen:destBytes:destLen:charset:requirePadding:
 //
 // Decodes the buffer into the larger.  returns the length of the decoded
-// data, or zero for an error.
+// data, or -1 for an error.
 // |charset| is the character decoding buffer to use
 //
 // Returns:
-//   the length of the encoded data.  zero if any error.
+//   the length of the decoded data (zero if the input only contains
+//   whitespace).  -1 if any error.
 //
 CFIndex _WBBase64DecodeBytes(const char *srcBytes, CFIndex srcLen,
                              UInt8 *destBytes, CFIndex destLen,
                              const char *charset, bool requirePadding) {
   if (!srcLen || !destLen || !srcBytes || !destBytes) {
-    return 0;
+    return -1;
   }
 
   int decode;
   CFIndex destIndex = 0;
   int state = 0;
   char ch = 0;
+
+  // The vector kernel handles runs of whole blocks. It is called each time
+  // we are at a block boundary, and the scalar loop takes care of whitespace,
+  // padding and errors.
+  UInt8 c62 = 0, c63 = 0;
+  const WBBase64VectorCodec *codec = _WBBase64GetVectorCodec();
+  if (codec) {
+    c62 = (charset == kWebSafeBase64DecodeChars) ? '-' : '+';
+    c63 = (charset == kWebSafeBase64DecodeChars) ? '_' : '/';
+    CFIndex consumed = codec->decode((const UInt8 *)srcBytes, srcLen, destBytes, destLen, c62, c63);
+    srcBytes += consumed;
+    srcLen -= consumed;
+    destIndex += consumed / 4 * 3;
+  }
+
   while (srcLen-- && (ch = *srcBytes++) != 0)  {
     if (IsSpace(ch))  // Skip whitespace
       continue;
@@ -539,9 +1243,9 @@ CFIndex _WBBase64DecodeBytes(const char *srcBytes, CFIndex srcLen,
     if (ch == kBase64PaddingChar)
       break;
 
-    decode = charset[(unsigned int)ch];
+    decode = charset[(unsigned char)ch];
     if (decode == kBase64InvalidChar)
-      return 0;
+      return -1;
 
     // Four cyphertext characters decode to three bytes.
     // Therefore we can be in one of four states.
@@ -585,6 +1289,12 @@ CFIndex _WBBase64DecodeBytes(const char *srcBytes, CFIndex srcLen,
         destBytes[destIndex] |= decode;
         destIndex++;
         state = 0;
+        if (codec) {
+          CFIndex consumed = codec->decode((const UInt8 *)srcBytes, srcLen, destBytes + destIndex, destLen - destIndex, c62, c63);
+          srcBytes += consumed;
+          srcLen -= consumed;
+          destIndex += consumed / 4 * 3;
+        }
         break;
     }
   }
@@ -593,27 +1303,27 @@ CFIndex _WBBase64DecodeBytes(const char *srcBytes, CFIndex srcLen,
   //      on a byte boundary, and/or with erroneous trailing characters.
   if (ch == kBase64PaddingChar) {               // We got a pad char
     if ((state == 0) || (state == 1)) {
-      return 0;  // Invalid '=' in first or second position
+      return -1;  // Invalid '=' in first or second position
     }
     if (srcLen == 0) {
       if (state == 2) { // We run out of input but we still need another '='
-        return 0;
+        return -1;
       }
       // Otherwise, we are in state 3 and only need this '='
     } else {
       if (state == 2) {  // need another '='
-        while ((ch = *srcBytes++) && (srcLen-- > 0)) {
+        while ((srcLen-- > 0) && (ch = *srcBytes++)) {
           if (!IsSpace(ch))
             break;
         }
         if (ch != kBase64PaddingChar) {
-          return 0;
+          return -1;
         }
       }
       // state = 1 or 2, check if all remain padding is space
-      while ((ch = *srcBytes++) && (srcLen-- > 0)) {
+      while ((srcLen-- > 0) && (ch = *srcBytes++)) {
         if (!IsSpace(ch)) {
-          return 0;
+          return -1;
         }
       }
     }
@@ -623,13 +1333,13 @@ CFIndex _WBBase64DecodeBytes(const char *srcBytes, CFIndex srcLen,
     if (requirePadding) {
       // If we require padding, then anything but state 0 is an error.
       if (state != 0) {
-        return 0;
+        return -1;
       }
     } else {
       // Make sure we have no partial bytes lying around.  Note that we do not
       // require trailing '=', so states 2 and 3 are okay too.
       if (state == 1) {
-        return 0;
+        return -1;
       }
     }
   }
@@ -637,9 +1347,11 @@ CFIndex _WBBase64DecodeBytes(const char *srcBytes, CFIndex srcLen,
   // If then next piece of output was valid and got written to it means we got a
   // very carefully crafted input that appeared valid but contains some trailing
   // bits past the real length, so just toss the thing.
-  if ((destIndex < destLen) &&
+  // Note: in state 0, nothing was written past destIndex (and the buffer may
+  // be provided by the caller, so it does not have to be zeroed).
+  if ((state != 0) && (destIndex < destLen) &&
       (destBytes[destIndex] != 0)) {
-    return 0;
+    return -1;
   }
 
   return destIndex;
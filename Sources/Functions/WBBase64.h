@@ -11,9 +11,31 @@
 #if !defined (__WB_BASE64_H)
 #define __WB_BASE64_H 1
 
-#include <WonderBox/WBBase.h>
+#if __has_include(<WonderBox/WBBase.h>)
+#  include <WonderBox/WBBase.h>
+#else
+#  include "../WBBase.h"
+#endif
 
-#include <CoreFoundation/CoreFoundation.h>
+// The CFData and CFString functions are only available with CoreFoundation.
+// Without it (plain C toolchains, used by the benchmark and fuzz targets),
+// only the buffer and streaming API are compiled.
+#if !defined(WB_BASE64_HAS_COREFOUNDATION)
+#  if defined(__APPLE__) || __has_include(<CoreFoundation/CoreFoundation.h>)
+#    define WB_BASE64_HAS_COREFOUNDATION 1
+#  else
+#    define WB_BASE64_HAS_COREFOUNDATION 0
+#  endif
+#endif
+
+#if WB_BASE64_HAS_COREFOUNDATION
+#  include <CoreFoundation/CoreFoundation.h>
+#else
+#  include <stdint.h>
+#  include <stdbool.h>
+typedef long CFIndex;
+typedef uint8_t UInt8;
+#endif
 
 // WBBase64
 //
@@ -25,6 +47,43 @@
 /// encoding.  You must use the webSafe* methods together, the data does not
 /// interop with the RFC methods.
 
+//
+// Vectorized codec
+//
+// Encoding and decoding use SSSE3/AVX2 (x86) or NEON (arm64) when the CPU
+// supports it. The scalar codec is always used for whitespace, padding and
+// error handling, and produces the exact same results.
+//
+
+// setVectorCodecEnabled:
+//
+/// Enables or disables the vectorized codec. It is enabled by default, and
+/// disabling it is mostly useful to compare against the reference scalar codec.
+//
+/// Returns:
+///   The previous setting.
+//
+WB_EXPORT
+bool WBBase64SetVectorCodecEnabled(bool enabled);
+
+// vectorCodecName
+//
+/// Returns:
+///   The name of the vectorized codec in use ("avx2", "ssse3", "neon"), or
+///   NULL if the scalar codec is used.
+//
+WB_EXPORT
+const char *WBBase64GetVectorCodecName(void);
+
+/// Character set used by the buffer and streaming functions.
+enum {
+  kWBBase64CharsetRFC = 0,
+  kWBBase64CharsetWebSafe = 1,
+};
+typedef uint32_t WBBase64Charset;
+
+#if WB_BASE64_HAS_COREFOUNDATION
+
 //
 // Standard Base64 (RFC) handling
 //
@@ -61,7 +120,8 @@ CFDataRef WBBase64CreateDataByEncodingBytes(const void *bytes, CFIndex length);
 
 // decodeBytes:length:
 //
-/// Base64 decodes the data pointed at by |bytes|.
+/// Base64 decodes the data pointed at by |bytes|. Input that only contains
+/// whitespace decodes to an empty NSData, like with WBBase64DecoderUpdate().
 //
 /// Returns:
 ///   A new autoreleased NSData with the encoded payload.  nil for any error.
@@ -69,6 +129,29 @@ CFDataRef WBBase64CreateDataByEncodingBytes(const void *bytes, CFIndex length);
 WB_EXPORT
 CFDataRef WBBase64CreateDataByDecodingBytes(const void *bytes, CFIndex length);
 
+// encodeData:lineLength:
+//
+/// Base64 encodes contents of the NSData object, inserting a CRLF every
+/// |lineLength| characters (76 for MIME, 64 for PEM).  |lineLength| must be a
+/// multiple of 4, 0 meaning no line break.
+//
+/// Returns:
+///   A new autoreleased NSData with the encoded payload.  nil for any error.
+//
+WB_EXPORT
+CFDataRef WBBase64CreateDataByEncodingDataWithLineLength(CFDataRef data, CFIndex lineLength);
+
+// encodeBytes:length:lineLength:
+//
+/// Base64 encodes the data pointed at by |bytes|, inserting a CRLF every
+/// |lineLength| characters.  |lineLength| must be a multiple of 4.
+//
+/// Returns:
+///   A new autoreleased NSData with the encoded payload.  nil for any error.
+//
+WB_EXPORT
+CFDataRef WBBase64CreateDataByEncodingBytesWithLineLength(const void *bytes, CFIndex length, CFIndex lineLength);
+
 // stringByEncodingData:
 //
 /// Base64 encodes contents of the NSData object.
@@ -183,4 +266,169 @@ CFStringRef WBWSBase64CreateStringByEncodingBytes(const void *bytes, CFIndex len
 WB_EXPORT
 CFDataRef WBWSBase64CreateDataByDecodingString(CFStringRef string);
 
+#endif /* WB_BASE64_HAS_COREFOUNDATION */
+
+#pragma mark Buffers
+//
+// Encoding into caller provided memory (stack, arena, ...), without any
+// CoreFoundation allocation.
+//
+
+// encodedLength:padded:
+//
+/// Returns:
+///   The exact length of |length| bytes once encoded.
+//
+WB_EXPORT
+CFIndex WBBase64GetEncodedLength(CFIndex length, bool padded);
+
+// encodedLength:padded:lineLength:
+//
+/// Returns:
+///   The exact length of |length| bytes once encoded with a CRLF every
+///   |lineLength| characters (except after the last line).  zero if |lineLength|
+///   is not a multiple of 4.
+//
+WB_EXPORT
+CFIndex WBBase64GetWrappedEncodedLength(CFIndex length, bool padded, CFIndex lineLength);
+
+// maxDecodedLength:
+//
+/// The actual length depends on whitespace and padding in the input.
+//
+/// Returns:
+///   The buffer size required to decode |length| characters.
+//
+WB_EXPORT
+CFIndex WBBase64GetMaxDecodedLength(CFIndex length);
+
+// encodeToBuffer:length:dest:destLength:charset:padded:
+//
+/// Encodes |length| bytes into |dest|, which must be at least
+/// WBBase64GetEncodedLength(length, padded) bytes long.
+//
+/// Returns:
+///   The number of characters written.  zero for any error.
+//
+WB_EXPORT
+CFIndex WBBase64EncodeToBuffer(const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength,
+                               WBBase64Charset charset, bool padded);
+
+// encodeToBuffer:length:dest:destLength:charset:padded:lineLength:
+//
+/// Encodes |length| bytes into |dest| and inserts a CRLF every |lineLength|
+/// characters in the same pass. |dest| must be at least
+/// WBBase64GetWrappedEncodedLength(length, padded, lineLength) bytes long.
+//
+/// Returns:
+///   The number of characters written.  zero for any error.
+//
+WB_EXPORT
+CFIndex WBBase64EncodeToBufferWithLineLength(const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength,
+                                             WBBase64Charset charset, bool padded, CFIndex lineLength);
+
+// decodeToBuffer:length:dest:destLength:charset:requirePadding:
+//
+/// Decodes |length| characters into |dest|, which must be at least
+/// WBBase64GetMaxDecodedLength(length) bytes long. Bytes past the returned
+/// length may be overwritten.
+//
+/// Returns:
+///   The number of bytes written.  zero for any error, or if the input only
+///   contains whitespace.
+//
+WB_EXPORT
+CFIndex WBBase64DecodeToBuffer(const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength,
+                               WBBase64Charset charset, bool requirePadding);
+
+#pragma mark Streaming
+//
+// Incremental encoding and decoding.
+//
+// The contexts carry the 0-2 leftover bytes (or 1-3 leftover characters)
+// across calls and write into caller provided buffers, so arbitrary large
+// payloads can be processed in constant memory (for instance from a read()
+// loop or a CFReadStream).
+// The decoder accepts the same input as the one-shot functions: whitespace
+// is ignored, a NUL character ends the input, and trailing bits must be zero.
+//
+
+typedef struct _WBBase64Encoder {
+  char opaque[16];
+} WBBase64Encoder;
+
+typedef struct _WBBase64Decoder {
+  char opaque[16];
+} WBBase64Decoder;
+
+// encoderInit:charset:padded:
+//
+/// Initializes an encoding context. If |padded| is true, padding characters
+/// are added by WBBase64EncoderFinal() so the result length is a multiple of 4.
+//
+WB_EXPORT
+void WBBase64EncoderInit(WBBase64Encoder *ctxt, WBBase64Charset charset, bool padded);
+
+// encoderSetLineLength:
+//
+/// Inserts a CRLF every |lineLength| characters of output, across calls.
+/// |lineLength| must be a multiple of 4, and 0 (the default) disables it.
+/// The Update and Final functions then need 2 more bytes per line in |dest|.
+//
+/// Returns:
+///   false if |lineLength| is invalid.
+//
+WB_EXPORT
+bool WBBase64EncoderSetLineLength(WBBase64Encoder *ctxt, CFIndex lineLength);
+
+// encoderUpdate:bytes:length:dest:destLength:
+//
+/// Encodes |length| bytes. |dest| must be at least ((length + 2) / 3) * 4 bytes long.
+//
+/// Returns:
+///   The number of characters written in |dest|.  -1 for any error.
+//
+WB_EXPORT
+CFIndex WBBase64EncoderUpdate(WBBase64Encoder *ctxt, const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength);
+
+// encoderFinal:dest:destLength:
+//
+/// Flushes the leftover bytes. |dest| must be at least 4 bytes long.
+//
+/// Returns:
+///   The number of characters written in |dest|.  -1 for any error.
+//
+WB_EXPORT
+CFIndex WBBase64EncoderFinal(WBBase64Encoder *ctxt, UInt8 *dest, CFIndex destLength);
+
+// decoderInit:charset:requirePadding:
+//
+/// Initializes a decoding context. The one-shot RFC decoders require padding
+/// and the web safe ones do not.
+//
+WB_EXPORT
+void WBBase64DecoderInit(WBBase64Decoder *ctxt, WBBase64Charset charset, bool requirePadding);
+
+// decoderUpdate:bytes:length:dest:destLength:
+//
+/// Decodes |length| characters. |dest| must be at least ((length + 3) / 4) * 3 bytes long.
+/// Once an error occured, all subsequent calls fail.
+//
+/// Returns:
+///   The number of bytes written in |dest|.  -1 for any error.
+//
+WB_EXPORT
+CFIndex WBBase64DecoderUpdate(WBBase64Decoder *ctxt, const void *bytes, CFIndex length, UInt8 *dest, CFIndex destLength);
+
+// decoderFinal:
+//
+/// Checks that the input ended on a valid boundary. As complete bytes are
+/// written by WBBase64DecoderUpdate(), this function never output anything.
+//
+/// Returns:
+///   true if the whole input was valid.
+//
+WB_EXPORT
+bool WBBase64DecoderFinal(WBBase64Decoder *ctxt);
+
 #endif /* __WB_BASE64_H */
@@ -10,55 +10,310 @@
 
 #include <WonderBox/WBTextFunctions.h>
 
-CFIndex WBTextGetCountOfLines(CFStringRef str) {
-  CFIndex lines = 0;
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-  CFIndex stringLength = CFStringGetLength(str);
-  for (CFIndex idx = 0; idx < stringLength; lines++)
-    CFStringGetLineBounds(str, CFRangeMake(idx, 0), NULL, &idx, NULL);
+#if defined(__x86_64__) || defined(__i386__)
+#  include <emmintrin.h>
+#  define WB_TEXT_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define WB_TEXT_NEON 1
+#endif
 
-  return lines;
-}
+// Line breaks are CR, LF, CR LF, LINE SEPARATOR and PARAGRAPH SEPARATOR.
+// CFStringGetLineBounds() also ends lines on NEXT LINE (U+0085), so the line
+// counter does, but WBTextConvertLineEnding() never did and still does not.
+//
+// The scanners count each CR and LF, and the CR LF pairs separately, so a
+// vector never has to look at its neighbours except for the pairs.
 
-CFIndex WBTextConvertLineEnding(CFMutableStringRef str, CFStringRef endOfLine) {
-  CFIndex position = 0, idx = 0, count = 0;
+enum {
+  kWBNextLineCharacter = 0x0085,
+  /* characters per chunk, when the string storage is not directly accessible */
+  kWBTextChunkLength = 1024,
+};
 
-  CFIndex eol = CFStringGetLength(endOfLine);
-  CFIndex length = CFStringGetLength(str);
+#pragma mark UTF-16 Scanner
+WB_INLINE
+bool _WBTextIsBreakUTF16(UniChar ch, bool nel) {
+  return kWBNewlineCharacter == ch || kWBCarriageReturnCharacter == ch || (ch & 0xfffe) == kWBLineSeparatorCharacter ||
+    (nel && kWBNextLineCharacter == ch);
+}
 
-  UniChar ch;
-  CFStringInlineBuffer buffer;
-  CFStringInitInlineBuffer(str, &buffer, CFRangeMake(0, length));
-
-  while ((ch = CFStringGetCharacterFromInlineBuffer(&buffer, idx))) {
-    CFRange range = CFRangeMake(kCFNotFound, 0);
-    if (kWBCarriageReturnCharacter == ch) {
-      range.length = 1;
-      range.location = idx;
-      ch = CFStringGetCharacterFromInlineBuffer(&buffer, idx + 1);
-      if (kWBNewlineCharacter == ch) {
-        idx++;
-        range.length = 2;
-      }
-    } else if (kWBNewlineCharacter == ch || kWBLineSeparatorCharacter == ch || kWBParagraphSeparatorCharacter == ch) {
-      range.length = 1;
-      range.location = idx;
+#if defined(WB_TEXT_SSE2)
+WB_INLINE
+__m128i _WBTextBreakMaskUTF16(__m128i chars, bool nel) {
+  __m128i mask = _mm_or_si128(_mm_cmpeq_epi16(chars, _mm_set1_epi16(kWBNewlineCharacter)),
+                              _mm_cmpeq_epi16(chars, _mm_set1_epi16(kWBCarriageReturnCharacter)));
+  /* 0x2028 and 0x2029 */
+  mask = _mm_or_si128(mask, _mm_cmpeq_epi16(_mm_and_si128(chars, _mm_set1_epi16((short)0xfffe)), _mm_set1_epi16(kWBLineSeparatorCharacter)));
+  if (nel)
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi16(chars, _mm_set1_epi16(kWBNextLineCharacter)));
+  return mask;
+}
+#elif defined(WB_TEXT_NEON)
+WB_INLINE
+uint16x8_t _WBTextBreakMaskUTF16(uint16x8_t chars, bool nel) {
+  uint16x8_t mask = vorrq_u16(vceqq_u16(chars, vdupq_n_u16(kWBNewlineCharacter)),
+                              vceqq_u16(chars, vdupq_n_u16(kWBCarriageReturnCharacter)));
+  mask = vorrq_u16(mask, vceqq_u16(vandq_u16(chars, vdupq_n_u16(0xfffe)), vdupq_n_u16(kWBLineSeparatorCharacter)));
+  if (nel)
+    mask = vorrq_u16(mask, vceqq_u16(chars, vdupq_n_u16(kWBNextLineCharacter)));
+  return mask;
+}
+#endif
+
+/* Number of break characters (CR and LF counted separately), and number of CR LF pairs */
+static CFIndex _WBTextCountBreaksUTF16(const UniChar *chars, CFIndex length, bool nel, CFIndex *pairs) {
+  CFIndex idx = 0, count = 0, crlf = 0;
+#if defined(WB_TEXT_SSE2)
+  for (; idx + 9 <= length; idx += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(chars + idx));
+    int mask = _mm_movemask_epi8(_WBTextBreakMaskUTF16(v, nel));
+    if (mask) {
+      count += __builtin_popcount(mask) / 2;
+      __m128i next = _mm_loadu_si128((const __m128i *)(chars + idx + 1));
+      __m128i pair = _mm_and_si128(_mm_cmpeq_epi16(v, _mm_set1_epi16(kWBCarriageReturnCharacter)),
+                                   _mm_cmpeq_epi16(next, _mm_set1_epi16(kWBNewlineCharacter)));
+      crlf += __builtin_popcount(_mm_movemask_epi8(pair)) / 2;
     }
-    idx++;
-    if (range.location != kCFNotFound) {
+  }
+#elif defined(WB_TEXT_NEON)
+  for (; idx + 9 <= length; idx += 8) {
+    uint16x8_t v = vld1q_u16(chars + idx);
+    uint16x8_t mask = _WBTextBreakMaskUTF16(v, nel);
+    if (vmaxvq_u16(mask)) {
+      count += vaddvq_u16(vshrq_n_u16(mask, 15));
+      uint16x8_t pair = vandq_u16(vceqq_u16(v, vdupq_n_u16(kWBCarriageReturnCharacter)),
+                                  vceqq_u16(vld1q_u16(chars + idx + 1), vdupq_n_u16(kWBNewlineCharacter)));
+      crlf += vaddvq_u16(vshrq_n_u16(pair, 15));
+    }
+  }
+#endif
+  for (; idx < length; ++idx) {
+    if (_WBTextIsBreakUTF16(chars[idx], nel)) {
       count++;
-      range.location += position;
-      CFIndex delta = eol - range.length;
-      CFStringReplace(str, range, endOfLine);
-      if (delta != 0) {
-        idx += delta;
-        length += delta;
-        position += idx;
-        CFStringInitInlineBuffer(str, &buffer, CFRangeMake(position, length - position));
-        idx = 0;
+      if (kWBCarriageReturnCharacter == chars[idx] && idx + 1 < length && kWBNewlineCharacter == chars[idx + 1])
+        crlf++;
+    }
+  }
+  *pairs = crlf;
+  return count;
+}
+
+/* Index of the first break character at or after idx, or length */
+static CFIndex _WBTextNextBreakUTF16(const UniChar *chars, CFIndex idx, CFIndex length, bool nel) {
+#if defined(WB_TEXT_SSE2)
+  for (; idx + 8 <= length; idx += 8) {
+    int mask = _mm_movemask_epi8(_WBTextBreakMaskUTF16(_mm_loadu_si128((const __m128i *)(chars + idx)), nel));
+    if (mask)
+      return idx + __builtin_ctz(mask) / 2;
+  }
+#elif defined(WB_TEXT_NEON)
+  for (; idx + 8 <= length; idx += 8) {
+    if (vmaxvq_u16(_WBTextBreakMaskUTF16(vld1q_u16(chars + idx), nel)))
+      break;
+  }
+#endif
+  while (idx < length && !_WBTextIsBreakUTF16(chars[idx], nel))
+    idx++;
+  return idx;
+}
+
+#pragma mark UTF-8 Scanner
+/* Length of the break sequence at bytes, 0 if there is none. NEL is C2 85, LS and PS are E2 80 A8 and E2 80 A9. */
+WB_INLINE
+CFIndex _WBTextBreakLengthUTF8(const uint8_t *bytes, CFIndex remaining, bool nel) {
+  switch (bytes[0]) {
+    case kWBNewlineCharacter:
+    case kWBCarriageReturnCharacter:
+      return 1;
+    case 0xc2:
+      return nel && remaining >= 2 && bytes[1] == 0x85 ? 2 : 0;
+    case 0xe2:
+      return remaining >= 3 && bytes[1] == 0x80 && (bytes[2] & 0xfe) == 0xa8 ? 3 : 0;
+  }
+  return 0;
+}
+
+#if defined(WB_TEXT_SSE2)
+/* Bytes that may start a break */
+WB_INLINE
+int _WBTextCandidateMaskUTF8(__m128i bytes) {
+  __m128i mask = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(kWBNewlineCharacter)),
+                              _mm_cmpeq_epi8(bytes, _mm_set1_epi8(kWBCarriageReturnCharacter)));
+  mask = _mm_or_si128(mask, _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)0xc2)), _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)0xe2))));
+  return _mm_movemask_epi8(mask);
+}
+#elif defined(WB_TEXT_NEON)
+WB_INLINE
+bool _WBTextHasCandidateUTF8(uint8x16_t bytes) {
+  uint8x16_t mask = vorrq_u8(vceqq_u8(bytes, vdupq_n_u8(kWBNewlineCharacter)), vceqq_u8(bytes, vdupq_n_u8(kWBCarriageReturnCharacter)));
+  mask = vorrq_u8(mask, vorrq_u8(vceqq_u8(bytes, vdupq_n_u8(0xc2)), vceqq_u8(bytes, vdupq_n_u8(0xe2))));
+  return vmaxvq_u8(mask) != 0;
+}
+#endif
+
+/* Index of the first break sequence at or after idx, or length */
+static CFIndex _WBTextNextBreakUTF8(const uint8_t *bytes, CFIndex idx, CFIndex length, bool nel) {
+#if defined(WB_TEXT_SSE2)
+  for (; idx + 16 <= length; idx += 16) {
+    int mask = _WBTextCandidateMaskUTF8(_mm_loadu_si128((const __m128i *)(bytes + idx)));
+    while (mask) {
+      CFIndex offset = idx + __builtin_ctz(mask);
+      if (_WBTextBreakLengthUTF8(bytes + offset, length - offset, nel))
+        return offset;
+      mask &= mask - 1;
+    }
+  }
+#elif defined(WB_TEXT_NEON)
+  for (; idx + 16 <= length; idx += 16) {
+    if (_WBTextHasCandidateUTF8(vld1q_u8(bytes + idx))) {
+      for (CFIndex end = idx + 16; idx < end; ++idx) {
+        if (_WBTextBreakLengthUTF8(bytes + idx, length - idx, nel))
+          return idx;
       }
+      idx -= 16;
     }
   }
+#endif
+  while (idx < length && !_WBTextBreakLengthUTF8(bytes + idx, length - idx, nel))
+    idx++;
+  return idx;
+}
+
+/* Same as the UTF-16 version */
+static CFIndex _WBTextCountBreaksUTF8(const uint8_t *bytes, CFIndex length, bool nel, CFIndex *pairs) {
+  CFIndex idx = 0, count = 0, crlf = 0;
+  while ((idx = _WBTextNextBreakUTF8(bytes, idx, length, nel)) < length) {
+    count++;
+    if (kWBCarriageReturnCharacter == bytes[idx] && idx + 1 < length && kWBNewlineCharacter == bytes[idx + 1])
+      crlf++;
+    idx += _WBTextBreakLengthUTF8(bytes + idx, length - idx, nel);
+  }
+  *pairs = crlf;
   return count;
 }
 
+#pragma mark Conversion
+/* Converted copy of chars. count is the number of breaks. */
+static CFStringRef _WBTextCreateConvertedUTF16(const UniChar *chars, CFIndex length, CFStringRef endOfLine, CFIndex *count) {
+  CFIndex pairs = 0, found = _WBTextCountBreaksUTF16(chars, length, false, &pairs);
+  *count = found - pairs;
+  if (!found)
+    return NULL;
+
+  CFIndex eol = CFStringGetLength(endOfLine);
+  /* every break character is removed, and every break gets a separator */
+  UniChar *result = malloc((length - found + *count * eol + 1) * sizeof(*result));
+  if (!result)
+    return NULL;
+  UniChar *output = result;
+  for (CFIndex idx = 0;;) {
+    CFIndex next = _WBTextNextBreakUTF16(chars, idx, length, false);
+    memcpy(output, chars + idx, (next - idx) * sizeof(*chars));
+    output += next - idx;
+    if (next >= length)
+      break;
+    CFStringGetCharacters(endOfLine, CFRangeMake(0, eol), output);
+    output += eol;
+    idx = next + (kWBCarriageReturnCharacter == chars[next] && next + 1 < length && kWBNewlineCharacter == chars[next + 1] ? 2 : 1);
+  }
+  CFStringRef str = CFStringCreateWithCharactersNoCopy(kCFAllocatorDefault, result, output - result, kCFAllocatorMalloc);
+  if (!str)
+    free(result);
+  return str;
+}
+
+static CFStringRef _WBTextCreateConvertedUTF8(const uint8_t *bytes, CFIndex length, CFStringRef endOfLine, CFIndex *count) {
+  CFIndex pairs = 0, found = _WBTextCountBreaksUTF8(bytes, length, false, &pairs);
+  *count = found - pairs;
+  if (!found)
+    return NULL;
+
+  CFIndex eol = 0;
+  CFStringGetBytes(endOfLine, CFRangeMake(0, CFStringGetLength(endOfLine)), kCFStringEncodingUTF8, 0, false, NULL, 0, &eol);
+  /* every break removes at least one byte */
+  uint8_t *result = malloc(length + *count * eol + 1);
+  if (!result)
+    return NULL;
+  uint8_t *output = result;
+  for (CFIndex idx = 0;;) {
+    CFIndex next = _WBTextNextBreakUTF8(bytes, idx, length, false);
+    memcpy(output, bytes + idx, next - idx);
+    output += next - idx;
+    if (next >= length)
+      break;
+    CFStringGetBytes(endOfLine, CFRangeMake(0, CFStringGetLength(endOfLine)), kCFStringEncodingUTF8, 0, false, output, eol, NULL);
+    output += eol;
+    if (kWBCarriageReturnCharacter == bytes[next] && next + 1 < length && kWBNewlineCharacter == bytes[next + 1])
+      idx = next + 2;
+    else
+      idx = next + _WBTextBreakLengthUTF8(bytes + next, length - next, false);
+  }
+  CFStringRef str = CFStringCreateWithBytes(kCFAllocatorDefault, result, output - result, kCFStringEncodingUTF8, false);
+  free(result);
+  return str;
+}
+
+#pragma mark -
+CFIndex WBTextGetCountOfLines(CFStringRef str) {
+  CFIndex length = CFStringGetLength(str);
+  if (!length)
+    return 0;
+
+  CFIndex breaks = 0, pairs = 0;
+  bool terminated = false;
+  const UniChar *chars = CFStringGetCharactersPtr(str);
+  /* 8 bits strings are ASCII, so there is one byte per character */
+  const char *bytes = chars ? NULL : CFStringGetCStringPtr(str, kCFStringEncodingUTF8);
+  if (chars) {
+    breaks = _WBTextCountBreaksUTF16(chars, length, true, &pairs);
+    terminated = _WBTextIsBreakUTF16(chars[length - 1], true);
+  } else if (bytes) {
+    breaks = _WBTextCountBreaksUTF8((const uint8_t *)bytes, length, true, &pairs);
+    terminated = _WBTextIsBreakUTF16((UniChar)(uint8_t)bytes[length - 1], true);
+  } else {
+    /* CR LF pairs may be split across chunks */
+    UniChar buffer[kWBTextChunkLength];
+    UniChar last = 0;
+    for (CFIndex idx = 0; idx < length; idx += kWBTextChunkLength) {
+      CFIndex count = length - idx < kWBTextChunkLength ? length - idx : kWBTextChunkLength, crlf = 0;
+      CFStringGetCharacters(str, CFRangeMake(idx, count), buffer);
+      breaks += _WBTextCountBreaksUTF16(buffer, count, true, &crlf);
+      pairs += crlf + (kWBCarriageReturnCharacter == last && kWBNewlineCharacter == buffer[0] ? 1 : 0);
+      last = buffer[count - 1];
+    }
+    terminated = _WBTextIsBreakUTF16(last, true);
+  }
+  /* the last line may not end with a break */
+  return breaks - pairs + (terminated ? 0 : 1);
+}
+
+CFIndex WBTextConvertLineEnding(CFMutableStringRef str, CFStringRef endOfLine) {
+  CFIndex count = 0;
+  CFStringRef converted = NULL;
+  CFIndex length = CFStringGetLength(str);
+  const UniChar *chars = CFStringGetCharactersPtr(str);
+  const char *bytes = chars ? NULL : CFStringGetCStringPtr(str, kCFStringEncodingUTF8);
+  if (chars) {
+    converted = _WBTextCreateConvertedUTF16(chars, length, endOfLine, &count);
+  } else if (bytes) {
+    converted = _WBTextCreateConvertedUTF8((const uint8_t *)bytes, length, endOfLine, &count);
+  } else if (length > 0) {
+    UniChar *copy = malloc(length * sizeof(*copy));
+    if (copy) {
+      CFStringGetCharacters(str, CFRangeMake(0, length), copy);
+      converted = _WBTextCreateConvertedUTF16(copy, length, endOfLine, &count);
+      free(copy);
+    }
+  }
+  if (converted) {
+    CFStringReplaceAll(str, converted);
+    CFRelease(converted);
+  }
+  return count;
+}
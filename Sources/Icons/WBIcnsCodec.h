@@ -21,6 +21,8 @@ WB_PRIVATE
 Handle WBIconFamilyGet8BitMaskForBitmap(NSBitmapImageRep *bitmap);
 
 #pragma mark -
+/* Fill the planes of a planar bitmap: red, green, blue (premultiplied) and alpha. planes[3] may be NULL.
+ Return the number of planes filled, or 0 if data is too short. */
 WB_PRIVATE
 NSUInteger WBIconFamilyBitmapDataFor32BitData(NSData *aData, NSSize size, unsigned char *planes[]);
 WB_PRIVATE
@@ -9,6 +9,7 @@
  */
 
 #import "WBIcnsCodec.h"
+#import "WBIcnsPixels.h"
 
 #pragma mark xBitData For Bitmap
 Handle WBIconFamilyGet32BitDataForBitmap(NSBitmapImageRep *bitmap) {
@@ -17,123 +18,28 @@ Handle WBIconFamilyGet32BitDataForBitmap(NSBitmapImageRep *bitmap) {
     SPXThrowException(NSInternalInconsistencyException, @"Image must have 8 bits per sample");
   }
 
-  BOOL premult = YES;
-  BOOL alphaFirst = NO;
+  WBIcnsPixelLayout layout = {
+    .components = (uint32_t)NSNumberOfColorComponents([bitmap colorSpaceName]),
+    .planar = [bitmap isPlanar],
+    .premultiplied = YES,
+  };
   /* Pre Tiger version don't know bitmapFormat */
   if ([bitmap respondsToSelector:@selector(bitmapFormat)]) {
-    premult = ([bitmap bitmapFormat] & NSAlphaNonpremultipliedBitmapFormat) == 0;
-    alphaFirst = ([bitmap bitmapFormat] & NSAlphaFirstBitmapFormat) != 0;
+    layout.premultiplied = ([bitmap bitmapFormat] & NSAlphaNonpremultipliedBitmapFormat) == 0;
+    layout.alphaFirst = ([bitmap bitmapFormat] & NSAlphaFirstBitmapFormat) != 0;
   }
-
-  BOOL alpha;
-  Handle handle = nil;
-  unsigned char *dest;
-  unsigned char *src[6];
-  BOOL isPlanar = [bitmap isPlanar];
-  NSSize size = NSMakeSize([bitmap pixelsWide], [bitmap pixelsHigh]);
-  NSUInteger i, j, pixels = size.width * size.height;
-  unsigned char alphaPix;
-  CGFloat oneOverAlpha;
-  NSUInteger skip = 0;
-  if (isPlanar) {
-    skip = [bitmap bytesPerRow] - size.width;
-  } else {
-    skip = [bitmap bytesPerRow] - (size.width * ([bitmap bitsPerPixel] / 8));
+  if (layout.components != 1 && layout.components != 3 && layout.components != 4) {
+    SPXThrowException(NSInternalInconsistencyException, @"Unsupported colors space: %@", [bitmap colorSpaceName]);
   }
+  NSInteger samples = layout.components + 1;
+  layout.alpha = layout.planar ? [bitmap numberOfPlanes] == samples : [bitmap bitsPerPixel] == samples * 8;
 
+  unsigned char *src[5];
   [bitmap getBitmapDataPlanes:src];
-
-  switch (NSNumberOfColorComponents([bitmap colorSpaceName])) {
-    case 4: /* CMYK */
-      handle = NewHandleClear(pixels * 4);
-      dest = (unsigned char *)*handle;
-      if (alphaFirst && isPlanar) {
-        unsigned char *tmp = src[0];
-        src[0] = src[1];
-        src[1] = src[2];
-        src[2] = src[3];
-        src[3] = src[4];
-        src[4] = tmp;
-      }
-      alpha = (isPlanar) ? [bitmap numberOfPlanes] == 5 : [bitmap bitsPerPixel] == 40;
-      for (i=0; i<size.height; i++) {
-        for (j=0; j<size.width; j++) {
-          alphaPix = (alpha) ? ((isPlanar) ? *(src[4]++) : (alphaFirst) ? *(src[0]++) : *(src[0]+4)) : 0;
-          oneOverAlpha = (alphaPix && premult) ? 255./alphaPix : 1;
-          char black = (isPlanar) ? *(src[3]++) : (alphaFirst) ? src[0][4] : src[0][3];
-          *(dest++) = alphaPix;
-          *(dest++) = MAX(0, (1 - *(src[0]++) - black)) * oneOverAlpha; /* red = (1 - cyan) - black */
-          *(dest++) = MAX(0, (1 - ((isPlanar) ? *(src[1]++) : *(src[0]++)) - black)) * oneOverAlpha; /* green  = (1 - magenta) - black */
-          *(dest++) = MAX(0, (1 - ((isPlanar) ? *(src[2]++) : *(src[0]++)) - black)) * oneOverAlpha; /* blue  = (1 - yellow) - black */
-          (isPlanar) ? src[3]++ : src[0]++; // ignore black component
-          // skip alpha if needed
-          if (alpha && !alphaFirst) src[0]++;
-        }
-        /* Skip padding at end of line */
-        src[0] += skip;
-        if (isPlanar) { src[1] += skip; src[2] += skip; src[3] += skip; if (alpha) src[4] += skip; }
-      }
-        break;
-    case 3: /* RGB */
-      handle = NewHandleClear(pixels * 4);
-      dest = (unsigned char *)*handle;
-      if (alphaFirst && isPlanar) {
-        /* Use src[5] as temp */
-        src[5] = src[0];
-        src[0] = src[1];
-        src[1] = src[2];
-        src[2] = src[3];
-        src[3] = src[5];
-      }
-      alpha = (isPlanar) ? [bitmap numberOfPlanes] == 4 : [bitmap bitsPerPixel] == 32;
-      for (i=0; i<size.height; i++) {
-        for (j=0; j<size.width; j++) {
-          alphaPix = (alpha) ? ((isPlanar) ? *(src[3]++) : (alphaFirst) ? *(src[0]++) : *(src[0]+3)) : 0;
-          oneOverAlpha = (alphaPix && premult) ? 255./alphaPix : 1;
-          *(dest++) = alphaPix;
-          *(dest++) = *(src[0]++) * oneOverAlpha; /* red */
-          *(dest++) = ((isPlanar) ? *(src[1]++) : *(src[0]++)) * oneOverAlpha; /* green */
-          *(dest++) = ((isPlanar) ? *(src[2]++) : *(src[0]++)) * oneOverAlpha; /* blue */
-          // skip alpha if needed
-          if (alpha && !alphaFirst) src[0]++;
-        }
-        /* Skip padding at end of line */
-        src[0] += skip;
-        if (isPlanar) { src[1] += skip; src[2] += skip; if (alpha) src[3] += skip; }
-      }
-        break;
-    case 1: /* Gray */
-      handle = NewHandleClear(pixels * 4);
-      dest = (unsigned char *)*handle;
-      if (alphaFirst) {
-        if (isPlanar) {
-          /* use src[2] as temp */
-          src[2] = src[0];
-          src[0] = src[1];
-          src[1] = src[2];
-        }
-      }
-      alpha = (isPlanar) ? [bitmap numberOfPlanes] == 2 : [bitmap bitsPerPixel] == 16;
-      for (i=0; i<size.height; i++) {
-        for (j=0; j<size.width; j++) {
-          alphaPix = (alpha) ? ((isPlanar) ? *(src[1]++) : (alphaFirst) ? *(src[0]++) : *(src[0]+1)) : 0;
-          oneOverAlpha = (alphaPix && premult) ? 255./alphaPix : 1;
-          *(dest++) = alphaPix;
-          /* Copy three times the same value */
-          *(dest++) = *src[0] * oneOverAlpha;
-          *(dest++) = *src[0] * oneOverAlpha;
-          *(dest++) = *(src[0]++) * oneOverAlpha;
-          // skip alpha if needed
-          if (alpha && !alphaFirst) src[0]++;
-        }
-        /* Skip padding at end of line */
-        src[0] += skip;
-        if (isPlanar && alpha) { src[1] += skip; }
-      }
-        break;
-    default:
-      SPXThrowException(NSInternalInconsistencyException, @"Unsupported colors space: %@", [bitmap colorSpaceName]);
-  }
+  NSUInteger width = [bitmap pixelsWide], height = [bitmap pixelsHigh];
+  Handle handle = NewHandle(width * height * 4);
+  if (handle)
+    WBIcnsConvertToARGB(&layout, (const uint8_t * const *)src, [bitmap bytesPerRow], width, height, (uint8_t *)*handle);
   return handle;
 }
 
@@ -196,25 +102,8 @@ NSUInteger WBIconFamilyBitmapDataFor32BitData(NSData *data, NSSize size, unsigne
   if (([data length] / 4) < pixels) {
     return 0;
   }
-  unsigned char *bytes = (unsigned char *)[data bytes];
-  unsigned char *r, *g, *b, *a;
-  r = malloc(pixels * sizeof(char));
-  g = malloc(pixels * sizeof(char));
-  b = malloc(pixels * sizeof(char));
-  a = malloc(pixels * sizeof(char));
-  CGFloat alpha;
-  for (NSUInteger i = 0; i < pixels; i++) {
-    a[i] = *(bytes++);
-    alpha = a[i]/255.;
-    r[i] = *(bytes++) * alpha;
-    g[i] = *(bytes++) * alpha;
-    b[i] = *(bytes++) * alpha;
-  }
-  planes[0] = r;
-  planes[1] = g;
-  planes[2] = b;
-  planes[3] = a;
-  return 4;
+  WBIcnsDeinterleaveARGB([data bytes], pixels, true, planes[3], planes[0], planes[1], planes[2]);
+  return planes[3] ? 4 : 3;
 }
 
 #pragma mark Bitmap For xBitMask
@@ -223,13 +112,6 @@ NSUInteger WBIconFamilyBitmapDataFor8BitMask(NSData *data, NSSize size, unsigned
   if ([data length] < pixels) {
     return 0;
   }
-  unsigned char *bytes = (unsigned char *)[data bytes];
-  unsigned char *gray;
-  gray = malloc(pixels * sizeof(char));
-  for (NSUInteger i = 0; i < pixels; i++) {
-    gray[i] = *bytes;
-    bytes++;
-  }
-  planes[0] = gray;
+  memcpy(planes[0], [data bytes], pixels);
   return 1;
 }
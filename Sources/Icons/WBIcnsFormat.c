@@ -0,0 +1,335 @@
+/*
+ *  WBIcnsFormat.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#include "WBIcnsFormat.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <emmintrin.h>
+#  define WB_ICNS_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define WB_ICNS_NEON 1
+#endif
+
+enum {
+  kWBIcnsRLEMaxLiteral = 128,
+  kWBIcnsRLEMinRun = 3,
+  kWBIcnsRLEMaxRun = 130,
+};
+
+WB_INLINE
+uint32_t _WBIcnsReadBigInt32(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+WB_INLINE
+void _WBIcnsWriteBigInt32(uint8_t *bytes, uint32_t value) {
+  bytes[0] = (uint8_t)(value >> 24);
+  bytes[1] = (uint8_t)(value >> 16);
+  bytes[2] = (uint8_t)(value >> 8);
+  bytes[3] = (uint8_t)value;
+}
+
+WBIcnsElementInfo WBIcnsGetElementInfo(uint32_t type) {
+  switch (type) {
+    case 'is32': return (WBIcnsElementInfo){ kWBIcnsElementRGB, 16, 0 };
+    case 'il32': return (WBIcnsElementInfo){ kWBIcnsElementRGB, 32, 0 };
+    case 'ih32': return (WBIcnsElementInfo){ kWBIcnsElementRGB, 48, 0 };
+    case 'it32': return (WBIcnsElementInfo){ kWBIcnsElementRGB, 128, 4 };
+    case 's8mk': return (WBIcnsElementInfo){ kWBIcnsElementMask, 16, 0 };
+    case 'l8mk': return (WBIcnsElementInfo){ kWBIcnsElementMask, 32, 0 };
+    case 'h8mk': return (WBIcnsElementInfo){ kWBIcnsElementMask, 48, 0 };
+    case 't8mk': return (WBIcnsElementInfo){ kWBIcnsElementMask, 128, 0 };
+    case 'ic04': return (WBIcnsElementInfo){ kWBIcnsElementARGB, 16, 0 };
+    case 'ic05': return (WBIcnsElementInfo){ kWBIcnsElementARGB, 32, 0 };
+  }
+  return (WBIcnsElementInfo){ kWBIcnsElementOther, 0, 0 };
+}
+
+#pragma mark RLE
+static uint8_t *_WBIcnsRLEWriteLiteral(const uint8_t *src, size_t length, uint8_t *dst) {
+  while (length > 0) {
+    size_t count = length < kWBIcnsRLEMaxLiteral ? length : kWBIcnsRLEMaxLiteral;
+    *dst++ = (uint8_t)(count - 1);
+    memcpy(dst, src, count);
+    dst += count;
+    src += count;
+    length -= count;
+  }
+  return dst;
+}
+
+size_t WBIcnsRLEEncode(const uint8_t *src, size_t length, uint8_t *dst) {
+  uint8_t *out = dst;
+  size_t idx = 0, literal = 0;
+  while (idx < length) {
+    size_t max = length - idx < kWBIcnsRLEMaxRun ? length - idx : kWBIcnsRLEMaxRun;
+    size_t run = 1;
+    while (run < max && src[idx + run] == src[idx])
+      run++;
+    if (run >= kWBIcnsRLEMinRun) {
+      out = _WBIcnsRLEWriteLiteral(src + literal, idx - literal, out);
+      *out++ = (uint8_t)(run + 125);
+      *out++ = src[idx];
+      literal = idx + run;
+    }
+    idx += run;
+  }
+  return _WBIcnsRLEWriteLiteral(src + literal, idx - literal, out) - dst;
+}
+
+// Runs and literals are written 16 bytes at a time when there is room for it,
+// the extra bytes being overwritten by the next packets.
+#if defined(WB_ICNS_SSE2)
+WB_INLINE void _WBIcnsCopy16(uint8_t *dst, const uint8_t *src) {
+  _mm_storeu_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+}
+WB_INLINE void _WBIcnsFill16(uint8_t *dst, uint8_t value, size_t blocks) {
+  const __m128i v = _mm_set1_epi8((char)value);
+  for (size_t idx = 0; idx < blocks; ++idx)
+    _mm_storeu_si128((__m128i *)(dst + idx * 16), v);
+}
+#elif defined(WB_ICNS_NEON)
+WB_INLINE void _WBIcnsCopy16(uint8_t *dst, const uint8_t *src) {
+  vst1q_u8(dst, vld1q_u8(src));
+}
+WB_INLINE void _WBIcnsFill16(uint8_t *dst, uint8_t value, size_t blocks) {
+  const uint8x16_t v = vdupq_n_u8(value);
+  for (size_t idx = 0; idx < blocks; ++idx)
+    vst1q_u8(dst + idx * 16, v);
+}
+#else
+WB_INLINE void _WBIcnsCopy16(uint8_t *dst, const uint8_t *src) {
+  memcpy(dst, src, 16);
+}
+WB_INLINE void _WBIcnsFill16(uint8_t *dst, uint8_t value, size_t blocks) {
+  memset(dst, value, blocks * 16);
+}
+#endif
+
+size_t WBIcnsRLEDecode(const uint8_t *src, size_t srcLength, uint8_t *dst, size_t length) {
+  size_t in = 0, out = 0;
+  while (out < length) {
+    if (in >= srcLength)
+      return 0;
+    size_t packet = src[in++];
+    if (packet < 0x80) {
+      size_t count = packet + 1;
+      if (count > srcLength - in || count > length - out)
+        return 0;
+      if (count <= 32 && srcLength - in >= 32 && length - out >= 32) {
+        _WBIcnsCopy16(dst + out, src + in);
+        if (count > 16)
+          _WBIcnsCopy16(dst + out + 16, src + in + 16);
+      } else {
+        memcpy(dst + out, src + in, count);
+      }
+      in += count;
+      out += count;
+    } else {
+      size_t count = packet - 125;
+      if (in >= srcLength || count > length - out)
+        return 0;
+      uint8_t value = src[in++];
+      size_t blocks = (count + 15) / 16;
+      if (length - out >= blocks * 16)
+        _WBIcnsFill16(dst + out, value, blocks);
+      else
+        memset(dst + out, value, count);
+      out += count;
+    }
+  }
+  return in;
+}
+
+#pragma mark Elements
+size_t WBIcnsElementMaxEncodedLength(uint32_t type) {
+  WBIcnsElementInfo info = WBIcnsGetElementInfo(type);
+  size_t pixels = (size_t)info.size * info.size;
+  switch (info.kind) {
+    case kWBIcnsElementRGB:
+      return info.padding + 3 * WBIcnsRLEMaxEncodedLength(pixels);
+    case kWBIcnsElementARGB:
+      return 4 + 4 * WBIcnsRLEMaxEncodedLength(pixels);
+    case kWBIcnsElementMask:
+      return pixels;
+  }
+  return 0;
+}
+
+size_t WBIcnsEncodeElementPlanes(uint32_t type, const uint8_t *a, const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *dst) {
+  WBIcnsElementInfo info = WBIcnsGetElementInfo(type);
+  size_t pixels = (size_t)info.size * info.size;
+  uint8_t *out = dst;
+  switch (info.kind) {
+    case kWBIcnsElementARGB:
+      _WBIcnsWriteBigInt32(out, 'ARGB');
+      out += 4;
+      out += WBIcnsRLEEncode(a, pixels, out);
+      // fall through
+    case kWBIcnsElementRGB:
+      if (kWBIcnsElementRGB == info.kind) {
+        memset(out, 0, info.padding);
+        out += info.padding;
+      }
+      out += WBIcnsRLEEncode(r, pixels, out);
+      out += WBIcnsRLEEncode(g, pixels, out);
+      out += WBIcnsRLEEncode(b, pixels, out);
+      break;
+    case kWBIcnsElementMask:
+      memcpy(out, a, pixels);
+      out += pixels;
+      break;
+  }
+  return out - dst;
+}
+
+bool WBIcnsDecodeElementPlanes(uint32_t type, const uint8_t *data, size_t length, uint8_t *a, uint8_t *r, uint8_t *g, uint8_t *b) {
+  WBIcnsElementInfo info = WBIcnsGetElementInfo(type);
+  size_t pixels = (size_t)info.size * info.size;
+  switch (info.kind) {
+    case kWBIcnsElementRGB:
+      /* uncompressed */
+      if (length == pixels * 4) {
+        WBIcnsDeinterleaveARGB(data, pixels, false, a, r, g, b);
+        return true;
+      }
+      if (length < info.padding)
+        return false;
+      for (uint32_t idx = 0; idx < info.padding; ++idx) {
+        if (data[idx])
+          return false;
+      }
+      data += info.padding;
+      length -= info.padding;
+      break;
+    case kWBIcnsElementARGB:
+      if (length < 4 || _WBIcnsReadBigInt32(data) != 'ARGB')
+        return false;
+      data += 4;
+      length -= 4;
+      break;
+    case kWBIcnsElementMask:
+      if (length < pixels)
+        return false;
+      memcpy(a, data, pixels);
+      return true;
+    default:
+      return false;
+  }
+  uint8_t *planes[4] = { r, g, b };
+  if (kWBIcnsElementARGB == info.kind) {
+    planes[0] = a;
+    planes[1] = r;
+    planes[2] = g;
+    planes[3] = b;
+  }
+  for (size_t idx = 0; idx < (kWBIcnsElementARGB == info.kind ? 4 : 3); ++idx) {
+    size_t used = WBIcnsRLEDecode(data, length, planes[idx], pixels);
+    if (!used)
+      return false;
+    data += used;
+    length -= used;
+  }
+  return true;
+}
+
+size_t WBIcnsEncodeElement(uint32_t type, const uint8_t *argb, uint8_t *dst) {
+  WBIcnsElementInfo info = WBIcnsGetElementInfo(type);
+  size_t pixels = (size_t)info.size * info.size;
+  if (kWBIcnsElementOther == info.kind)
+    return 0;
+  uint8_t *planes = malloc(pixels * 4);
+  if (!planes)
+    return 0;
+  WBIcnsDeinterleaveARGB(argb, pixels, false, planes, planes + pixels, planes + pixels * 2, planes + pixels * 3);
+  size_t length = WBIcnsEncodeElementPlanes(type, planes, planes + pixels, planes + pixels * 2, planes + pixels * 3, dst);
+  free(planes);
+  return length;
+}
+
+bool WBIcnsDecodeElement(uint32_t type, const uint8_t *data, size_t length, uint8_t *argb) {
+  WBIcnsElementInfo info = WBIcnsGetElementInfo(type);
+  size_t pixels = (size_t)info.size * info.size;
+  if (kWBIcnsElementOther == info.kind)
+    return false;
+  uint8_t *planes = malloc(pixels * 4);
+  if (!planes)
+    return false;
+  uint8_t *a = planes, *r = planes + pixels, *g = planes + pixels * 2, *b = planes + pixels * 3;
+  bool ok = WBIcnsDecodeElementPlanes(type, data, length, a, r, g, b);
+  if (ok) {
+    if (kWBIcnsElementMask == info.kind) {
+      for (size_t idx = 0; idx < pixels; ++idx)
+        argb[idx * 4] = a[idx];
+    } else {
+      WBIcnsInterleaveARGB(kWBIcnsElementARGB == info.kind ? a : NULL, r, g, b, argb, pixels);
+    }
+  }
+  free(planes);
+  return ok;
+}
+
+#pragma mark Container
+bool WBIcnsReadContainer(const uint8_t *bytes, size_t length, WBIcnsElement *elements, size_t capacity, size_t *count) {
+  *count = 0;
+  if (length < kWBIcnsHeaderLength || _WBIcnsReadBigInt32(bytes) != kWBIcnsFileType)
+    return false;
+  size_t total = _WBIcnsReadBigInt32(bytes + 4);
+  if (total < kWBIcnsHeaderLength || total > length)
+    return false;
+
+  size_t offset = kWBIcnsHeaderLength, found = 0;
+  while (offset < total) {
+    if (total - offset < kWBIcnsHeaderLength)
+      return false;
+    size_t size = _WBIcnsReadBigInt32(bytes + offset + 4);
+    if (size < kWBIcnsHeaderLength || size > total - offset)
+      return false;
+    if (elements && found < capacity) {
+      elements[found].type = _WBIcnsReadBigInt32(bytes + offset);
+      elements[found].data = bytes + offset + kWBIcnsHeaderLength;
+      elements[found].length = size - kWBIcnsHeaderLength;
+    }
+    found++;
+    offset += size;
+  }
+  *count = found;
+  return true;
+}
+
+size_t WBIcnsContainerLength(const WBIcnsElement *elements, size_t count) {
+  size_t length = kWBIcnsHeaderLength;
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (elements[idx].length > UINT32_MAX - kWBIcnsHeaderLength - length)
+      return 0;
+    length += kWBIcnsHeaderLength + elements[idx].length;
+  }
+  return length;
+}
+
+size_t WBIcnsWriteContainer(const WBIcnsElement *elements, size_t count, uint8_t *dst) {
+  size_t length = WBIcnsContainerLength(elements, count);
+  if (!length)
+    return 0;
+  _WBIcnsWriteBigInt32(dst, kWBIcnsFileType);
+  _WBIcnsWriteBigInt32(dst + 4, (uint32_t)length);
+  uint8_t *out = dst + kWBIcnsHeaderLength;
+  for (size_t idx = 0; idx < count; ++idx) {
+    _WBIcnsWriteBigInt32(out, elements[idx].type);
+    _WBIcnsWriteBigInt32(out + 4, (uint32_t)(elements[idx].length + kWBIcnsHeaderLength));
+    memcpy(out + kWBIcnsHeaderLength, elements[idx].data, elements[idx].length);
+    out += kWBIcnsHeaderLength + elements[idx].length;
+  }
+  return length;
+}
@@ -0,0 +1,129 @@
+/*
+ *  WBIcnsFormat.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#if !defined(__WB_ICNS_FORMAT_H)
+#define __WB_ICNS_FORMAT_H 1
+
+#include "WBIcnsPixels.h"
+
+// icns file format, without the system icon APIs.
+//
+// A .icns file is a 'icns' header (type and total length, big endian) followed
+// by elements (type, length including the 8 bytes header, data).
+//
+// 32 bits elements ('is32', 'il32', 'ih32', 'it32') store the red, green and
+// blue planes one after the other, each compressed with a PackBits like RLE:
+//  - 0x00 - 0x7f: n + 1 literal bytes follow.
+//  - 0x80 - 0xff: the next byte is repeated n - 125 times (3 to 130).
+// 'it32' data starts with 4 zero bytes. 'ic04' and 'ic05' store 'ARGB' followed
+// by the alpha, red, green and blue planes. Masks ('s8mk'…) are not compressed.
+// Other elements ('ic08' and larger are PNG or JPEG 2000) are not decoded.
+
+enum {
+  kWBIcnsFileType = 'icns',
+  kWBIcnsHeaderLength = 8,
+};
+
+enum {
+  /* Not a bitmap element */
+  kWBIcnsElementOther = 0,
+  /* RLE red, green and blue planes */
+  kWBIcnsElementRGB = 1,
+  /* 'ARGB' then RLE alpha, red, green and blue planes */
+  kWBIcnsElementARGB = 2,
+  /* 8 bits alpha */
+  kWBIcnsElementMask = 3,
+};
+typedef uint32_t WBIcnsElementKind;
+
+typedef struct _WBIcnsElementInfo {
+  WBIcnsElementKind kind;
+  /* width and height */
+  uint32_t size;
+  /* zero bytes before the planes ('it32') */
+  uint32_t padding;
+} WBIcnsElementInfo;
+
+/* A container element. data references the container bytes. */
+typedef struct _WBIcnsElement {
+  uint32_t type;
+  const uint8_t *data;
+  size_t length;
+} WBIcnsElement;
+
+/* Returns kWBIcnsElementOther for unknown types */
+WB_PRIVATE
+WBIcnsElementInfo WBIcnsGetElementInfo(uint32_t type);
+
+#pragma mark RLE
+/* Worst case encoded length of a plane */
+WB_INLINE
+size_t WBIcnsRLEMaxEncodedLength(size_t length) { return length + (length + 127) / 128; }
+
+/* Returns the number of bytes written in dst (WBIcnsRLEMaxEncodedLength(length) at most) */
+WB_PRIVATE
+size_t WBIcnsRLEEncode(const uint8_t *src, size_t length, uint8_t *dst);
+/*!
+  @function
+  @abstract Decodes exactly length bytes.
+  @result The number of bytes read from src, or 0 if src is truncated or a run overflows dst.
+*/
+WB_PRIVATE
+size_t WBIcnsRLEDecode(const uint8_t *src, size_t srcLength, uint8_t *dst, size_t length);
+
+#pragma mark Elements
+/* Worst case encoded length of an element data (without the element header), 0 if type is not a bitmap element */
+WB_PRIVATE
+size_t WBIcnsElementMaxEncodedLength(uint32_t type);
+
+/*!
+  @function
+  @abstract Encodes size * size ARGB pixels.
+  @discussion Masks use the alpha component, RGB elements ignore it.
+  @result The number of bytes written, or 0 if type is not a bitmap element.
+*/
+WB_PRIVATE
+size_t WBIcnsEncodeElement(uint32_t type, const uint8_t *argb, uint8_t *dst);
+
+/*!
+  @function
+  @abstract Decodes an element to size * size ARGB pixels.
+  @discussion Masks only set the alpha component, RGB elements set it to 0 (so decode the mask last).
+  Uncompressed RGB elements (4 bytes per pixel) are supported.
+  @result false if the data is invalid, or type is not a bitmap element.
+*/
+WB_PRIVATE
+bool WBIcnsDecodeElement(uint32_t type, const uint8_t *data, size_t length, uint8_t *argb);
+
+/* Same as above, on planes (a may be NULL for RGB elements, masks only use a) */
+WB_PRIVATE
+size_t WBIcnsEncodeElementPlanes(uint32_t type, const uint8_t *a, const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *dst);
+WB_PRIVATE
+bool WBIcnsDecodeElementPlanes(uint32_t type, const uint8_t *data, size_t length, uint8_t *a, uint8_t *r, uint8_t *g, uint8_t *b);
+
+#pragma mark Container
+/*!
+  @function
+  @abstract Parses a .icns container.
+  @param elements Receives the first capacity elements. May be NULL.
+  @param count On return, the number of elements in the container.
+  @result false if the container is invalid.
+*/
+WB_PRIVATE
+bool WBIcnsReadContainer(const uint8_t *bytes, size_t length, WBIcnsElement *elements, size_t capacity, size_t *count);
+
+/* Returns the container length, or 0 if it is too large */
+WB_PRIVATE
+size_t WBIcnsContainerLength(const WBIcnsElement *elements, size_t count);
+/* dst must be WBIcnsContainerLength() bytes long. Returns the number of bytes written. */
+WB_PRIVATE
+size_t WBIcnsWriteContainer(const WBIcnsElement *elements, size_t count, uint8_t *dst);
+
+#endif /* __WB_ICNS_FORMAT_H */
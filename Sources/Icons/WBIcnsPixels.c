@@ -0,0 +1,684 @@
+/*
+ *  WBIcnsPixels.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#include "WBIcnsPixels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <emmintrin.h>
+#  define WB_ICNS_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define WB_ICNS_NEON 1
+#endif
+
+// Un-premultiply reciprocals: color * 255 / alpha == (color * table[alpha]) >> 16
+// (exact for every color <= alpha). This array was generated by the following code:
+//   for (a = 1; a < 256; a++) printf("%8u, ", (255 * 65536 + a - 1) / a);
+static const uint32_t kWBIcnsReciprocal[256] = {
+         0, 16711680,  8355840,  5570560,  4177920,  3342336,  2785280,  2387383,
+   2088960,  1856854,  1671168,  1519244,  1392640,  1285514,  1193692,  1114112,
+   1044480,   983040,   928427,   879563,   835584,   795795,   759622,   726595,
+    696320,   668468,   642757,   618952,   596846,   576265,   557056,   539087,
+    522240,   506415,   491520,   477477,   464214,   451668,   439782,   428505,
+    417792,   407602,   397898,   388644,   379811,   371371,   363298,   355568,
+    348160,   341055,   334234,   327680,   321379,   315315,   309476,   303849,
+    298423,   293188,   288133,   283249,   278528,   273962,   269544,   265265,
+    261120,   257103,   253208,   249429,   245760,   242199,   238739,   235376,
+    232107,   228928,   225834,   222823,   219891,   217035,   214253,   211541,
+    208896,   206318,   203801,   201346,   198949,   196608,   194322,   192089,
+    189906,   187772,   185686,   183645,   181649,   179696,   177784,   175913,
+    174080,   172286,   170528,   168805,   167117,   165463,   163840,   162250,
+    160690,   159159,   157658,   156184,   154738,   153319,   151925,   150556,
+    149212,   147891,   146594,   145319,   144067,   142835,   141625,   140435,
+    139264,   138114,   136981,   135868,   134772,   133694,   132633,   131589,
+    130560,   129548,   128552,   127571,   126604,   125652,   124715,   123791,
+    122880,   121984,   121100,   120228,   119370,   118523,   117688,   116865,
+    116054,   115253,   114464,   113685,   112917,   112159,   111412,   110674,
+    109946,   109227,   108518,   107818,   107127,   106444,   105771,   105105,
+    104448,   103800,   103159,   102526,   101901,   101283,   100673,   100070,
+     99475,    98886,    98304,    97730,    97161,    96600,    96045,    95496,
+     94953,    94417,    93886,    93362,    92843,    92330,    91823,    91321,
+     90825,    90334,    89848,    89368,    88892,    88422,    87957,    87496,
+     87040,    86590,    86143,    85701,    85264,    84831,    84403,    83979,
+     83559,    83143,    82732,    82324,    81920,    81521,    81125,    80733,
+     80345,    79961,    79580,    79203,    78829,    78459,    78092,    77729,
+     77369,    77013,    76660,    76310,    75963,    75619,    75278,    74941,
+     74606,    74275,    73946,    73620,    73297,    72977,    72660,    72345,
+     72034,    71724,    71418,    71114,    70813,    70514,    70218,    69924,
+     69632,    69344,    69057,    68773,    68491,    68211,    67934,    67659,
+     67386,    67116,    66847,    66581,    66317,    66055,    65795,    65536,
+};
+
+WB_INLINE
+uint8_t _WBIcnsUnpremultiply(uint8_t color, uint8_t alpha) {
+  uint32_t value = (color * kWBIcnsReciprocal[alpha]) >> 16;
+  /* color > alpha is not a valid premultiplied value */
+  return value > 255 ? 255 : (uint8_t)value;
+}
+
+/* color * alpha / 255, rounded down */
+WB_INLINE
+uint8_t _WBIcnsPremultiply(uint8_t color, uint8_t alpha) {
+  uint32_t value = color * alpha;
+  return (uint8_t)((value + 1 + (value >> 8)) >> 8);
+}
+
+/* red = 255 - (cyan + black) */
+WB_INLINE
+uint8_t _WBIcnsCMYKToRGB(uint8_t color, uint8_t black) {
+  uint32_t value = color + black;
+  return value > 255 ? 0 : (uint8_t)(255 - value);
+}
+
+WB_INLINE
+void _WBIcnsStorePixel(uint8_t *argb, uint8_t a, uint8_t r, uint8_t g, uint8_t b) {
+  argb[0] = a;
+  argb[1] = r;
+  argb[2] = g;
+  argb[3] = b;
+}
+
+#pragma mark Vector helpers
+#if defined(WB_ICNS_SSE2)
+
+/* 16 pixels from 4 planes */
+WB_INLINE
+void _WBIcnsStoreARGB16(uint8_t *argb, __m128i a, __m128i r, __m128i g, __m128i b) {
+  __m128i ar = _mm_unpacklo_epi8(a, r), gb = _mm_unpacklo_epi8(g, b);
+  _mm_storeu_si128((__m128i *)argb, _mm_unpacklo_epi16(ar, gb));
+  _mm_storeu_si128((__m128i *)(argb + 16), _mm_unpackhi_epi16(ar, gb));
+  ar = _mm_unpackhi_epi8(a, r);
+  gb = _mm_unpackhi_epi8(g, b);
+  _mm_storeu_si128((__m128i *)(argb + 32), _mm_unpacklo_epi16(ar, gb));
+  _mm_storeu_si128((__m128i *)(argb + 48), _mm_unpackhi_epi16(ar, gb));
+}
+
+/* 16 ARGB pixels to 4 planes */
+WB_INLINE
+void _WBIcnsLoadARGB16(__m128i v0, __m128i v1, __m128i v2, __m128i v3, __m128i *a, __m128i *r, __m128i *g, __m128i *b) {
+  /* pixels (0 4) (1 5) | (2 6) (3 7) | (8 12) (9 13) | (10 14) (11 15) */
+  __m128i t0 = _mm_unpacklo_epi8(v0, v1), t1 = _mm_unpackhi_epi8(v0, v1);
+  __m128i t2 = _mm_unpacklo_epi8(v2, v3), t3 = _mm_unpackhi_epi8(v2, v3);
+  /* channels of pixels 0 2 4 6 | 1 3 5 7 | 8 10 12 14 | 9 11 13 15 */
+  __m128i u0 = _mm_unpacklo_epi8(t0, t1), u1 = _mm_unpackhi_epi8(t0, t1);
+  __m128i u2 = _mm_unpacklo_epi8(t2, t3), u3 = _mm_unpackhi_epi8(t2, t3);
+  /* a0-7 r0-7 | g0-7 b0-7 | a8-15 r8-15 | g8-15 b8-15 */
+  __m128i w0 = _mm_unpacklo_epi8(u0, u1), w1 = _mm_unpackhi_epi8(u0, u1);
+  __m128i w2 = _mm_unpacklo_epi8(u2, u3), w3 = _mm_unpackhi_epi8(u2, u3);
+  *a = _mm_unpacklo_epi64(w0, w2);
+  *r = _mm_unpackhi_epi64(w0, w2);
+  *g = _mm_unpacklo_epi64(w1, w3);
+  *b = _mm_unpackhi_epi64(w1, w3);
+}
+
+/* 255 - saturate(color + black) */
+WB_INLINE
+__m128i _WBIcnsCMYKToRGB16(__m128i color, __m128i black) {
+  return _mm_xor_si128(_mm_adds_epu8(color, black), _mm_set1_epi8(-1));
+}
+
+/* color * alpha / 255 on 16 bits lanes */
+WB_INLINE
+__m128i _WBIcnsPremultiply8(__m128i color, __m128i alpha) {
+  __m128i value = _mm_mullo_epi16(color, alpha);
+  value = _mm_add_epi16(_mm_add_epi16(value, _mm_set1_epi16(1)), _mm_srli_epi16(value, 8));
+  return _mm_srli_epi16(value, 8);
+}
+
+/* Premultiplies 4 ARGB pixels */
+WB_INLINE
+__m128i _WBIcnsPremultiply4(__m128i pixels) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i amask = _mm_set1_epi32(0xff);
+  /* broadcast alpha in each pixel */
+  __m128i alpha = _mm_and_si128(pixels, amask);
+  alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 8));
+  alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+  __m128i lo = _WBIcnsPremultiply8(_mm_unpacklo_epi8(pixels, zero), _mm_unpacklo_epi8(alpha, zero));
+  __m128i hi = _WBIcnsPremultiply8(_mm_unpackhi_epi8(pixels, zero), _mm_unpackhi_epi8(alpha, zero));
+  __m128i result = _mm_packus_epi16(lo, hi);
+  /* keep alpha */
+  return _mm_or_si128(_mm_andnot_si128(amask, result), _mm_and_si128(pixels, amask));
+}
+
+#endif
+
+#pragma mark Planes
+/* alpha is a compile time constant once inlined */
+WB_INLINE
+void _WBIcnsInterleave(const uint8_t *a, const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                       uint8_t *argb, size_t pixels, bool alpha) {
+  size_t idx = 0;
+#if defined(WB_ICNS_SSE2)
+  for (; idx + 16 <= pixels; idx += 16) {
+    __m128i va = alpha ? _mm_loadu_si128((const __m128i *)(a + idx)) : _mm_setzero_si128();
+    _WBIcnsStoreARGB16(argb + idx * 4, va, _mm_loadu_si128((const __m128i *)(r + idx)),
+                       _mm_loadu_si128((const __m128i *)(g + idx)), _mm_loadu_si128((const __m128i *)(b + idx)));
+  }
+#elif defined(WB_ICNS_NEON)
+  for (; idx + 16 <= pixels; idx += 16) {
+    uint8x16x4_t v;
+    v.val[0] = alpha ? vld1q_u8(a + idx) : vdupq_n_u8(0);
+    v.val[1] = vld1q_u8(r + idx);
+    v.val[2] = vld1q_u8(g + idx);
+    v.val[3] = vld1q_u8(b + idx);
+    vst4q_u8(argb + idx * 4, v);
+  }
+#endif
+  for (; idx < pixels; ++idx)
+    _WBIcnsStorePixel(argb + idx * 4, alpha ? a[idx] : 0, r[idx], g[idx], b[idx]);
+}
+
+void WBIcnsInterleaveARGB(const uint8_t *a, const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                          uint8_t *argb, size_t pixels) {
+  if (a)
+    _WBIcnsInterleave(a, r, g, b, argb, pixels, true);
+  else
+    _WBIcnsInterleave(NULL, r, g, b, argb, pixels, false);
+}
+
+WB_INLINE
+void _WBIcnsDeinterleave(const uint8_t *argb, size_t pixels, bool premultiply,
+                         uint8_t *a, uint8_t *r, uint8_t *g, uint8_t *b) {
+  size_t idx = 0;
+#if defined(WB_ICNS_SSE2)
+  for (; idx + 16 <= pixels; idx += 16) {
+    const uint8_t *src = argb + idx * 4;
+    __m128i v0 = _mm_loadu_si128((const __m128i *)src), v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i v2 = _mm_loadu_si128((const __m128i *)(src + 32)), v3 = _mm_loadu_si128((const __m128i *)(src + 48));
+    if (premultiply) {
+      v0 = _WBIcnsPremultiply4(v0);
+      v1 = _WBIcnsPremultiply4(v1);
+      v2 = _WBIcnsPremultiply4(v2);
+      v3 = _WBIcnsPremultiply4(v3);
+    }
+    __m128i va, vr, vg, vb;
+    _WBIcnsLoadARGB16(v0, v1, v2, v3, &va, &vr, &vg, &vb);
+    if (a)
+      _mm_storeu_si128((__m128i *)(a + idx), va);
+    _mm_storeu_si128((__m128i *)(r + idx), vr);
+    _mm_storeu_si128((__m128i *)(g + idx), vg);
+    _mm_storeu_si128((__m128i *)(b + idx), vb);
+  }
+#elif defined(WB_ICNS_NEON)
+  for (; idx + 16 <= pixels; idx += 16) {
+    uint8x16x4_t v = vld4q_u8(argb + idx * 4);
+    if (premultiply) {
+      for (int c = 1; c < 4; ++c) {
+        uint16x8_t lo = vmull_u8(vget_low_u8(v.val[c]), vget_low_u8(v.val[0]));
+        uint16x8_t hi = vmull_u8(vget_high_u8(v.val[c]), vget_high_u8(v.val[0]));
+        /* (x + 1 + (x >> 8)) >> 8 */
+        v.val[c] = vcombine_u8(vaddhn_u16(vaddq_u16(lo, vdupq_n_u16(1)), vshrq_n_u16(lo, 8)),
+                               vaddhn_u16(vaddq_u16(hi, vdupq_n_u16(1)), vshrq_n_u16(hi, 8)));
+      }
+    }
+    if (a)
+      vst1q_u8(a + idx, v.val[0]);
+    vst1q_u8(r + idx, v.val[1]);
+    vst1q_u8(g + idx, v.val[2]);
+    vst1q_u8(b + idx, v.val[3]);
+  }
+#endif
+  for (; idx < pixels; ++idx) {
+    const uint8_t *pixel = argb + idx * 4;
+    if (a)
+      a[idx] = pixel[0];
+    r[idx] = premultiply ? _WBIcnsPremultiply(pixel[1], pixel[0]) : pixel[1];
+    g[idx] = premultiply ? _WBIcnsPremultiply(pixel[2], pixel[0]) : pixel[2];
+    b[idx] = premultiply ? _WBIcnsPremultiply(pixel[3], pixel[0]) : pixel[3];
+  }
+}
+
+void WBIcnsDeinterleaveARGB(const uint8_t *argb, size_t pixels, bool premultiply,
+                            uint8_t *a, uint8_t *r, uint8_t *g, uint8_t *b) {
+  if (premultiply)
+    _WBIcnsDeinterleave(argb, pixels, true, a, r, g, b);
+  else
+    _WBIcnsDeinterleave(argb, pixels, false, a, r, g, b);
+}
+
+#pragma mark Swizzle
+void WBIcnsSwizzleRGBAToARGB(const uint8_t *src, uint8_t *dst, size_t pixels) {
+  size_t idx = 0;
+#if defined(WB_ICNS_SSE2)
+  /* little endian rotate left by 8 */
+  for (; idx + 4 <= pixels; idx += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + idx * 4));
+    _mm_storeu_si128((__m128i *)(dst + idx * 4), _mm_or_si128(_mm_slli_epi32(v, 8), _mm_srli_epi32(v, 24)));
+  }
+#elif defined(WB_ICNS_NEON)
+  for (; idx + 16 <= pixels; idx += 16) {
+    uint8x16x4_t v = vld4q_u8(src + idx * 4);
+    uint8x16x4_t out = { { v.val[3], v.val[0], v.val[1], v.val[2] } };
+    vst4q_u8(dst + idx * 4, out);
+  }
+#endif
+  for (; idx < pixels; ++idx) {
+    const uint8_t *pixel = src + idx * 4;
+    _WBIcnsStorePixel(dst + idx * 4, pixel[3], pixel[0], pixel[1], pixel[2]);
+  }
+}
+
+void WBIcnsSwizzleARGBToRGBA(const uint8_t *src, uint8_t *dst, size_t pixels) {
+  size_t idx = 0;
+#if defined(WB_ICNS_SSE2)
+  for (; idx + 4 <= pixels; idx += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + idx * 4));
+    _mm_storeu_si128((__m128i *)(dst + idx * 4), _mm_or_si128(_mm_srli_epi32(v, 8), _mm_slli_epi32(v, 24)));
+  }
+#elif defined(WB_ICNS_NEON)
+  for (; idx + 16 <= pixels; idx += 16) {
+    uint8x16x4_t v = vld4q_u8(src + idx * 4);
+    uint8x16x4_t out = { { v.val[1], v.val[2], v.val[3], v.val[0] } };
+    vst4q_u8(dst + idx * 4, out);
+  }
+#endif
+  for (; idx < pixels; ++idx) {
+    const uint8_t *pixel = src + idx * 4;
+    uint8_t alpha = pixel[0];
+    dst[idx * 4] = pixel[1];
+    dst[idx * 4 + 1] = pixel[2];
+    dst[idx * 4 + 2] = pixel[3];
+    dst[idx * 4 + 3] = alpha;
+  }
+}
+
+#pragma mark Premultiply
+void WBIcnsUnpremultiplyARGB(uint8_t *argb, size_t pixels) {
+  size_t idx = 0;
+  while (idx < pixels) {
+    /* Most icon pixels are either opaque or transparent, and do not change */
+#if defined(WB_ICNS_SSE2)
+    for (; idx + 4 <= pixels; idx += 4) {
+      __m128i alpha = _mm_and_si128(_mm_loadu_si128((const __m128i *)(argb + idx * 4)), _mm_set1_epi32(0xff));
+      __m128i unchanged = _mm_or_si128(_mm_cmpeq_epi32(alpha, _mm_setzero_si128()), _mm_cmpeq_epi32(alpha, _mm_set1_epi32(0xff)));
+      if (_mm_movemask_epi8(unchanged) != 0xffff)
+        break;
+    }
+#elif defined(WB_ICNS_NEON)
+    for (; idx + 16 <= pixels; idx += 16) {
+      uint8x16_t alpha = vld4q_u8(argb + idx * 4).val[0];
+      uint8x16_t unchanged = vorrq_u8(vceqq_u8(alpha, vdupq_n_u8(0)), vceqq_u8(alpha, vdupq_n_u8(0xff)));
+      if (vminvq_u8(unchanged) != 0xff)
+        break;
+    }
+#endif
+    /* At least one vector of scalar pixels */
+    size_t end = idx + 16 < pixels ? idx + 16 : pixels;
+    for (; idx < end; ++idx) {
+      uint8_t *pixel = argb + idx * 4;
+      uint8_t alpha = pixel[0];
+      if (alpha != 0 && alpha != 255) {
+        pixel[1] = _WBIcnsUnpremultiply(pixel[1], alpha);
+        pixel[2] = _WBIcnsUnpremultiply(pixel[2], alpha);
+        pixel[3] = _WBIcnsUnpremultiply(pixel[3], alpha);
+      }
+    }
+  }
+}
+
+void WBIcnsPremultiplyARGB(uint8_t *argb, size_t pixels) {
+  size_t idx = 0;
+#if defined(WB_ICNS_SSE2)
+  for (; idx + 4 <= pixels; idx += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(argb + idx * 4));
+    _mm_storeu_si128((__m128i *)(argb + idx * 4), _WBIcnsPremultiply4(v));
+  }
+#endif
+  for (; idx < pixels; ++idx) {
+    uint8_t *pixel = argb + idx * 4;
+    pixel[1] = _WBIcnsPremultiply(pixel[1], pixel[0]);
+    pixel[2] = _WBIcnsPremultiply(pixel[2], pixel[0]);
+    pixel[3] = _WBIcnsPremultiply(pixel[3], pixel[0]);
+  }
+}
+
+#pragma mark Rows
+// Row functions: planes are the row start of each plane, color components first,
+// then alpha (the alpha plane is moved at the end for alpha first planar layouts).
+typedef void (*WBIcnsRowFunction)(const uint8_t * const planes[], uint8_t *argb, size_t width);
+
+/* 8 bits gray, or planar gray without alpha */
+static void _WBIcnsRowGray(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsInterleave(NULL, planes[0], planes[0], planes[0], argb, width, false);
+}
+
+static void _WBIcnsRowPlanarGrayAlpha(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsInterleave(planes[1], planes[0], planes[0], planes[0], argb, width, true);
+}
+
+/* interleaved gray and alpha */
+WB_INLINE
+void _WBIcnsRowGrayAlpha(const uint8_t *src, uint8_t *argb, size_t width, bool alphaFirst) {
+  size_t idx = 0;
+#if defined(WB_ICNS_SSE2)
+  for (; idx + 8 <= width; idx += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + idx * 2));
+    /* 16 bits lanes: alpha in the low byte, gray in the high byte */
+    __m128i ag = alphaFirst ? v : _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    __m128i gray = _mm_srli_epi16(ag, 8);
+    __m128i gg = _mm_or_si128(gray, _mm_slli_epi16(gray, 8));
+    _mm_storeu_si128((__m128i *)(argb + idx * 4), _mm_unpacklo_epi16(ag, gg));
+    _mm_storeu_si128((__m128i *)(argb + idx * 4 + 16), _mm_unpackhi_epi16(ag, gg));
+  }
+#elif defined(WB_ICNS_NEON)
+  for (; idx + 16 <= width; idx += 16) {
+    uint8x16x2_t v = vld2q_u8(src + idx * 2);
+    uint8x16_t gray = v.val[alphaFirst ? 1 : 0];
+    uint8x16x4_t out = { { v.val[alphaFirst ? 0 : 1], gray, gray, gray } };
+    vst4q_u8(argb + idx * 4, out);
+  }
+#endif
+  for (; idx < width; ++idx) {
+    uint8_t gray = src[idx * 2 + (alphaFirst ? 1 : 0)];
+    _WBIcnsStorePixel(argb + idx * 4, src[idx * 2 + (alphaFirst ? 0 : 1)], gray, gray, gray);
+  }
+}
+
+static void _WBIcnsRowGrayAlphaLast(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsRowGrayAlpha(planes[0], argb, width, false);
+}
+
+static void _WBIcnsRowAlphaGray(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsRowGrayAlpha(planes[0], argb, width, true);
+}
+
+/* 24 bits RGB */
+static void _WBIcnsRowRGB(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  const uint8_t *src = planes[0];
+  for (size_t idx = 0; idx < width; ++idx, src += 3)
+    _WBIcnsStorePixel(argb + idx * 4, 0, src[0], src[1], src[2]);
+}
+
+static void _WBIcnsRowRGBA(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  WBIcnsSwizzleRGBAToARGB(planes[0], argb, width);
+}
+
+static void _WBIcnsRowARGB(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  memcpy(argb, planes[0], width * 4);
+}
+
+static void _WBIcnsRowPlanarRGB(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsInterleave(NULL, planes[0], planes[1], planes[2], argb, width, false);
+}
+
+static void _WBIcnsRowPlanarRGBA(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsInterleave(planes[3], planes[0], planes[1], planes[2], argb, width, true);
+}
+
+/* 32 bits CMYK */
+static void _WBIcnsRowCMYK(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  const uint8_t *src = planes[0];
+  size_t idx = 0;
+#if defined(WB_ICNS_SSE2)
+  for (; idx + 4 <= width; idx += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + idx * 4));
+    /* broadcast black in each pixel */
+    __m128i black = _mm_srli_epi32(v, 24);
+    black = _mm_or_si128(black, _mm_slli_epi32(black, 8));
+    black = _mm_or_si128(black, _mm_slli_epi32(black, 16));
+    /* r g b x -> 0 r g b */
+    _mm_storeu_si128((__m128i *)(argb + idx * 4), _mm_slli_epi32(_WBIcnsCMYKToRGB16(v, black), 8));
+  }
+#elif defined(WB_ICNS_NEON)
+  for (; idx + 16 <= width; idx += 16) {
+    uint8x16x4_t v = vld4q_u8(src + idx * 4);
+    uint8x16x4_t out;
+    out.val[0] = vdupq_n_u8(0);
+    out.val[1] = vmvnq_u8(vqaddq_u8(v.val[0], v.val[3]));
+    out.val[2] = vmvnq_u8(vqaddq_u8(v.val[1], v.val[3]));
+    out.val[3] = vmvnq_u8(vqaddq_u8(v.val[2], v.val[3]));
+    vst4q_u8(argb + idx * 4, out);
+  }
+#endif
+  for (; idx < width; ++idx) {
+    const uint8_t *pixel = src + idx * 4;
+    _WBIcnsStorePixel(argb + idx * 4, 0, _WBIcnsCMYKToRGB(pixel[0], pixel[3]),
+                      _WBIcnsCMYKToRGB(pixel[1], pixel[3]), _WBIcnsCMYKToRGB(pixel[2], pixel[3]));
+  }
+}
+
+/* 40 bits CMYK with alpha */
+WB_INLINE
+void _WBIcnsRowCMYKAlpha(const uint8_t *src, uint8_t *argb, size_t width, bool alphaFirst) {
+  const size_t color = alphaFirst ? 1 : 0;
+  for (size_t idx = 0; idx < width; ++idx, src += 5) {
+    const uint8_t *cmyk = src + color;
+    _WBIcnsStorePixel(argb + idx * 4, src[alphaFirst ? 0 : 4], _WBIcnsCMYKToRGB(cmyk[0], cmyk[3]),
+                      _WBIcnsCMYKToRGB(cmyk[1], cmyk[3]), _WBIcnsCMYKToRGB(cmyk[2], cmyk[3]));
+  }
+}
+
+static void _WBIcnsRowCMYKA(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsRowCMYKAlpha(planes[0], argb, width, false);
+}
+
+static void _WBIcnsRowACMYK(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsRowCMYKAlpha(planes[0], argb, width, true);
+}
+
+WB_INLINE
+void _WBIcnsRowPlanarCMYKAlpha(const uint8_t * const planes[], uint8_t *argb, size_t width, bool alpha) {
+  const uint8_t *c = planes[0], *m = planes[1], *y = planes[2], *k = planes[3];
+  size_t idx = 0;
+#if defined(WB_ICNS_SSE2)
+  for (; idx + 16 <= width; idx += 16) {
+    __m128i black = _mm_loadu_si128((const __m128i *)(k + idx));
+    _WBIcnsStoreARGB16(argb + idx * 4, alpha ? _mm_loadu_si128((const __m128i *)(planes[4] + idx)) : _mm_setzero_si128(),
+                       _WBIcnsCMYKToRGB16(_mm_loadu_si128((const __m128i *)(c + idx)), black),
+                       _WBIcnsCMYKToRGB16(_mm_loadu_si128((const __m128i *)(m + idx)), black),
+                       _WBIcnsCMYKToRGB16(_mm_loadu_si128((const __m128i *)(y + idx)), black));
+  }
+#elif defined(WB_ICNS_NEON)
+  for (; idx + 16 <= width; idx += 16) {
+    uint8x16_t black = vld1q_u8(k + idx);
+    uint8x16x4_t out;
+    out.val[0] = alpha ? vld1q_u8(planes[4] + idx) : vdupq_n_u8(0);
+    out.val[1] = vmvnq_u8(vqaddq_u8(vld1q_u8(c + idx), black));
+    out.val[2] = vmvnq_u8(vqaddq_u8(vld1q_u8(m + idx), black));
+    out.val[3] = vmvnq_u8(vqaddq_u8(vld1q_u8(y + idx), black));
+    vst4q_u8(argb + idx * 4, out);
+  }
+#endif
+  for (; idx < width; ++idx) {
+    _WBIcnsStorePixel(argb + idx * 4, alpha ? planes[4][idx] : 0, _WBIcnsCMYKToRGB(c[idx], k[idx]),
+                      _WBIcnsCMYKToRGB(m[idx], k[idx]), _WBIcnsCMYKToRGB(y[idx], k[idx]));
+  }
+}
+
+static void _WBIcnsRowPlanarCMYK(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsRowPlanarCMYKAlpha(planes, argb, width, false);
+}
+
+static void _WBIcnsRowPlanarCMYKA(const uint8_t * const planes[], uint8_t *argb, size_t width) {
+  _WBIcnsRowPlanarCMYKAlpha(planes, argb, width, true);
+}
+
+static WBIcnsRowFunction _WBIcnsGetRowFunction(const WBIcnsPixelLayout *layout) {
+  switch (layout->components) {
+    case 1:
+      if (layout->planar || !layout->alpha)
+        return layout->alpha ? _WBIcnsRowPlanarGrayAlpha : _WBIcnsRowGray;
+      return layout->alphaFirst ? _WBIcnsRowAlphaGray : _WBIcnsRowGrayAlphaLast;
+    case 3:
+      if (layout->planar)
+        return layout->alpha ? _WBIcnsRowPlanarRGBA : _WBIcnsRowPlanarRGB;
+      if (!layout->alpha)
+        return _WBIcnsRowRGB;
+      return layout->alphaFirst ? _WBIcnsRowARGB : _WBIcnsRowRGBA;
+    case 4:
+      if (layout->planar)
+        return layout->alpha ? _WBIcnsRowPlanarCMYKA : _WBIcnsRowPlanarCMYK;
+      if (!layout->alpha)
+        return _WBIcnsRowCMYK;
+      return layout->alphaFirst ? _WBIcnsRowACMYK : _WBIcnsRowCMYKA;
+  }
+  return NULL;
+}
+
+bool WBIcnsConvertToARGB(const WBIcnsPixelLayout *layout, const uint8_t * const planes[], size_t bytesPerRow,
+                         size_t width, size_t height, uint8_t *argb) {
+  WBIcnsRowFunction row = _WBIcnsGetRowFunction(layout);
+  if (!row)
+    return false;
+
+  const uint8_t *rows[5] = { planes[0] };
+  size_t count = 1;
+  if (layout->planar) {
+    count = layout->components + (layout->alpha ? 1 : 0);
+    for (size_t idx = 0; idx < count; ++idx)
+      rows[idx] = planes[idx];
+    /* color planes first */
+    if (layout->alpha && layout->alphaFirst) {
+      memmove(rows, rows + 1, layout->components * sizeof(*rows));
+      rows[layout->components] = planes[0];
+    }
+  }
+  bool unpremultiply = layout->alpha && layout->premultiplied;
+  for (size_t line = 0; line < height; ++line) {
+    uint8_t *dest = argb + line * width * 4;
+    row(rows, dest, width);
+    /* while the row is in cache */
+    if (unpremultiply)
+      WBIcnsUnpremultiplyARGB(dest, width);
+    for (size_t idx = 0; idx < count; ++idx)
+      rows[idx] += bytesPerRow;
+  }
+  return true;
+}
+
+#pragma mark Downsample
+/* 2 x 2 average, rounded to nearest */
+static void _WBIcnsHalveARGB(const uint8_t *src, size_t srcWidth, uint8_t *dst, size_t width, size_t height) {
+  for (size_t line = 0; line < height; ++line) {
+    const uint8_t *row0 = src + line * 2 * srcWidth * 4, *row1 = row0 + srcWidth * 4;
+    uint8_t *out = dst + line * width * 4;
+    size_t x = 0;
+#if defined(WB_ICNS_SSE2)
+    const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+    for (; x + 4 <= width; x += 4) {
+      __m128i sums[2];
+      for (int half = 0; half < 2; ++half) {
+        __m128i top = _mm_loadu_si128((const __m128i *)(row0 + x * 8 + half * 16));
+        __m128i bottom = _mm_loadu_si128((const __m128i *)(row1 + x * 8 + half * 16));
+        /* vertical sums of pixels 0 1 | 2 3 */
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+        __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+        sums[half] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+      }
+      _mm_storeu_si128((__m128i *)(out + x * 4), _mm_packus_epi16(sums[0], sums[1]));
+    }
+#elif defined(WB_ICNS_NEON)
+    for (; x + 8 <= width; x += 8) {
+      uint8x16x4_t top = vld4q_u8(row0 + x * 8), bottom = vld4q_u8(row1 + x * 8);
+      uint8x8x4_t result;
+      for (int c = 0; c < 4; ++c)
+        result.val[c] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(top.val[c]), vpaddlq_u8(bottom.val[c])), 2);
+      vst4_u8(out + x * 4, result);
+    }
+#endif
+    for (; x < width; ++x) {
+      for (int c = 0; c < 4; ++c)
+        out[x * 4 + c] = (uint8_t)((row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c] + 2) >> 2);
+    }
+  }
+}
+
+typedef struct _WBIcnsSpan {
+  size_t start;
+  size_t count;
+} WBIcnsSpan;
+
+/* Source pixels covered by each destination pixel, and their coverage (16 bits fixed point, summing to 65536) */
+static void _WBIcnsGetAreaWeights(size_t srcLength, size_t length, WBIcnsSpan *spans, uint32_t *weights, size_t stride) {
+  for (size_t idx = 0; idx < length; ++idx) {
+    /* in 1 / length source pixel units */
+    size_t start = idx * srcLength, end = start + srcLength;
+    WBIcnsSpan *span = spans + idx;
+    uint32_t *weight = weights + idx * stride;
+    span->start = start / length;
+    span->count = 0;
+    uint32_t total = 0, largest = 0;
+    for (size_t pixel = span->start; pixel * length < end; ++pixel) {
+      size_t from = pixel * length > start ? pixel * length : start;
+      size_t to = (pixel + 1) * length < end ? (pixel + 1) * length : end;
+      weight[span->count] = (uint32_t)(((to - from) * 65536 + srcLength / 2) / srcLength);
+      total += weight[span->count];
+      if (weight[span->count] > weight[largest])
+        largest = (uint32_t)span->count;
+      span->count++;
+    }
+    weight[largest] += 65536 - total;
+  }
+}
+
+/* Box filter with fractional coverage, horizontal pass then vertical pass */
+static bool _WBIcnsAreaAverageARGB(const uint8_t *src, size_t srcWidth, size_t srcHeight, uint8_t *dst, size_t width, size_t height) {
+  size_t xstride = (srcWidth + width - 1) / width + 1, ystride = (srcHeight + height - 1) / height + 1;
+  WBIcnsSpan *xspans = malloc(width * sizeof(*xspans)), *yspans = malloc(height * sizeof(*yspans));
+  uint32_t *xweights = malloc(width * xstride * sizeof(*xweights)), *yweights = malloc(height * ystride * sizeof(*yweights));
+  /* 8.8 fixed point samples */
+  uint32_t *columns = malloc(srcHeight * width * 4 * sizeof(*columns));
+  bool ok = xspans && yspans && xweights && yweights && columns;
+  if (ok) {
+    _WBIcnsGetAreaWeights(srcWidth, width, xspans, xweights, xstride);
+    _WBIcnsGetAreaWeights(srcHeight, height, yspans, yweights, ystride);
+    for (size_t line = 0; line < srcHeight; ++line) {
+      const uint8_t *row = src + line * srcWidth * 4;
+      uint32_t *out = columns + line * width * 4;
+      for (size_t x = 0; x < width; ++x) {
+        const uint8_t *pixel = row + xspans[x].start * 4;
+        const uint32_t *weight = xweights + x * xstride;
+        uint32_t sums[4] = { 128, 128, 128, 128 };
+        for (size_t idx = 0; idx < xspans[x].count; ++idx) {
+          for (int c = 0; c < 4; ++c)
+            sums[c] += weight[idx] * pixel[idx * 4 + c];
+        }
+        for (int c = 0; c < 4; ++c)
+          out[x * 4 + c] = sums[c] >> 8;
+      }
+    }
+    /* 65536 * 65280 + 2^23 fits in 32 bits */
+    for (size_t line = 0; line < height; ++line) {
+      const uint32_t *weight = yweights + line * ystride;
+      uint8_t *out = dst + line * width * 4;
+      for (size_t x = 0; x < width * 4; ++x) {
+        const uint32_t *sample = columns + yspans[line].start * width * 4 + x;
+        uint32_t sum = 1 << 23;
+        for (size_t idx = 0; idx < yspans[line].count; ++idx)
+          sum += weight[idx] * sample[idx * width * 4];
+        out[x] = (uint8_t)(sum >> 24);
+      }
+    }
+  }
+  free(columns);
+  free(yweights);
+  free(xweights);
+  free(yspans);
+  free(xspans);
+  return ok;
+}
+
+bool WBIcnsDownsampleARGB(const uint8_t *src, size_t srcWidth, size_t srcHeight, uint8_t *dst, size_t width, size_t height) {
+  if (!width || !height || width > srcWidth || height > srcHeight)
+    return false;
+  if (width == srcWidth && height == srcHeight) {
+    memcpy(dst, src, width * height * 4);
+  } else if (width * 2 == srcWidth && height * 2 == srcHeight) {
+    _WBIcnsHalveARGB(src, srcWidth, dst, width, height);
+  } else {
+    return _WBIcnsAreaAverageARGB(src, srcWidth, srcHeight, dst, width, height);
+  }
+  return true;
+}
@@ -0,0 +1,89 @@
+/*
+ *  WBIcnsPixels.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#if !defined(__WB_ICNS_PIXELS_H)
+#define __WB_ICNS_PIXELS_H 1
+
+#if __has_include(<WonderBox/WBBase.h>)
+#  include <WonderBox/WBBase.h>
+#else
+#  include "../WBBase.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Pixel conversion kernels used by the icns codec.
+//
+// They use SSE2 (x86) or NEON (arm64), and only depend on the C library, so
+// they can be used (and benchmarked) without the system icon APIs.
+// The conversion function is selected once per image from the source layout,
+// so the kernels never test the layout per pixel.
+//
+// ARGB buffers are interleaved 8 bits per sample, alpha first.
+
+/* Layout of a 8 bits per sample bitmap */
+typedef struct _WBIcnsPixelLayout {
+  /* color components: 1 (gray), 3 (RGB) or 4 (CMYK) */
+  uint32_t components;
+  bool alpha;
+  bool alphaFirst;
+  bool planar;
+  bool premultiplied;
+} WBIcnsPixelLayout;
+
+/*!
+  @function
+  @abstract Converts a bitmap to non premultiplied ARGB.
+  @discussion CMYK is converted using red = 255 - (cyan + black). Without alpha, the alpha bytes are 0.
+  @param planes For planar layouts, one plane by sample, in the bitmap order. Else only planes[0] is used.
+  @param bytesPerRow Bytes per row of each plane.
+  @param argb width * height * 4 bytes.
+  @result false if the layout is not supported.
+*/
+WB_PRIVATE
+bool WBIcnsConvertToARGB(const WBIcnsPixelLayout *layout, const uint8_t * const planes[], size_t bytesPerRow,
+                         size_t width, size_t height, uint8_t *argb);
+
+/* Premultiplied ARGB to non premultiplied ARGB, in place. Pixels with a 0 alpha are not modified. */
+WB_PRIVATE
+void WBIcnsUnpremultiplyARGB(uint8_t *argb, size_t pixels);
+/* Non premultiplied ARGB to premultiplied ARGB, in place. */
+WB_PRIVATE
+void WBIcnsPremultiplyARGB(uint8_t *argb, size_t pixels);
+
+/* a, r, g, b planes to ARGB. a may be NULL (alpha is then 0) */
+WB_PRIVATE
+void WBIcnsInterleaveARGB(const uint8_t *a, const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                          uint8_t *argb, size_t pixels);
+/* ARGB to a, r, g, b planes. a may be NULL. If premultiply is true, colors are premultiplied by alpha. */
+WB_PRIVATE
+void WBIcnsDeinterleaveARGB(const uint8_t *argb, size_t pixels, bool premultiply,
+                            uint8_t *a, uint8_t *r, uint8_t *g, uint8_t *b);
+
+/* RGBA <-> ARGB. src and dst may be the same buffer */
+WB_PRIVATE
+void WBIcnsSwizzleRGBAToARGB(const uint8_t *src, uint8_t *dst, size_t pixels);
+WB_PRIVATE
+void WBIcnsSwizzleARGBToRGBA(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+/*!
+  @function
+  @abstract Downsamples premultiplied ARGB with an area average (box) filter.
+  @discussion Halving each dimension uses a vectorized 2 x 2 average, other ratios weight the
+  source pixels by their coverage. Colors must be premultiplied so transparent pixels do not bleed.
+  @result false if the destination is larger than the source, or on allocation failure.
+*/
+WB_PRIVATE
+bool WBIcnsDownsampleARGB(const uint8_t *src, size_t srcWidth, size_t srcHeight,
+                          uint8_t *dst, size_t width, size_t height);
+
+#endif /* __WB_ICNS_PIXELS_H */
@@ -248,11 +248,14 @@ WB_OBJC_EXPORT
 
   /*!
     @method     setIconFamilyElements:fromImage:
-    @abstract   (brief description)
-    @discussion This methods create one bitmap resized representation per Elements size, so it is
-				more efficient to use it instead of repeatly call setIconFamilyElement:fromBitmap:.
+    @abstract   Sets the elements selected by <em>selector</em> from an image.
+    @discussion The image is drawn once at the largest selected size, and each smaller size is
+				averaged down from a larger one (unless the delegate provides it).
+				The elements are then converted and compressed concurrently,
+				so it is more efficient than repeatly calling setIconFamilyElement:fromBitmap:.
     @param      selector A selector that define which elements you want to set.
     @param      anImage An image in any format.
+    @result     The number of elements set.
 */
 - (NSUInteger)setIconFamilyElements:(WBIconFamilySelector)selector fromImage:(NSImage *)anImage;
 
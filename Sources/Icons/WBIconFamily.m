@@ -9,6 +9,7 @@
  */
 
 #import "WBIcnsCodec.h"
+#import "WBIcnsFormat.h"
 #import <WonderBox/WBIconFamily.h>
 #import <WonderBox/WBIconFunctions.h>
 
@@ -17,6 +18,40 @@
 // #import <WonderBox/WBImageFunctions.h>
 
 #pragma mark -
+enum {
+  kWBIconFamilyLevelCount = 7,
+  kWBIconFamilyElementCount = 11,
+};
+
+static const struct {
+  WBIconFamilySelector selector;
+  OSType type;
+  NSUInteger size;
+} kWBIconFamilyElements[kWBIconFamilyElementCount] = {
+  { kWBSelector1024ARGB, kIconServices1024PixelDataARGB, 1024 },
+  { kWBSelector512ARGB, kIconServices512PixelDataARGB, 512 },
+  { kWBSelector256ARGB, kIconServices256PixelDataARGB, 256 },
+  { kWBSelector128Data, kThumbnail32BitData, 128 },
+  { kWBSelector128Mask, kThumbnail8BitMask, 128 },
+  { kWBSelector48Data, kHuge32BitData, 48 },
+  { kWBSelector48Mask, kHuge8BitMask, 48 },
+  { kWBSelector32Data, kLarge32BitData, 32 },
+  { kWBSelector32Mask, kLarge8BitMask, 32 },
+  { kWBSelector16Data, kSmall32BitData, 16 },
+  { kWBSelector16Mask, kSmall8BitMask, 16 },
+};
+
+typedef struct _WBIconFamilyElementJob {
+  OSType type;
+  size_t level;
+  CFDataRef data;
+} WBIconFamilyElementJob;
+
+static uint8_t *WBIconFamilyRenderImage(NSImage *image, NSUInteger size);
+static uint8_t *WBIconFamilyCopyPremultipliedARGB(NSBitmapImageRep *bitmap);
+static CFDataRef WBIconFamilyCreateElementData(OSType type, const uint8_t *argb, NSUInteger size);
+static IconFamilyHandle WBIconFamilyCreateWithElements(IconFamilyResource *rsrc, const WBIconFamilyElementJob *jobs, size_t count, NSUInteger *added);
+
 static NSMutableArray *WBIconFamilyFindVariants(IconFamilyResource *rsrc);
 static BOOL WBIconFamilyContainsVariant(IconFamilyResource *rsrc, OSType variant);
 static IconFamilyHandle WBIconFamilyCopyVariant(IconFamilyResource *rsrc, OSType variant);
@@ -289,10 +324,8 @@ static BOOL WBIconFamilyRemoveVariant(IconFamilyResource *rsrc, OSType variant,
 - (NSBitmapImageRep *)bitmapForIconFamilyElement:(OSType)anElement withMask:(BOOL)useAlpha {
   /* switch d'element pour trouver la taille et le nbr de bits */
   NSSize size = NSZeroSize;
-  NSUInteger samples = 0;
+  BOOL mask = NO;
   NSData *data = [self dataForIconFamilyElement:anElement];
-  NSData *alpha = nil;
-  unsigned char *planes[5] = {nil, nil, nil, nil, nil};
   if (!data) {
     return nil;
   }
@@ -300,92 +333,78 @@ static BOOL WBIconFamilyRemoveVariant(IconFamilyResource *rsrc, OSType variant,
     /* 1024 x 1024 */
     case kIconServices1024PixelDataARGB:
       size = NSMakeSize(1024, 1024);
-      samples = WBIconFamilyBitmapDataFor32BitData(data, size, planes);
       break;
     /* 512 x 512 */
     case kIconServices512PixelDataARGB:
       size = NSMakeSize(512, 512);
-      samples = WBIconFamilyBitmapDataFor32BitData(data, size, planes);
       break;
     /* 256 x 256 */
     case kIconServices256PixelDataARGB: // 'ic08' 256x256 32-bits ARGB image
       size = NSMakeSize(256, 256);
-      samples = WBIconFamilyBitmapDataFor32BitData(data, size, planes);
       break;
       /* Thumbnail */
     case kThumbnail32BitData:
       size = NSMakeSize(128, 128);
-      samples = WBIconFamilyBitmapDataFor32BitData(data, size, planes);
       break;
     case kThumbnail8BitMask:
-      useAlpha = NO;
+      mask = YES;
       size = NSMakeSize(128, 128);
-      samples = WBIconFamilyBitmapDataFor8BitMask(data, size, planes);
       break;
 
       /* Huge */
     case kHuge32BitData:
       size = NSMakeSize(48, 48);
-      samples = WBIconFamilyBitmapDataFor32BitData(data, size, planes);
       break;
     case kHuge8BitMask:
-      useAlpha = NO;
+      mask = YES;
       size = NSMakeSize(48, 48);
-      samples = WBIconFamilyBitmapDataFor8BitMask(data, size, planes);
       break;
 
       /* Large */
     case kLarge32BitData:
       size = NSMakeSize(32, 32);
-      samples = WBIconFamilyBitmapDataFor32BitData(data, size, planes);
       break;
     case kLarge8BitMask:
-      useAlpha = NO;
+      mask = YES;
       size = NSMakeSize(32, 32);
-      samples = WBIconFamilyBitmapDataFor8BitMask(data, size, planes);
       break;
 
       /* Small */
     case kSmall32BitData:
       size = NSMakeSize(16, 16);
-      samples = WBIconFamilyBitmapDataFor32BitData(data, size, planes);
       break;
     case kSmall8BitMask:
-      useAlpha = NO;
+      mask = YES;
       size = NSMakeSize(16, 16);
-      samples = WBIconFamilyBitmapDataFor8BitMask(data, size, planes);
       break;
 
     default:
       SPXThrowException(NSInvalidArgumentException, @"Unsupported Element type: %@", NSFileTypeForHFSTypeCode(anElement));
   }
-  if (samples > 0) {
-    if (useAlpha && samples == 3) {
-      if (alpha && WBIconFamilyBitmapDataFor8BitMask(alpha, size, planes + samples))
-        samples++;
-    } else if (!useAlpha && samples == 4) {
-      free(planes[3]);
-      samples = 3;
-    }
-    NSBitmapImageRep *bitmap = [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:planes
-                                                                       pixelsWide:size.width
-                                                                       pixelsHigh:size.height
-                                                                    bitsPerSample:8
-                                                                  samplesPerPixel:samples
-                                                                         hasAlpha:(samples == 4)
-                                                                         isPlanar:YES
-                                                                   colorSpaceName:NSDeviceRGBColorSpace
-                                                                     bitmapFormat:(samples == 4) ? NSAlphaNonpremultipliedBitmapFormat : 0
-                                                                      bytesPerRow:size.width
-                                                                     bitsPerPixel:8];
-    if (!bitmap) {
-      for (NSUInteger i = 0; i < samples; i++) {
-        free(planes[i]);
-      }
-    }
-    return [bitmap autorelease];
+  /* The bitmap owns the planes, and the data is converted in place */
+  NSInteger samples = mask ? 1 : (useAlpha ? 4 : 3);
+  NSBitmapImageRep *bitmap = [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL
+                                                                     pixelsWide:size.width
+                                                                     pixelsHigh:size.height
+                                                                  bitsPerSample:8
+                                                                samplesPerPixel:samples
+                                                                       hasAlpha:(samples == 4)
+                                                                       isPlanar:YES
+                                                                 colorSpaceName:mask ? NSDeviceWhiteColorSpace : NSDeviceRGBColorSpace
+                                                                   bitmapFormat:0
+                                                                    bytesPerRow:size.width
+                                                                   bitsPerPixel:8];
+  if (!bitmap) {
+    return nil;
   }
-  return nil;
+  unsigned char *planes[5] = {nil, nil, nil, nil, nil};
+  [bitmap getBitmapDataPlanes:planes];
+  NSUInteger filled = mask ? WBIconFamilyBitmapDataFor8BitMask(data, size, planes) : WBIconFamilyBitmapDataFor32BitData(data, size, planes);
+  if (filled != (NSUInteger)samples) {
+    [bitmap release];
+    return nil;
+  }
+  return [bitmap autorelease];
 }
 
 - (BOOL)setIconFamilyElement:(OSType)anElement fromData:(NSData *)data {
@@ -447,49 +466,72 @@ static BOOL WBIconFamilyRemoveVariant(IconFamilyResource *rsrc, OSType variant,
 }
 
 - (NSUInteger)setIconFamilyElements:(WBIconFamilySelector)selector fromImage:(NSImage *)anImage {
-  id bitmap = nil;
-  NSUInteger count = 0;
-  /* 512 x 512 */
-  if (selector & kWBSelector1024ARGB) {
-    bitmap = [self scaleImage:anImage toSize:NSMakeSize(1024, 1024)];
-    count += [self setIconFamilyElement:kIconServices1024PixelDataARGB fromBitmap:bitmap] ? 1 : 0;
-  }
-  /* 512 x 512 */
-  if (selector & kWBSelector512ARGB) {
-    bitmap = [self scaleImage:anImage toSize:NSMakeSize(512, 512)];
-    count += [self setIconFamilyElement:kIconServices512PixelDataARGB fromBitmap:bitmap] ? 1 : 0;
-  }
-  /* 256 x 256 */
-  if (selector & kWBSelector256ARGB) {
-    bitmap = [self scaleImage:anImage toSize:NSMakeSize(256, 256)];
-    count += [self setIconFamilyElement:kIconServices256PixelDataARGB fromBitmap:bitmap] ? 1 : 0;
-  }
-  /* Thumbnails */
-  if (selector & kWBSelector128) {
-    bitmap = [self scaleImage:anImage toSize:NSMakeSize(128, 128)];
-    if (selector & kWBSelector128Data) count += [self setIconFamilyElement:kThumbnail32BitData fromBitmap:bitmap] ? 1 : 0;
-    if (selector & kWBSelector128Mask) count += [self setIconFamilyElement:kThumbnail8BitMask fromBitmap:bitmap] ? 1 : 0;
-  }
-
-  if (selector & kWBSelector48) {
-    bitmap = [self scaleImage:anImage toSize:NSMakeSize(48, 48)];
-    if (selector & kWBSelector48Data) count += [self setIconFamilyElement:kHuge32BitData fromBitmap:bitmap] ? 1 : 0;
-    if (selector & kWBSelector48Mask) count += [self setIconFamilyElement:kHuge8BitMask fromBitmap:bitmap] ? 1 : 0;
+  /* Largest first: each level is scaled down from a larger one */
+  NSUInteger levels[kWBIconFamilyLevelCount];
+  uint8_t *pixels[kWBIconFamilyLevelCount];
+  WBIconFamilyElementJob jobs[kWBIconFamilyElementCount];
+  size_t count = 0, levelCount = 0;
+  for (size_t idx = 0; idx < kWBIconFamilyElementCount; ++idx) {
+    if (selector & kWBIconFamilyElements[idx].selector) {
+      NSUInteger size = kWBIconFamilyElements[idx].size;
+      if (!levelCount || levels[levelCount - 1] != size)
+        levels[levelCount++] = size;
+      jobs[count++] = (WBIconFamilyElementJob){ kWBIconFamilyElements[idx].type, levelCount - 1, NULL };
+    }
   }
-
-  if (selector & kWBSelector32) {
-    bitmap = [self scaleImage:anImage toSize:NSMakeSize(32, 32)];
-    if (selector & kWBSelector32Data) count += [self setIconFamilyElement:kLarge32BitData fromBitmap:bitmap] ? 1 : 0;
-    if (selector & kWBSelector32Mask) count += [self setIconFamilyElement:kLarge8BitMask fromBitmap:bitmap] ? 1 : 0;
+  if (!count)
+    return 0;
+
+  /* The delegate may provide any level. The others are scaled from the smallest level
+   at least twice as large (or from the largest one), so each pixel is filtered once. */
+  for (size_t level = 0; level < levelCount; ++level) {
+    NSUInteger size = levels[level];
+    NSBitmapImageRep *bitmap = [self scaleImage:anImage toSize:NSMakeSize(size, size)];
+    if (bitmap && (NSUInteger)[bitmap pixelsWide] == size && (NSUInteger)[bitmap pixelsHigh] == size) {
+      pixels[level] = WBIconFamilyCopyPremultipliedARGB(bitmap);
+    } else if (0 == level) {
+      pixels[level] = WBIconFamilyRenderImage(anImage, size);
+    } else {
+      size_t source = 0;
+      for (size_t idx = level; idx-- > 0;) {
+        if (pixels[idx] && levels[idx] >= size * 2) {
+          source = idx;
+          break;
+        }
+      }
+      pixels[level] = pixels[source] ? malloc(size * size * 4) : NULL;
+      if (pixels[level] && !WBIcnsDownsampleARGB(pixels[source], levels[source], levels[source], pixels[level], size, size)) {
+        free(pixels[level]);
+        pixels[level] = NULL;
+      }
+    }
   }
 
-  if (selector & kWBSelector16) {
-    bitmap = [self scaleImage:anImage toSize:NSMakeSize(16, 16)];
-    if (selector & kWBSelector16Data) count += [self setIconFamilyElement:kSmall32BitData fromBitmap:bitmap] ? 1 : 0;
-    if (selector & kWBSelector16Mask) count += [self setIconFamilyElement:kSmall8BitMask fromBitmap:bitmap] ? 1 : 0;
-  }
+  /* Elements are independent: convert and compress them concurrently */
+  WBIconFamilyElementJob *elements = jobs;
+  uint8_t * const *buffers = pixels;
+  const NSUInteger *sizes = levels;
+  dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t idx) {
+    const uint8_t *argb = buffers[elements[idx].level];
+    if (argb)
+      elements[idx].data = WBIconFamilyCreateElementData(elements[idx].type, argb, sizes[elements[idx].level]);
+  });
+  for (size_t level = 0; level < levelCount; ++level)
+    free(pixels[level]);
 
-  return count;
+  NSUInteger result = 0;
+  HLock((Handle)wb_family);
+  IconFamilyHandle family = WBIconFamilyCreateWithElements(WBIconFamilyGetFamilyResource(wb_family), jobs, count, &result);
+  HUnlock((Handle)wb_family);
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (jobs[idx].data)
+      CFRelease(jobs[idx].data);
+  }
+  if (!family)
+    return 0;
+  [self setFamilyHandle:family];
+  DisposeHandle((Handle)family);
+  return result;
 }
 
 - (BOOL)setIconFamilyElement:(OSType)anElement fromBitmap:(NSBitmapImageRep *)bitmap {
@@ -745,3 +787,143 @@ static BOOL WBIconFamilyRemoveVariant(IconFamilyResource *rsrc, OSType aVariant,
   HUnlock((Handle)result);
   return YES;
 }
+
+#pragma mark -
+#pragma mark Elements Generation
+/* Premultiplied ARGB, drawn with high quality interpolation */
+static uint8_t *WBIconFamilyRenderImage(NSImage *image, NSUInteger size) {
+  if (!image) return NULL;
+  NSBitmapImageRep *bitmap = [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL
+                                                                     pixelsWide:size
+                                                                     pixelsHigh:size
+                                                                  bitsPerSample:8
+                                                                samplesPerPixel:4
+                                                                       hasAlpha:YES
+                                                                       isPlanar:NO
+                                                                 colorSpaceName:NSDeviceRGBColorSpace
+                                                                   bitmapFormat:0
+                                                                    bytesPerRow:size * 4
+                                                                   bitsPerPixel:32];
+  if (!bitmap) return NULL;
+  [NSGraphicsContext saveGraphicsState];
+  NSGraphicsContext *ctxt = [NSGraphicsContext graphicsContextWithBitmapImageRep:bitmap];
+  [NSGraphicsContext setCurrentContext:ctxt];
+  [ctxt setImageInterpolation:NSImageInterpolationHigh];
+  [image drawInRect:NSMakeRect(0, 0, size, size) fromRect:NSZeroRect operation:NSCompositeCopy fraction:1];
+  [NSGraphicsContext restoreGraphicsState];
+
+  uint8_t *argb = malloc(size * size * 4);
+  if (argb)
+    WBIcnsSwizzleRGBAToARGB([bitmap bitmapData], argb, size * size);
+  [bitmap release];
+  return argb;
+}
+
+static uint8_t *WBIconFamilyCopyPremultipliedARGB(NSBitmapImageRep *bitmap) {
+  Handle handle = WBIconFamilyGet32BitDataForBitmap(bitmap);
+  if (!handle) return NULL;
+  size_t pixels = [bitmap pixelsWide] * [bitmap pixelsHigh];
+  uint8_t *argb = malloc(pixels * 4);
+  if (argb) {
+    memcpy(argb, *handle, pixels * 4);
+    /* opaque bitmaps have a 0 alpha */
+    if (![bitmap hasAlpha]) {
+      for (size_t idx = 0; idx < pixels; ++idx)
+        argb[idx * 4] = 255;
+    } else {
+      WBIcnsPremultiplyARGB(argb, pixels);
+    }
+  }
+  DisposeHandle(handle);
+  return argb;
+}
+
+static CFDataRef WBIconFamilyCreatePNGData(const uint8_t *argb, NSUInteger size) {
+  CFMutableDataRef data = NULL;
+  CGColorSpaceRef space = CGColorSpaceCreateDeviceRGB();
+  CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, argb, size * size * 4, NULL);
+  CGImageRef image = CGImageCreate(size, size, 8, 32, size * 4, space, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Big,
+                                   provider, NULL, false, kCGRenderingIntentDefault);
+  if (image) {
+    data = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    CGImageDestinationRef dest = CGImageDestinationCreateWithData(data, kUTTypePNG, 1, NULL);
+    bool ok = false;
+    if (dest) {
+      CGImageDestinationAddImage(dest, image, NULL);
+      ok = CGImageDestinationFinalize(dest);
+      CFRelease(dest);
+    }
+    if (!ok) {
+      CFRelease(data);
+      data = NULL;
+    }
+    CGImageRelease(image);
+  }
+  CGDataProviderRelease(provider);
+  CGColorSpaceRelease(space);
+  return data;
+}
+
+/* Element data, as stored in the family. Safe to call concurrently. */
+static CFDataRef WBIconFamilyCreateElementData(OSType type, const uint8_t *argb, NSUInteger size) {
+  /* 256 x 256 and larger elements are PNG */
+  if (kWBIcnsElementOther == WBIcnsGetElementInfo(type).kind)
+    return WBIconFamilyCreatePNGData(argb, size);
+
+  size_t pixels = size * size;
+  uint8_t *colors = malloc(pixels * 4);
+  CFMutableDataRef data = CFDataCreateMutable(kCFAllocatorDefault, 0);
+  if (colors && data) {
+    memcpy(colors, argb, pixels * 4);
+    WBIcnsUnpremultiplyARGB(colors, pixels);
+    CFDataSetLength(data, WBIcnsElementMaxEncodedLength(type));
+    CFDataSetLength(data, WBIcnsEncodeElement(type, colors, CFDataGetMutableBytePtr(data)));
+  }
+  free(colors);
+  if (data && !CFDataGetLength(data)) {
+    CFRelease(data);
+    data = NULL;
+  }
+  return data;
+}
+
+/* Copy rsrc, replacing the elements of the same type (variants are not modified) */
+static IconFamilyHandle WBIconFamilyCreateWithElements(IconFamilyResource *rsrc, const WBIconFamilyElementJob *jobs, size_t count, NSUInteger *added) {
+  IconFamilyHandle result = (IconFamilyHandle)NewHandle(0);
+  if (!result) return NULL;
+  OSErr err = PtrAndHand(rsrc, (Handle)result, 8); // Copy header
+
+  WBIconFamilyIterator iterator;
+  IconFamilyElement *elt = NULL;
+  WBIconFamilyIteratorInit(&iterator, rsrc);
+  while ((elt = WBIconFamilyIteratorNextElement(&iterator))) {
+    OSType type = WBIconFamilyElementGetType(elt);
+    bool replaced = false;
+    for (size_t idx = 0; idx < count && !replaced; ++idx)
+      replaced = jobs[idx].data && jobs[idx].type == type;
+    if (!replaced && noErr == err)
+      err = PtrAndHand(elt, (Handle)result, WBIconFamilyElementGetSize(elt));
+  }
+
+  *added = 0;
+  for (size_t idx = 0; idx < count && noErr == err; ++idx) {
+    if (!jobs[idx].data) continue;
+    CFIndex length = CFDataGetLength(jobs[idx].data);
+    IconFamilyElement header;
+    WBIconFamilyElementSetType(&header, jobs[idx].type);
+    WBIconFamilyElementSetSize(&header, (SInt32)(length + 8));
+    err = PtrAndHand(&header, (Handle)result, 8);
+    if (noErr == err)
+      err = PtrAndHand(CFDataGetBytePtr(jobs[idx].data), (Handle)result, length);
+    if (noErr == err)
+      (*added)++;
+  }
+  if (noErr != err) {
+    DisposeHandle((Handle)result);
+    return NULL;
+  }
+  HLock((Handle)result);
+  WBIconFamilyResourceSetSize(WBIconFamilyGetFamilyResource(result), (SInt32)GetHandleSize((Handle)result));
+  HUnlock((Handle)result);
+  return result;
+}
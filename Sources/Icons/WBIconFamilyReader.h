@@ -0,0 +1,71 @@
+/*
+ *  WBIconFamilyReader.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+/*!
+    @header WBIconFamilyReader
+    @abstract   Read only access to .icns files, decoding elements on demand.
+*/
+
+#import <WonderBox/WBBase.h>
+
+/*!
+    @class		 WBIconFamilyReader
+    @abstract    A lazy .icns file reader.
+    @discussion  The file is mapped in memory and only its table of contents (type and offset of each element)
+				 is read when the reader is created. An element is decoded the first time its bitmap is requested,
+				 and decoded bitmaps are kept in a least recently used cache limited to <em>cacheLimit</em> bytes.
+				 Unlike <em>WBIconFamily</em>, it does not use the system icon APIs.
+				 A reader can be used from several threads.
+*/
+WB_OBJC_EXPORT
+@interface WBIconFamilyReader : NSObject
+
+/*!
+    @method     initWithContentsOfFile:error:
+    @abstract   Maps an .icns file and reads its table of contents.
+    @param      path The full path of an 'icns' file.
+    @param      outError On return, the error if the file cannot be read or is not a valid icns file.
+*/
+- (instancetype)initWithContentsOfFile:(NSString *)path error:(NSError **)outError;
+/* data is retained, not copied */
+- (instancetype)initWithData:(NSData *)data error:(NSError **)outError;
+
+/* Element types (NSNumber), in file order */
+- (NSArray *)elementTypes;
+- (BOOL)containsElement:(OSType)anElement;
+
+/*!
+    @method     dataForIconFamilyElement:
+    @abstract   Returns the raw element data, without copying it.
+    @result     nil if the file does not contain anElement.
+*/
+- (NSData *)dataForIconFamilyElement:(OSType)anElement;
+
+/* Same as bitmapForIconFamilyElement:withMask: with mask */
+- (NSBitmapImageRep *)bitmapForIconFamilyElement:(OSType)anElement;
+/*!
+    @method     bitmapForIconFamilyElement:withMask:
+    @abstract   Decodes an element, or returns it from the cache.
+    @discussion 32 bits data elements use the mask of the same size when <em>useAlpha</em> is YES.
+				PNG and JPEG 2000 elements are decoded by NSBitmapImageRep.
+				The returned bitmap is shared with the cache and must not be modified.
+    @result     nil if the file does not contain anElement, or if the element cannot be decoded.
+*/
+- (NSBitmapImageRep *)bitmapForIconFamilyElement:(OSType)anElement withMask:(BOOL)useAlpha;
+
+#pragma mark Cache
+/* Maximum bytes of decoded bitmaps kept in cache. Default is 8 MB. 0 disables the cache. */
+- (NSUInteger)cacheLimit;
+- (void)setCacheLimit:(NSUInteger)aLimit;
+
+/* Bytes currently used by cached bitmaps */
+- (NSUInteger)cacheSize;
+- (void)removeAllCachedBitmaps;
+
+@end
@@ -0,0 +1,287 @@
+/*
+ *  WBIconFamilyReader.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#import <WonderBox/WBIconFamilyReader.h>
+
+#import "WBIcnsFormat.h"
+
+enum {
+  kWBIconFamilyReaderDefaultCacheLimit = 8 * 1024 * 1024,
+};
+
+typedef struct _WBIconFamilyReaderEntry {
+  WBIcnsElement element;
+  /* Decoded bitmaps, without and with mask */
+  NSBitmapImageRep *bitmaps[2];
+  NSUInteger costs[2];
+  /* Last access time, for the LRU eviction */
+  uint64_t accesses[2];
+} WBIconFamilyReaderEntry;
+
+static NSData *WBIconFamilyReaderCreateElementData(NSData *data, const WBIcnsElement *element);
+static NSBitmapImageRep *WBIconFamilyReaderCreateBitmap(NSData *data, const WBIconFamilyReaderEntry *entries, size_t count, size_t idx, BOOL useAlpha);
+static void WBIconFamilyReaderEvict(WBIconFamilyReaderEntry *entries, size_t count, NSUInteger *size, NSUInteger limit);
+
+@implementation WBIconFamilyReader {
+@private
+  NSData *wb_data;
+  size_t wb_count;
+  WBIconFamilyReaderEntry *wb_entries;
+
+  uint64_t wb_clock;
+  NSUInteger wb_size;
+  NSUInteger wb_limit;
+}
+
+- (instancetype)initWithContentsOfFile:(NSString *)path error:(NSError **)outError {
+  NSData *data = [[NSData alloc] initWithContentsOfFile:[path stringByExpandingTildeInPath]
+                                                options:NSDataReadingMappedAlways
+                                                  error:outError];
+  if (!data) {
+    [self release];
+    return nil;
+  }
+  self = [self initWithData:data error:outError];
+  [data release];
+  return self;
+}
+
+- (instancetype)initWithData:(NSData *)data error:(NSError **)outError {
+  if (self = [super init]) {
+    size_t count = 0;
+    const uint8_t *bytes = [data bytes];
+    if (!data || !WBIcnsReadContainer(bytes, [data length], NULL, 0, &count)) {
+      if (outError)
+        *outError = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:nil];
+      [self release];
+      return nil;
+    }
+    WBIcnsElement *elements = malloc(count * sizeof(*elements));
+    wb_entries = calloc(count, sizeof(*wb_entries));
+    if (count && (!elements || !wb_entries)) {
+      free(elements);
+      [self release];
+      return nil;
+    }
+    WBIcnsReadContainer(bytes, [data length], elements, count, &count);
+    for (size_t idx = 0; idx < count; ++idx)
+      wb_entries[idx].element = elements[idx];
+    free(elements);
+
+    wb_count = count;
+    wb_data = [data retain];
+    wb_limit = kWBIconFamilyReaderDefaultCacheLimit;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [self removeAllCachedBitmaps];
+  free(wb_entries);
+  [wb_data release];
+  [super dealloc];
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"<%@ %p> { elements: %lu, cache: %lu bytes }",
+          NSStringFromClass([self class]), self, (unsigned long)wb_count, (unsigned long)wb_size];
+}
+
+#pragma mark -
+static size_t WBIconFamilyReaderFind(const WBIconFamilyReaderEntry *entries, size_t count, OSType type) {
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (entries[idx].element.type == type)
+      return idx;
+  }
+  return NSNotFound;
+}
+
+- (NSArray *)elementTypes {
+  NSMutableArray *types = [NSMutableArray arrayWithCapacity:wb_count];
+  for (size_t idx = 0; idx < wb_count; ++idx)
+    [types addObject:@(wb_entries[idx].element.type)];
+  return types;
+}
+
+- (BOOL)containsElement:(OSType)anElement {
+  return WBIconFamilyReaderFind(wb_entries, wb_count, anElement) != NSNotFound;
+}
+
+- (NSData *)dataForIconFamilyElement:(OSType)anElement {
+  size_t idx = WBIconFamilyReaderFind(wb_entries, wb_count, anElement);
+  if (NSNotFound == idx)
+    return nil;
+  return [WBIconFamilyReaderCreateElementData(wb_data, &wb_entries[idx].element) autorelease];
+}
+
+- (NSBitmapImageRep *)bitmapForIconFamilyElement:(OSType)anElement {
+  return [self bitmapForIconFamilyElement:anElement withMask:YES];
+}
+
+- (NSBitmapImageRep *)bitmapForIconFamilyElement:(OSType)anElement withMask:(BOOL)useAlpha {
+  size_t idx = WBIconFamilyReaderFind(wb_entries, wb_count, anElement);
+  if (NSNotFound == idx)
+    return nil;
+  /* PNG and masks do not depend on useAlpha */
+  WBIcnsElementKind kind = WBIcnsGetElementInfo(anElement).kind;
+  NSUInteger slot = useAlpha && (kWBIcnsElementRGB == kind || kWBIcnsElementARGB == kind) ? 1 : 0;
+
+  WBIconFamilyReaderEntry *entry = &wb_entries[idx];
+  @synchronized(self) {
+    if (entry->bitmaps[slot]) {
+      entry->accesses[slot] = ++wb_clock;
+      return [[entry->bitmaps[slot] retain] autorelease];
+    }
+  }
+
+  /* Decoded without lock, so other elements remain available meanwhile */
+  NSBitmapImageRep *bitmap = WBIconFamilyReaderCreateBitmap(wb_data, wb_entries, wb_count, idx, slot);
+  if (!bitmap)
+    return nil;
+
+  NSUInteger cost = [bitmap bytesPerPlane] * [bitmap numberOfPlanes];
+  @synchronized(self) {
+    /* before the eviction, so the new bitmap is the most recently used */
+    entry->accesses[slot] = ++wb_clock;
+    if (entry->bitmaps[slot]) {
+      /* decoded concurrently by an other thread */
+      [bitmap release];
+      bitmap = [entry->bitmaps[slot] retain];
+    } else if (cost <= wb_limit) {
+      entry->bitmaps[slot] = [bitmap retain];
+      entry->costs[slot] = cost;
+      wb_size += cost;
+      WBIconFamilyReaderEvict(wb_entries, wb_count, &wb_size, wb_limit);
+    }
+  }
+  return [bitmap autorelease];
+}
+
+#pragma mark Cache
+/* Releases the least recently used bitmaps until size <= limit */
+static void WBIconFamilyReaderEvict(WBIconFamilyReaderEntry *entries, size_t count, NSUInteger *size, NSUInteger limit) {
+  while (*size > limit) {
+    WBIconFamilyReaderEntry *oldest = NULL;
+    NSUInteger slot = 0;
+    for (size_t idx = 0; idx < count; ++idx) {
+      for (NSUInteger bitmap = 0; bitmap < 2; ++bitmap) {
+        if (entries[idx].bitmaps[bitmap] && (!oldest || entries[idx].accesses[bitmap] < oldest->accesses[slot])) {
+          oldest = &entries[idx];
+          slot = bitmap;
+        }
+      }
+    }
+    if (!oldest)
+      break;
+    [oldest->bitmaps[slot] release];
+    oldest->bitmaps[slot] = nil;
+    *size -= oldest->costs[slot];
+    oldest->costs[slot] = 0;
+  }
+}
+
+- (NSUInteger)cacheLimit {
+  return wb_limit;
+}
+- (void)setCacheLimit:(NSUInteger)aLimit {
+  @synchronized(self) {
+    wb_limit = aLimit;
+    WBIconFamilyReaderEvict(wb_entries, wb_count, &wb_size, wb_limit);
+  }
+}
+
+- (NSUInteger)cacheSize {
+  return wb_size;
+}
+
+- (void)removeAllCachedBitmaps {
+  @synchronized(self) {
+    WBIconFamilyReaderEvict(wb_entries, wb_count, &wb_size, 0);
+  }
+}
+
+@end
+
+#pragma mark -
+#pragma mark Decoding
+/* References the element bytes, and keeps the file mapped while in use */
+static NSData *WBIconFamilyReaderCreateElementData(NSData *data, const WBIcnsElement *element) {
+  [data retain];
+  return [[NSData alloc] initWithBytesNoCopy:(void *)element->data length:element->length deallocator:^(void *bytes, NSUInteger length) {
+    [data release];
+  }];
+}
+
+static NSBitmapImageRep *WBIconFamilyReaderCreatePlanarBitmap(NSUInteger size, NSInteger samples) {
+  return [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL
+                                                 pixelsWide:size
+                                                 pixelsHigh:size
+                                              bitsPerSample:8
+                                            samplesPerPixel:samples
+                                                   hasAlpha:(samples == 4)
+                                                   isPlanar:YES
+                                             colorSpaceName:(samples == 1) ? NSDeviceWhiteColorSpace : NSDeviceRGBColorSpace
+                                               bitmapFormat:0
+                                                bytesPerRow:size
+                                               bitsPerPixel:8];
+}
+
+static NSBitmapImageRep *WBIconFamilyReaderCreateBitmap(NSData *data, const WBIconFamilyReaderEntry *entries, size_t count, size_t idx, BOOL useAlpha) {
+  const WBIcnsElement *element = &entries[idx].element;
+  WBIcnsElementInfo info = WBIcnsGetElementInfo(element->type);
+  unsigned char *planes[5] = { NULL, NULL, NULL, NULL, NULL };
+
+  switch (info.kind) {
+    case kWBIcnsElementOther: {
+      /* PNG or JPEG 2000 */
+      NSData *bytes = WBIconFamilyReaderCreateElementData(data, element);
+      NSBitmapImageRep *bitmap = [[NSBitmapImageRep alloc] initWithData:bytes];
+      [bytes release];
+      /* decode now, so the cache keeps the pixels */
+      if (bitmap && ![bitmap bitmapData]) {
+        [bitmap release];
+        bitmap = nil;
+      }
+      return bitmap;
+    }
+    case kWBIcnsElementMask: {
+      NSBitmapImageRep *bitmap = WBIconFamilyReaderCreatePlanarBitmap(info.size, 1);
+      [bitmap getBitmapDataPlanes:planes];
+      if (bitmap && !WBIcnsDecodeElementPlanes(element->type, element->data, element->length, planes[0], NULL, NULL, NULL)) {
+        [bitmap release];
+        bitmap = nil;
+      }
+      return bitmap;
+    }
+  }
+
+  size_t pixels = (size_t)info.size * info.size;
+  uint8_t *argb = malloc(pixels * 4);
+  if (!argb || !WBIcnsDecodeElement(element->type, element->data, element->length, argb)) {
+    free(argb);
+    return nil;
+  }
+  BOOL alpha = useAlpha && kWBIcnsElementARGB == info.kind;
+  if (useAlpha && kWBIcnsElementRGB == info.kind) {
+    /* the mask of the same size */
+    for (size_t mask = 0; mask < count && !alpha; ++mask) {
+      WBIcnsElementInfo minfo = WBIcnsGetElementInfo(entries[mask].element.type);
+      if (kWBIcnsElementMask == minfo.kind && minfo.size == info.size)
+        alpha = WBIcnsDecodeElement(entries[mask].element.type, entries[mask].element.data, entries[mask].element.length, argb);
+    }
+  }
+  NSBitmapImageRep *bitmap = WBIconFamilyReaderCreatePlanarBitmap(info.size, alpha ? 4 : 3);
+  if (bitmap) {
+    [bitmap getBitmapDataPlanes:planes];
+    WBIcnsDeinterleaveARGB(argb, pixels, alpha, alpha ? planes[3] : NULL, planes[0], planes[1], planes[2]);
+  }
+  free(argb);
+  return bitmap;
+}
@@ -0,0 +1,130 @@
+/*
+ *  WBDigest.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+/*!
+ @header WBDigest.h
+ @abstract Compile-time digest algorithm selection.
+ @discussion wb::Digest&lt;kWBDigestSHA256&gt; calls the implementation directly and
+ contains only the context of its algorithm, where WBDigestContext is a 240 bytes
+ context dispatching through a function table. Both use the same implementation
+ (CommonCrypto or WBDigestBackend), so they produce the same digests.
+ This is a project header: the portable implementation calls the WBDigestBackend
+ functions, which are not exported by the framework.
+ */
+
+#if !defined(__WBDIGEST_H)
+#define __WBDIGEST_H 1
+
+#if __has_include(<WonderBox/WBDigestFunctions.h>)
+#  include <WonderBox/WBDigestFunctions.h>
+#else
+#  include "WBDigestFunctions.h"
+#endif
+
+#if defined(__cplusplus)
+
+#if defined(__APPLE__) && !defined(WB_DIGEST_PORTABLE)
+#  include <CommonCrypto/CommonDigest.h>
+#else
+#  include "WBDigestBackend.h"
+#endif
+
+namespace wb {
+
+  /* Only defined for the supported algorithms */
+  template <WBDigestAlgorithm Algo>
+  struct DigestTraits;
+
+#if defined(__APPLE__) && !defined(WB_DIGEST_PORTABLE)
+  /* CC_LONG is 32 bits */
+#  define WB_DIGEST_TRAITS(algorithm, Ctx) \
+  template <> struct DigestTraits<kWBDigest##algorithm> { \
+    typedef Ctx Context; \
+    static const size_t length = WB_##algorithm##_DIGEST_LENGTH; \
+    static inline void init(Context *ctxt) { CC_##algorithm##_Init(ctxt); } \
+    static inline void update(Context *ctxt, const void *data, size_t len) { \
+      while (__builtin_expect(len > 0x40000000, 0)) { \
+        CC_##algorithm##_Update(ctxt, data, 0x40000000); \
+        data = static_cast<const uint8_t *>(data) + 0x40000000; \
+        len -= 0x40000000; \
+      } \
+      CC_##algorithm##_Update(ctxt, data, static_cast<CC_LONG>(len)); \
+    } \
+    static inline void final(uint8_t *md, Context *ctxt) { CC_##algorithm##_Final(md, ctxt); } \
+  }
+
+  WB_DIGEST_TRAITS(MD2, CC_MD2_CTX);
+  WB_DIGEST_TRAITS(MD4, CC_MD4_CTX);
+  WB_DIGEST_TRAITS(MD5, CC_MD5_CTX);
+  WB_DIGEST_TRAITS(SHA1, CC_SHA1_CTX);
+  WB_DIGEST_TRAITS(SHA224, CC_SHA256_CTX);
+  WB_DIGEST_TRAITS(SHA256, CC_SHA256_CTX);
+  WB_DIGEST_TRAITS(SHA384, CC_SHA512_CTX);
+  WB_DIGEST_TRAITS(SHA512, CC_SHA512_CTX);
+#else
+#  define WB_DIGEST_TRAITS(algorithm, Ctx) \
+  template <> struct DigestTraits<kWBDigest##algorithm> { \
+    typedef Ctx Context; \
+    static const size_t length = WB_##algorithm##_DIGEST_LENGTH; \
+    static inline void init(Context *ctxt) { WB##algorithm##Init(ctxt); } \
+    static inline void update(Context *ctxt, const void *data, size_t len) { WB##algorithm##Update(ctxt, data, len); } \
+    static inline void final(uint8_t *md, Context *ctxt) { WB##algorithm##Final(md, ctxt); } \
+  }
+
+  WB_DIGEST_TRAITS(MD5, WBMD5Context);
+  WB_DIGEST_TRAITS(SHA1, WBSHA1Context);
+  WB_DIGEST_TRAITS(SHA224, WBSHA256Context);
+  WB_DIGEST_TRAITS(SHA256, WBSHA256Context);
+  WB_DIGEST_TRAITS(SHA384, WBSHA512Context);
+  WB_DIGEST_TRAITS(SHA512, WBSHA512Context);
+#endif
+
+#undef WB_DIGEST_TRAITS
+
+  template <WBDigestAlgorithm Algo>
+  class Digest {
+  private:
+    typedef DigestTraits<Algo> Traits;
+    typename Traits::Context _ctxt;
+
+  public:
+    static const WBDigestAlgorithm algorithm = Algo;
+    static const size_t length = Traits::length;
+
+    inline Digest() { Traits::init(&_ctxt); }
+
+    inline void update(const void *data, size_t len) { Traits::update(&_ctxt, data, len); }
+
+    /* md must be at least length bytes long. The digest is reset and can be reused. */
+    inline void final(uint8_t *md) {
+      Traits::final(md, &_ctxt);
+      Traits::init(&_ctxt);
+    }
+
+    inline void reset() { Traits::init(&_ctxt); }
+
+    static inline void digest(const void *data, size_t len, uint8_t *md) {
+      typename Traits::Context ctxt;
+      Traits::init(&ctxt);
+      Traits::update(&ctxt, data, len);
+      Traits::final(md, &ctxt);
+    }
+  };
+
+  typedef Digest<kWBDigestMD5> MD5Digest;
+  typedef Digest<kWBDigestSHA1> SHA1Digest;
+  typedef Digest<kWBDigestSHA224> SHA224Digest;
+  typedef Digest<kWBDigestSHA256> SHA256Digest;
+  typedef Digest<kWBDigestSHA384> SHA384Digest;
+  typedef Digest<kWBDigestSHA512> SHA512Digest;
+}
+
+#endif /* __cplusplus */
+
+#endif /* __WBDIGEST_H */
@@ -0,0 +1,762 @@
+/*
+ *  WBDigestBackend.c
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#if __has_include(<WonderBox/WBDigestBackend.h>)
+#  include <WonderBox/WBDigestBackend.h>
+#else
+#  include "WBDigestBackend.h"
+#endif
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <cpuid.h>
+#  include <immintrin.h>
+#  if defined(__APPLE__)
+#    include <sys/sysctl.h>
+#  endif
+#  define WB_DIGEST_X86 1
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+/* Always the case on Apple Silicon, requires -march=armv8-a+crypto on other platforms. */
+#  include <arm_neon.h>
+#  define WB_DIGEST_ARMV8 1
+#endif
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+WB_INLINE
+uint32_t _WBReadBig32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+WB_INLINE
+uint32_t _WBReadLittle32(const uint8_t *p) {
+  return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+WB_INLINE
+uint64_t _WBReadBig64(const uint8_t *p) {
+  return (uint64_t)_WBReadBig32(p) << 32 | _WBReadBig32(p + 4);
+}
+
+WB_INLINE
+void _WBWriteBig32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+WB_INLINE
+void _WBWriteLittle32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+WB_INLINE
+void _WBWriteBig64(uint8_t *p, uint64_t v) {
+  _WBWriteBig32(p, (uint32_t)(v >> 32));
+  _WBWriteBig32(p + 4, (uint32_t)v);
+}
+
+typedef void (*WBDigestBlockFunction)(uint32_t *state, const uint8_t *data, size_t blocks);
+
+// MARK: -
+// MARK: Block buffering
+/* Common buffering for the 64 bytes block algorithms. */
+static void _WBDigestUpdate64(uint32_t *state, uint8_t buffer[64], uint64_t *count,
+                              const uint8_t *data, size_t length, WBDigestBlockFunction compress) {
+  size_t used = (size_t)(*count % 64);
+  *count += length;
+  if (used) {
+    size_t fill = 64 - used;
+    if (length < fill) {
+      memcpy(buffer + used, data, length);
+      return;
+    }
+    memcpy(buffer + used, data, fill);
+    compress(state, buffer, 1);
+    data += fill;
+    length -= fill;
+  }
+  if (length >= 64) {
+    compress(state, data, length / 64);
+    data += length / 64 * 64;
+    length %= 64;
+  }
+  if (length)
+    memcpy(buffer, data, length);
+}
+
+static void _WBDigestFinal64(uint32_t *state, uint8_t buffer[64], uint64_t count,
+                             WBDigestBlockFunction compress, bool bigEndian) {
+  size_t used = (size_t)(count % 64);
+  buffer[used++] = 0x80;
+  if (used > 56) {
+    memset(buffer + used, 0, 64 - used);
+    compress(state, buffer, 1);
+    used = 0;
+  }
+  memset(buffer + used, 0, 56 - used);
+  uint64_t bits = count * 8;
+  for (int idx = 0; idx < 8; ++idx)
+    buffer[56 + idx] = (uint8_t)(bigEndian ? bits >> (56 - 8 * idx) : bits >> (8 * idx));
+  compress(state, buffer, 1);
+}
+
+// MARK: -
+// MARK: MD5
+static const uint32_t _WBMD5K[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+/* The message indices must be constants */
+#if defined(__clang__)
+#  define WB_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#  define WB_UNROLL _Pragma("GCC unroll 4")
+#else
+#  define WB_UNROLL
+#endif
+
+#define WB_MD5_STEP(f, a, b, c, d, k, s, i) \
+  a = b + ROL32(a + f(b, c, d) + w[k] + _WBMD5K[i], s)
+#define WB_MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define WB_MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define WB_MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define WB_MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+static void _WBMD5Compress(uint32_t *state, const uint8_t *data, size_t blocks) {
+  while (blocks-- > 0) {
+    uint32_t w[16];
+    for (int idx = 0; idx < 16; ++idx)
+      w[idx] = _WBReadLittle32(data + idx * 4);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    WB_UNROLL
+    for (int i = 0; i < 16; i += 4) {
+      WB_MD5_STEP(WB_MD5_F, a, b, c, d, i, 7, i);
+      WB_MD5_STEP(WB_MD5_F, d, a, b, c, i + 1, 12, i + 1);
+      WB_MD5_STEP(WB_MD5_F, c, d, a, b, i + 2, 17, i + 2);
+      WB_MD5_STEP(WB_MD5_F, b, c, d, a, i + 3, 22, i + 3);
+    }
+    WB_UNROLL
+    for (int i = 16; i < 32; i += 4) {
+      WB_MD5_STEP(WB_MD5_G, a, b, c, d, (5 * i + 1) % 16, 5, i);
+      WB_MD5_STEP(WB_MD5_G, d, a, b, c, (5 * i + 6) % 16, 9, i + 1);
+      WB_MD5_STEP(WB_MD5_G, c, d, a, b, (5 * i + 11) % 16, 14, i + 2);
+      WB_MD5_STEP(WB_MD5_G, b, c, d, a, (5 * i + 16) % 16, 20, i + 3);
+    }
+    WB_UNROLL
+    for (int i = 32; i < 48; i += 4) {
+      WB_MD5_STEP(WB_MD5_H, a, b, c, d, (3 * i + 5) % 16, 4, i);
+      WB_MD5_STEP(WB_MD5_H, d, a, b, c, (3 * i + 8) % 16, 11, i + 1);
+      WB_MD5_STEP(WB_MD5_H, c, d, a, b, (3 * i + 11) % 16, 16, i + 2);
+      WB_MD5_STEP(WB_MD5_H, b, c, d, a, (3 * i + 14) % 16, 23, i + 3);
+    }
+    WB_UNROLL
+    for (int i = 48; i < 64; i += 4) {
+      WB_MD5_STEP(WB_MD5_I, a, b, c, d, (7 * i) % 16, 6, i);
+      WB_MD5_STEP(WB_MD5_I, d, a, b, c, (7 * i + 7) % 16, 10, i + 1);
+      WB_MD5_STEP(WB_MD5_I, c, d, a, b, (7 * i + 14) % 16, 15, i + 2);
+      WB_MD5_STEP(WB_MD5_I, b, c, d, a, (7 * i + 21) % 16, 21, i + 3);
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    data += 64;
+  }
+}
+
+int WBMD5Init(WBMD5Context *ctxt) {
+  static const uint32_t iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  memcpy(ctxt->state, iv, sizeof(iv));
+  ctxt->count = 0;
+  return 1;
+}
+
+int WBMD5Update(WBMD5Context *ctxt, const void *data, size_t length) {
+  _WBDigestUpdate64(ctxt->state, ctxt->buffer, &ctxt->count, data, length, _WBMD5Compress);
+  return 1;
+}
+
+int WBMD5Final(unsigned char *md, WBMD5Context *ctxt) {
+  _WBDigestFinal64(ctxt->state, ctxt->buffer, ctxt->count, _WBMD5Compress, false);
+  for (int idx = 0; idx < 4; ++idx)
+    _WBWriteLittle32(md + idx * 4, ctxt->state[idx]);
+  memset(ctxt, 0, sizeof(*ctxt));
+  return 1;
+}
+
+// MARK: -
+// MARK: SHA-1
+static void _WBSHA1CompressGeneric(uint32_t *state, const uint8_t *data, size_t blocks) {
+  while (blocks-- > 0) {
+    uint32_t w[80];
+    for (int idx = 0; idx < 16; ++idx)
+      w[idx] = _WBReadBig32(data + idx * 4);
+    for (int idx = 16; idx < 80; ++idx)
+      w[idx] = ROL32(w[idx - 3] ^ w[idx - 8] ^ w[idx - 14] ^ w[idx - 16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int idx = 0; idx < 80; ++idx) {
+      uint32_t f, k;
+      if (idx < 20) {
+        f = d ^ (b & (c ^ d)); k = 0x5a827999;
+      } else if (idx < 40) {
+        f = b ^ c ^ d; k = 0x6ed9eba1;
+      } else if (idx < 60) {
+        f = (b & c) | (d & (b | c)); k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d; k = 0xca62c1d6;
+      }
+      uint32_t t = ROL32(a, 5) + f + e + k + w[idx];
+      e = d; d = c; c = ROL32(b, 30); b = a; a = t;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+    data += 64;
+  }
+}
+
+// MARK: -
+// MARK: SHA-256
+const uint32_t WBSHA256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t WBSHA224IV[8] = {
+  0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4,
+};
+
+const uint32_t WBSHA256IV[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static void _WBSHA256CompressGeneric(uint32_t *state, const uint8_t *data, size_t blocks) {
+  while (blocks-- > 0) {
+    uint32_t w[64];
+    for (int idx = 0; idx < 16; ++idx)
+      w[idx] = _WBReadBig32(data + idx * 4);
+    for (int idx = 16; idx < 64; ++idx) {
+      uint32_t s0 = ROR32(w[idx - 15], 7) ^ ROR32(w[idx - 15], 18) ^ (w[idx - 15] >> 3);
+      uint32_t s1 = ROR32(w[idx - 2], 17) ^ ROR32(w[idx - 2], 19) ^ (w[idx - 2] >> 10);
+      w[idx] = w[idx - 16] + s0 + w[idx - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int idx = 0; idx < 64; ++idx) {
+      uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + (g ^ (e & (f ^ g))) + WBSHA256K[idx] + w[idx];
+      uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) | (c & (a | b)));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    data += 64;
+  }
+}
+
+// MARK: -
+// MARK: SHA extensions (x86)
+#if defined(WB_DIGEST_X86)
+
+#define WB_SHANI __attribute__((__target__("sha,sse4.1")))
+
+/* The SHA-256 instructions work on the state as ABEF and CDGH vectors. */
+WB_SHANI WB_INLINE
+void _WBSHA256LoadSHANI(const uint32_t state[8], __m128i *abef, __m128i *cdgh) {
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xB1); // CDAB
+  __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)), 0x1B); // EFGH
+  *abef = _mm_alignr_epi8(tmp, efgh, 8);
+  *cdgh = _mm_blend_epi16(efgh, tmp, 0xF0);
+}
+
+WB_SHANI WB_INLINE
+void _WBSHA256StoreSHANI(uint32_t state[8], __m128i abef, __m128i cdgh) {
+  __m128i tmp = _mm_shuffle_epi32(abef, 0x1B); // FEBA
+  cdgh = _mm_shuffle_epi32(cdgh, 0xB1); // DCHG
+  _mm_storeu_si128((__m128i *)state, _mm_blend_epi16(tmp, cdgh, 0xF0)); // DCBA
+  _mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(cdgh, tmp, 8)); // HGFE
+}
+
+/* 4 rounds (i) of a block. m0 is the current message vector, m1 the next and m3 the previous one. */
+#define WB_SHANI_SHA256_ROUNDS(i, abef, cdgh, m0, m1, m3) do { \
+  __m128i __msg = _mm_add_epi32(m0, _mm_loadu_si128((const __m128i *)(WBSHA256K + 4 * (i)))); \
+  cdgh = _mm_sha256rnds2_epu32(cdgh, abef, __msg); \
+  if ((i) >= 3 && (i) <= 14) \
+    m1 = _mm_sha256msg2_epu32(_mm_add_epi32(m1, _mm_alignr_epi8(m0, m3, 4)), m0); \
+  abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(__msg, 0x0E)); \
+  if ((i) >= 1 && (i) <= 12) \
+    m3 = _mm_sha256msg1_epu32(m3, m0); \
+} while (0)
+
+#define WB_SHANI_LOAD(block, mask, m0, m1, m2, m3) do { \
+  m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block)), mask); \
+  m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block) + 1), mask); \
+  m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block) + 2), mask); \
+  m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block) + 3), mask); \
+} while (0)
+
+WB_SHANI
+static void _WBSHA256CompressSHANI(uint32_t *state, const uint8_t *data, size_t blocks) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i abef, cdgh;
+  _WBSHA256LoadSHANI(state, &abef, &cdgh);
+  while (blocks-- > 0) {
+    __m128i abef0 = abef, cdgh0 = cdgh;
+    __m128i m0, m1, m2, m3;
+    WB_SHANI_LOAD(data, bswap, m0, m1, m2, m3);
+    for (int i = 0; i < 16; i += 4) {
+      WB_SHANI_SHA256_ROUNDS(i, abef, cdgh, m0, m1, m3);
+      WB_SHANI_SHA256_ROUNDS(i + 1, abef, cdgh, m1, m2, m0);
+      WB_SHANI_SHA256_ROUNDS(i + 2, abef, cdgh, m2, m3, m1);
+      WB_SHANI_SHA256_ROUNDS(i + 3, abef, cdgh, m3, m0, m2);
+    }
+    abef = _mm_add_epi32(abef, abef0);
+    cdgh = _mm_add_epi32(cdgh, cdgh0);
+    data += 64;
+  }
+  _WBSHA256StoreSHANI(state, abef, cdgh);
+}
+
+/* The rounds of the 2 messages are interleaved to hide the latency of sha256rnds2. */
+WB_SHANI
+void WBSHA256Compress2SHANI(uint32_t state1[8], const uint8_t *block1, uint32_t state2[8], const uint8_t *block2) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i abef1, cdgh1, abef2, cdgh2;
+  _WBSHA256LoadSHANI(state1, &abef1, &cdgh1);
+  _WBSHA256LoadSHANI(state2, &abef2, &cdgh2);
+  __m128i abef10 = abef1, cdgh10 = cdgh1, abef20 = abef2, cdgh20 = cdgh2;
+
+  __m128i a0, a1, a2, a3, b0, b1, b2, b3;
+  WB_SHANI_LOAD(block1, bswap, a0, a1, a2, a3);
+  WB_SHANI_LOAD(block2, bswap, b0, b1, b2, b3);
+  for (int i = 0; i < 16; i += 4) {
+    WB_SHANI_SHA256_ROUNDS(i, abef1, cdgh1, a0, a1, a3); WB_SHANI_SHA256_ROUNDS(i, abef2, cdgh2, b0, b1, b3);
+    WB_SHANI_SHA256_ROUNDS(i + 1, abef1, cdgh1, a1, a2, a0); WB_SHANI_SHA256_ROUNDS(i + 1, abef2, cdgh2, b1, b2, b0);
+    WB_SHANI_SHA256_ROUNDS(i + 2, abef1, cdgh1, a2, a3, a1); WB_SHANI_SHA256_ROUNDS(i + 2, abef2, cdgh2, b2, b3, b1);
+    WB_SHANI_SHA256_ROUNDS(i + 3, abef1, cdgh1, a3, a0, a2); WB_SHANI_SHA256_ROUNDS(i + 3, abef2, cdgh2, b3, b0, b2);
+  }
+  _WBSHA256StoreSHANI(state1, _mm_add_epi32(abef1, abef10), _mm_add_epi32(cdgh1, cdgh10));
+  _WBSHA256StoreSHANI(state2, _mm_add_epi32(abef2, abef20), _mm_add_epi32(cdgh2, cdgh20));
+}
+
+/* 4 rounds (g) of SHA-1: e0 is consumed and e1 receives the next E. */
+#define WB_SHANI_SHA1_ROUNDS(g, abcd, e0, e1, m0, m1, m2, m3) do { \
+  if ((g) == 0) \
+    e0 = _mm_add_epi32(e0, m0); \
+  else \
+    e0 = _mm_sha1nexte_epu32(e0, m0); \
+  e1 = abcd; \
+  if ((g) >= 3 && (g) <= 18) \
+    m1 = _mm_sha1msg2_epu32(m1, m0); \
+  abcd = _mm_sha1rnds4_epu32(abcd, e0, (g) / 5); \
+  if ((g) >= 1 && (g) <= 16) \
+    m3 = _mm_sha1msg1_epu32(m3, m0); \
+  if ((g) >= 2 && (g) <= 17) \
+    m2 = _mm_xor_si128(m2, m0); \
+} while (0)
+
+WB_SHANI
+static void _WBSHA1CompressSHANI(uint32_t *state, const uint8_t *data, size_t blocks) {
+  const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+  __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0), e1;
+  while (blocks-- > 0) {
+    __m128i abcd0 = abcd, e00 = e0;
+    __m128i m0, m1, m2, m3;
+    WB_SHANI_LOAD(data, bswap, m0, m1, m2, m3);
+    /* the message vector used by group g is m[g % 4], m1 is the next one, m3 the previous and m2 the one before */
+    WB_SHANI_SHA1_ROUNDS(0, abcd, e0, e1, m0, m1, m2, m3);
+    WB_SHANI_SHA1_ROUNDS(1, abcd, e1, e0, m1, m2, m3, m0);
+    WB_SHANI_SHA1_ROUNDS(2, abcd, e0, e1, m2, m3, m0, m1);
+    WB_SHANI_SHA1_ROUNDS(3, abcd, e1, e0, m3, m0, m1, m2);
+    WB_SHANI_SHA1_ROUNDS(4, abcd, e0, e1, m0, m1, m2, m3);
+    WB_SHANI_SHA1_ROUNDS(5, abcd, e1, e0, m1, m2, m3, m0);
+    WB_SHANI_SHA1_ROUNDS(6, abcd, e0, e1, m2, m3, m0, m1);
+    WB_SHANI_SHA1_ROUNDS(7, abcd, e1, e0, m3, m0, m1, m2);
+    WB_SHANI_SHA1_ROUNDS(8, abcd, e0, e1, m0, m1, m2, m3);
+    WB_SHANI_SHA1_ROUNDS(9, abcd, e1, e0, m1, m2, m3, m0);
+    WB_SHANI_SHA1_ROUNDS(10, abcd, e0, e1, m2, m3, m0, m1);
+    WB_SHANI_SHA1_ROUNDS(11, abcd, e1, e0, m3, m0, m1, m2);
+    WB_SHANI_SHA1_ROUNDS(12, abcd, e0, e1, m0, m1, m2, m3);
+    WB_SHANI_SHA1_ROUNDS(13, abcd, e1, e0, m1, m2, m3, m0);
+    WB_SHANI_SHA1_ROUNDS(14, abcd, e0, e1, m2, m3, m0, m1);
+    WB_SHANI_SHA1_ROUNDS(15, abcd, e1, e0, m3, m0, m1, m2);
+    WB_SHANI_SHA1_ROUNDS(16, abcd, e0, e1, m0, m1, m2, m3);
+    WB_SHANI_SHA1_ROUNDS(17, abcd, e1, e0, m1, m2, m3, m0);
+    WB_SHANI_SHA1_ROUNDS(18, abcd, e0, e1, m2, m3, m0, m1);
+    WB_SHANI_SHA1_ROUNDS(19, abcd, e1, e0, m3, m0, m1, m2);
+    e0 = _mm_sha1nexte_epu32(e0, e00);
+    abcd = _mm_add_epi32(abcd, abcd0);
+    data += 64;
+  }
+  _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+  state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static uint32_t sWBDigestCPUFeatures = 0;
+static pthread_once_t sWBDigestCPUOnce = PTHREAD_ONCE_INIT;
+
+static void _WBDigestCheckCPU(void) {
+  unsigned int eax, ebx, ecx, edx;
+  bool sse41 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1);
+  if (sse41 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA))
+    sWBDigestCPUFeatures |= kWBDigestCPUSHA;
+#if defined(__APPLE__)
+  int value = 0;
+  size_t length = sizeof(value);
+  if (sysctlbyname("hw.optional.avx2_0", &value, &length, NULL, 0) == 0 && value)
+    sWBDigestCPUFeatures |= kWBDigestCPUAVX2;
+#else
+  if (__builtin_cpu_supports("avx2"))
+    sWBDigestCPUFeatures |= kWBDigestCPUAVX2;
+#endif
+}
+
+uint32_t WBDigestGetCPUFeatures(void) {
+  pthread_once(&sWBDigestCPUOnce, _WBDigestCheckCPU);
+  return sWBDigestCPUFeatures;
+}
+
+#endif /* WB_DIGEST_X86 */
+
+// MARK: -
+// MARK: ARMv8 cryptographic extensions
+#if defined(WB_DIGEST_ARMV8)
+
+/* 4 rounds (g) of SHA-256. m0 is the current message vector. */
+#define WB_ARMV8_SHA256_ROUNDS(g, s0, s1, m0, m1, m2, m3) do { \
+  uint32x4_t __msg = vaddq_u32(m0, vld1q_u32(WBSHA256K + 4 * (g))); \
+  uint32x4_t __s0 = s0; \
+  if ((g) < 12) \
+    m0 = vsha256su0q_u32(m0, m1); \
+  s0 = vsha256hq_u32(s0, s1, __msg); \
+  s1 = vsha256h2q_u32(s1, __s0, __msg); \
+  if ((g) < 12) \
+    m0 = vsha256su1q_u32(m0, m2, m3); \
+} while (0)
+
+static void _WBSHA256CompressARMv8(uint32_t *state, const uint8_t *data, size_t blocks) {
+  uint32x4_t s0 = vld1q_u32(state), s1 = vld1q_u32(state + 4);
+  while (blocks-- > 0) {
+    uint32x4_t abcd = s0, efgh = s1;
+    uint32x4_t m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data)));
+    uint32x4_t m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+    uint32x4_t m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+    uint32x4_t m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+    for (int g = 0; g < 16; g += 4) {
+      WB_ARMV8_SHA256_ROUNDS(g, s0, s1, m0, m1, m2, m3);
+      WB_ARMV8_SHA256_ROUNDS(g + 1, s0, s1, m1, m2, m3, m0);
+      WB_ARMV8_SHA256_ROUNDS(g + 2, s0, s1, m2, m3, m0, m1);
+      WB_ARMV8_SHA256_ROUNDS(g + 3, s0, s1, m3, m0, m1, m2);
+    }
+    s0 = vaddq_u32(s0, abcd);
+    s1 = vaddq_u32(s1, efgh);
+    data += 64;
+  }
+  vst1q_u32(state, s0);
+  vst1q_u32(state + 4, s1);
+}
+
+/* 4 rounds (g) of SHA-1, using the |op| (c, p or m) round function. */
+#define WB_ARMV8_SHA1_ROUNDS(g, op, k, abcd, e0, e1, m0, m1, m2, m3) do { \
+  uint32x4_t __msg = vaddq_u32(m0, vdupq_n_u32(k)); \
+  e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+  abcd = vsha1##op##q_u32(abcd, e0, __msg); \
+  if ((g) < 16) \
+    m0 = vsha1su1q_u32(vsha1su0q_u32(m0, m1, m2), m3); \
+} while (0)
+
+static void _WBSHA1CompressARMv8(uint32_t *state, const uint8_t *data, size_t blocks) {
+  uint32x4_t abcd = vld1q_u32(state);
+  uint32_t e0 = state[4], e1;
+  while (blocks-- > 0) {
+    uint32x4_t abcd0 = abcd;
+    uint32_t e00 = e0;
+    uint32x4_t m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data)));
+    uint32x4_t m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+    uint32x4_t m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+    uint32x4_t m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+    WB_ARMV8_SHA1_ROUNDS(0, c, 0x5a827999, abcd, e0, e1, m0, m1, m2, m3);
+    WB_ARMV8_SHA1_ROUNDS(1, c, 0x5a827999, abcd, e1, e0, m1, m2, m3, m0);
+    WB_ARMV8_SHA1_ROUNDS(2, c, 0x5a827999, abcd, e0, e1, m2, m3, m0, m1);
+    WB_ARMV8_SHA1_ROUNDS(3, c, 0x5a827999, abcd, e1, e0, m3, m0, m1, m2);
+    WB_ARMV8_SHA1_ROUNDS(4, c, 0x5a827999, abcd, e0, e1, m0, m1, m2, m3);
+    WB_ARMV8_SHA1_ROUNDS(5, p, 0x6ed9eba1, abcd, e1, e0, m1, m2, m3, m0);
+    WB_ARMV8_SHA1_ROUNDS(6, p, 0x6ed9eba1, abcd, e0, e1, m2, m3, m0, m1);
+    WB_ARMV8_SHA1_ROUNDS(7, p, 0x6ed9eba1, abcd, e1, e0, m3, m0, m1, m2);
+    WB_ARMV8_SHA1_ROUNDS(8, p, 0x6ed9eba1, abcd, e0, e1, m0, m1, m2, m3);
+    WB_ARMV8_SHA1_ROUNDS(9, p, 0x6ed9eba1, abcd, e1, e0, m1, m2, m3, m0);
+    WB_ARMV8_SHA1_ROUNDS(10, m, 0x8f1bbcdc, abcd, e0, e1, m2, m3, m0, m1);
+    WB_ARMV8_SHA1_ROUNDS(11, m, 0x8f1bbcdc, abcd, e1, e0, m3, m0, m1, m2);
+    WB_ARMV8_SHA1_ROUNDS(12, m, 0x8f1bbcdc, abcd, e0, e1, m0, m1, m2, m3);
+    WB_ARMV8_SHA1_ROUNDS(13, m, 0x8f1bbcdc, abcd, e1, e0, m1, m2, m3, m0);
+    WB_ARMV8_SHA1_ROUNDS(14, m, 0x8f1bbcdc, abcd, e0, e1, m2, m3, m0, m1);
+    WB_ARMV8_SHA1_ROUNDS(15, p, 0xca62c1d6, abcd, e1, e0, m3, m0, m1, m2);
+    WB_ARMV8_SHA1_ROUNDS(16, p, 0xca62c1d6, abcd, e0, e1, m0, m1, m2, m3);
+    WB_ARMV8_SHA1_ROUNDS(17, p, 0xca62c1d6, abcd, e1, e0, m1, m2, m3, m0);
+    WB_ARMV8_SHA1_ROUNDS(18, p, 0xca62c1d6, abcd, e0, e1, m2, m3, m0, m1);
+    WB_ARMV8_SHA1_ROUNDS(19, p, 0xca62c1d6, abcd, e1, e0, m3, m0, m1, m2);
+    abcd = vaddq_u32(abcd, abcd0);
+    e0 += e00;
+    data += 64;
+  }
+  vst1q_u32(state, abcd);
+  state[4] = e0;
+}
+
+#endif /* WB_DIGEST_ARMV8 */
+
+// MARK: -
+// MARK: Implementation selection
+static WBDigestBlockFunction sWBSHA1Compress = _WBSHA1CompressGeneric;
+static WBDigestBlockFunction sWBSHA256Compress = _WBSHA256CompressGeneric;
+static const char *sWBDigestImplementation = "generic";
+static pthread_once_t sWBDigestBackendOnce = PTHREAD_ONCE_INIT;
+
+static void _WBDigestSelectBackend(void) {
+#if defined(WB_DIGEST_X86)
+  if (WBDigestGetCPUFeatures() & kWBDigestCPUSHA) {
+    sWBSHA1Compress = _WBSHA1CompressSHANI;
+    sWBSHA256Compress = _WBSHA256CompressSHANI;
+    sWBDigestImplementation = "sha-ni";
+  }
+#elif defined(WB_DIGEST_ARMV8)
+  sWBSHA1Compress = _WBSHA1CompressARMv8;
+  sWBSHA256Compress = _WBSHA256CompressARMv8;
+  sWBDigestImplementation = "armv8";
+#endif
+}
+
+const char *WBDigestBackendGetImplementation(void) {
+  pthread_once(&sWBDigestBackendOnce, _WBDigestSelectBackend);
+  return sWBDigestImplementation;
+}
+
+void WBSHA256Compress(uint32_t state[8], const uint8_t *data, size_t blocks) {
+  pthread_once(&sWBDigestBackendOnce, _WBDigestSelectBackend);
+  sWBSHA256Compress(state, data, blocks);
+}
+
+// MARK: -
+// MARK: SHA-1 and SHA-256 contexts
+int WBSHA1Init(WBSHA1Context *ctxt) {
+  static const uint32_t iv[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+  pthread_once(&sWBDigestBackendOnce, _WBDigestSelectBackend);
+  memcpy(ctxt->state, iv, sizeof(iv));
+  ctxt->count = 0;
+  return 1;
+}
+
+int WBSHA1Update(WBSHA1Context *ctxt, const void *data, size_t length) {
+  _WBDigestUpdate64(ctxt->state, ctxt->buffer, &ctxt->count, data, length, sWBSHA1Compress);
+  return 1;
+}
+
+int WBSHA1Final(unsigned char *md, WBSHA1Context *ctxt) {
+  _WBDigestFinal64(ctxt->state, ctxt->buffer, ctxt->count, sWBSHA1Compress, true);
+  for (int idx = 0; idx < 5; ++idx)
+    _WBWriteBig32(md + idx * 4, ctxt->state[idx]);
+  memset(ctxt, 0, sizeof(*ctxt));
+  return 1;
+}
+
+int WBSHA224Init(WBSHA256Context *ctxt) {
+  pthread_once(&sWBDigestBackendOnce, _WBDigestSelectBackend);
+  memcpy(ctxt->state, WBSHA224IV, sizeof(WBSHA224IV));
+  ctxt->count = 0;
+  return 1;
+}
+
+int WBSHA224Update(WBSHA256Context *ctxt, const void *data, size_t length) {
+  return WBSHA256Update(ctxt, data, length);
+}
+
+int WBSHA224Final(unsigned char *md, WBSHA256Context *ctxt) {
+  _WBDigestFinal64(ctxt->state, ctxt->buffer, ctxt->count, sWBSHA256Compress, true);
+  for (int idx = 0; idx < 7; ++idx)
+    _WBWriteBig32(md + idx * 4, ctxt->state[idx]);
+  memset(ctxt, 0, sizeof(*ctxt));
+  return 1;
+}
+
+int WBSHA256Init(WBSHA256Context *ctxt) {
+  pthread_once(&sWBDigestBackendOnce, _WBDigestSelectBackend);
+  memcpy(ctxt->state, WBSHA256IV, sizeof(WBSHA256IV));
+  ctxt->count = 0;
+  return 1;
+}
+
+int WBSHA256Update(WBSHA256Context *ctxt, const void *data, size_t length) {
+  _WBDigestUpdate64(ctxt->state, ctxt->buffer, &ctxt->count, data, length, sWBSHA256Compress);
+  return 1;
+}
+
+int WBSHA256Final(unsigned char *md, WBSHA256Context *ctxt) {
+  _WBDigestFinal64(ctxt->state, ctxt->buffer, ctxt->count, sWBSHA256Compress, true);
+  for (int idx = 0; idx < 8; ++idx)
+    _WBWriteBig32(md + idx * 4, ctxt->state[idx]);
+  memset(ctxt, 0, sizeof(*ctxt));
+  return 1;
+}
+
+// MARK: -
+// MARK: SHA-512
+static const uint64_t _WBSHA512K[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+/* The variables are renamed instead of moved between rounds. */
+#define WB_SHA512_ROUND(a, b, c, d, e, f, g, h, i) do { \
+  uint64_t __t1 = h + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41)) + (g ^ (e & (f ^ g))) + _WBSHA512K[i] + w[i]; \
+  d += __t1; \
+  h = __t1 + (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39)) + ((a & b) | (c & (a | b))); \
+} while (0)
+
+static void _WBSHA512Compress(uint64_t *state, const uint8_t *data, size_t blocks) {
+  while (blocks-- > 0) {
+    uint64_t w[80];
+    for (int idx = 0; idx < 16; ++idx)
+      w[idx] = _WBReadBig64(data + idx * 8);
+    for (int idx = 16; idx < 80; ++idx) {
+      uint64_t s0 = ROR64(w[idx - 15], 1) ^ ROR64(w[idx - 15], 8) ^ (w[idx - 15] >> 7);
+      uint64_t s1 = ROR64(w[idx - 2], 19) ^ ROR64(w[idx - 2], 61) ^ (w[idx - 2] >> 6);
+      w[idx] = w[idx - 16] + s0 + w[idx - 7] + s1;
+    }
+
+    uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int idx = 0; idx < 80; idx += 8) {
+      WB_SHA512_ROUND(a, b, c, d, e, f, g, h, idx);
+      WB_SHA512_ROUND(h, a, b, c, d, e, f, g, idx + 1);
+      WB_SHA512_ROUND(g, h, a, b, c, d, e, f, idx + 2);
+      WB_SHA512_ROUND(f, g, h, a, b, c, d, e, idx + 3);
+      WB_SHA512_ROUND(e, f, g, h, a, b, c, d, idx + 4);
+      WB_SHA512_ROUND(d, e, f, g, h, a, b, c, idx + 5);
+      WB_SHA512_ROUND(c, d, e, f, g, h, a, b, idx + 6);
+      WB_SHA512_ROUND(b, c, d, e, f, g, h, a, idx + 7);
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    data += 128;
+  }
+}
+
+static void _WBSHA512Update(WBSHA512Context *ctxt, const uint8_t *data, size_t length) {
+  size_t used = (size_t)(ctxt->count % 128);
+  ctxt->count += length;
+  if (used) {
+    size_t fill = 128 - used;
+    if (length < fill) {
+      memcpy(ctxt->buffer + used, data, length);
+      return;
+    }
+    memcpy(ctxt->buffer + used, data, fill);
+    _WBSHA512Compress(ctxt->state, ctxt->buffer, 1);
+    data += fill;
+    length -= fill;
+  }
+  if (length >= 128) {
+    _WBSHA512Compress(ctxt->state, data, length / 128);
+    data += length / 128 * 128;
+    length %= 128;
+  }
+  if (length)
+    memcpy(ctxt->buffer, data, length);
+}
+
+static void _WBSHA512Final(unsigned char *md, size_t length, WBSHA512Context *ctxt) {
+  size_t used = (size_t)(ctxt->count % 128);
+  ctxt->buffer[used++] = 0x80;
+  if (used > 112) {
+    memset(ctxt->buffer + used, 0, 128 - used);
+    _WBSHA512Compress(ctxt->state, ctxt->buffer, 1);
+    used = 0;
+  }
+  memset(ctxt->buffer + used, 0, 120 - used);
+  _WBWriteBig64(ctxt->buffer + 120, ctxt->count * 8);
+  _WBSHA512Compress(ctxt->state, ctxt->buffer, 1);
+
+  for (size_t idx = 0; idx < length / 8; ++idx)
+    _WBWriteBig64(md + idx * 8, ctxt->state[idx]);
+  memset(ctxt, 0, sizeof(*ctxt));
+}
+
+int WBSHA384Init(WBSHA512Context *ctxt) {
+  static const uint64_t iv[8] = {
+    0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+    0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+  };
+  memcpy(ctxt->state, iv, sizeof(iv));
+  ctxt->count = 0;
+  return 1;
+}
+
+int WBSHA384Update(WBSHA512Context *ctxt, const void *data, size_t length) {
+  _WBSHA512Update(ctxt, data, length);
+  return 1;
+}
+
+int WBSHA384Final(unsigned char *md, WBSHA512Context *ctxt) {
+  _WBSHA512Final(md, 48, ctxt);
+  return 1;
+}
+
+int WBSHA512Init(WBSHA512Context *ctxt) {
+  static const uint64_t iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+  };
+  memcpy(ctxt->state, iv, sizeof(iv));
+  ctxt->count = 0;
+  return 1;
+}
+
+int WBSHA512Update(WBSHA512Context *ctxt, const void *data, size_t length) {
+  _WBSHA512Update(ctxt, data, length);
+  return 1;
+}
+
+int WBSHA512Final(unsigned char *md, WBSHA512Context *ctxt) {
+  _WBSHA512Final(md, 64, ctxt);
+  return 1;
+}
@@ -0,0 +1,104 @@
+/*
+ *  WBDigestBackend.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+/*!
+ @header WBDigestBackend.h
+ @abstract Self-contained MD5, SHA-1 and SHA-2 implementations.
+ @discussion Used by WBDigestFunctions when CommonCrypto is not available. The block
+ functions use the SHA extensions (x86) or the ARMv8 cryptographic extensions when
+ the CPU supports them.
+ */
+
+#if !defined(__WBDIGEST_BACKEND_H)
+#define __WBDIGEST_BACKEND_H 1
+
+#if __has_include(<WonderBox/WBBase.h>)
+#  include <WonderBox/WBBase.h>
+#else
+#  include "../WBBase.h"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct _WBMD5Context {
+  uint32_t state[4];
+  uint64_t count;
+  uint8_t buffer[64];
+} WBMD5Context;
+
+typedef struct _WBSHA1Context {
+  uint32_t state[5];
+  uint64_t count;
+  uint8_t buffer[64];
+} WBSHA1Context;
+
+/* SHA-224 and SHA-256 */
+typedef struct _WBSHA256Context {
+  uint32_t state[8];
+  uint64_t count;
+  uint8_t buffer[64];
+} WBSHA256Context;
+
+/* SHA-384 and SHA-512 */
+typedef struct _WBSHA512Context {
+  uint64_t state[8];
+  uint64_t count; // the 128 bits length is only needed past 2 EB
+  uint8_t buffer[128];
+} WBSHA512Context;
+
+/* Same conventions as CommonCrypto: functions return 1 */
+WB_PRIVATE int WBMD5Init(WBMD5Context *ctxt);
+WB_PRIVATE int WBMD5Update(WBMD5Context *ctxt, const void *data, size_t length);
+WB_PRIVATE int WBMD5Final(unsigned char *md, WBMD5Context *ctxt);
+
+WB_PRIVATE int WBSHA1Init(WBSHA1Context *ctxt);
+WB_PRIVATE int WBSHA1Update(WBSHA1Context *ctxt, const void *data, size_t length);
+WB_PRIVATE int WBSHA1Final(unsigned char *md, WBSHA1Context *ctxt);
+
+WB_PRIVATE int WBSHA224Init(WBSHA256Context *ctxt);
+WB_PRIVATE int WBSHA224Update(WBSHA256Context *ctxt, const void *data, size_t length);
+WB_PRIVATE int WBSHA224Final(unsigned char *md, WBSHA256Context *ctxt);
+
+WB_PRIVATE int WBSHA256Init(WBSHA256Context *ctxt);
+WB_PRIVATE int WBSHA256Update(WBSHA256Context *ctxt, const void *data, size_t length);
+WB_PRIVATE int WBSHA256Final(unsigned char *md, WBSHA256Context *ctxt);
+
+WB_PRIVATE int WBSHA384Init(WBSHA512Context *ctxt);
+WB_PRIVATE int WBSHA384Update(WBSHA512Context *ctxt, const void *data, size_t length);
+WB_PRIVATE int WBSHA384Final(unsigned char *md, WBSHA512Context *ctxt);
+
+WB_PRIVATE int WBSHA512Init(WBSHA512Context *ctxt);
+WB_PRIVATE int WBSHA512Update(WBSHA512Context *ctxt, const void *data, size_t length);
+WB_PRIVATE int WBSHA512Final(unsigned char *md, WBSHA512Context *ctxt);
+
+// MARK: Block functions
+WB_PRIVATE const uint32_t WBSHA256K[64];
+WB_PRIVATE const uint32_t WBSHA224IV[8];
+WB_PRIVATE const uint32_t WBSHA256IV[8];
+
+/* Processes |blocks| 64 bytes blocks using the best available implementation. */
+WB_PRIVATE void WBSHA256Compress(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+/* Returns the name of the block functions implementation ("generic", "sha-ni", "armv8"). */
+WB_PRIVATE const char *WBDigestBackendGetImplementation(void);
+
+#if defined(__x86_64__) || defined(__i386__)
+enum {
+  kWBDigestCPUAVX2 = 1 << 0,
+  kWBDigestCPUSHA = 1 << 1, // SHA extensions (and SSE4.1)
+};
+WB_PRIVATE uint32_t WBDigestGetCPUFeatures(void);
+
+/* Processes one block of two independent SHA-256 messages. Requires kWBDigestCPUSHA. */
+WB_PRIVATE void WBSHA256Compress2SHANI(uint32_t state1[8], const uint8_t *block1, uint32_t state2[8], const uint8_t *block2);
+#endif
+
+#endif /* __WBDIGEST_BACKEND_H */
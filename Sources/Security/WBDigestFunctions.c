@@ -8,11 +8,54 @@
  *  This file is distributed under the MIT License. See LICENSE.TXT for details.
  */
 
-#include <WonderBox/WBDigestFunctions.h>
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE 1 // O_DIRECT
+#endif
 
-#include <CommonCrypto/CommonDigest.h>
+#if __has_include(<WonderBox/WBDigestFunctions.h>)
+#  include <WonderBox/WBDigestFunctions.h>
+#else
+#  include "WBDigestFunctions.h"
+#endif
 
-#include <libc.h>
+#include "WBDigestBackend.h"
+
+/* CommonCrypto is used when available, unless the portable backend is requested. */
+#if defined(__APPLE__) && !defined(WB_DIGEST_PORTABLE)
+#  include <CommonCrypto/CommonDigest.h>
+#  define WB_DIGEST_COMMONCRYPTO 1
+typedef CC_LONG WBDigestLength;
+#else
+typedef size_t WBDigestLength;
+#endif
+
+#if defined(__APPLE__)
+#  include <libc.h>
+#else
+#  include <assert.h>
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <stdlib.h>
+#  include <string.h>
+#  include <strings.h>
+#  include <unistd.h>
+#endif
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if __has_include(<dispatch/dispatch.h>)
+#  include <dispatch/dispatch.h>
+#  define WB_DIGEST_DISPATCH 1
+#else
+#  include <stdatomic.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define WB_DIGEST_X86 1
+#endif
 
 typedef struct _WBDigestInfo {
   uint8_t algo;
@@ -20,35 +63,79 @@ typedef struct _WBDigestInfo {
   const char *name;
   /* functions */
   int (*init)(void *c);
-  int (*update)(void *c, const void *data, CC_LONG len);
+  int (*update)(void *c, const void *data, WBDigestLength len);
   int (*final)(unsigned char *md, void *c);
 } WBDigestInfo;
 
+/* SHA-256 used by the tree digest */
+#if defined(WB_DIGEST_COMMONCRYPTO)
+typedef CC_SHA256_CTX WBTreeHashContext;
+#  define WBTreeHashInit CC_SHA256_Init
+#  define WBTreeHashUpdate(c, data, len) CC_SHA256_Update(c, data, (CC_LONG)(len))
+#  define WBTreeHashFinal CC_SHA256_Final
+#else
+typedef WBSHA256Context WBTreeHashContext;
+#  define WBTreeHashInit WBSHA256Init
+#  define WBTreeHashUpdate WBSHA256Update
+#  define WBTreeHashFinal WBSHA256Final
+#endif
+
+typedef struct _WBDigestTreeContext {
+  uint32_t offset; // bytes in the current leaf
+  WBTreeHashContext leaf;
+  WBTreeHashContext root;
+} WBDigestTreeContext;
+
+static int _WBDigestTreeInit(WBDigestTreeContext *ctxt);
+static int _WBDigestTreeUpdate(WBDigestTreeContext *ctxt, const void *data, WBDigestLength len);
+static int _WBDigestTreeFinal(unsigned char *md, WBDigestTreeContext *ctxt);
+
 typedef struct _WBPrivateDigestContext {
   const WBDigestInfo *digest;
   union {
+#if defined(WB_DIGEST_COMMONCRYPTO)
     CC_MD2_CTX md2;
     CC_MD4_CTX md4;
     CC_MD5_CTX md5;
     CC_SHA1_CTX sha1;
     CC_SHA256_CTX sha256; // 224 & 256
     CC_SHA512_CTX sha512; // 384 & 512
+#else
+    WBMD5Context md5;
+    WBSHA1Context sha1;
+    WBSHA256Context sha256; // 224 & 256
+    WBSHA512Context sha512; // 384 & 512
+#endif
+    WBDigestTreeContext tree;
   } ctxt;
 } WBPrivateDigestContext;
 
+#if defined(WB_DIGEST_COMMONCRYPTO)
 #define DEFINE_DIGEST_INFO(str, algorithm) { \
   .algo = kWBDigest##algorithm, \
   .length = CC_##algorithm##_DIGEST_LENGTH, \
   .name = str, \
   .init = (int (*)(void *))CC_##algorithm##_Init, \
-  .update = (int (*)(void *, const void *, CC_LONG))CC_##algorithm##_Update, \
+  .update = (int (*)(void *, const void *, WBDigestLength))CC_##algorithm##_Update, \
   .final = (int (*)(unsigned char *, void *))CC_##algorithm##_Final \
 }
+#else
+#define DEFINE_DIGEST_INFO(str, algorithm) { \
+  .algo = kWBDigest##algorithm, \
+  .length = WB_##algorithm##_DIGEST_LENGTH, \
+  .name = str, \
+  .init = (int (*)(void *))WB##algorithm##Init, \
+  .update = (int (*)(void *, const void *, WBDigestLength))WB##algorithm##Update, \
+  .final = (int (*)(unsigned char *, void *))WB##algorithm##Final \
+}
+#endif
 static const WBDigestInfo _WBDigestInfos[] = {
+#if defined(WB_DIGEST_COMMONCRYPTO)
   /* MD2 */
   DEFINE_DIGEST_INFO("md2", MD2),
   /* MD4 */
   DEFINE_DIGEST_INFO("md4", MD4),
+#endif
   /* MD5 */
   DEFINE_DIGEST_INFO("md5", MD5),
   /* SHA1 */
@@ -61,6 +148,15 @@ static const WBDigestInfo _WBDigestInfos[] = {
   DEFINE_DIGEST_INFO("sha384", SHA384),
   /* SHA 512 */
   DEFINE_DIGEST_INFO("sha512", SHA512),
+  /* SHA 256 tree */
+  {
+    .algo = kWBDigestSHA256Tree,
+    .length = WB_SHA256_TREE_DIGEST_LENGTH,
+    .name = "sha256-tree",
+    .init = (int (*)(void *))_WBDigestTreeInit,
+    .update = (int (*)(void *, const void *, WBDigestLength))_WBDigestTreeUpdate,
+    .final = (int (*)(unsigned char *, void *))_WBDigestTreeFinal
+  },
   /* Sentinel */
   { kWBDigestUndefined, 0, NULL, NULL, NULL, NULL }
 };
@@ -74,6 +170,10 @@ const WBDigestInfo *__WBDigestInfoForAlgoritm(WBDigestAlgorithm algo) {
   return digest->algo ? digest : NULL;
 }
 
+enum {
+  kWBDigestMaxUpdateLength = 1024 * 1024 * 1024,
+};
+
 // MARK: -
 // MARK: Algorithms
 size_t WBDigestGetOutputSize(WBDigestAlgorithm algo) {
@@ -103,8 +203,16 @@ int WBDigestInit(WBDigestAlgorithm algo, WBDigestRef c) {
 int WBDigestUpdate(WBDigestRef c, const void *data, size_t len) {
   WBPrivateDigestContext *ctxt = (WBPrivateDigestContext *)c;
   if (!ctxt->digest) return 0; // error ?
-  assert(len < UINT32_MAX && "integer overflow");
-  return ctxt->digest->update(&ctxt->ctxt, data, (CC_LONG)len);
+#if defined(WB_DIGEST_COMMONCRYPTO)
+  /* CC_LONG is 32 bits */
+  while (len > kWBDigestMaxUpdateLength) {
+    int err = ctxt->digest->update(&ctxt->ctxt, data, kWBDigestMaxUpdateLength);
+    if (err <= 0) return err;
+    data = (const uint8_t *)data + kWBDigestMaxUpdateLength;
+    len -= kWBDigestMaxUpdateLength;
+  }
+#endif
+  return ctxt->digest->update(&ctxt->ctxt, data, (WBDigestLength)len);
 }
 
 int WBDigestFinal(WBDigestRef c, uint8_t *md) {
@@ -150,28 +258,411 @@ int WBDigestData(const void *data, size_t length, WBDigestAlgorithm algo, unsign
   return err;
 }
 
-int WBDigestFile(const char *path, WBDigestAlgorithm algo, unsigned char *md) {
+// MARK: Parallel
+typedef void (*WBDigestApplyFunction)(void *ctxt, size_t idx);
+
+#if !defined(WB_DIGEST_DISPATCH)
+typedef struct _WBDigestApplyContext {
+  atomic_size_t next;
+  size_t count;
+  void *ctxt;
+  WBDigestApplyFunction function;
+} WBDigestApplyContext;
+
+static void *_WBDigestApplyWorker(void *arg) {
+  WBDigestApplyContext *apply = arg;
+  size_t idx;
+  while ((idx = atomic_fetch_add(&apply->next, 1)) < apply->count)
+    apply->function(apply->ctxt, idx);
+  return NULL;
+}
+#endif
+
+/* Calls function for each index in [0; count) on all CPUs, and waits for completion. */
+static void _WBDigestApply(size_t count, void *ctxt, WBDigestApplyFunction function) {
+#if defined(WB_DIGEST_DISPATCH)
+  dispatch_apply_f(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ctxt, function);
+#else
+  WBDigestApplyContext apply = { .count = count, .ctxt = ctxt, .function = function };
+  atomic_init(&apply.next, 0);
+
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t nthreads = ncpu > 1 ? (size_t)ncpu - 1 : 0; // the caller is a worker too
+  if (nthreads > count - 1)
+    nthreads = count - 1;
+  pthread_t *threads = nthreads ? malloc(nthreads * sizeof(*threads)) : NULL;
+  size_t started = 0;
+  while (threads && started < nthreads && pthread_create(&threads[started], NULL, _WBDigestApplyWorker, &apply) == 0)
+    started++;
+  _WBDigestApplyWorker(&apply);
+  for (size_t idx = 0; idx < started; ++idx)
+    pthread_join(threads[idx], NULL);
+  free(threads);
+#endif
+}
+
+// MARK: Tree
+//
+// The tree digest is a two levels Merkle tree: the leaves are hashed
+// independently, and the root hashes the list of leaf digests. The 0x00
+// and 0x01 prefixes prevent a leaf from being taken for a list of digests.
+//
+static const uint8_t kWBDigestTreeLeafPrefix = 0x00;
+static const uint8_t kWBDigestTreeRootPrefix = 0x01;
+
+enum {
+  kWBDigestTreeMaxLeavesPerTask = 16,
+};
+
+static void _WBDigestTreeLeafInit(WBTreeHashContext *leaf) {
+  WBTreeHashInit(leaf);
+  WBTreeHashUpdate(leaf, &kWBDigestTreeLeafPrefix, 1);
+}
+
+static int _WBDigestTreeInit(WBDigestTreeContext *ctxt) {
+  ctxt->offset = 0;
+  _WBDigestTreeLeafInit(&ctxt->leaf);
+  WBTreeHashInit(&ctxt->root);
+  WBTreeHashUpdate(&ctxt->root, &kWBDigestTreeRootPrefix, 1);
+  return 1;
+}
+
+static int _WBDigestTreeUpdate(WBDigestTreeContext *ctxt, const void *data, WBDigestLength len) {
+  const uint8_t *bytes = data;
+  while (len > 0) {
+    /* the leaf is completed lazily, so an input that ends on a leaf boundary has no trailing empty leaf */
+    if (WB_DIGEST_TREE_LEAF_SIZE == ctxt->offset) {
+      uint8_t md[WB_SHA256_DIGEST_LENGTH];
+      WBTreeHashFinal(md, &ctxt->leaf);
+      WBTreeHashUpdate(&ctxt->root, md, sizeof(md));
+      _WBDigestTreeLeafInit(&ctxt->leaf);
+      ctxt->offset = 0;
+    }
+    size_t count = WB_DIGEST_TREE_LEAF_SIZE - ctxt->offset;
+    if (count > len)
+      count = len;
+    WBTreeHashUpdate(&ctxt->leaf, bytes, count);
+    ctxt->offset += (uint32_t)count;
+    bytes += count;
+    len -= count;
+  }
+  return 1;
+}
+
+static int _WBDigestTreeFinal(unsigned char *md, WBDigestTreeContext *ctxt) {
+  uint8_t leaf[WB_SHA256_DIGEST_LENGTH];
+  WBTreeHashFinal(leaf, &ctxt->leaf);
+  WBTreeHashUpdate(&ctxt->root, leaf, sizeof(leaf));
+  WBTreeHashFinal(md, &ctxt->root);
+  memset(ctxt, 0, sizeof(*ctxt));
+  return 1;
+}
+
+int WBDigestTreeLeaf(const void *data, size_t length, unsigned char *md) {
+  if (length > WB_DIGEST_TREE_LEAF_SIZE)
+    return 0;
+  WBTreeHashContext leaf;
+  _WBDigestTreeLeafInit(&leaf);
+  WBTreeHashUpdate(&leaf, data, length);
+  WBTreeHashFinal(md, &leaf);
+  return WB_SHA256_TREE_DIGEST_LENGTH;
+}
+
+int WBDigestTreeRoot(const uint8_t *leaves, size_t count, unsigned char *md) {
+  if (!count || !leaves)
+    return 0;
+  WBTreeHashContext root;
+  WBTreeHashInit(&root);
+  WBTreeHashUpdate(&root, &kWBDigestTreeRootPrefix, 1);
+  WBTreeHashUpdate(&root, leaves, count * WB_SHA256_DIGEST_LENGTH);
+  WBTreeHashFinal(md, &root);
+  return WB_SHA256_TREE_DIGEST_LENGTH;
+}
+
+typedef struct _WBDigestTreeFile {
+  int fd;
+  off_t size;
+  size_t count; // leaves
+  size_t leavesPerTask;
+  uint8_t *leaves;
+  volatile bool failed;
+} WBDigestTreeFile;
+
+enum {
+  /* O_DIRECT alignment of the buffer, the offsets and the lengths */
+  kWBDigestDirectAlignment = 4096,
+};
+
+static void _WBDigestTreeFileTask(void *ctxt, size_t task) {
+  WBDigestTreeFile *file = ctxt;
+  void *buffer;
+  /* aligned, in case the file was opened with O_DIRECT */
+  if (posix_memalign(&buffer, kWBDigestDirectAlignment, WB_DIGEST_TREE_LEAF_SIZE) != 0) {
+    file->failed = true;
+    return;
+  }
+  size_t end = (task + 1) * file->leavesPerTask;
+  if (end > file->count)
+    end = file->count;
+  for (size_t leaf = task * file->leavesPerTask; leaf < end && !file->failed; ++leaf) {
+    off_t offset = (off_t)leaf * WB_DIGEST_TREE_LEAF_SIZE;
+    size_t length = file->size - offset < WB_DIGEST_TREE_LEAF_SIZE ? (size_t)(file->size - offset) : WB_DIGEST_TREE_LEAF_SIZE;
+    size_t done = 0;
+    while (done < length) {
+      /* O_DIRECT requires whole blocks: read past the end of the last leaf (pread stops
+       at the end of file), and only hash the valid bytes. The leaf size is a multiple
+       of the alignment, and short reads only happen at the end of file, so the offsets
+       remain aligned and the buffer is large enough. */
+      size_t request = (length - done + kWBDigestDirectAlignment - 1) & ~(size_t)(kWBDigestDirectAlignment - 1);
+      ssize_t count = pread(file->fd, (uint8_t *)buffer + done, request, offset + (off_t)done);
+      if (count <= 0) {
+        if (count < 0 && EINTR == errno)
+          continue;
+        file->failed = true; // error or truncated file
+        break;
+      }
+      done += (size_t)count;
+    }
+    if (done >= length)
+      WBDigestTreeLeaf(buffer, length, file->leaves + leaf * WB_SHA256_DIGEST_LENGTH);
+  }
+  free(buffer);
+}
+
+static int _WBDigestFileTree(int fd, off_t size, unsigned char *md, uint8_t **leaves, size_t *count) {
+  WBDigestTreeFile file = {
+    .fd = fd,
+    .size = size,
+    .count = size > 0 ? (size_t)((size - 1) / WB_DIGEST_TREE_LEAF_SIZE + 1) : 1,
+  };
+  file.leaves = malloc(file.count * WB_SHA256_DIGEST_LENGTH);
+  if (!file.leaves)
+    return -1; // memFullErr
+
+  /* a few tasks per CPU, but large enough to amortize the buffer allocation */
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  file.leavesPerTask = file.count / (size_t)((ncpu > 0 ? ncpu : 1) * 4);
+  if (file.leavesPerTask < 1)
+    file.leavesPerTask = 1;
+  else if (file.leavesPerTask > kWBDigestTreeMaxLeavesPerTask)
+    file.leavesPerTask = kWBDigestTreeMaxLeavesPerTask;
+  size_t ntasks = (file.count + file.leavesPerTask - 1) / file.leavesPerTask;
+  if (ntasks > 1)
+    _WBDigestApply(ntasks, &file, _WBDigestTreeFileTask);
+  else
+    _WBDigestTreeFileTask(&file, 0);
+
+  int err = file.failed ? -1 : WBDigestTreeRoot(file.leaves, file.count, md);
+  if (err > 0 && leaves) {
+    *leaves = file.leaves;
+  } else {
+    free(file.leaves);
+    if (leaves)
+      *leaves = NULL;
+  }
+  if (count)
+    *count = err > 0 ? file.count : 0;
+  return err;
+}
+
+int WBDigestFileTree(const char *path, unsigned char *md, uint8_t **leaves, size_t *count) {
   int fd = open(path, O_RDONLY);
-  if (fd <= 0)
+  if (fd < 0)
+    return -1;
+  int err = -1;
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    err = _WBDigestFileTree(fd, info.st_size, md, leaves, count);
+  close(fd);
+  return err;
+}
+
+// MARK: Files
+enum {
+  kWBDigestReadBufferSize = 32 * 1024,
+  kWBDigestDirectBufferSize = 4 * 1024 * 1024,
+  kWBDigestThreadBufferSize = 4 * 1024 * 1024,
+  kWBDigestMapWindowSize = 256 * 1024 * 1024,
+};
+
+static int _WBDigestFileRead(int fd, WBDigestRef ctxt, size_t size, size_t alignment) {
+  void *buffer = NULL;
+  if (alignment) {
+    if (posix_memalign(&buffer, alignment, size) != 0)
+      buffer = NULL;
+  } else {
+    buffer = malloc(size);
+  }
+  if (!buffer)
+    return -1; // memFullErr
+
+  int err = 1;
+  ssize_t count = 0;
+  while (err > 0 && (count = read(fd, buffer, size)) > 0) {
+    err = WBDigestUpdate(ctxt, buffer, count);
+  }
+  if (count < 0)
+    err = -1; // CSSM_ERRCODE_FUNCTION_FAILED;
+  free(buffer);
+  return err;
+}
+
+/* Maps the file by windows, so huge files do not exhaust the address space. */
+static int _WBDigestFileMap(int fd, WBDigestRef ctxt) {
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    return _WBDigestFileRead(fd, ctxt, kWBDigestReadBufferSize, 0);
+
+  int err = 1;
+  off_t offset = 0;
+  while (err > 0 && offset < info.st_size) {
+    size_t length = (size_t)(info.st_size - offset < kWBDigestMapWindowSize ? info.st_size - offset : kWBDigestMapWindowSize);
+    void *addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, offset);
+    if (MAP_FAILED == addr) {
+      /* read what remains */
+      if (lseek(fd, offset, SEEK_SET) != offset)
+        return -1;
+      return _WBDigestFileRead(fd, ctxt, kWBDigestReadBufferSize, 0);
+    }
+    madvise(addr, length, MADV_SEQUENTIAL);
+    err = WBDigestUpdate(ctxt, addr, length);
+    munmap(addr, length);
+    offset += length;
+  }
+  return err;
+}
+
+/* The reader thread fills a buffer while the caller hashes the other one. */
+typedef struct _WBDigestFileReader {
+  int fd;
+  bool cancel;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint8_t *buffers[2];
+  ssize_t lengths[2]; // read() result, valid when full is set
+  bool full[2];
+} WBDigestFileReader;
+
+static void *_WBDigestFileReaderMain(void *arg) {
+  WBDigestFileReader *reader = arg;
+  for (size_t idx = 0; ; idx ^= 1) {
+    pthread_mutex_lock(&reader->lock);
+    while (reader->full[idx] && !reader->cancel)
+      pthread_cond_wait(&reader->cond, &reader->lock);
+    bool cancel = reader->cancel;
+    pthread_mutex_unlock(&reader->lock);
+    if (cancel)
+      break;
+
+    ssize_t count = read(reader->fd, reader->buffers[idx], kWBDigestThreadBufferSize);
+
+    pthread_mutex_lock(&reader->lock);
+    reader->lengths[idx] = count;
+    reader->full[idx] = true;
+    pthread_cond_signal(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+    if (count <= 0)
+      break;
+  }
+  return NULL;
+}
+
+static int _WBDigestFileThreaded(int fd, WBDigestRef ctxt) {
+  WBDigestFileReader reader = { .fd = fd };
+  reader.buffers[0] = malloc(2 * kWBDigestThreadBufferSize);
+  if (!reader.buffers[0])
+    return -1; // memFullErr
+  reader.buffers[1] = reader.buffers[0] + kWBDigestThreadBufferSize;
+  pthread_mutex_init(&reader.lock, NULL);
+  pthread_cond_init(&reader.cond, NULL);
+
+  int err;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, _WBDigestFileReaderMain, &reader) != 0) {
+    err = _WBDigestFileRead(fd, ctxt, kWBDigestReadBufferSize, 0);
+  } else {
+    err = 1;
+    for (size_t idx = 0; err > 0; idx ^= 1) {
+      pthread_mutex_lock(&reader.lock);
+      while (!reader.full[idx])
+        pthread_cond_wait(&reader.cond, &reader.lock);
+      ssize_t count = reader.lengths[idx];
+      pthread_mutex_unlock(&reader.lock);
+      if (count <= 0) {
+        if (count < 0)
+          err = -1; // CSSM_ERRCODE_FUNCTION_FAILED;
+        break;
+      }
+
+      err = WBDigestUpdate(ctxt, reader.buffers[idx], count);
+
+      pthread_mutex_lock(&reader.lock);
+      reader.full[idx] = false;
+      pthread_cond_signal(&reader.cond);
+      pthread_mutex_unlock(&reader.lock);
+    }
+    pthread_mutex_lock(&reader.lock);
+    reader.cancel = true;
+    pthread_cond_signal(&reader.cond);
+    pthread_mutex_unlock(&reader.lock);
+    pthread_join(thread, NULL);
+  }
+
+  pthread_cond_destroy(&reader.cond);
+  pthread_mutex_destroy(&reader.lock);
+  free(reader.buffers[0]);
+  return err;
+}
+
+int WBDigestFile(const char *path, WBDigestAlgorithm algo, unsigned char *md) {
+  return WBDigestFileWithStrategy(path, algo, kWBDigestFileRead, md);
+}
+
+int WBDigestFileWithStrategy(const char *path, WBDigestAlgorithm algo, WBDigestFileStrategy strategy, unsigned char *md) {
+  int flags = O_RDONLY;
+#if defined(O_DIRECT)
+  if (kWBDigestFileDirectIO == strategy)
+    flags |= O_DIRECT;
+#endif
+  int fd = open(path, flags);
+#if defined(O_DIRECT)
+  /* not supported by the file system */
+  if (fd < 0 && EINVAL == errno && (flags & O_DIRECT))
+    fd = open(path, O_RDONLY);
+#endif
+  if (fd < 0)
     return -1;
+#if defined(F_NOCACHE)
   /* disable file system caching */
-  fcntl(fd, F_NOCACHE, 0);
+  if (kWBDigestFileDirectIO == strategy)
+    fcntl(fd, F_NOCACHE, 1);
+#endif
+
+  /* the leaves of regular files are hashed in parallel */
+  struct stat info;
+  if (kWBDigestSHA256Tree == algo && fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+    int err = _WBDigestFileTree(fd, info.st_size, md, NULL, NULL);
+    close(fd);
+    return err;
+  }
 
   WBDigestContext ctxt;
   int err = WBDigestInit(algo, &ctxt);
   if (err > 0) {
-    /* must be 4k align because caching is disabled */
-    char *buffer = malloc(32 * 1024);
-    if (!buffer) {
-      err = -1; // memFullErr
-    } else {
-      ssize_t count = 0;
-      while (err > 0 && (count = read(fd, buffer, 32 * 1024)) > 0) {
-        err = WBDigestUpdate(&ctxt, buffer, count);
-      }
-      if (count < 0)
-        err = -1; // CSSM_ERRCODE_FUNCTION_FAILED;
-      free(buffer);
+    switch (strategy) {
+      case kWBDigestFileMap:
+        err = _WBDigestFileMap(fd, &ctxt);
+        break;
+      case kWBDigestFileDirectIO:
+        /* must be page aligned because caching is disabled */
+        err = _WBDigestFileRead(fd, &ctxt, kWBDigestDirectBufferSize, kWBDigestDirectAlignment);
+        break;
+      case kWBDigestFileThreaded:
+        err = _WBDigestFileThreaded(fd, &ctxt);
+        break;
+      default:
+        err = _WBDigestFileRead(fd, &ctxt, kWBDigestReadBufferSize, 0);
+        break;
     }
 
     if (err > 0) {
@@ -186,3 +677,328 @@ int WBDigestFile(const char *path, WBDigestAlgorithm algo, unsigned char *md) {
   return err;
 }
 
+// MARK: -
+// MARK: Batch
+//
+// Hashing many small buffers one at a time is bound by the latency of the
+// compression function. SHA-224/256 batches run 8 independent messages in
+// the 8 lanes of AVX2 registers (each lane is refilled with the next message
+// as soon as it is done), and the batch is split over the GCD thread pool
+// when it is large enough. Buffers larger than kWBDigestLaneMaxLength are
+// not worth a lane and use the regular (single stream) implementation.
+//
+enum {
+  kWBDigestLaneMaxLength = 64 * 1024,
+  kWBDigestBatchMinChunk = 256 * 1024, // minimum bytes per thread pool task
+};
+
+#if defined(WB_DIGEST_X86)
+
+#define WB_AVX2 __attribute__((__target__("avx2")))
+
+#define WB_ROR32X8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+/* Transposes 8 rows of 8 words, so row i contains the word i of each lane. */
+WB_AVX2 WB_INLINE
+void _WBTranspose8x8(__m256i r[8]) {
+  __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+  __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+  __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+  __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+  __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+  __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+  __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+  __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+  r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+/* Processes one 64 bytes block for each of the 8 lanes. state[i][lane] is the word i of the lane. */
+WB_AVX2
+static void _WBSHA256Compress8(uint32_t state[8][8], const uint8_t *blocks[8]) {
+  const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                         3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i w[16];
+  for (int half = 0; half < 2; ++half) {
+    for (int lane = 0; lane < 8; ++lane)
+      w[half * 8 + lane] = _mm256_loadu_si256((const __m256i *)(blocks[lane] + half * 32));
+    _WBTranspose8x8(w + half * 8);
+  }
+  for (int idx = 0; idx < 16; ++idx)
+    w[idx] = _mm256_shuffle_epi8(w[idx], bswap);
+
+  __m256i a = _mm256_loadu_si256((const __m256i *)state[0]), b = _mm256_loadu_si256((const __m256i *)state[1]);
+  __m256i c = _mm256_loadu_si256((const __m256i *)state[2]), d = _mm256_loadu_si256((const __m256i *)state[3]);
+  __m256i e = _mm256_loadu_si256((const __m256i *)state[4]), f = _mm256_loadu_si256((const __m256i *)state[5]);
+  __m256i g = _mm256_loadu_si256((const __m256i *)state[6]), h = _mm256_loadu_si256((const __m256i *)state[7]);
+
+  for (int t = 0; t < 64; ++t) {
+    if (t >= 16) {
+      __m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+      __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(WB_ROR32X8(w15, 7), WB_ROR32X8(w15, 18)), _mm256_srli_epi32(w15, 3));
+      __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(WB_ROR32X8(w2, 17), WB_ROR32X8(w2, 19)), _mm256_srli_epi32(w2, 10));
+      w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+    }
+    __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(WB_ROR32X8(e, 6), WB_ROR32X8(e, 11)), WB_ROR32X8(e, 25));
+    __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+    __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1), _mm256_add_epi32(ch, w[t & 15]));
+    t1 = _mm256_add_epi32(t1, _mm256_set1_epi32((int)WBSHA256K[t]));
+    __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(WB_ROR32X8(a, 2), WB_ROR32X8(a, 13)), WB_ROR32X8(a, 22));
+    __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+    __m256i t2 = _mm256_add_epi32(S0, maj);
+    h = g; g = f; f = e;
+    e = _mm256_add_epi32(d, t1);
+    d = c; c = b; b = a;
+    a = _mm256_add_epi32(t1, t2);
+  }
+
+  __m256i *st = (__m256i *)state;
+  _mm256_storeu_si256(st + 0, _mm256_add_epi32(_mm256_loadu_si256(st + 0), a));
+  _mm256_storeu_si256(st + 1, _mm256_add_epi32(_mm256_loadu_si256(st + 1), b));
+  _mm256_storeu_si256(st + 2, _mm256_add_epi32(_mm256_loadu_si256(st + 2), c));
+  _mm256_storeu_si256(st + 3, _mm256_add_epi32(_mm256_loadu_si256(st + 3), d));
+  _mm256_storeu_si256(st + 4, _mm256_add_epi32(_mm256_loadu_si256(st + 4), e));
+  _mm256_storeu_si256(st + 5, _mm256_add_epi32(_mm256_loadu_si256(st + 5), f));
+  _mm256_storeu_si256(st + 6, _mm256_add_epi32(_mm256_loadu_si256(st + 6), g));
+  _mm256_storeu_si256(st + 7, _mm256_add_epi32(_mm256_loadu_si256(st + 7), h));
+}
+
+/* A message split in 64 bytes blocks: the full blocks are read in place, and
+ the last partial one is copied with the padding. */
+typedef struct _WBSHA256Message {
+  const uint8_t *data;
+  size_t blocks; // full blocks in data
+  size_t total; // blocks, including the padding ones
+  uint8_t tail[128];
+} WBSHA256Message;
+
+static void _WBSHA256MessageInit(WBSHA256Message *msg, const void *data, size_t length) {
+  msg->data = data;
+  msg->blocks = length / 64;
+
+  size_t remain = length % 64;
+  memset(msg->tail, 0, sizeof(msg->tail));
+  if (remain)
+    memcpy(msg->tail, msg->data + msg->blocks * 64, remain);
+  msg->tail[remain] = 0x80;
+  size_t padding = (remain + 9 <= 64) ? 64 : 128;
+  uint64_t bits = (uint64_t)length * 8;
+  for (int i = 0; i < 8; ++i)
+    msg->tail[padding - 1 - i] = (uint8_t)(bits >> (8 * i));
+  msg->total = msg->blocks + padding / 64;
+}
+
+WB_INLINE
+const uint8_t *_WBSHA256MessageBlock(const WBSHA256Message *msg, size_t idx) {
+  return idx < msg->blocks ? msg->data + idx * 64 : msg->tail + (idx - msg->blocks) * 64;
+}
+
+static void _WBSHA256WriteDigest(uint8_t *md, size_t length, const uint32_t state[8]) {
+  for (size_t i = 0; i < length / 4; ++i) {
+    md[i * 4] = (uint8_t)(state[i] >> 24);
+    md[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+    md[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+    md[i * 4 + 3] = (uint8_t)state[i];
+  }
+}
+
+static bool _WBSHA256BatchEligible(size_t length) {
+  return length <= kWBDigestLaneMaxLength;
+}
+
+typedef struct _WBSHA256Lane {
+  WBSHA256Message msg;
+  size_t next;
+  size_t job;
+} WBSHA256Lane;
+
+/* Hashes all eligible buffers of the range, using 8 lanes. */
+static void _WBSHA256DigestLanesAVX2(const uint32_t iv[8], size_t outlen, const void * const *buffers, const size_t *lengths,
+                                     size_t count, uint8_t *digests) {
+  static const uint8_t zero[64];
+  uint32_t state[8][8];
+  WBSHA256Lane lanes[8];
+  bool active[8] = { false };
+  const uint8_t *blocks[8];
+
+  size_t job = 0;
+  int running = 0;
+  for (int idx = 0; idx < 8; ++idx) {
+    while (job < count && !_WBSHA256BatchEligible(lengths[job])) job++;
+    if (job < count) {
+      _WBSHA256MessageInit(&lanes[idx].msg, buffers[job], lengths[job]);
+      lanes[idx].next = 0;
+      lanes[idx].job = job++;
+      for (int i = 0; i < 8; ++i)
+        state[i][idx] = iv[i];
+      active[idx] = true;
+      running++;
+    }
+  }
+
+  while (running > 0) {
+    for (int idx = 0; idx < 8; ++idx)
+      blocks[idx] = active[idx] ? _WBSHA256MessageBlock(&lanes[idx].msg, lanes[idx].next) : zero;
+    _WBSHA256Compress8(state, blocks);
+
+    for (int idx = 0; idx < 8; ++idx) {
+      if (!active[idx] || ++lanes[idx].next < lanes[idx].msg.total)
+        continue;
+      /* this lane is done, output the digest and take the next buffer */
+      uint32_t result[8];
+      for (int i = 0; i < 8; ++i)
+        result[i] = state[i][idx];
+      _WBSHA256WriteDigest(digests + lanes[idx].job * outlen, outlen, result);
+
+      while (job < count && !_WBSHA256BatchEligible(lengths[job])) job++;
+      if (job < count) {
+        _WBSHA256MessageInit(&lanes[idx].msg, buffers[job], lengths[job]);
+        lanes[idx].next = 0;
+        lanes[idx].job = job++;
+        for (int i = 0; i < 8; ++i)
+          state[i][idx] = iv[i];
+      } else {
+        active[idx] = false;
+        running--;
+      }
+    }
+  }
+}
+
+// MARK: SHA extensions
+/* Hashes all eligible buffers of the range, two at a time. */
+static void _WBSHA256DigestLanesSHANI(const uint32_t iv[8], size_t outlen, const void * const *buffers, const size_t *lengths,
+                                      size_t count, uint8_t *digests) {
+  size_t job = 0;
+  for (;;) {
+    size_t jobs[2], pending = 0;
+    while (pending < 2 && job < count) {
+      if (_WBSHA256BatchEligible(lengths[job]))
+        jobs[pending++] = job;
+      job++;
+    }
+    if (0 == pending)
+      break;
+
+    WBSHA256Message msgs[2];
+    uint32_t state[2][8];
+    memcpy(state[0], iv, sizeof(state[0]));
+    memcpy(state[1], iv, sizeof(state[1]));
+    size_t blk = 0;
+    _WBSHA256MessageInit(&msgs[0], buffers[jobs[0]], lengths[jobs[0]]);
+    if (pending == 2) {
+      _WBSHA256MessageInit(&msgs[1], buffers[jobs[1]], lengths[jobs[1]]);
+      size_t common = msgs[0].total < msgs[1].total ? msgs[0].total : msgs[1].total;
+      for (; blk < common; ++blk)
+        WBSHA256Compress2SHANI(state[0], _WBSHA256MessageBlock(&msgs[0], blk), state[1], _WBSHA256MessageBlock(&msgs[1], blk));
+      for (size_t b = blk; b < msgs[1].total; ++b)
+        WBSHA256Compress(state[1], _WBSHA256MessageBlock(&msgs[1], b), 1);
+    }
+    for (; blk < msgs[0].total; ++blk)
+      WBSHA256Compress(state[0], _WBSHA256MessageBlock(&msgs[0], blk), 1);
+
+    for (size_t idx = 0; idx < pending; ++idx)
+      _WBSHA256WriteDigest(digests + jobs[idx] * outlen, outlen, state[idx]);
+  }
+}
+
+#endif /* WB_DIGEST_X86 */
+
+typedef struct _WBDigestBatch {
+  WBDigestAlgorithm algo;
+  size_t length; // digest length
+  const void * const *buffers;
+  const size_t *lengths;
+  uint8_t *digests;
+  const size_t *chunks; // chunk boundaries (count + 1 entries)
+} WBDigestBatch;
+
+static void _WBDigestBatchRange(const WBDigestBatch *batch, size_t start, size_t end) {
+  bool lanes = false;
+#if defined(WB_DIGEST_X86)
+  if (batch->algo == kWBDigestSHA256 || batch->algo == kWBDigestSHA224) {
+    const uint32_t *iv = batch->algo == kWBDigestSHA256 ? WBSHA256IV : WBSHA224IV;
+    uint32_t features = WBDigestGetCPUFeatures();
+    /* SHA extensions are faster than 8 AVX2 lanes when available */
+    if (features & kWBDigestCPUSHA) {
+      lanes = true;
+      _WBSHA256DigestLanesSHANI(iv, batch->length, batch->buffers + start, batch->lengths + start, end - start,
+                                batch->digests + start * batch->length);
+    } else if (features & kWBDigestCPUAVX2) {
+      lanes = true;
+      _WBSHA256DigestLanesAVX2(iv, batch->length, batch->buffers + start, batch->lengths + start, end - start,
+                               batch->digests + start * batch->length);
+    }
+  }
+#endif
+  for (size_t idx = start; idx < end; ++idx) {
+#if defined(WB_DIGEST_X86)
+    /* already done by the multi-buffer code */
+    if (lanes && _WBSHA256BatchEligible(batch->lengths[idx]))
+      continue;
+#endif
+    WBDigestData(batch->buffers[idx], batch->lengths[idx], batch->algo, batch->digests + idx * batch->length);
+  }
+}
+
+static void _WBDigestBatchChunk(void *ctxt, size_t chunk) {
+  const WBDigestBatch *batch = ctxt;
+  _WBDigestBatchRange(batch, batch->chunks[chunk], batch->chunks[chunk + 1]);
+}
+
+int WBDigestDataBatch(WBDigestAlgorithm algo, const void * const *buffers, const size_t *lengths, size_t count, uint8_t *digests) {
+  const WBDigestInfo *digest = __WBDigestInfoForAlgoritm(algo);
+  if (!digest || (count > 0 && (!buffers || !lengths || !digests)))
+    return 0;
+  if (0 == count)
+    return digest->length;
+
+  WBDigestBatch batch = {
+    .algo = algo,
+    .length = digest->length,
+    .buffers = buffers,
+    .lengths = lengths,
+    .digests = digests,
+  };
+
+  /* Split the batch in chunks of about the same amount of data, a few per CPU. */
+  size_t total = 0;
+  for (size_t idx = 0; idx < count; ++idx)
+    total += lengths[idx];
+
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t target = total / (size_t)((ncpu > 0 ? ncpu : 1) * 4);
+  if (target < kWBDigestBatchMinChunk)
+    target = kWBDigestBatchMinChunk;
+  if (total <= target || count == 1) {
+    _WBDigestBatchRange(&batch, 0, count);
+    return digest->length;
+  }
+
+  size_t *chunks = malloc((count + 1) * sizeof(*chunks));
+  if (!chunks)
+    return 0;
+  size_t nchunks = 0, size = 0;
+  chunks[0] = 0;
+  for (size_t idx = 0; idx < count; ++idx) {
+    size += lengths[idx];
+    if (size >= target) {
+      chunks[++nchunks] = idx + 1;
+      size = 0;
+    }
+  }
+  if (chunks[nchunks] != count)
+    chunks[++nchunks] = count;
+  batch.chunks = chunks;
+
+  _WBDigestApply(nchunks, &batch, _WBDigestBatchChunk);
+  free(chunks);
+
+  return digest->length;
+}
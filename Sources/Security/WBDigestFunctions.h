@@ -15,9 +15,14 @@
 #if !defined(__WBDIGEST_FUNCTIONS_H)
 #define __WBDIGEST_FUNCTIONS_H 1
 
-#include <WonderBox/WBBase.h>
+#if __has_include(<WonderBox/WBBase.h>)
+#  include <WonderBox/WBBase.h>
+#else
+#  include "../WBBase.h"
+#endif
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef struct _WBDigestContext {
   char opaque[240];
@@ -25,6 +30,8 @@ typedef struct _WBDigestContext {
 
 typedef WBDigestContext *WBDigestRef;
 
+/* MD2 and MD4 are only available when CommonCrypto is used (Apple platforms,
+ unless WB_DIGEST_PORTABLE is defined). Other algorithms use WBDigestBackend. */
 enum {
   kWBDigestUndefined = 0,
   kWBDigestMD2,
@@ -35,6 +42,8 @@ enum {
   kWBDigestSHA256,
   kWBDigestSHA384,
   kWBDigestSHA512,
+  /* SHA-256 tree: see WBDigestFileTree() */
+  kWBDigestSHA256Tree,
 };
 typedef uint32_t WBDigestAlgorithm;
 
@@ -47,6 +56,10 @@ typedef uint32_t WBDigestAlgorithm;
 #define WB_SHA256_DIGEST_LENGTH 32
 #define WB_SHA384_DIGEST_LENGTH 48
 #define WB_SHA512_DIGEST_LENGTH 64
+#define WB_SHA256_TREE_DIGEST_LENGTH 32
+
+/* Size of the tree digest leaves (the last one may be shorter) */
+#define WB_DIGEST_TREE_LEAF_SIZE (1024 * 1024)
 
 #define WB_DIGEST_MAX_LENGTH WB_SHA512_DIGEST_LENGTH
 
@@ -75,10 +88,63 @@ const char *WBDigestGetAlgorithmNameFromRef(WBDigestRef ctxt);
 WB_EXPORT
 WBDigestAlgorithm WBDigestGetAlgorithmFromRef(WBDigestRef ctxt);
 
+/* WBDigestFile strategies */
+enum {
+  kWBDigestFileRead = 0, // 32 KB reads (default)
+  kWBDigestFileMap, // mmap with sequential access advice
+  kWBDigestFileDirectIO, // large aligned reads bypassing the file system cache
+  kWBDigestFileThreaded, // double buffered reads on a separate thread, overlapping I/O and hashing
+};
+typedef uint32_t WBDigestFileStrategy;
+
 /* convenient functions */
 WB_EXPORT
 int WBDigestFile(const char *path, WBDigestAlgorithm algo, unsigned char *md);
+
+/*!
+@function
+ @abstract Same as WBDigestFile() using the <i>strategy</i> to read the file.
+ @discussion kWBDigestFileMap falls back to kWBDigestFileRead for files that cannot be mapped (pipes, devices).
+ The file must not be truncated while it is mapped. kWBDigestFileDirectIO uses O_DIRECT or F_NOCACHE, and falls back
+ to cached reads when the file system does not support it.
+ @result Returns the digest length on success, 0 or -1 if an error occured
+ */
+WB_EXPORT
+int WBDigestFileWithStrategy(const char *path, WBDigestAlgorithm algo, WBDigestFileStrategy strategy, unsigned char *md);
 WB_EXPORT
 int WBDigestData(const void *data, size_t length, WBDigestAlgorithm algo, unsigned char *md);
 
+/*!
+@function
+ @abstract Computes the digests of <i>count</i> independent buffers.
+ @discussion The result is the same as calling WBDigestData() on each buffer, but
+ the buffers are processed in parallel: SHA-224 and SHA-256 use the SHA extensions (2 interleaved
+ messages) or 8 AVX2 lanes when the CPU supports it, and large batches are spread over the GCD thread pool.
+ @param digests receives the <i>count</i> digests one after the other, so it must be
+ at least count * WBDigestGetOutputSize(algo) bytes long.
+ @result Returns the digest length on success, 0 if an error occured
+ */
+WB_EXPORT
+int WBDigestDataBatch(WBDigestAlgorithm algo, const void * const *buffers, const size_t *lengths, size_t count, uint8_t *digests);
+
+/*!
+@function
+ @abstract Computes the kWBDigestSHA256Tree digest of a file, hashing the leaves in parallel.
+ @discussion The input is split in WB_DIGEST_TREE_LEAF_SIZE leaves (an empty input has one empty leaf).
+ Each leaf digest is SHA-256(0x00 || leaf), and the root is SHA-256(0x01 || leaf digests).
+ WBDigestFile() uses this function for kWBDigestSHA256Tree, and the streaming functions compute the same digest.
+ @param leaves if not NULL, receives a malloc'ed buffer with the leaf digests, that the caller must free.
+ @param count if not NULL, receives the number of leaves.
+ @result Returns the digest length on success, 0 or -1 if an error occured
+ */
+WB_EXPORT
+int WBDigestFileTree(const char *path, unsigned char *md, uint8_t **leaves, size_t *count);
+
+/* Computes the digest of one leaf (at most WB_DIGEST_TREE_LEAF_SIZE bytes), to verify a range of a file. */
+WB_EXPORT
+int WBDigestTreeLeaf(const void *data, size_t length, unsigned char *md);
+/* Computes the tree digest from the leaf digests. */
+WB_EXPORT
+int WBDigestTreeRoot(const uint8_t *leaves, size_t count, unsigned char *md);
+
 #endif /* __WBDIGEST_FUNCTIONS_H */
@@ -0,0 +1,123 @@
+/*
+ *  WBCompiledTemplate.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+/*!
+    @header WBCompiledTemplate
+    @abstract   Parse once, render many times.
+    @discussion A template is compiled into a flat instruction array: UTF-8 literal slices,
+    variable slots, and block begin and end, where block begin knows the position of its end.
+    Variables are resolved by slot, so rendering does not perform any dictionary lookup.
+    A compiled template is immutable, and can be shared by any number of renderers,
+    on any thread.
+*/
+
+#import <WonderBox/WBTemplate.h>
+
+#include <stdio.h>
+#include <sys/uio.h>
+
+enum {
+  /* Block index of the template itself */
+  kWBTemplateRootBlock = 0,
+};
+
+WB_OBJC_EXPORT
+@interface WBCompiledTemplate : NSObject
+
+/* The template is loaded if needed. Variables values are ignored. */
+- (instancetype)initWithTemplate:(WBTemplate *)aTemplate;
+/* UTF-8 files are compiled while they are parsed, without loading a WBTemplate first */
+- (instancetype)initWithContentsOfFile:(NSString *)aFile encoding:(NSStringEncoding)encoding;
+
+@property(nonatomic, readonly) NSUInteger numberOfBlocks;
+@property(nonatomic, readonly) NSUInteger numberOfSlots;
+
+/* Returns NSNotFound if there is no block with that name */
+- (NSUInteger)indexOfBlock:(NSString *)aName;
+/* Returns NSNotFound if aBlock does not use the variable */
+- (NSUInteger)slotOfVariable:(NSString *)aKey inBlock:(NSUInteger)aBlock;
+/* The slots of a block are contiguous */
+- (NSRange)slotRangeOfBlock:(NSUInteger)aBlock;
+
+@end
+
+/* Writes all the buffers. Returns NO, and sets errno on failure. */
+typedef BOOL (*WBTemplateWriteFunction)(const struct iovec *buffers, int count, void *context);
+
+/* An UTF-8 value, not necessarily null terminated */
+typedef struct _WBTemplateValue {
+  const char *bytes;
+  NSUInteger length;
+} WBTemplateValue;
+
+/* Sets the values of a row. values is indexed by slot - first slot of the block, and is cleared before each call.
+ The values must stay valid until the next call. Returns NO to stop. */
+typedef BOOL (*WBTemplateRowFunction)(NSUInteger row, WBTemplateValue *values, void *context);
+
+/*!
+    @class
+    @abstract    Renders a compiled template.
+    @discussion  Works like WBTemplate: set the variables of a block, then dump it to add an
+    instance of this block to its parent. Dumping a block renders it immediately, in the
+    block pending output, so each instance is rendered once, and the renderer only stores
+    UTF-8 bytes. A renderer must not be used by more than one thread at a time.
+*/
+WB_OBJC_EXPORT
+@interface WBTemplateRenderer : NSObject
+
+- (instancetype)initWithTemplate:(WBCompiledTemplate *)aTemplate;
+
+@property(nonatomic, readonly) WBCompiledTemplate *compiledTemplate;
+
+- (void)setString:(NSString *)aValue forSlot:(NSUInteger)aSlot;
+/* The bytes are copied */
+- (void)setUTF8String:(const char *)aValue length:(NSUInteger)length forSlot:(NSUInteger)aSlot;
+
+/* Renders an instance of the block, and clears the block variables */
+- (void)dumpBlock:(NSUInteger)aBlock;
+
+/*!
+    @method
+    @abstract   Dumps count instances of a block, one per row of a columnar data source.
+    @discussion Same as setting the block variables and dumping it count times, but values are
+    copied straight from the columns to the output. Sub-blocks instances pending, if any, go to the first row.
+    @param      columns Indexed by slot - first slot of the block. Each column contains count values.
+    A NULL column is an empty variable.
+*/
+- (void)dumpBlock:(NSUInteger)aBlock rows:(NSUInteger)count columns:(const WBTemplateValue * const *)columns;
+/* Same as -dumpBlock:rows:columns:, but the values are provided by function. Returns the number of rows dumped. */
+- (NSUInteger)dumpBlock:(NSUInteger)aBlock rows:(NSUInteger)count function:(WBTemplateRowFunction)function context:(void *)context;
+
+/* Dumps the root block, and returns the UTF-8 output. The renderer is then ready for a new output. */
+- (NSData *)renderedData;
+/* Same as -renderedData */
+- (NSString *)stringRepresentation;
+
+/*!
+    @method
+    @abstract   Dumps the root block, and writes it without building the whole output.
+    @discussion Only the root instance is streamed: its literals and variables values are written in place,
+    and small slices are grouped, so function receives a few large batches of buffers. Instances of the
+    other blocks are rendered when they are dumped, and stay in their parent pending output until it is
+    dumped, so the renderer still holds the rendered output of all the root sub-blocks when this method is called.
+    As for -renderedData, the renderer is ready for a new output afterward, even on failure.
+*/
+- (BOOL)renderUsingFunction:(WBTemplateWriteFunction)function context:(void *)context;
+
+- (BOOL)renderToFileDescriptor:(int)fd error:(NSError * __autoreleasing *)outError;
+- (BOOL)renderToFILE:(FILE *)file error:(NSError * __autoreleasing *)outError;
+/* stream must be open */
+- (BOOL)renderToStream:(CFWriteStreamRef)stream error:(NSError * __autoreleasing *)outError;
+/* If atomically is YES, the output is written to a temporary file, then renamed. */
+- (BOOL)renderToFile:(NSString *)path atomically:(BOOL)atomically error:(NSError * __autoreleasing *)outError;
+
+/* Clears all variables and pending blocks */
+- (void)reset;
+
+@end
@@ -0,0 +1,635 @@
+/*
+ *  WBCompiledTemplate.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#import <WonderBox/WBCompiledTemplate.h>
+#import <WonderBox/WBTemplateParser.h>
+
+#import "WBTemplateSink.h"
+
+#include <errno.h>
+
+enum {
+  kWBTemplateOpLiteral = 0,
+  kWBTemplateOpVariable = 1,
+  kWBTemplateOpBlockBegin = 2,
+  kWBTemplateOpBlockEnd = 3,
+};
+
+typedef struct _WBTemplateInstruction {
+  uint32_t op;
+  /* literal length, slot, or block index */
+  uint32_t arg;
+  /* literal offset, or for block begin, position of the block end */
+  NSUInteger value;
+} WBTemplateInstruction;
+
+typedef struct _WBTemplateBlockInfo {
+  /* body instructions range */
+  NSUInteger first;
+  NSUInteger end;
+  NSUInteger firstSlot;
+  NSUInteger slotCount;
+} WBTemplateBlockInfo;
+
+@interface WBTemplate (WBCompiledTemplate)
+- (NSArray *)wb_compiledContents;
+- (BOOL)wb_isVariable:(NSString *)aKey;
+@end
+
+@implementation WBTemplate (WBCompiledTemplate)
+
+- (NSArray *)wb_compiledContents {
+  return wb_contents;
+}
+
+- (BOOL)wb_isVariable:(NSString *)aKey {
+  return [wb_vars objectForKey:aKey] != nil;
+}
+
+@end
+
+#pragma mark -
+@implementation WBCompiledTemplate {
+@package
+  NSMutableData *wb_literals;
+  NSMutableData *wb_instructions;
+  NSMutableData *wb_blocks;
+  NSUInteger wb_slotCount;
+  /* block names, and variable slots by block */
+  NSMutableArray *wb_names;
+  NSMutableArray *wb_slots;
+  /* blocks being compiled while parsing */
+  NSMutableArray *wb_open;
+}
+
+- (NSUInteger)wb_appendInstruction:(uint32_t)op arg:(NSUInteger)arg value:(NSUInteger)value {
+  if (arg > UINT32_MAX)
+    SPXThrowException(NSInvalidArgumentException, @"Template too large.");
+  WBTemplateInstruction instruction = { op, (uint32_t)arg, value };
+  [wb_instructions appendBytes:&instruction length:sizeof(instruction)];
+  return [wb_instructions length] / sizeof(instruction) - 1;
+}
+
+- (void)wb_compileBlock:(WBTemplate *)block {
+  NSUInteger index = [wb_names count];
+  [wb_names addObject:[block name] ? : @""];
+  WBTemplateBlockInfo info = { 0, 0, wb_slotCount, 0 };
+  [wb_blocks appendBytes:&info length:sizeof(info)];
+
+  /* Slots of a block are contiguous, so they can be cleared at once */
+  NSArray *contents = [block wb_compiledContents];
+  NSMutableDictionary *slots = [[NSMutableDictionary alloc] init];
+  NSUInteger count = [contents count];
+  for (NSUInteger idx = 1; idx < count; idx += 2) {
+    NSString *key = contents[idx];
+    if ([block wb_isVariable:key] && !slots[key])
+      slots[key] = @(wb_slotCount++);
+  }
+  [wb_slots addObject:slots];
+
+  info.first = [wb_instructions length] / sizeof(WBTemplateInstruction);
+  info.slotCount = wb_slotCount - info.firstSlot;
+  WBTemplate *child = [block firstChild];
+  for (NSUInteger idx = 0; idx < count; idx++) {
+    NSString *item = contents[idx];
+    if (0 == idx % 2) { /* String Value */
+      NSData *utf8 = [item dataUsingEncoding:NSUTF8StringEncoding];
+      if ([utf8 length] > 0) {
+        [self wb_appendInstruction:kWBTemplateOpLiteral arg:[utf8 length] value:[wb_literals length]];
+        [wb_literals appendData:utf8];
+      }
+    } else if (slots[item]) { /* Variable */
+      [self wb_appendInstruction:kWBTemplateOpVariable arg:[slots[item] unsignedIntegerValue] value:0];
+    } else { /* Block: children are in the same order than in contents */
+      WBTemplate *sub = child;
+      while (sub && ![[sub name] isEqualToString:item])
+        sub = [sub nextSibling];
+      if (sub) {
+        child = [sub nextSibling];
+        NSUInteger begin = [self wb_appendInstruction:kWBTemplateOpBlockBegin arg:[wb_names count] value:0];
+        [self wb_compileBlock:sub];
+        WBTemplateInstruction *instructions = [wb_instructions mutableBytes];
+        instructions[begin].value = [self wb_appendInstruction:kWBTemplateOpBlockEnd arg:instructions[begin].arg value:0];
+      }
+    }
+  }
+  /* the parent appends the block end afterward */
+  info.end = [wb_instructions length] / sizeof(WBTemplateInstruction);
+  ((WBTemplateBlockInfo *)[wb_blocks mutableBytes])[index] = info;
+}
+
+- (instancetype)init {
+  return [self initWithTemplate:nil];
+}
+
+- (instancetype)initWithTemplate:(WBTemplate *)aTemplate {
+  if (self = [super init]) {
+    if (![aTemplate wb_compiledContents] && ![aTemplate isBlock])
+      [aTemplate load];
+    if (![aTemplate wb_compiledContents])
+      return nil;
+
+    wb_literals = [[NSMutableData alloc] init];
+    wb_instructions = [[NSMutableData alloc] init];
+    wb_blocks = [[NSMutableData alloc] init];
+    wb_names = [[NSMutableArray alloc] init];
+    wb_slots = [[NSMutableArray alloc] init];
+    [self wb_compileBlock:aTemplate];
+  }
+  return self;
+}
+
+- (instancetype)initWithContentsOfFile:(NSString *)aFile encoding:(NSStringEncoding)encoding {
+  if (NSUTF8StringEncoding != encoding) {
+    WBTemplate *tpl = [[WBTemplate alloc] initWithContentsOfFile:aFile encoding:encoding];
+    return [self initWithTemplate:tpl];
+  }
+  /* UTF-8 files are compiled while parsing: literals are copied from the file bytes */
+  if (self = [super init]) {
+    wb_literals = [[NSMutableData alloc] init];
+    wb_instructions = [[NSMutableData alloc] init];
+    wb_blocks = [[NSMutableData alloc] init];
+    wb_names = [[NSMutableArray alloc] init];
+    wb_slots = [[NSMutableArray alloc] init];
+    wb_open = [[NSMutableArray alloc] init];
+
+    WBTemplateParser *parser = [[WBTemplateParser alloc] initWithFile:aFile encoding:NSUTF8StringEncoding];
+    [parser setDelegate:self];
+    [self wb_startBlock:aFile ? : @""];
+    BOOL ok = [parser parse];
+    [parser setDelegate:nil];
+    if (!ok)
+      return nil;
+    [self wb_endBlock];
+    [self wb_assignSlots];
+    wb_open = nil;
+  }
+  return self;
+}
+
+- (NSUInteger)numberOfBlocks {
+  return [wb_names count];
+}
+
+- (NSUInteger)numberOfSlots {
+  return wb_slotCount;
+}
+
+- (NSUInteger)indexOfBlock:(NSString *)aName {
+  return [wb_names indexOfObject:aName];
+}
+
+- (NSUInteger)slotOfVariable:(NSString *)aKey inBlock:(NSUInteger)aBlock {
+  if (aBlock >= [wb_slots count])
+    return NSNotFound;
+  NSNumber *slot = wb_slots[aBlock][aKey];
+  return slot ? [slot unsignedIntegerValue] : NSNotFound;
+}
+
+- (NSRange)slotRangeOfBlock:(NSUInteger)aBlock {
+  if (aBlock >= [wb_names count])
+    return NSMakeRange(NSNotFound, 0);
+  const WBTemplateBlockInfo *info = &((const WBTemplateBlockInfo *)[wb_blocks bytes])[aBlock];
+  return NSMakeRange(info->firstSlot, info->slotCount);
+}
+
+#pragma mark Parser Delegate
+- (void)wb_startBlock:(NSString *)name {
+  [wb_open addObject:@([wb_names count])];
+  [wb_names addObject:name];
+  [wb_slots addObject:[NSMutableDictionary dictionary]];
+  WBTemplateBlockInfo info = { [wb_instructions length] / sizeof(WBTemplateInstruction), 0, 0, 0 };
+  [wb_blocks appendBytes:&info length:sizeof(info)];
+}
+
+/* Returns the index of the block */
+- (NSUInteger)wb_endBlock {
+  NSUInteger index = [[wb_open lastObject] unsignedIntegerValue];
+  [wb_open removeLastObject];
+  WBTemplateBlockInfo *info = &((WBTemplateBlockInfo *)[wb_blocks mutableBytes])[index];
+  info->end = [wb_instructions length] / sizeof(WBTemplateInstruction);
+  return index;
+}
+
+/* Variables are numbered by block while parsing. Makes the slots of each block contiguous, as -wb_compileBlock: does. */
+- (void)wb_assignSlots {
+  WBTemplateBlockInfo *blocks = [wb_blocks mutableBytes];
+  for (NSUInteger idx = 0; idx < [wb_names count]; ++idx) {
+    NSMutableDictionary *slots = wb_slots[idx];
+    blocks[idx].firstSlot = wb_slotCount;
+    blocks[idx].slotCount = [slots count];
+    for (NSString *key in [slots allKeys])
+      slots[key] = @([slots[key] unsignedIntegerValue] + wb_slotCount);
+    wb_slotCount += [slots count];
+  }
+  WBTemplateInstruction *instructions = [wb_instructions mutableBytes];
+  for (NSUInteger block = 0; block < [wb_names count]; ++block) {
+    /* sub-blocks are skipped, they are updated using their own info */
+    for (NSUInteger idx = blocks[block].first; idx < blocks[block].end; ++idx) {
+      if (kWBTemplateOpVariable == instructions[idx].op)
+        instructions[idx].arg += (uint32_t)blocks[block].firstSlot;
+      else if (kWBTemplateOpBlockBegin == instructions[idx].op)
+        idx = instructions[idx].value;
+    }
+  }
+}
+
+- (void)templateParser:(WBTemplateParser *)parser foundCharactersInRange:(NSRange)range {
+  if (range.length > 0) {
+    [self wb_appendInstruction:kWBTemplateOpLiteral arg:range.length value:[wb_literals length]];
+    [wb_literals appendBytes:[parser bytes] + range.location length:range.length];
+  }
+}
+
+- (void)templateParser:(WBTemplateParser *)parser foundVariableInRange:(NSRange)range {
+  NSString *key = [[NSString alloc] initWithBytes:[parser bytes] + range.location length:range.length encoding:NSUTF8StringEncoding];
+  NSMutableDictionary *slots = wb_slots[[[wb_open lastObject] unsignedIntegerValue]];
+  NSNumber *slot = slots[key];
+  if (!slot)
+    slot = slots[key] = @([slots count]);
+  [self wb_appendInstruction:kWBTemplateOpVariable arg:[slot unsignedIntegerValue] value:0];
+}
+
+- (void)templateParser:(WBTemplateParser *)parser didStartBlockInRange:(NSRange)range {
+  NSString *name = [[NSString alloc] initWithBytes:[parser bytes] + range.location length:range.length encoding:NSUTF8StringEncoding];
+  [self wb_appendInstruction:kWBTemplateOpBlockBegin arg:[wb_names count] value:0];
+  [self wb_startBlock:name];
+}
+
+- (void)templateParserDidEndBlock:(WBTemplateParser *)parser {
+  /* the root block is closed after parsing */
+  if ([wb_open count] < 2)
+    return;
+  NSUInteger index = [self wb_endBlock];
+  NSUInteger end = [self wb_appendInstruction:kWBTemplateOpBlockEnd arg:index value:0];
+  /* the block begin is just before the block body */
+  WBTemplateInstruction *instructions = [wb_instructions mutableBytes];
+  instructions[((const WBTemplateBlockInfo *)[wb_blocks bytes])[index].first - 1].value = end;
+}
+
+@end
+
+#pragma mark -
+typedef struct _WBTemplateBuffer {
+  uint8_t *bytes;
+  size_t length;
+  size_t capacity;
+} WBTemplateBuffer;
+
+static
+uint8_t *_WBTemplateBufferReserve(WBTemplateBuffer *buffer, size_t length) {
+  if (buffer->capacity - buffer->length < length) {
+    size_t capacity = MAX(buffer->capacity * 2, 256);
+    while (capacity - buffer->length < length)
+      capacity *= 2;
+    uint8_t *bytes = realloc(buffer->bytes, capacity);
+    if (!bytes)
+      SPXThrowException(NSMallocException, @"Cannot allocate template buffer.");
+    buffer->bytes = bytes;
+    buffer->capacity = capacity;
+  }
+  return buffer->bytes + buffer->length;
+}
+
+WB_INLINE
+void _WBTemplateBufferAppend(WBTemplateBuffer *buffer, const void *bytes, size_t length) {
+  if (length) {
+    memcpy(_WBTemplateBufferReserve(buffer, length), bytes, length);
+    buffer->length += length;
+  }
+}
+
+@implementation WBTemplateRenderer {
+  WBCompiledTemplate *wb_template;
+  const WBTemplateInstruction *wb_instructions;
+  const WBTemplateBlockInfo *wb_blocks;
+  const uint8_t *wb_literals;
+  NSUInteger wb_blockCount;
+  NSUInteger wb_slotCount;
+  /* variable values, and rendered instances waiting for their parent */
+  WBTemplateBuffer *wb_values;
+  WBTemplateBuffer *wb_pending;
+  /* bulk dump row, large enough for any block */
+  WBTemplateValue *wb_row;
+}
+
+- (instancetype)init {
+  return [self initWithTemplate:nil];
+}
+
+- (instancetype)initWithTemplate:(WBCompiledTemplate *)aTemplate {
+  NSParameterAssert(aTemplate);
+  if (self = [super init]) {
+    wb_template = aTemplate;
+    wb_instructions = [aTemplate->wb_instructions bytes];
+    wb_blocks = [aTemplate->wb_blocks bytes];
+    wb_literals = [aTemplate->wb_literals bytes];
+    wb_blockCount = [aTemplate numberOfBlocks];
+    wb_slotCount = [aTemplate numberOfSlots];
+    wb_values = calloc(wb_slotCount + wb_blockCount, sizeof(*wb_values));
+    if (!wb_values)
+      return nil;
+    wb_pending = wb_values + wb_slotCount;
+
+    NSUInteger slots = 1;
+    for (NSUInteger idx = 0; idx < wb_blockCount; ++idx)
+      slots = MAX(slots, wb_blocks[idx].slotCount);
+    wb_row = calloc(slots, sizeof(*wb_row));
+    if (!wb_row)
+      return nil;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  for (NSUInteger idx = 0; idx < wb_slotCount + wb_blockCount; ++idx)
+    free(wb_values[idx].bytes);
+  free(wb_values);
+  free(wb_row);
+}
+
+- (WBCompiledTemplate *)compiledTemplate {
+  return wb_template;
+}
+
+#pragma mark Variables
+- (void)setUTF8String:(const char *)aValue length:(NSUInteger)length forSlot:(NSUInteger)aSlot {
+  if (aSlot >= wb_slotCount)
+    SPXThrowException(NSRangeException, @"slot (%lu) beyond bounds (%lu)", (unsigned long)aSlot, (unsigned long)wb_slotCount);
+  wb_values[aSlot].length = 0;
+  _WBTemplateBufferAppend(&wb_values[aSlot], aValue, length);
+}
+
+- (void)setString:(NSString *)aValue forSlot:(NSUInteger)aSlot {
+  if (aSlot >= wb_slotCount)
+    SPXThrowException(NSRangeException, @"slot (%lu) beyond bounds (%lu)", (unsigned long)aSlot, (unsigned long)wb_slotCount);
+  WBTemplateBuffer *value = &wb_values[aSlot];
+  value->length = 0;
+  if (!aValue)
+    return;
+
+  CFStringRef str = SPXNSToCFString(aValue);
+  const char *ascii = CFStringGetCStringPtr(str, kCFStringEncodingUTF8);
+  if (ascii) {
+    _WBTemplateBufferAppend(value, ascii, strlen(ascii));
+  } else {
+    CFIndex length = CFStringGetLength(str);
+    CFIndex max = CFStringGetMaximumSizeForEncoding(length, kCFStringEncodingUTF8);
+    CFIndex used = 0;
+    CFStringGetBytes(str, CFRangeMake(0, length), kCFStringEncodingUTF8, 0, false,
+                     _WBTemplateBufferReserve(value, (size_t)max), max, &used);
+    value->length = (size_t)used;
+  }
+}
+
+#pragma mark Output
+- (void)dumpBlock:(NSUInteger)aBlock {
+  if (aBlock >= wb_blockCount)
+    SPXThrowException(NSRangeException, @"block (%lu) beyond bounds (%lu)", (unsigned long)aBlock, (unsigned long)wb_blockCount);
+  const WBTemplateBlockInfo *info = &wb_blocks[aBlock];
+  WBTemplateBuffer *output = &wb_pending[aBlock];
+  for (NSUInteger idx = info->first; idx < info->end; ++idx) {
+    const WBTemplateInstruction *instruction = &wb_instructions[idx];
+    switch (instruction->op) {
+      case kWBTemplateOpLiteral:
+        _WBTemplateBufferAppend(output, wb_literals + instruction->value, instruction->arg);
+        break;
+      case kWBTemplateOpVariable:
+        _WBTemplateBufferAppend(output, wb_values[instruction->arg].bytes, wb_values[instruction->arg].length);
+        break;
+      case kWBTemplateOpBlockBegin: {
+        /* Instances of the sub-block belong to this instance */
+        WBTemplateBuffer *instances = &wb_pending[instruction->arg];
+        _WBTemplateBufferAppend(output, instances->bytes, instances->length);
+        instances->length = 0;
+        idx = instruction->value;
+      }
+        break;
+      default:
+        break;
+    }
+  }
+  for (NSUInteger slot = 0; slot < info->slotCount; ++slot)
+    wb_values[info->firstSlot + slot].length = 0;
+}
+
+#pragma mark Bulk
+/* Same as -dumpBlock:, but the variables values are read from values */
+WB_INLINE
+void _WBTemplateRenderRow(const WBTemplateInstruction *instructions, const uint8_t *literals, const WBTemplateBlockInfo *info,
+                          const WBTemplateValue *values, WBTemplateBuffer *pending, WBTemplateBuffer *output) {
+  for (NSUInteger idx = info->first; idx < info->end; ++idx) {
+    const WBTemplateInstruction *instruction = &instructions[idx];
+    switch (instruction->op) {
+      case kWBTemplateOpLiteral:
+        _WBTemplateBufferAppend(output, literals + instruction->value, instruction->arg);
+        break;
+      case kWBTemplateOpVariable: {
+        const WBTemplateValue *value = &values[instruction->arg - info->firstSlot];
+        _WBTemplateBufferAppend(output, value->bytes, value->length);
+      }
+        break;
+      case kWBTemplateOpBlockBegin: {
+        /* Only the first row gets the sub-block instances, the others find an empty buffer */
+        WBTemplateBuffer *instances = &pending[instruction->arg];
+        _WBTemplateBufferAppend(output, instances->bytes, instances->length);
+        instances->length = 0;
+        idx = instruction->value;
+      }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+typedef struct _WBTemplateColumns {
+  const WBTemplateValue * const *columns;
+  NSUInteger count;
+} WBTemplateColumns;
+
+static
+BOOL _WBTemplateColumnsRow(NSUInteger row, WBTemplateValue *values, void *context) {
+  const WBTemplateColumns *columns = context;
+  for (NSUInteger column = 0; column < columns->count; ++column) {
+    if (columns->columns[column])
+      values[column] = columns->columns[column][row];
+  }
+  return YES;
+}
+
+- (void)dumpBlock:(NSUInteger)aBlock rows:(NSUInteger)count columns:(const WBTemplateValue * const *)columns {
+  NSParameterAssert(columns || 0 == count);
+  if (aBlock >= wb_blockCount)
+    SPXThrowException(NSRangeException, @"block (%lu) beyond bounds (%lu)", (unsigned long)aBlock, (unsigned long)wb_blockCount);
+  WBTemplateColumns context = { columns, wb_blocks[aBlock].slotCount };
+  [self dumpBlock:aBlock rows:count function:_WBTemplateColumnsRow context:&context];
+}
+
+- (NSUInteger)dumpBlock:(NSUInteger)aBlock rows:(NSUInteger)count function:(WBTemplateRowFunction)function context:(void *)context {
+  NSParameterAssert(function);
+  if (aBlock >= wb_blockCount)
+    SPXThrowException(NSRangeException, @"block (%lu) beyond bounds (%lu)", (unsigned long)aBlock, (unsigned long)wb_blockCount);
+  const WBTemplateBlockInfo *info = &wb_blocks[aBlock];
+  WBTemplateBuffer *output = &wb_pending[aBlock];
+  NSUInteger row = 0;
+  for (; row < count; ++row) {
+    memset(wb_row, 0, info->slotCount * sizeof(*wb_row));
+    if (!function(row, wb_row, context))
+      break;
+    _WBTemplateRenderRow(wb_instructions, wb_literals, info, wb_row, wb_pending, output);
+  }
+  for (NSUInteger slot = 0; slot < info->slotCount; ++slot)
+    wb_values[info->firstSlot + slot].length = 0;
+  return row;
+}
+
+- (NSData *)renderedData {
+  [self dumpBlock:kWBTemplateRootBlock];
+  NSData *data = [NSData dataWithBytes:wb_pending[kWBTemplateRootBlock].bytes length:wb_pending[kWBTemplateRootBlock].length];
+  wb_pending[kWBTemplateRootBlock].length = 0;
+  return data;
+}
+
+- (NSString *)stringRepresentation {
+  return [[NSString alloc] initWithData:[self renderedData] encoding:NSUTF8StringEncoding];
+}
+
+#pragma mark Streaming
+/* Same as -dumpBlock: on the root, but the root instance goes to the sink */
+- (BOOL)wb_renderToSink:(WBTemplateSink *)sink {
+  const WBTemplateBlockInfo *info = &wb_blocks[kWBTemplateRootBlock];
+  /* Previously dumped instances */
+  WBTemplateSinkAppend(sink, wb_pending[kWBTemplateRootBlock].bytes, wb_pending[kWBTemplateRootBlock].length);
+  for (NSUInteger idx = info->first; idx < info->end; ++idx) {
+    const WBTemplateInstruction *instruction = &wb_instructions[idx];
+    switch (instruction->op) {
+      case kWBTemplateOpLiteral:
+        WBTemplateSinkAppend(sink, wb_literals + instruction->value, instruction->arg);
+        break;
+      case kWBTemplateOpVariable:
+        WBTemplateSinkAppend(sink, wb_values[instruction->arg].bytes, wb_values[instruction->arg].length);
+        break;
+      case kWBTemplateOpBlockBegin:
+        WBTemplateSinkAppend(sink, wb_pending[instruction->arg].bytes, wb_pending[instruction->arg].length);
+        idx = instruction->value;
+        break;
+      default:
+        break;
+    }
+  }
+  /* The sink references the buffers until it is flushed */
+  bool ok = WBTemplateSinkFlush(sink);
+
+  for (NSUInteger idx = info->first; idx < info->end; ++idx) {
+    if (kWBTemplateOpBlockBegin == wb_instructions[idx].op) {
+      wb_pending[wb_instructions[idx].arg].length = 0;
+      idx = wb_instructions[idx].value;
+    }
+  }
+  for (NSUInteger slot = 0; slot < info->slotCount; ++slot)
+    wb_values[info->firstSlot + slot].length = 0;
+  wb_pending[kWBTemplateRootBlock].length = 0;
+  return ok;
+}
+
+- (BOOL)renderUsingFunction:(WBTemplateWriteFunction)function context:(void *)context {
+  NSParameterAssert(function);
+  WBTemplateSink *sink = malloc(sizeof(*sink));
+  if (!sink)
+    SPXThrowException(NSMallocException, @"Cannot allocate template buffer.");
+  WBTemplateSinkInitialize(sink, function, context);
+  BOOL ok = [self wb_renderToSink:sink];
+  int error = sink->error;
+  free(sink);
+  errno = error;
+  return ok;
+}
+
+static
+NSError *_WBTemplatePOSIXError(int code) {
+  return [NSError errorWithDomain:NSPOSIXErrorDomain code:code ? : EIO userInfo:nil];
+}
+
+- (BOOL)renderToFileDescriptor:(int)fd error:(NSError * __autoreleasing *)outError {
+  BOOL ok = [self renderUsingFunction:WBTemplateWriteFileDescriptor context:(void *)(intptr_t)fd];
+  if (!ok && outError)
+    *outError = _WBTemplatePOSIXError(errno);
+  return ok;
+}
+
+static
+BOOL _WBTemplateWriteFILE(const struct iovec *buffers, int count, void *context) {
+  for (int idx = 0; idx < count; ++idx) {
+    if (fwrite(buffers[idx].iov_base, 1, buffers[idx].iov_len, (FILE *)context) != buffers[idx].iov_len)
+      return NO;
+  }
+  return YES;
+}
+
+- (BOOL)renderToFILE:(FILE *)file error:(NSError * __autoreleasing *)outError {
+  NSParameterAssert(file);
+  BOOL ok = [self renderUsingFunction:_WBTemplateWriteFILE context:file];
+  if (!ok && outError)
+    *outError = _WBTemplatePOSIXError(errno);
+  return ok;
+}
+
+static
+BOOL _WBTemplateWriteStream(const struct iovec *buffers, int count, void *context) {
+  for (int idx = 0; idx < count; ++idx) {
+    const UInt8 *bytes = buffers[idx].iov_base;
+    size_t remaining = buffers[idx].iov_len;
+    while (remaining > 0) {
+      CFIndex written = CFWriteStreamWrite((CFWriteStreamRef)context, bytes, (CFIndex)MIN(remaining, (size_t)LONG_MAX));
+      if (written <= 0)
+        return NO;
+      bytes += written;
+      remaining -= (size_t)written;
+    }
+  }
+  return YES;
+}
+
+- (BOOL)renderToStream:(CFWriteStreamRef)stream error:(NSError * __autoreleasing *)outError {
+  NSParameterAssert(stream);
+  BOOL ok = [self renderUsingFunction:_WBTemplateWriteStream context:(void *)stream];
+  if (!ok && outError) {
+    CFErrorRef error = CFWriteStreamCopyError(stream);
+    *outError = error ? CFBridgingRelease(error) : _WBTemplatePOSIXError(EIO);
+  }
+  return ok;
+}
+
+- (BOOL)renderToFile:(NSString *)path atomically:(BOOL)atomically error:(NSError * __autoreleasing *)outError {
+  char *temporary = NULL;
+  const char *cpath = [path fileSystemRepresentation];
+  int fd = WBTemplateOpenOutputFile(cpath, atomically, &temporary);
+  if (fd < 0) {
+    int error = errno;
+    /* keep the renderer state consistent */
+    [self renderUsingFunction:WBTemplateWriteNothing context:NULL];
+    if (outError)
+      *outError = _WBTemplatePOSIXError(error);
+    return NO;
+  }
+  BOOL ok = [self renderUsingFunction:WBTemplateWriteFileDescriptor context:(void *)(intptr_t)fd];
+  ok = WBTemplateCloseOutputFile(fd, cpath, temporary, ok);
+  if (!ok && outError)
+    *outError = _WBTemplatePOSIXError(errno);
+  return ok;
+}
+
+- (void)reset {
+  for (NSUInteger idx = 0; idx < wb_slotCount + wb_blockCount; ++idx)
+    wb_values[idx].length = 0;
+}
+
+@end
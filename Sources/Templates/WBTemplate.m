@@ -11,6 +11,8 @@
 #import <WonderBox/WBTemplate.h>
 #import <WonderBox/WBTemplateParser.h>
 
+#import "WBTemplateSink.h"
+
 #define _WBTemplateNullPlaceholder (__bridge id)kCFNull
 
 @interface WBTemplate ()
@@ -305,11 +307,80 @@
   return result;
 }
 
+/* Same as -writeBlock:inBuffer:, without building the output */
+- (BOOL)writeBlock:(NSDictionary *)block toSink:(WBTemplateSink *)sink encoding:(CFStringEncoding)encoding {
+  NSUInteger count = [wb_contents count];
+  for (NSUInteger idx = 0; idx < count; idx++) {
+    NSString *var = [wb_contents objectAtIndex:idx];
+    if (idx % 2) {  /* Var or Block */
+      id string = [block objectForKey:var];
+      if (string) { /* string is a variable */
+        if (string != _WBTemplateNullPlaceholder && !WBTemplateSinkAppendString(sink, SPXNSToCFString(string), encoding))
+          return NO;
+      } else { /* string is a block */
+        WBTemplate *child = [self blockWithName:var];
+        if (child) {
+          for (NSDictionary *item in [[block objectForKey:@"_Blocks_"] objectForKey:[child name]]) {
+            if (![child writeBlock:item toSink:sink encoding:encoding])
+              return NO;
+          }
+        }
+      }
+    } else if (!WBTemplateSinkAppendString(sink, SPXNSToCFString(var), encoding)) { /* String Value */
+      return NO;
+    }
+  }
+  return YES;
+}
+
+/* Writes the byte order mark and the root instances. Returns NO if a string cannot be converted to the template encoding. */
+- (BOOL)wb_writeToSink:(WBTemplateSink *)sink {
+  CFStringEncoding encoding = CFStringConvertNSStringEncodingToEncoding(_encoding);
+  /* Same byte order mark as -[NSString writeToFile:atomically:encoding:error:] */
+  if (NSUnicodeStringEncoding == _encoding) {
+    const UniChar bom = 0xfeff;
+    WBTemplateSinkAppend(sink, &bom, sizeof(bom));
+  }
+  NSUInteger count = [wb_blocks count];
+  for (NSUInteger idx = 0; idx < count; idx++) {
+    @autoreleasepool {
+      if (![self writeBlock:[wb_blocks objectAtIndex:idx] toSink:sink encoding:encoding])
+        return NO;
+    }
+  }
+  return YES;
+}
+
+/* Streams the output to the file, without building the output string */
 - (BOOL)writeToFile:(NSString *)file atomically:(BOOL)flag andReset:(BOOL)reset {
   @autoreleasepool {
-    NSString *result = [self stringRepresentation];
+    if (![self isBlock]) /* If root then dump */
+      [self dumpBlock];
+
+    BOOL ok = NO;
+    WBTemplateSink *sink = malloc(sizeof(*sink));
+    if (sink) {
+      ok = YES;
+      /* The file is truncated when it is opened if there is no temporary file,
+       so make sure the output can be converted before touching it */
+      if (!flag) {
+        WBTemplateSinkInitialize(sink, WBTemplateWriteNothing, NULL);
+        ok = [self wb_writeToSink:sink];
+      }
+      char *temporary = NULL;
+      const char *path = [file fileSystemRepresentation];
+      int fd = ok ? WBTemplateOpenOutputFile(path, flag, &temporary) : -1;
+      if (fd >= 0) {
+        WBTemplateSinkInitialize(sink, WBTemplateWriteFileDescriptor, (void *)(intptr_t)fd);
+        ok = [self wb_writeToSink:sink];
+        ok = WBTemplateSinkFlush(sink) && ok;
+        ok = WBTemplateCloseOutputFile(fd, path, temporary, ok);
+      } else {
+        ok = NO;
+      }
+      free(sink);
+    }
 
-    BOOL ok = [result writeToFile:file atomically:flag encoding:_encoding error:nil];
     if (reset)
       [self reset];
     return ok;
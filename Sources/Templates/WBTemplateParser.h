@@ -28,8 +28,12 @@ WB_OBJC_EXPORT
     unsigned int startTemplate:1;
     unsigned int endTemplate:1;
     unsigned int warning:1;
-    unsigned int:1;
+    unsigned int foundCharsRange:1;
+    unsigned int foundVarRange:1;
+    unsigned int startBlockRange:1;
+    unsigned int:6;
   } tpimp;
+  const uint8_t *wb_bytes;
 }
 
 - (id)initWithFile:(NSString *)aFile encoding:(NSStringEncoding)encoding;
@@ -44,6 +48,9 @@ WB_OBJC_EXPORT
 - (NSStringEncoding)encoding;
 - (void)setStringEncoding:(NSStringEncoding)encoding;
 
+/* UTF-8 content of the file. Only valid while parsing an UTF-8 file. */
+- (const uint8_t *)bytes NS_RETURNS_INNER_POINTER;
+
 @end
 
 extern BOOL WBTemplateLogWarning;
@@ -68,4 +75,10 @@ extern BOOL WBTemplateLogMessage;
 
 - (void)templateParser:(WBTemplateParser *)parser warningOccured:(NSString *)warning;
 
+/* UTF-8 files are scanned as bytes. A delegate that implements these methods receives byte
+ ranges in -[WBTemplateParser bytes] instead of the corresponding string callbacks. */
+- (void)templateParser:(WBTemplateParser *)parser foundCharactersInRange:(NSRange)range;
+- (void)templateParser:(WBTemplateParser *)parser foundVariableInRange:(NSRange)range;
+- (void)templateParser:(WBTemplateParser *)parser didStartBlockInRange:(NSRange)range;
+
 @end
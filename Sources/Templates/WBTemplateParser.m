@@ -46,6 +46,9 @@ BOOL WBTemplateLogMessage = NO;
     tpimp.startTemplate = [wb_delegate respondsToSelector:@selector(templateParser:didStartTemplate:)] ? 1 : 0;
     tpimp.endTemplate = [wb_delegate respondsToSelector:@selector(templateParser:didEndTemplate:)] ? 1 : 0;
     tpimp.warning  = [wb_delegate respondsToSelector:@selector(templateParser:warningOccured:)] ? 1 : 0;
+    tpimp.foundCharsRange = [wb_delegate respondsToSelector:@selector(templateParser:foundCharactersInRange:)] ? 1 : 0;
+    tpimp.foundVarRange = [wb_delegate respondsToSelector:@selector(templateParser:foundVariableInRange:)] ? 1 : 0;
+    tpimp.startBlockRange = [wb_delegate respondsToSelector:@selector(templateParser:didStartBlockInRange:)] ? 1 : 0;
   } else {
     memset(&tpimp, 0, sizeof(tpimp));
   }
@@ -65,6 +68,10 @@ BOOL WBTemplateLogMessage = NO;
   wb_encoding = encoding;
 }
 
+- (const uint8_t *)bytes {
+  return wb_bytes;
+}
+
 #pragma mark -
 - (void)foundVariable:(CFStringRef)theVariable inString:(NSString *)theString atRange:(NSRange)aRange {
   if (tpimp.foundChars) {
@@ -112,25 +119,162 @@ BOOL WBTemplateLogMessage = NO;
   }
 }
 
-- (BOOL)parse {
-  if (!wb_file)
-		SPXThrowException(NSInternalInconsistencyException, @"A file must be set before parsing.");
+#pragma mark UTF-8
+/* 1: ends a variable ('!' or ASCII whitespace), 2: may start a non ASCII whitespace */
+static const uint8_t sWBTemplateTerminators[256] = {
+  ['\t'] = 1, ['\n'] = 1, [0x0b] = 1, [0x0c] = 1, ['\r'] = 1, [' '] = 1, ['!'] = 1,
+  [0xc2] = 2, [0xe1] = 2, [0xe2] = 2, [0xe3] = 2,
+};
 
-  wb_blocks = 0;
-  wb_position = 0;
+/* Same characters as kCFCharacterSetWhitespaceAndNewline */
+static
+bool _WBTemplateIsUnicodeSpace(const uint8_t *bytes, const uint8_t *end) {
+  switch (bytes[0]) {
+    case 0xc2: /* U+0085, U+00A0 */
+      return end - bytes >= 2 && (0x85 == bytes[1] || 0xa0 == bytes[1]);
+    case 0xe1: /* U+1680 */
+      return end - bytes >= 3 && 0x9a == bytes[1] && 0x80 == bytes[2];
+    case 0xe2: /* U+2000 to U+200A, U+2028, U+2029, U+202F, U+205F */
+      if (end - bytes < 3)
+        return false;
+      if (0x80 == bytes[1])
+        return bytes[2] <= 0x8a || 0xa8 == bytes[2] || 0xa9 == bytes[2] || 0xaf == bytes[2];
+      return 0x81 == bytes[1] && 0x9f == bytes[2];
+    case 0xe3: /* U+3000 */
+      return end - bytes >= 3 && 0x80 == bytes[1] && 0x80 == bytes[2];
+  }
+  return false;
+}
+
+WB_INLINE
+const uint8_t *_WBTemplateFindTerminator(const uint8_t *bytes, const uint8_t *end) {
+  /* Continuation bytes are never terminators, so the bytes can be checked one by one */
+  for (; bytes < end; ++bytes) {
+    uint8_t kind = sWBTemplateTerminators[*bytes];
+    if (1 == kind || (2 == kind && _WBTemplateIsUnicodeSpace(bytes, end)))
+      return bytes;
+  }
+  return NULL;
+}
+
+static
+bool _WBTemplateIsValidUTF8(const uint8_t *bytes, size_t length) {
+  const uint8_t *end = bytes + length;
+  while (bytes < end) {
+    /* ASCII fast path */
+    uint64_t word;
+    while (end - bytes >= 8 && (memcpy(&word, bytes, 8), 0 == (word & 0x8080808080808080ULL)))
+      bytes += 8;
+    if (bytes >= end)
+      break;
+    if (*bytes < 0x80) {
+      bytes++;
+      continue;
+    }
+    size_t count;
+    uint32_t ch, min;
+    if (0xc0 == (*bytes & 0xe0)) {
+      count = 2; ch = *bytes & 0x1f; min = 0x80;
+    } else if (0xe0 == (*bytes & 0xf0)) {
+      count = 3; ch = *bytes & 0x0f; min = 0x800;
+    } else if (0xf0 == (*bytes & 0xf8)) {
+      count = 4; ch = *bytes & 0x07; min = 0x10000;
+    } else {
+      return false;
+    }
+    if ((size_t)(end - bytes) < count)
+      return false;
+    for (size_t idx = 1; idx < count; ++idx) {
+      if (0x80 != (bytes[idx] & 0xc0))
+        return false;
+      ch = (ch << 6) | (bytes[idx] & 0x3f);
+    }
+    if (ch < min || ch > 0x10ffff || (ch >= 0xd800 && ch <= 0xdfff))
+      return false;
+    bytes += count;
+  }
+  return true;
+}
 
-  CFStringRef str = SPXCFStringBridgingRetain(([[NSString alloc] initWithContentsOfFile:wb_file encoding:wb_encoding error:nil]));
+- (NSString *)wb_stringInRange:(NSRange)aRange {
+  return [[NSString alloc] initWithBytes:wb_bytes + aRange.location length:aRange.length encoding:NSUTF8StringEncoding];
+}
+
+/* name is empty for the end of file */
+- (void)wb_foundVariableInRange:(NSRange)name tagRange:(NSRange)aRange {
+  NSRange text = NSMakeRange(wb_position, aRange.location - wb_position);
+  if (tpimp.foundCharsRange)
+    [wb_delegate templateParser:self foundCharactersInRange:text];
+  else if (tpimp.foundChars)
+    [wb_delegate templateParser:self foundCharacters:[self wb_stringInRange:text]];
+  wb_position = NSMaxRange(aRange);
 
-  if (!str)
-    return NO;
+  if (0 == name.length)
+    return;
 
+  const uint8_t *var = wb_bytes + name.location;
+  if (name.length >= 6 && 0 == memcmp(var, "Start:", 6)) {
+    if (name.length > 6) {
+      NSRange block = NSMakeRange(name.location + 6, name.length - 6);
+      _WBTemplateLogMessage(@"Start Block: %@", wb_blocks, [self wb_stringInRange:block]);
+      wb_blocks++;
+      if (tpimp.startBlockRange)
+        [wb_delegate templateParser:self didStartBlockInRange:block];
+      else if (tpimp.startBlock)
+        [wb_delegate templateParser:self didStartBlock:[self wb_stringInRange:block]];
+    } else {
+      _WBTemplateLogWarning(@"WARNING: Invalid Block: %@", [self wb_stringInRange:name]);
+      if (tpimp.warning)
+        [wb_delegate templateParser:self warningOccured:[NSString stringWithFormat:@"Invalid Block: %@", [self wb_stringInRange:name]]];
+    }
+  } else if (3 == name.length && 0 == memcmp(var, "End", 3)) {
+    if (wb_blocks > 0) {
+      wb_blocks--;
+      _WBTemplateLogMessage(@"End Block", wb_blocks);
+      if (tpimp.endBlock)
+        [wb_delegate templateParserDidEndBlock:self];
+    } else {
+      _WBTemplateLogWarning(@"WARNING: @End tag encounter but all blocks already closed.");
+      if (tpimp.warning)
+        [wb_delegate templateParser:self warningOccured:@"@End tag encounter but all blocks already closed."];
+    }
+  } else {
+    _WBTemplateLogMessage(@"Variable: %@", wb_blocks, [self wb_stringInRange:name]);
+    if (tpimp.foundVarRange)
+      [wb_delegate templateParser:self foundVariableInRange:name];
+    else if (tpimp.foundVar)
+      [wb_delegate templateParser:self foundVariable:[self wb_stringInRange:name]];
+  }
+}
+
+/* memchr() jumps from '@' to '@', and each byte is checked at most once for a terminator,
+ as any '@' before a whitespace ends on that same whitespace. */
+- (void)wb_scanBytes:(NSUInteger)length {
+  const uint8_t *end = wb_bytes + length;
+  const uint8_t *at = wb_bytes + wb_position;
+  while (at < end && (at = memchr(at, '@', (size_t)(end - at)))) {
+    const uint8_t *terminator = _WBTemplateFindTerminator(at + 1, end);
+    /* Without terminator, there is no variable left */
+    if (!terminator)
+      break;
+    if ('!' == *terminator) {
+      if (terminator > at + 1)
+        [self wb_foundVariableInRange:NSMakeRange(at + 1 - wb_bytes, terminator - at - 1)
+                             tagRange:NSMakeRange(at - wb_bytes, terminator - at + 1)];
+      at = terminator + 1;
+    } else {
+      at = terminator;
+    }
+  }
+  /* Send characters between last var and end of file */
+  [self wb_foundVariableInRange:NSMakeRange(0, 0) tagRange:NSMakeRange(length, 0)];
+}
+
+#pragma mark -
+- (void)wb_scanString:(CFStringRef)str {
   CFStringInlineBuffer inlineBuffer;
   CFIndex length = CFStringGetLength(str);
 
-  _WBTemplateLogMessage(@"Start File: %@", wb_blocks, wb_file);
-  if (tpimp.startTemplate)
-    [wb_delegate templateParser:self didStartTemplate:wb_file];
-
   CFMutableCharacterSetRef charSet = CFCharacterSetCreateMutableCopy(kCFAllocatorDefault,
                                                                      CFCharacterSetGetPredefined(kCFCharacterSetWhitespaceAndNewline));
   CFCharacterSetAddCharactersInString(charSet, CFSTR("!"));
@@ -143,39 +287,77 @@ BOOL WBTemplateLogMessage = NO;
     UniChar ch = CFStringGetCharacterFromInlineBuffer(&inlineBuffer, cnt);
     if ('@' == ch) {
       CFRange space;
-      if (CFStringFindCharacterFromSet(str, varEndChars, CFRangeMake(cnt, length - cnt), 0, &space)) {
-        if (space.location != kCFNotFound) {
-          ch = CFStringGetCharacterFromInlineBuffer(&inlineBuffer, space.location);
-          if ('!' == ch) {
-            cnt++;
-            if (space.location > cnt) {
-              CFStringRef var = CFStringCreateWithSubstring(kCFAllocatorDefault, str, CFRangeMake(cnt, space.location - cnt));
-              if (var) {
-                [self foundVariable:var inString:SPXCFToNSString(str) atRange:NSMakeRange(cnt -1, space.location - cnt + 2)];
-                CFRelease(var);
-              }
-            }
-            cnt = space.location;
+      /* Without terminator, there is no variable left */
+      if (!CFStringFindCharacterFromSet(str, varEndChars, CFRangeMake(cnt, length - cnt), 0, &space) || space.location == kCFNotFound)
+        break;
+      ch = CFStringGetCharacterFromInlineBuffer(&inlineBuffer, space.location);
+      if ('!' == ch) {
+        cnt++;
+        if (space.location > cnt) {
+          CFStringRef var = CFStringCreateWithSubstring(kCFAllocatorDefault, str, CFRangeMake(cnt, space.location - cnt));
+          if (var) {
+            [self foundVariable:var inString:SPXCFToNSString(str) atRange:NSMakeRange(cnt -1, space.location - cnt + 2)];
+            CFRelease(var);
           }
+        }
+      }
 #if defined(DEBUG)
-          else {
-            if (space.location > cnt) {
-              CFStringRef var = CFStringCreateWithSubstring(kCFAllocatorDefault, str, CFRangeMake(cnt, space.location - cnt));
-              if (var) {
-                NSLog(@"Ignore: %@", var);
-                CFRelease(var);
-              }
-            }
+      else {
+        if (space.location > cnt) {
+          CFStringRef var = CFStringCreateWithSubstring(kCFAllocatorDefault, str, CFRangeMake(cnt, space.location - cnt));
+          if (var) {
+            NSLog(@"Ignore: %@", var);
+            CFRelease(var);
           }
-#endif
         }
       }
+#endif
+      /* Any '@' before space ends on the same whitespace */
+      cnt = space.location;
     }
   }
   /* Send characters between last var and end of file */
   [self foundVariable:nil inString:SPXCFToNSString(str) atRange:NSMakeRange(CFStringGetLength(str), 0)];
   CFRelease(varEndChars);
-  CFRelease(str);
+}
+
+- (BOOL)parse {
+  if (!wb_file)
+		SPXThrowException(NSInternalInconsistencyException, @"A file must be set before parsing.");
+
+  wb_blocks = 0;
+  wb_position = 0;
+
+  NSData *data = nil;
+  CFStringRef str = NULL;
+  if (NSUTF8StringEncoding == wb_encoding) {
+    data = [NSData dataWithContentsOfFile:wb_file options:NSDataReadingMappedIfSafe error:NULL];
+    if (!data || !_WBTemplateIsValidUTF8([data bytes], [data length]))
+      return NO;
+    wb_bytes = [data bytes];
+    /* Skip the byte order mark */
+    if ([data length] >= 3 && 0 == memcmp(wb_bytes, "\xEF\xBB\xBF", 3))
+      wb_position = 3;
+  } else {
+    str = SPXCFStringBridgingRetain(([[NSString alloc] initWithContentsOfFile:wb_file encoding:wb_encoding error:nil]));
+    if (!str)
+      return NO;
+  }
+
+  _WBTemplateLogMessage(@"Start File: %@", wb_blocks, wb_file);
+  if (tpimp.startTemplate)
+    [wb_delegate templateParser:self didStartTemplate:wb_file];
+
+  if (str) {
+    [self wb_scanString:str];
+    CFRelease(str);
+  } else {
+    @try {
+      [self wb_scanBytes:[data length]];
+    } @finally {
+      wb_bytes = NULL;
+    }
+  }
 
   if (wb_blocks) {
     _WBTemplateLogWarning(@"WARNING: %u blocks unclosed.", wb_blocks);
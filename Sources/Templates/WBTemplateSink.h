@@ -0,0 +1,59 @@
+/*
+ *  WBTemplateSink.h
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#import <WonderBox/WBCompiledTemplate.h>
+
+enum {
+  kWBTemplateSinkBufferCount = 256,
+  kWBTemplateSinkStageSize = 16 * 1024,
+  /* Smaller slices are copied in the stage, so they are not written one by one */
+  kWBTemplateSinkSmallSlice = 128,
+};
+
+/* Batches the output slices, and writes them kWBTemplateSinkBufferCount at a time.
+ Large slices are not copied, and must stay valid until the sink is flushed. */
+typedef struct _WBTemplateSink {
+  WBTemplateWriteFunction write;
+  void *context;
+  /* errno of the first failure */
+  int error;
+  int count;
+  size_t staged;
+  struct iovec buffers[kWBTemplateSinkBufferCount];
+  uint8_t stage[kWBTemplateSinkStageSize];
+} WBTemplateSink;
+
+WB_PRIVATE
+void WBTemplateSinkInitialize(WBTemplateSink *sink, WBTemplateWriteFunction write, void *context);
+
+WB_PRIVATE
+void WBTemplateSinkAppend(WBTemplateSink *sink, const void *bytes, size_t length);
+/* Returns false if the string cannot be converted to encoding */
+WB_PRIVATE
+bool WBTemplateSinkAppendString(WBTemplateSink *sink, CFStringRef string, CFStringEncoding encoding);
+
+/* Returns false if a write failed */
+WB_PRIVATE
+bool WBTemplateSinkFlush(WBTemplateSink *sink);
+
+/* context is the file descriptor */
+WB_PRIVATE
+BOOL WBTemplateWriteFileDescriptor(const struct iovec *buffers, int count, void *context);
+/* Ignores the output */
+WB_PRIVATE
+BOOL WBTemplateWriteNothing(const struct iovec *buffers, int count, void *context);
+
+/* Atomic outputs are written in a temporary file, renamed on close, that gets the mode of the replaced file.
+ Returns -1 and sets errno on failure. */
+WB_PRIVATE
+int WBTemplateOpenOutputFile(const char *path, bool atomically, char **temporary);
+/* Closes fd, and commits or discards the temporary file. Returns false and sets errno on failure. */
+WB_PRIVATE
+bool WBTemplateCloseOutputFile(int fd, const char *path, char *temporary, bool success);
@@ -0,0 +1,180 @@
+/*
+ *  WBTemplateSink.m
+ *  WonderBox
+ *
+ *  Created by Jean-Daniel Dupas.
+ *  Copyright (c) 2004 - 2009 Jean-Daniel Dupas. All rights reserved.
+ *
+ *  This file is distributed under the MIT License. See LICENSE.TXT for details.
+ */
+
+#import "WBTemplateSink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+void WBTemplateSinkInitialize(WBTemplateSink *sink, WBTemplateWriteFunction write, void *context) {
+  sink->write = write;
+  sink->context = context;
+  sink->error = 0;
+  sink->count = 0;
+  sink->staged = 0;
+}
+
+bool WBTemplateSinkFlush(WBTemplateSink *sink) {
+  if (sink->count > 0 && !sink->error) {
+    errno = 0;
+    if (!sink->write(sink->buffers, sink->count, sink->context))
+      sink->error = errno ? : EIO;
+  }
+  sink->count = 0;
+  sink->staged = 0;
+  return 0 == sink->error;
+}
+
+/* Appends length bytes from the stage */
+WB_INLINE
+void _WBTemplateSinkCommitStage(WBTemplateSink *sink, size_t length) {
+  uint8_t *bytes = sink->stage + sink->staged;
+  struct iovec *last = sink->count > 0 ? &sink->buffers[sink->count - 1] : NULL;
+  if (last && (uint8_t *)last->iov_base + last->iov_len == bytes) {
+    last->iov_len += length;
+  } else {
+    sink->buffers[sink->count].iov_base = bytes;
+    sink->buffers[sink->count].iov_len = length;
+    sink->count++;
+  }
+  sink->staged += length;
+}
+
+void WBTemplateSinkAppend(WBTemplateSink *sink, const void *bytes, size_t length) {
+  if (0 == length || sink->error)
+    return;
+  if (kWBTemplateSinkBufferCount == sink->count)
+    WBTemplateSinkFlush(sink);
+  if (length <= kWBTemplateSinkSmallSlice) {
+    if (sink->staged + length > kWBTemplateSinkStageSize)
+      WBTemplateSinkFlush(sink);
+    memcpy(sink->stage + sink->staged, bytes, length);
+    _WBTemplateSinkCommitStage(sink, length);
+  } else {
+    sink->buffers[sink->count].iov_base = (void *)bytes;
+    sink->buffers[sink->count].iov_len = length;
+    sink->count++;
+  }
+}
+
+bool WBTemplateSinkAppendString(WBTemplateSink *sink, CFStringRef string, CFStringEncoding encoding) {
+  CFIndex length = CFStringGetLength(string);
+  CFRange range = CFRangeMake(0, length);
+  while (range.length > 0 && !sink->error) {
+    /* room for at least a few characters */
+    if (kWBTemplateSinkBufferCount == sink->count || kWBTemplateSinkStageSize - sink->staged < 16)
+      WBTemplateSinkFlush(sink);
+    CFIndex used = 0;
+    CFIndex count = CFStringGetBytes(string, range, encoding, 0, false, sink->stage + sink->staged,
+                                     (CFIndex)(kWBTemplateSinkStageSize - sink->staged), &used);
+    if (0 == count)
+      return false;
+    _WBTemplateSinkCommitStage(sink, (size_t)used);
+    range.location += count;
+    range.length -= count;
+  }
+  return true;
+}
+
+#pragma mark -
+BOOL WBTemplateWriteFileDescriptor(const struct iovec *buffers, int count, void *context) {
+  int fd = (int)(intptr_t)context;
+  while (count > 0) {
+    ssize_t written = writev(fd, buffers, count);
+    if (written < 0) {
+      if (EINTR == errno)
+        continue;
+      return NO;
+    }
+    while (count > 0 && (size_t)written >= buffers->iov_len) {
+      written -= buffers->iov_len;
+      buffers++;
+      count--;
+    }
+    /* Partial write: finish this buffer before writing the next ones */
+    if (count > 0 && written > 0) {
+      const uint8_t *bytes = (const uint8_t *)buffers->iov_base + written;
+      size_t remaining = buffers->iov_len - (size_t)written;
+      while (remaining > 0) {
+        ssize_t result = write(fd, bytes, remaining);
+        if (result < 0) {
+          if (EINTR == errno)
+            continue;
+          return NO;
+        }
+        bytes += result;
+        remaining -= (size_t)result;
+      }
+      buffers++;
+      count--;
+    }
+  }
+  return YES;
+}
+
+BOOL WBTemplateWriteNothing(const struct iovec *buffers, int count, void *context) {
+  return YES;
+}
+
+int WBTemplateOpenOutputFile(const char *path, bool atomically, char **temporary) {
+  *temporary = NULL;
+  if (!path) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!atomically)
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+  if (asprintf(temporary, "%s.XXXXXX", path) < 0) {
+    *temporary = NULL;
+    errno = ENOMEM;
+    return -1;
+  }
+  int fd = mkstemp(*temporary);
+  if (fd < 0) {
+    free(*temporary);
+    *temporary = NULL;
+    return -1;
+  }
+  /* mkstemp creates the file with 0600: keep the mode of the replaced file, else use the same mode as open() */
+  struct stat st;
+  mode_t mode;
+  if (0 == stat(path, &st)) {
+    mode = st.st_mode & 07777;
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = 0666 & ~mask;
+  }
+  fchmod(fd, mode);
+  return fd;
+}
+
+bool WBTemplateCloseOutputFile(int fd, const char *path, char *temporary, bool success) {
+  int error = success ? 0 : errno;
+  if (0 != close(fd) && success) {
+    error = errno;
+    success = false;
+  }
+  if (temporary) {
+    if (success && 0 != rename(temporary, path)) {
+      error = errno;
+      success = false;
+    }
+    if (!success)
+      unlink(temporary);
+    free(temporary);
+  }
+  errno = error;
+  return success;
+}
@@ -399,6 +399,204 @@ static BOOL NoEqualChar(CFDataRef data) {
 
 #endif
 
+- (void)testVectorCodec {
+  // Differential fuzzing of the vectorized codec against the scalar one.
+  // Sizes are large enough to run the vector loops several times, and
+  // the decoder input is mangled with whitespace, padding and garbage.
+  static const char kGarbage[] = " \t\r\n=+/-_\0@\xff";
+  bool previous = WBBase64SetVectorCodecEnabled(true);
+  for (int x = 0 ; x < 4096 ; ++x) {
+    UInt8 data[512];
+    CFIndex length = 1 + random() % sizeof(data);
+    FillWithRandom(data, length);
+    bool webSafe = random() & 1;
+    bool padded = random() & 1;
+
+    WBBase64SetVectorCodecEnabled(true);
+    CFDataRef encoded = webSafe ? WBWSBase64CreateDataByEncodingBytes(data, length, padded) : WBBase64CreateDataByEncodingBytes(data, length);
+    WBBase64SetVectorCodecEnabled(false);
+    CFDataRef reference = webSafe ? WBWSBase64CreateDataByEncodingBytes(data, length, padded) : WBBase64CreateDataByEncodingBytes(data, length);
+    XCTAssertEqualObjects(SPXCFToNSData(encoded), SPXCFToNSData(reference), @"vector encoder does not match scalar encoder");
+    CFRelease(reference);
+
+    CFMutableDataRef mangled = CFDataCreateMutableCopy(kCFAllocatorDefault, 0, encoded);
+    CFIndex changes = random() % 8;
+    for (CFIndex idx = 0; idx < changes; ++idx) {
+      UInt8 ch = kGarbage[random() % (sizeof(kGarbage) - 1)];
+      CFIndex offset = random() % (CFDataGetLength(mangled) + 1);
+      if (random() & 1)
+        CFDataReplaceBytes(mangled, CFRangeMake(offset, 0), &ch, 1);
+      else if (offset < CFDataGetLength(mangled))
+        CFDataGetMutableBytePtr(mangled)[offset] = ch;
+    }
+
+    WBBase64SetVectorCodecEnabled(true);
+    CFDataRef decoded = webSafe ? WBWSBase64CreateDataByDecodingData(mangled) : WBBase64CreateDataByDecodingData(mangled);
+    WBBase64SetVectorCodecEnabled(false);
+    reference = webSafe ? WBWSBase64CreateDataByDecodingData(mangled) : WBBase64CreateDataByDecodingData(mangled);
+    XCTAssertEqualObjects(SPXCFToNSData(decoded), SPXCFToNSData(reference), @"vector decoder does not match scalar decoder");
+
+    SPXCFRelease(reference);
+    SPXCFRelease(decoded);
+    CFRelease(mangled);
+    CFRelease(encoded);
+  }
+  WBBase64SetVectorCodecEnabled(previous);
+}
+
+- (void)testBuffers {
+  for (int x = 1 ; x < 1024 ; ++x) {
+    UInt8 data[1024];
+    FillWithRandom(data, x);
+    bool webSafe = random() & 1;
+    bool padded = webSafe ? (random() & 1) : true;
+    CFDataRef expected = webSafe ? WBWSBase64CreateDataByEncodingBytes(data, x, padded) : WBBase64CreateDataByEncodingBytes(data, x);
+
+    UInt8 encoded[1400];
+    CFIndex length = WBBase64GetEncodedLength(x, padded);
+    XCTAssertEqual(length, CFDataGetLength(expected), @"wrong encoded length");
+    memset(encoded, 0xaa, sizeof(encoded));
+    XCTAssertEqual(WBBase64EncodeToBuffer(data, x, encoded, length - 1, webSafe ? kWBBase64CharsetWebSafe : kWBBase64CharsetRFC, padded), (CFIndex)0,
+                   @"should not encode into a too short buffer");
+    XCTAssertEqual(WBBase64EncodeToBuffer(data, x, encoded, length, webSafe ? kWBBase64CharsetWebSafe : kWBBase64CharsetRFC, padded), length,
+                   @"failed to encode into buffer");
+    XCTAssertEqualObjects([NSData dataWithBytes:encoded length:length], SPXCFToNSData(expected), @"buffer encoder does not match");
+    XCTAssertEqual(encoded[length], 0xaa, @"encoder wrote past the end of the output");
+
+    // decode into a dirty buffer
+    UInt8 decoded[1024];
+    memset(decoded, 0xff, sizeof(decoded));
+    CFIndex decodedLength = WBBase64DecodeToBuffer(encoded, length, decoded, WBBase64GetMaxDecodedLength(length),
+                                                   webSafe ? kWBBase64CharsetWebSafe : kWBBase64CharsetRFC, !webSafe);
+    XCTAssertEqualObjects([NSData dataWithBytes:decoded length:decodedLength], [NSData dataWithBytes:data length:x],
+                          @"failed to round trip via buffer apis");
+    CFRelease(expected);
+  }
+}
+
+- (void)testLineLength {
+  const CFIndex kLineLengths[] = { 4, 64, 76 };
+  for (int x = 1 ; x < 1024 ; ++x) {
+    UInt8 data[1024];
+    FillWithRandom(data, x);
+    CFIndex lineLength = kLineLengths[random() % 3];
+    CFDataRef flat = WBBase64CreateDataByEncodingBytes(data, x);
+
+    // wrap the single line result
+    NSMutableData *expected = [NSMutableData data];
+    for (CFIndex idx = 0; idx < CFDataGetLength(flat); idx += lineLength) {
+      if (idx > 0)
+        [expected appendBytes:"\r\n" length:2];
+      [expected appendBytes:CFDataGetBytePtr(flat) + idx length:MIN(lineLength, CFDataGetLength(flat) - idx)];
+    }
+    CFRelease(flat);
+
+    CFDataRef wrapped = WBBase64CreateDataByEncodingBytesWithLineLength(data, x, lineLength);
+    XCTAssertEqualObjects(SPXCFToNSData(wrapped), expected, @"wrong line wrapping");
+    CFRelease(wrapped);
+
+    UInt8 encoded[2100];
+    CFIndex length = WBBase64GetWrappedEncodedLength(x, true, lineLength);
+    XCTAssertEqual(length, (CFIndex)[expected length], @"wrong wrapped length");
+    XCTAssertEqual(WBBase64EncodeToBufferWithLineLength(data, x, encoded, length - 1, kWBBase64CharsetRFC, true, lineLength), (CFIndex)0,
+                   @"should not encode into a too short buffer");
+    XCTAssertEqual(WBBase64EncodeToBufferWithLineLength(data, x, encoded, length, kWBBase64CharsetRFC, true, lineLength), length);
+    XCTAssertEqualObjects([NSData dataWithBytes:encoded length:length], expected, @"buffer encoder does not match");
+
+    // streaming in random chunks
+    WBBase64Encoder encoder;
+    WBBase64EncoderInit(&encoder, kWBBase64CharsetRFC, true);
+    XCTAssertTrue(WBBase64EncoderSetLineLength(&encoder, lineLength));
+    CFIndex written = 0;
+    for (CFIndex idx = 0; idx < x; ) {
+      CFIndex chunk = MIN(x - idx, random() % 100);
+      CFIndex count = WBBase64EncoderUpdate(&encoder, data + idx, chunk, encoded + written, sizeof(encoded) - written);
+      XCTAssertTrue(count >= 0);
+      written += count;
+      idx += chunk;
+    }
+    written += WBBase64EncoderFinal(&encoder, encoded + written, sizeof(encoded) - written);
+    XCTAssertEqualObjects([NSData dataWithBytes:encoded length:written], expected, @"streaming encoder does not match");
+
+    // and the decoder skips the line breaks
+    UInt8 decoded[1600];
+    CFIndex decodedLength = WBBase64DecodeToBuffer(encoded, written, decoded, WBBase64GetMaxDecodedLength(written), kWBBase64CharsetRFC, true);
+    XCTAssertEqualObjects([NSData dataWithBytes:decoded length:decodedLength], [NSData dataWithBytes:data length:x]);
+  }
+  XCTAssertEqual(WBBase64GetWrappedEncodedLength(16, true, 10), (CFIndex)0, @"line length must be a multiple of 4");
+  XCTAssertTrue(WBBase64CreateDataByEncodingBytesWithLineLength("data", 4, 10) == NULL);
+}
+
+- (void)testStreaming {
+  for (int x = 0 ; x < 1024 ; ++x) {
+    UInt8 data[1024];
+    CFIndex length = 1 + random() % sizeof(data);
+    FillWithRandom(data, length);
+    bool webSafe = random() & 1;
+    bool padded = webSafe ? (random() & 1) : true;
+    CFDataRef expected = webSafe ? WBWSBase64CreateDataByEncodingBytes(data, length, padded) : WBBase64CreateDataByEncodingBytes(data, length);
+
+    // encode in random chunks
+    UInt8 encoded[1400];
+    CFIndex encodedLength = 0;
+    WBBase64Encoder encoder;
+    WBBase64EncoderInit(&encoder, webSafe ? kWBBase64CharsetWebSafe : kWBBase64CharsetRFC, padded);
+    for (CFIndex offset = 0; offset < length; ) {
+      CFIndex chunk = MIN(length - offset, random() % 64);
+      CFIndex written = WBBase64EncoderUpdate(&encoder, data + offset, chunk, encoded + encodedLength, (chunk + 2) / 3 * 4);
+      XCTAssertTrue(written >= 0, @"encoder update failed");
+      encodedLength += written;
+      offset += chunk;
+    }
+    encodedLength += WBBase64EncoderFinal(&encoder, encoded + encodedLength, 4);
+    XCTAssertEqualObjects([NSData dataWithBytes:encoded length:encodedLength], SPXCFToNSData(expected),
+                          @"streaming encoder does not match one-shot encoder");
+
+    // and decode it back the same way
+    UInt8 decoded[1024];
+    CFIndex decodedLength = 0;
+    WBBase64Decoder decoder;
+    WBBase64DecoderInit(&decoder, webSafe ? kWBBase64CharsetWebSafe : kWBBase64CharsetRFC, !webSafe);
+    for (CFIndex offset = 0; offset < encodedLength; ) {
+      CFIndex chunk = MIN(encodedLength - offset, random() % 64);
+      CFIndex written = WBBase64DecoderUpdate(&decoder, encoded + offset, chunk, decoded + decodedLength, (chunk + 3) / 4 * 3);
+      XCTAssertTrue(written >= 0, @"decoder update failed");
+      decodedLength += written;
+      offset += chunk;
+    }
+    XCTAssertTrue(WBBase64DecoderFinal(&decoder), @"decoder final failed");
+    XCTAssertEqualObjects([NSData dataWithBytes:decoded length:decodedLength], [NSData dataWithBytes:data length:length],
+                          @"failed to round trip via streaming apis");
+    CFRelease(expected);
+  }
+
+  // errors are detected whatever the chunk boundaries are
+  const char *invalids[] = { "vw==vw", "vw=", "v", "WD==", "vw=v", "@@@" };
+  for (size_t idx = 0; idx < sizeof(invalids) / sizeof(*invalids); ++idx) {
+    UInt8 buffer[8];
+    WBBase64Decoder decoder;
+    WBBase64DecoderInit(&decoder, kWBBase64CharsetRFC, true);
+    bool ok = true;
+    for (const char *ch = invalids[idx]; ok && *ch; ++ch)
+      ok = WBBase64DecoderUpdate(&decoder, ch, 1, buffer, sizeof(buffer)) >= 0;
+    XCTAssertFalse(ok && WBBase64DecoderFinal(&decoder), @"'%s' should not decode", invalids[idx]);
+  }
+
+  // whitespace only input decodes to nothing with both decoders
+  const char *blank = " \r\n\t ";
+  UInt8 buffer[8];
+  WBBase64Decoder decoder;
+  WBBase64DecoderInit(&decoder, kWBBase64CharsetRFC, true);
+  XCTAssertEqual(WBBase64DecoderUpdate(&decoder, blank, strlen(blank), buffer, sizeof(buffer)), (CFIndex)0);
+  XCTAssertTrue(WBBase64DecoderFinal(&decoder));
+  CFDataRef empty = WBBase64CreateDataByDecodingBytes(blank, strlen(blank));
+  XCTAssertEqualObjects(SPXCFToNSData(empty), [NSData data], @"whitespace should decode to an empty data");
+  SPXCFRelease(empty);
+  empty = WBWSBase64CreateDataByDecodingBytes(blank, strlen(blank));
+  XCTAssertEqualObjects(SPXCFToNSData(empty), [NSData data], @"whitespace should decode to an empty data");
+  SPXCFRelease(empty);
+}
+
 - (void)testErrors {
   const int something = 0;
   CFStringRef nonAscString = CFSTR("This test ©™®๒०᠐٧");
@@ -0,0 +1,88 @@
+//
+//  WBDigestTemplateTest.mm
+//  WonderBox
+//
+//  Created by Jean-Daniel Dupas.
+//
+//
+
+#import <XCTest/XCTest.h>
+
+#import "WBDigest.h"
+
+#include <algorithm>
+#include <vector>
+
+static void FillWithRandom(uint8_t *data, size_t len) {
+  for (size_t idx = 0; idx < len; ++idx)
+    data[idx] = random() & 0xff;
+}
+
+@interface WBDigestTemplateTest : XCTestCase
+
+@end
+
+@implementation WBDigestTemplateTest
+
+- (void)setUp {
+  [super setUp];
+  srandomdev();
+}
+
+// One-shot, chunked and reused digests must all match WBDigestData().
+template <WBDigestAlgorithm Algo>
+static void WBDigestTemplateCheck(WBDigestTemplateTest *self, const uint8_t *data, size_t length) {
+  typedef wb::Digest<Algo> Digest;
+  uint8_t expected[WB_DIGEST_MAX_LENGTH], md[WB_DIGEST_MAX_LENGTH];
+  XCTAssertEqual(WBDigestData(data, length, Algo, expected), (int)Digest::length);
+  XCTAssertEqual(WBDigestGetOutputSize(Algo), Digest::length);
+
+  memset(md, 0, sizeof(md));
+  Digest::digest(data, length, md);
+  XCTAssertTrue(memcmp(md, expected, Digest::length) == 0, @"digest %u mismatch for %zu bytes", Algo, length);
+
+  Digest digest;
+  for (size_t offset = 0; offset < length; ) {
+    size_t chunk = std::min(length - offset, (size_t)(random() % 200));
+    digest.update(data + offset, chunk);
+    offset += chunk;
+  }
+  memset(md, 0, sizeof(md));
+  digest.final(md);
+  XCTAssertTrue(memcmp(md, expected, Digest::length) == 0, @"chunked digest %u mismatch for %zu bytes", Algo, length);
+
+  // final() resets the digest
+  digest.update(data, length);
+  memset(md, 0, sizeof(md));
+  digest.final(md);
+  XCTAssertTrue(memcmp(md, expected, Digest::length) == 0, @"reused digest %u mismatch for %zu bytes", Algo, length);
+
+  digest.update("garbage", 7);
+  digest.reset();
+  digest.update(data, length);
+  memset(md, 0, sizeof(md));
+  digest.final(md);
+  XCTAssertTrue(memcmp(md, expected, Digest::length) == 0, @"reset digest %u mismatch for %zu bytes", Algo, length);
+}
+
+- (void)testDigestTemplate {
+  // empty, around the block and padding boundaries (64 and 128 bytes blocks), and multi-block inputs.
+  const size_t sizes[] = { 0, 1, 55, 56, 63, 64, 65, 111, 112, 127, 128, 129, 1000, 4096 + 17, 1024 * 1024 + 3 };
+  std::vector<uint8_t> data(sizes[sizeof(sizes) / sizeof(*sizes) - 1]);
+  FillWithRandom(data.data(), data.size());
+  for (size_t idx = 0; idx < sizeof(sizes) / sizeof(*sizes); ++idx) {
+    const size_t length = sizes[idx];
+#if defined(__APPLE__) && !defined(WB_DIGEST_PORTABLE)
+    WBDigestTemplateCheck<kWBDigestMD2>(self, data.data(), length);
+    WBDigestTemplateCheck<kWBDigestMD4>(self, data.data(), length);
+#endif
+    WBDigestTemplateCheck<kWBDigestMD5>(self, data.data(), length);
+    WBDigestTemplateCheck<kWBDigestSHA1>(self, data.data(), length);
+    WBDigestTemplateCheck<kWBDigestSHA224>(self, data.data(), length);
+    WBDigestTemplateCheck<kWBDigestSHA256>(self, data.data(), length);
+    WBDigestTemplateCheck<kWBDigestSHA384>(self, data.data(), length);
+    WBDigestTemplateCheck<kWBDigestSHA512>(self, data.data(), length);
+  }
+}
+
+@end
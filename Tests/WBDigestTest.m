@@ -0,0 +1,139 @@
+//
+//  WBDigestTest.m
+//  WonderBox
+//
+//  Created by Jean-Daniel Dupas.
+//
+//
+
+#import <XCTest/XCTest.h>
+
+#import <WonderBox/WBDigestFunctions.h>
+
+static void FillWithRandom(uint8_t *data, size_t len) {
+  for (size_t idx = 0; idx < len; ++idx)
+    data[idx] = random() & 0xff;
+}
+
+@interface WBDigestTest : XCTestCase
+
+@end
+
+@implementation WBDigestTest
+
+- (void)setUp {
+  [super setUp];
+  srandomdev();
+}
+
+- (void)testDigestBatch {
+  const WBDigestAlgorithm algorithms[] = { kWBDigestMD5, kWBDigestSHA1, kWBDigestSHA224, kWBDigestSHA256, kWBDigestSHA512 };
+  for (size_t a = 0; a < sizeof(algorithms) / sizeof(*algorithms); ++a) {
+    WBDigestAlgorithm algo = algorithms[a];
+    size_t length = WBDigestGetOutputSize(algo);
+
+    // lengths around the block and padding boundaries, and a few large buffers.
+    enum { count = 1000 };
+    const void *buffers[count];
+    size_t lengths[count];
+    for (size_t idx = 0; idx < count; ++idx) {
+      switch (idx % 10) {
+        case 0: lengths[idx] = 0; break;
+        case 1: lengths[idx] = 55 + random() % 3; break;
+        case 2: lengths[idx] = (random() % 8) * 64 + random() % 2; break;
+        case 3: lengths[idx] = idx == 3 ? 1024 * 1024 : random() % 128; break;
+        default: lengths[idx] = random() % 1024; break;
+      }
+      uint8_t *buffer = malloc(lengths[idx] + 1);
+      FillWithRandom(buffer, lengths[idx]);
+      buffers[idx] = buffer;
+    }
+
+    uint8_t *digests = malloc(count * length);
+    XCTAssertEqual(WBDigestDataBatch(algo, buffers, lengths, count, digests), (int)length);
+    for (size_t idx = 0; idx < count; ++idx) {
+      uint8_t md[WB_DIGEST_MAX_LENGTH];
+      WBDigestData(buffers[idx], lengths[idx], algo, md);
+      XCTAssertTrue(memcmp(md, digests + idx * length, length) == 0, @"digest %u mismatch for %zu bytes",
+                    algo, lengths[idx]);
+    }
+    free(digests);
+    for (size_t idx = 0; idx < count; ++idx)
+      free((void *)buffers[idx]);
+  }
+
+  XCTAssertEqual(WBDigestDataBatch(kWBDigestUndefined, NULL, NULL, 0, NULL), 0);
+  XCTAssertEqual(WBDigestDataBatch(kWBDigestSHA256, NULL, NULL, 0, NULL), WB_SHA256_DIGEST_LENGTH);
+}
+
+- (void)testDigestFileStrategies {
+  // larger than the thread buffers, and not a multiple of the page size.
+  const size_t length = 9 * 1024 * 1024 + 123;
+  uint8_t *data = malloc(length);
+  FillWithRandom(data, length);
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+  XCTAssertTrue([[NSData dataWithBytesNoCopy:data length:length freeWhenDone:NO] writeToFile:path atomically:NO]);
+
+  uint8_t expected[WB_SHA256_DIGEST_LENGTH];
+  WBDigestData(data, length, kWBDigestSHA256, expected);
+  const WBDigestFileStrategy strategies[] = { kWBDigestFileRead, kWBDigestFileMap, kWBDigestFileDirectIO, kWBDigestFileThreaded };
+  for (size_t idx = 0; idx < sizeof(strategies) / sizeof(*strategies); ++idx) {
+    uint8_t md[WB_SHA256_DIGEST_LENGTH];
+    XCTAssertEqual(WBDigestFileWithStrategy([path fileSystemRepresentation], kWBDigestSHA256, strategies[idx], md), WB_SHA256_DIGEST_LENGTH);
+    XCTAssertTrue(memcmp(md, expected, sizeof(md)) == 0, @"strategy %u mismatch", strategies[idx]);
+  }
+  XCTAssertEqual(WBDigestFileWithStrategy("/nonexistent", kWBDigestSHA256, kWBDigestFileMap, expected), -1);
+
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  free(data);
+}
+
+- (void)testDigestTree {
+  XCTAssertEqual(WBDigestGetAlgorithmByName("sha256-tree"), kWBDigestSHA256Tree);
+  XCTAssertEqual(WBDigestGetOutputSize(kWBDigestSHA256Tree), (size_t)WB_SHA256_TREE_DIGEST_LENGTH);
+
+  // 3 MB + 12345 bytes: the last leaf is not a multiple of the O_DIRECT block size.
+  const size_t sizes[] = { 0, 1, WB_DIGEST_TREE_LEAF_SIZE, WB_DIGEST_TREE_LEAF_SIZE + 1, 3 * WB_DIGEST_TREE_LEAF_SIZE + 12345, 20 * WB_DIGEST_TREE_LEAF_SIZE + 7 };
+  uint8_t *data = malloc(sizes[5]);
+  FillWithRandom(data, sizes[5]);
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+  for (size_t idx = 0; idx < sizeof(sizes) / sizeof(*sizes); ++idx) {
+    const size_t length = sizes[idx];
+    XCTAssertTrue([[NSData dataWithBytesNoCopy:data length:length freeWhenDone:NO] writeToFile:path atomically:NO]);
+
+    // the streaming functions and the parallel file hashing must agree.
+    uint8_t expected[WB_SHA256_TREE_DIGEST_LENGTH], md[WB_SHA256_TREE_DIGEST_LENGTH];
+    WBDigestContext ctxt;
+    WBDigestInit(kWBDigestSHA256Tree, &ctxt);
+    for (size_t offset = 0; offset < length; offset += 100000)
+      WBDigestUpdate(&ctxt, data + offset, MIN(100000, length - offset));
+    XCTAssertEqual(WBDigestFinal(&ctxt, expected), WB_SHA256_TREE_DIGEST_LENGTH);
+
+    const WBDigestFileStrategy strategies[] = { kWBDigestFileRead, kWBDigestFileMap, kWBDigestFileDirectIO, kWBDigestFileThreaded };
+    for (size_t strategy = 0; strategy < sizeof(strategies) / sizeof(*strategies); ++strategy) {
+      memset(md, 0, sizeof(md));
+      XCTAssertEqual(WBDigestFileWithStrategy([path fileSystemRepresentation], kWBDigestSHA256Tree, strategies[strategy], md), WB_SHA256_TREE_DIGEST_LENGTH,
+                     @"strategy %u failed for %zu bytes", strategies[strategy], length);
+      XCTAssertTrue(memcmp(md, expected, sizeof(md)) == 0, @"tree digest mismatch for %zu bytes (strategy %u)", length, strategies[strategy]);
+    }
+
+    uint8_t *leaves = NULL;
+    size_t count = 0;
+    XCTAssertEqual(WBDigestFileTree([path fileSystemRepresentation], md, &leaves, &count), WB_SHA256_TREE_DIGEST_LENGTH);
+    XCTAssertEqual(count, MAX((size_t)1, (length + WB_DIGEST_TREE_LEAF_SIZE - 1) / WB_DIGEST_TREE_LEAF_SIZE));
+    XCTAssertTrue(memcmp(md, expected, sizeof(md)) == 0);
+
+    // verify the last leaf, and the root from the leaves.
+    uint8_t leaf[WB_SHA256_TREE_DIGEST_LENGTH];
+    size_t last = (count - 1) * WB_DIGEST_TREE_LEAF_SIZE;
+    XCTAssertEqual(WBDigestTreeLeaf(data + last, length - last, leaf), WB_SHA256_TREE_DIGEST_LENGTH);
+    XCTAssertTrue(memcmp(leaf, leaves + (count - 1) * WB_SHA256_TREE_DIGEST_LENGTH, sizeof(leaf)) == 0);
+    XCTAssertEqual(WBDigestTreeRoot(leaves, count, md), WB_SHA256_TREE_DIGEST_LENGTH);
+    XCTAssertTrue(memcmp(md, expected, sizeof(md)) == 0);
+    free(leaves);
+  }
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  free(data);
+}
+
+@end
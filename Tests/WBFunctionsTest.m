@@ -12,8 +12,72 @@
 
 #import "WBFunctions.h"
 #import "WBObjCRuntime.h"
+#import "WBTextFunctions.h"
 #import "WBVersionFunctions.h"
 
+/* Does not give access to its characters storage, so the text functions copy them by chunks */
+@interface WBFunctionsTestString : NSMutableString {
+@private
+  NSMutableString *_storage;
+}
+@end
+
+@implementation WBFunctionsTestString
+
+- (instancetype)initWithString:(NSString *)aString {
+  if (self = [super init])
+    _storage = [aString mutableCopy];
+  return self;
+}
+
+- (void)dealloc {
+  [_storage release];
+  [super dealloc];
+}
+
+- (NSUInteger)length { return [_storage length]; }
+- (unichar)characterAtIndex:(NSUInteger)idx { return [_storage characterAtIndex:idx]; }
+- (void)getCharacters:(unichar *)buffer range:(NSRange)range { [_storage getCharacters:buffer range:range]; }
+- (void)replaceCharactersInRange:(NSRange)range withString:(NSString *)aString {
+  [_storage replaceCharactersInRange:range withString:aString];
+}
+
+@end
+
+/* Reference: NEL ends a line, but is not converted. Returns the number of lines. */
+static CFIndex _WBFunctionsTestScanLines(NSString *str, NSString *eol, NSMutableString *converted, CFIndex *breaks) {
+  CFIndex lines = 0;
+  *breaks = 0;
+  NSUInteger length = [str length];
+  for (NSUInteger idx = 0; idx < length; ++idx) {
+    unichar ch = [str characterAtIndex:idx];
+    bool end = idx + 1 == length;
+    switch (ch) {
+      case kWBCarriageReturnCharacter:
+        if (!end && kWBNewlineCharacter == [str characterAtIndex:idx + 1])
+          idx++;
+        // fall through
+      case kWBNewlineCharacter:
+      case kWBLineSeparatorCharacter:
+      case kWBParagraphSeparatorCharacter:
+        [converted appendString:eol];
+        (*breaks)++;
+        lines++;
+        break;
+      case 0x0085:
+        [converted appendFormat:@"%C", ch];
+        lines++;
+        break;
+      default:
+        [converted appendFormat:@"%C", ch];
+        if (end)
+          lines++;
+        break;
+    }
+  }
+  return lines;
+}
+
 @interface WBFunctionsTest : XCTestCase {
 
 }
@@ -108,4 +172,84 @@ bool _CFArrayContainsClass(CFArrayRef classes, Class cls) {
   CFRelease(classes);
 }
 
+- (void)testTextLines {
+  const struct { NSString *text; CFIndex lines; } tests[] = {
+    { @"", 0 },
+    { @"a", 1 },
+    { @"\n", 1 },
+    { @"\r\n\r", 2 },
+    { @"\n\r", 2 },
+    { @"a\r\nb\n", 2 },
+    { @"a\u0085b\u2028c\u2029d", 4 },
+    { @"\u00e9\r\n\u2029", 2 },
+  };
+  for (size_t idx = 0; idx < sizeof(tests) / sizeof(*tests); ++idx) {
+    CFIndex breaks = 0;
+    XCTAssertEqual(_WBFunctionsTestScanLines(tests[idx].text, @"\n", [NSMutableString string], &breaks), tests[idx].lines);
+    XCTAssertEqual(WBTextGetCountOfLines(SPXNSToCFString(tests[idx].text)), tests[idx].lines, @"%@", tests[idx].text);
+  }
+
+  // NEL ends a line, but is not converted.
+  NSMutableString *str = [NSMutableString stringWithString:@"a\u0085b\u2028c\u2029d\r\ne\rf"];
+  XCTAssertEqual(WBTextConvertLineEnding(SPXNSToCFMutableString(str), CFSTR("\n")), (CFIndex)4);
+  XCTAssertEqualObjects(str, @"a\u0085b\nc\nd\ne\nf");
+
+  // CR LF pairs split between two chunks, and CR at the end of a chunk.
+  NSString *padding = [@"" stringByPaddingToLength:1023 withString:@"a" startingAtIndex:0];
+  NSString *split[] = {
+    [padding stringByAppendingString:@"\r\nb"],
+    [padding stringByAppendingString:@"\rb\n"],
+    [padding stringByAppendingString:@"\r\r\nb"],
+    [[padding substringFromIndex:1] stringByAppendingString:@"\r\r\nb"],
+    [padding stringByAppendingString:@"\u2029\nb\u0085"],
+  };
+  for (size_t idx = 0; idx < sizeof(split) / sizeof(*split); ++idx) {
+    NSMutableString *expected = [NSMutableString string];
+    CFIndex breaks = 0, lines = _WBFunctionsTestScanLines(split[idx], @"\r\n", expected, &breaks);
+    WBFunctionsTestString *chunked = [[WBFunctionsTestString alloc] initWithString:split[idx]];
+    XCTAssertTrue(CFStringGetCharactersPtr(SPXNSToCFString(chunked)) == NULL);
+    XCTAssertEqual(WBTextGetCountOfLines(SPXNSToCFString(chunked)), lines, @"string %zu", idx);
+    XCTAssertEqual(WBTextGetCountOfLines(SPXNSToCFString(split[idx])), lines, @"string %zu", idx);
+    XCTAssertEqual(WBTextConvertLineEnding(SPXNSToCFMutableString(chunked), CFSTR("\r\n")), breaks, @"string %zu", idx);
+    XCTAssertEqualObjects([NSString stringWithString:chunked], expected, @"string %zu", idx);
+    [chunked release];
+  }
+}
+
+- (void)testTextLinesStorage {
+  // random lines long enough to cross chunks and vector boundaries, in every string storage.
+  NSString *ascii[] = { @"a", @"bc", @"\r", @"\n", @"\r\n", @"\n\r" };
+  NSString *unicode[] = { @"\u00e9", @"\u0085", @"\u2028", @"\u2029", @"\u2029\n" };
+  NSString *eols[] = { @"\n", @"\r\n", @"", @"\u2029" };
+  for (int iteration = 0; iteration < 20; ++iteration) {
+    NSMutableString *text = [NSMutableString string];
+    while ([text length] < 5000) {
+      long pick = random() % 20;
+      if (pick < 6)
+        [text appendString:ascii[pick]];
+      else if (pick < 11 && iteration % 2)
+        [text appendString:unicode[pick - 6]];
+      else
+        [text appendString:[@"" stringByPaddingToLength:random() % 40 withString:@"x" startingAtIndex:0]];
+    }
+    NSString *eol = eols[iteration % 4];
+    NSMutableString *expected = [NSMutableString string];
+    CFIndex breaks = 0, lines = _WBFunctionsTestScanLines(text, eol, expected, &breaks);
+
+    // CF storage (8 bits for ASCII strings, UTF-16 otherwise), and without direct access.
+    NSMutableString *strings[] = {
+      [[NSMutableString alloc] initWithString:text],
+      (NSMutableString *)CFStringCreateMutableCopy(kCFAllocatorDefault, 0, SPXNSToCFString(text)),
+      [[WBFunctionsTestString alloc] initWithString:text],
+    };
+    for (size_t idx = 0; idx < sizeof(strings) / sizeof(*strings); ++idx) {
+      XCTAssertEqual(WBTextGetCountOfLines(SPXNSToCFString(strings[idx])), lines, @"iteration %d, string %zu", iteration, idx);
+      XCTAssertEqual(WBTextConvertLineEnding(SPXNSToCFMutableString(strings[idx]), SPXNSToCFString(eol)), breaks,
+                     @"iteration %d, string %zu", iteration, idx);
+      XCTAssertEqualObjects([NSString stringWithString:strings[idx]], expected, @"iteration %d, string %zu", iteration, idx);
+      [strings[idx] release];
+    }
+  }
+}
+
 @end
@@ -0,0 +1,510 @@
+//
+//  WBIcnsTest.m
+//  WonderBox
+//
+//  Created by Jean-Daniel Dupas.
+//
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+
+#import "WBIcnsFormat.h"
+#import "WBIcnsPixels.h"
+#import "WBIconFamilyReader.h"
+
+static void FillWithRandom(uint8_t *data, size_t len) {
+  for (size_t idx = 0; idx < len; ++idx)
+    data[idx] = random() & 0xff;
+}
+
+#pragma mark Scalar references
+static uint8_t _WBIcnsTestPremultiply(uint8_t color, uint8_t alpha) {
+  return (uint8_t)(color * alpha / 255);
+}
+
+static uint8_t _WBIcnsTestUnpremultiply(uint8_t color, uint8_t alpha) {
+  uint32_t value = color * 255 / alpha;
+  return value > 255 ? 255 : (uint8_t)value;
+}
+
+static uint8_t _WBIcnsTestCMYKToRGB(uint8_t color, uint8_t black) {
+  return color + black > 255 ? 0 : (uint8_t)(255 - color - black);
+}
+
+/* Reads the samples of a pixel in the bitmap order, then converts them */
+static void _WBIcnsTestConvertPixel(const WBIcnsPixelLayout *layout, const uint8_t * const planes[], size_t bytesPerRow,
+                                    size_t x, size_t y, uint8_t *argb) {
+  size_t count = layout->components + (layout->alpha ? 1 : 0);
+  uint8_t samples[5];
+  for (size_t sample = 0; sample < count; ++sample)
+    samples[sample] = layout->planar ? planes[sample][y * bytesPerRow + x] : planes[0][y * bytesPerRow + x * count + sample];
+  const uint8_t *color = samples + (layout->alpha && layout->alphaFirst ? 1 : 0);
+  uint8_t alpha = layout->alpha ? samples[layout->alphaFirst ? 0 : layout->components] : 0;
+  argb[0] = alpha;
+  for (int c = 0; c < 3; ++c) {
+    switch (layout->components) {
+      case 1: argb[1 + c] = color[0]; break;
+      case 3: argb[1 + c] = color[c]; break;
+      case 4: argb[1 + c] = _WBIcnsTestCMYKToRGB(color[c], color[3]); break;
+    }
+    if (layout->alpha && layout->premultiplied && alpha != 0 && alpha != 255)
+      argb[1 + c] = _WBIcnsTestUnpremultiply(argb[1 + c], alpha);
+  }
+}
+
+/* Random bytes, with runs of every length from 1 to 300 */
+static void FillWithRuns(uint8_t *data, size_t len) {
+  FillWithRandom(data, len);
+  for (size_t idx = 0, run = 1; idx < len; idx += run * 2, run = run % 300 + 1)
+    memset(data + idx, data[idx], MIN(run, len - idx));
+}
+
+/* Decodes exactly length bytes, or returns 0 */
+static size_t _WBIcnsTestRLEDecode(const uint8_t *src, size_t srcLength, uint8_t *dst, size_t length) {
+  size_t in = 0, out = 0;
+  while (out < length) {
+    if (in >= srcLength)
+      return 0;
+    uint8_t packet = src[in++];
+    size_t count = packet < 0x80 ? packet + 1 : packet - 125u;
+    if (out + count > length || in + (packet < 0x80 ? count : 1) > srcLength)
+      return 0;
+    for (size_t idx = 0; idx < count; ++idx)
+      dst[out++] = packet < 0x80 ? src[in + idx] : src[in];
+    in += packet < 0x80 ? count : 1;
+  }
+  return in;
+}
+
+/* Area average, in floating point */
+static void _WBIcnsTestDownsample(const uint8_t *src, size_t srcWidth, size_t srcHeight, double *dst, size_t width, size_t height) {
+  const double sx = (double)srcWidth / width, sy = (double)srcHeight / height;
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      double sums[4] = { 0, 0, 0, 0 };
+      for (size_t line = (size_t)(y * sy); line < srcHeight && line < (y + 1) * sy; ++line) {
+        double coverageY = MIN(line + 1, (y + 1) * sy) - MAX(line, y * sy);
+        for (size_t column = (size_t)(x * sx); column < srcWidth && column < (x + 1) * sx; ++column) {
+          double coverage = coverageY * (MIN(column + 1, (x + 1) * sx) - MAX(column, x * sx));
+          for (int c = 0; c < 4; ++c)
+            sums[c] += coverage * src[(line * srcWidth + column) * 4 + c];
+        }
+      }
+      for (int c = 0; c < 4; ++c)
+        dst[(y * width + x) * 4 + c] = sums[c] / (sx * sy);
+    }
+  }
+}
+
+@interface WBIcnsTest : XCTestCase
+
+@end
+
+@implementation WBIcnsTest
+
+- (void)setUp {
+  [super setUp];
+  srandomdev();
+}
+
+- (void)testConvertToARGB {
+  // odd width, for the vector loops tails, and padded rows.
+  enum { width = 37, height = 5, padding = 3 };
+  uint8_t argb[width * height * 4], expected[width * height * 4];
+  const uint32_t components[] = { 1, 3, 4 };
+  for (size_t idx = 0; idx < sizeof(components) / sizeof(*components); ++idx) {
+    for (unsigned flags = 0; flags < 16; ++flags) {
+      WBIcnsPixelLayout layout = { components[idx], flags & 1, (flags & 2) != 0, (flags & 4) != 0, (flags & 8) != 0 };
+      if (!layout.alpha && (layout.alphaFirst || layout.premultiplied))
+        continue;
+
+      size_t count = layout.components + (layout.alpha ? 1 : 0);
+      size_t bytesPerRow = (layout.planar ? width : width * count) + padding;
+      uint8_t *data = malloc(bytesPerRow * height * count);
+      FillWithRandom(data, bytesPerRow * height * count);
+      const uint8_t *planes[5] = { data };
+      for (size_t plane = 1; layout.planar && plane < count; ++plane)
+        planes[plane] = data + plane * bytesPerRow * height;
+
+      for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x)
+          _WBIcnsTestConvertPixel(&layout, planes, bytesPerRow, x, y, expected + (y * width + x) * 4);
+      }
+      XCTAssertTrue(WBIcnsConvertToARGB(&layout, planes, bytesPerRow, width, height, argb));
+      XCTAssertTrue(memcmp(argb, expected, sizeof(argb)) == 0, @"%u components, alpha: %d, first: %d, planar: %d, premultiplied: %d",
+                    layout.components, layout.alpha, layout.alphaFirst, layout.planar, layout.premultiplied);
+      free(data);
+    }
+  }
+  WBIcnsPixelLayout invalid = { 2, true, false, false, false };
+  const uint8_t *planes[1] = { argb };
+  XCTAssertFalse(WBIcnsConvertToARGB(&invalid, planes, width * 2, width, height, expected));
+}
+
+- (void)testPremultiply {
+  // every color and alpha pair: the first and last 256 pixels are transparent and opaque.
+  enum { pixels = 256 * 256 };
+  uint8_t *argb = malloc(pixels * 4), *expected = malloc(pixels * 4);
+  for (size_t idx = 0; idx < pixels; ++idx) {
+    uint8_t *pixel = argb + idx * 4;
+    pixel[0] = (uint8_t)(idx >> 8);
+    pixel[1] = (uint8_t)idx;
+    pixel[2] = (uint8_t)(255 - idx);
+    pixel[3] = (uint8_t)(idx ^ 0x55);
+  }
+
+  memcpy(expected, argb, pixels * 4);
+  for (size_t idx = 0; idx < pixels; ++idx) {
+    uint8_t *pixel = expected + idx * 4;
+    for (int c = 1; c < 4; ++c)
+      pixel[c] = _WBIcnsTestPremultiply(pixel[c], pixel[0]);
+  }
+  uint8_t *premultiplied = malloc(pixels * 4);
+  memcpy(premultiplied, argb, pixels * 4);
+  WBIcnsPremultiplyARGB(premultiplied, pixels);
+  XCTAssertTrue(memcmp(premultiplied, expected, pixels * 4) == 0);
+
+  // colors larger than alpha are clamped.
+  memcpy(expected, argb, pixels * 4);
+  for (size_t idx = 0; idx < pixels; ++idx) {
+    uint8_t *pixel = expected + idx * 4;
+    for (int c = 1; pixel[0] != 0 && pixel[0] != 255 && c < 4; ++c)
+      pixel[c] = _WBIcnsTestUnpremultiply(pixel[c], pixel[0]);
+  }
+  WBIcnsUnpremultiplyARGB(argb, pixels);
+  XCTAssertTrue(memcmp(argb, expected, pixels * 4) == 0);
+
+  // a few pixels, after opaque runs.
+  for (size_t count = 0; count < 40; ++count) {
+    FillWithRandom(argb, count * 4);
+    for (size_t idx = 0; idx < count / 2; ++idx)
+      argb[idx * 4] = idx % 3 ? 255 : 0;
+    memcpy(expected, argb, count * 4);
+    for (size_t idx = 0; idx < count; ++idx) {
+      uint8_t *pixel = expected + idx * 4;
+      for (int c = 1; pixel[0] != 0 && pixel[0] != 255 && c < 4; ++c)
+        pixel[c] = _WBIcnsTestUnpremultiply(pixel[c], pixel[0]);
+    }
+    WBIcnsUnpremultiplyARGB(argb, count);
+    XCTAssertTrue(memcmp(argb, expected, count * 4) == 0, @"%zu pixels", count);
+  }
+  free(premultiplied);
+  free(expected);
+  free(argb);
+}
+
+- (void)testInterleave {
+  enum { pixels = 67 };
+  uint8_t planes[4][pixels], argb[pixels * 4], expected[pixels * 4];
+  FillWithRandom(&planes[0][0], sizeof(planes));
+  for (int alpha = 0; alpha < 2; ++alpha) {
+    for (size_t idx = 0; idx < pixels; ++idx) {
+      expected[idx * 4] = alpha ? planes[0][idx] : 0;
+      for (int c = 1; c < 4; ++c)
+        expected[idx * 4 + c] = planes[c][idx];
+    }
+    WBIcnsInterleaveARGB(alpha ? planes[0] : NULL, planes[1], planes[2], planes[3], argb, pixels);
+    XCTAssertTrue(memcmp(argb, expected, sizeof(argb)) == 0, @"alpha: %d", alpha);
+  }
+
+  FillWithRandom(argb, sizeof(argb));
+  for (int premultiply = 0; premultiply < 2; ++premultiply) {
+    for (int alpha = 0; alpha < 2; ++alpha) {
+      uint8_t output[4][pixels];
+      memset(output, 0xaa, sizeof(output));
+      WBIcnsDeinterleaveARGB(argb, pixels, premultiply, alpha ? output[0] : NULL, output[1], output[2], output[3]);
+      for (size_t idx = 0; idx < pixels; ++idx) {
+        const uint8_t *pixel = argb + idx * 4;
+        XCTAssertEqual((int)output[0][idx], alpha ? pixel[0] : 0xaa);
+        for (int c = 1; c < 4; ++c)
+          XCTAssertEqual((int)output[c][idx], premultiply ? _WBIcnsTestPremultiply(pixel[c], pixel[0]) : pixel[c],
+                         @"pixel %zu, premultiply: %d", idx, premultiply);
+      }
+    }
+  }
+}
+
+- (void)testSwizzle {
+  enum { pixels = 67 };
+  uint8_t rgba[pixels * 4], argb[pixels * 4], output[pixels * 4];
+  FillWithRandom(rgba, sizeof(rgba));
+  WBIcnsSwizzleRGBAToARGB(rgba, argb, pixels);
+  for (size_t idx = 0; idx < pixels; ++idx) {
+    const uint8_t *src = rgba + idx * 4, *dst = argb + idx * 4;
+    XCTAssertTrue(dst[0] == src[3] && dst[1] == src[0] && dst[2] == src[1] && dst[3] == src[2], @"pixel %zu", idx);
+  }
+  WBIcnsSwizzleARGBToRGBA(argb, output, pixels);
+  XCTAssertTrue(memcmp(output, rgba, sizeof(rgba)) == 0);
+
+  // in place
+  WBIcnsSwizzleRGBAToARGB(output, output, pixels);
+  XCTAssertTrue(memcmp(output, argb, sizeof(argb)) == 0);
+  WBIcnsSwizzleARGBToRGBA(output, output, pixels);
+  XCTAssertTrue(memcmp(output, rgba, sizeof(rgba)) == 0);
+}
+
+- (void)testRLE {
+  const size_t lengths[] = { 0, 1, 2, 3, 127, 128, 129, 130, 131, 300, 16 * 16, 128 * 128 };
+  for (size_t idx = 0; idx < sizeof(lengths) / sizeof(*lengths); ++idx) {
+    const size_t length = lengths[idx];
+    uint8_t *data = malloc(length + 1), *encoded = malloc(WBIcnsRLEMaxEncodedLength(length)), *decoded = malloc(length + 1);
+    for (int pattern = 0; pattern < 3; ++pattern) {
+      switch (pattern) {
+        case 0: FillWithRandom(data, length); break;
+        case 1: memset(data, 0x42, length); break;
+        case 2: FillWithRuns(data, length); break;
+      }
+      size_t size = WBIcnsRLEEncode(data, length, encoded);
+      XCTAssertLessThanOrEqual(size, WBIcnsRLEMaxEncodedLength(length));
+      // the packets follow the icns format.
+      memset(decoded, 0, length);
+      XCTAssertEqual(_WBIcnsTestRLEDecode(encoded, size, decoded, length), size, @"%zu bytes, pattern %d", length, pattern);
+      XCTAssertTrue(memcmp(decoded, data, length) == 0);
+
+      memset(decoded, 0, length);
+      XCTAssertEqual(WBIcnsRLEDecode(encoded, size, decoded, length), size, @"%zu bytes, pattern %d", length, pattern);
+      XCTAssertTrue(memcmp(decoded, data, length) == 0, @"%zu bytes, pattern %d", length, pattern);
+
+      // truncated input: every packet is needed.
+      for (size_t truncated = 0; length && truncated < size; truncated += 1 + truncated / 16)
+        XCTAssertEqual(WBIcnsRLEDecode(encoded, truncated, decoded, length), (size_t)0, @"%zu bytes, truncated at %zu", length, truncated);
+    }
+    free(decoded);
+    free(encoded);
+    free(data);
+  }
+
+  uint8_t dst[8];
+  // a run longer than the output, truncated runs and literals.
+  XCTAssertEqual(WBIcnsRLEDecode((const uint8_t *)"\x82\x01", 2, dst, 4), (size_t)0);
+  XCTAssertEqual(WBIcnsRLEDecode((const uint8_t *)"\x82\x01", 2, dst, 5), (size_t)2);
+  XCTAssertEqual(WBIcnsRLEDecode((const uint8_t *)"\x82", 1, dst, 5), (size_t)0);
+  XCTAssertEqual(WBIcnsRLEDecode((const uint8_t *)"\x04" "abcd", 5, dst, 5), (size_t)0);
+  XCTAssertEqual(WBIcnsRLEDecode((const uint8_t *)"\x04" "abcde", 6, dst, 3), (size_t)0);
+  // the following bytes are not read.
+  XCTAssertEqual(WBIcnsRLEDecode((const uint8_t *)"\x02" "abc\x82\x01", 6, dst, 3), (size_t)4);
+  XCTAssertTrue(memcmp(dst, "abc", 3) == 0);
+}
+
+- (void)testElements {
+  const uint32_t types[] = { 'is32', 'il32', 'ih32', 'it32', 's8mk', 'l8mk', 'h8mk', 't8mk', 'ic04', 'ic05' };
+  for (size_t idx = 0; idx < sizeof(types) / sizeof(*types); ++idx) {
+    WBIcnsElementInfo info = WBIcnsGetElementInfo(types[idx]);
+    size_t pixels = (size_t)info.size * info.size;
+    uint8_t *argb = malloc(pixels * 4), *decoded = malloc(pixels * 4), *expected = malloc(pixels * 4);
+    uint8_t *data = malloc(WBIcnsElementMaxEncodedLength(types[idx]));
+    FillWithRuns(argb, pixels * 4);
+
+    size_t length = WBIcnsEncodeElement(types[idx], argb, data);
+    XCTAssertTrue(length > 0 && length <= WBIcnsElementMaxEncodedLength(types[idx]));
+    // RGB elements clear alpha, masks only set it.
+    memcpy(expected, argb, pixels * 4);
+    memset(decoded, 0x33, pixels * 4);
+    for (size_t pixel = 0; pixel < pixels; ++pixel) {
+      if (kWBIcnsElementRGB == info.kind)
+        expected[pixel * 4] = 0;
+      else if (kWBIcnsElementMask == info.kind)
+        memset(expected + pixel * 4 + 1, 0x33, 3);
+    }
+    XCTAssertTrue(WBIcnsDecodeElement(types[idx], data, length, decoded));
+    XCTAssertTrue(memcmp(decoded, expected, pixels * 4) == 0, @"element %zu", idx);
+    XCTAssertFalse(WBIcnsDecodeElement(types[idx], data, length - 1, decoded), @"element %zu", idx);
+
+    if (kWBIcnsElementRGB == info.kind) {
+      // uncompressed
+      memset(decoded, 0x33, pixels * 4);
+      XCTAssertTrue(WBIcnsDecodeElement(types[idx], argb, pixels * 4, decoded));
+      XCTAssertTrue(memcmp(decoded, expected, pixels * 4) == 0, @"element %zu", idx);
+    }
+    if (info.padding) {
+      data[0] = 1;
+      XCTAssertFalse(WBIcnsDecodeElement(types[idx], data, length, decoded));
+    }
+    if (kWBIcnsElementARGB == info.kind) {
+      data[0] = 'R';
+      XCTAssertFalse(WBIcnsDecodeElement(types[idx], data, length, decoded));
+    }
+    free(data);
+    free(expected);
+    free(decoded);
+    free(argb);
+  }
+  XCTAssertEqual(WBIcnsElementMaxEncodedLength('ic08'), (size_t)0);
+  XCTAssertEqual(WBIcnsEncodeElement('ic08', NULL, NULL), (size_t)0);
+  XCTAssertFalse(WBIcnsDecodeElement('ic08', NULL, 0, NULL));
+}
+
+- (void)testContainer {
+  WBIcnsElement elements[] = {
+    { 's8mk', (const uint8_t *)"mask", 4 },
+    { 'ic08', (const uint8_t *)"", 0 },
+    { 'is32', (const uint8_t *)"rgb", 3 },
+  };
+  size_t length = WBIcnsContainerLength(elements, 3);
+  XCTAssertEqual(length, (size_t)(8 + 3 * 8 + 7));
+  uint8_t *bytes = malloc(length + 4);
+  XCTAssertEqual(WBIcnsWriteContainer(elements, 3, bytes), length);
+  XCTAssertTrue(memcmp(bytes, "icns\0\0\0\x27s8mk\0\0\0\x0cmask", 20) == 0);
+
+  WBIcnsElement read[3];
+  size_t count = 0;
+  XCTAssertTrue(WBIcnsReadContainer(bytes, length, read, 3, &count));
+  XCTAssertEqual(count, (size_t)3);
+  for (size_t idx = 0; idx < 3; ++idx) {
+    XCTAssertEqual(read[idx].type, elements[idx].type);
+    XCTAssertEqual(read[idx].length, elements[idx].length);
+    XCTAssertTrue(memcmp(read[idx].data, elements[idx].data, elements[idx].length) == 0);
+  }
+  // the count of all the elements, even when they do not fit.
+  XCTAssertTrue(WBIcnsReadContainer(bytes, length, read, 1, &count));
+  XCTAssertEqual(count, (size_t)3);
+  XCTAssertTrue(WBIcnsReadContainer(bytes, length, NULL, 0, &count));
+  XCTAssertEqual(count, (size_t)3);
+  // trailing bytes after the container are ignored.
+  XCTAssertTrue(WBIcnsReadContainer(bytes, length + 4, read, 3, &count));
+  XCTAssertEqual(count, (size_t)3);
+
+  // truncated containers and elements.
+  for (size_t truncated = 0; truncated < length; ++truncated) {
+    XCTAssertFalse(WBIcnsReadContainer(bytes, truncated, read, 3, &count), @"truncated at %zu", truncated);
+    XCTAssertEqual(count, (size_t)0);
+  }
+  bytes[7] = (uint8_t)(length - 1);
+  XCTAssertFalse(WBIcnsReadContainer(bytes, length, read, 3, &count));
+  bytes[7] = (uint8_t)length;
+  bytes[8 + 12 + 7] = 7;
+  XCTAssertFalse(WBIcnsReadContainer(bytes, length, read, 3, &count));
+  bytes[8 + 12 + 7] = 8;
+  XCTAssertTrue(WBIcnsReadContainer(bytes, length, read, 3, &count));
+  bytes[8 + 12 + 7] = 0x30;
+  XCTAssertFalse(WBIcnsReadContainer(bytes, length, read, 3, &count));
+  bytes[0] = 'I';
+  XCTAssertFalse(WBIcnsReadContainer(bytes, length, read, 3, &count));
+  free(bytes);
+}
+
+- (void)testDownsample {
+  const size_t sizes[][4] = {
+    { 37, 37, 37, 37 }, { 32, 32, 16, 16 }, { 34, 6, 17, 3 }, { 128, 128, 48, 48 }, { 128, 128, 32, 32 },
+    { 37, 21, 16, 7 }, { 100, 33, 33, 32 }, { 20, 20, 10, 5 }, { 5, 5, 1, 1 }, { 64, 64, 1, 1 },
+  };
+  for (size_t idx = 0; idx < sizeof(sizes) / sizeof(*sizes); ++idx) {
+    const size_t srcWidth = sizes[idx][0], srcHeight = sizes[idx][1], width = sizes[idx][2], height = sizes[idx][3];
+    uint8_t *src = malloc(srcWidth * srcHeight * 4), *dst = malloc(width * height * 4);
+    double *expected = malloc(width * height * 4 * sizeof(*expected));
+    FillWithRandom(src, srcWidth * srcHeight * 4);
+    WBIcnsPremultiplyARGB(src, srcWidth * srcHeight);
+    XCTAssertTrue(WBIcnsDownsampleARGB(src, srcWidth, srcHeight, dst, width, height));
+
+    _WBIcnsTestDownsample(src, srcWidth, srcHeight, expected, width, height);
+    for (size_t sample = 0; sample < width * height * 4; ++sample) {
+      if (width * 2 == srcWidth && height * 2 == srcHeight) {
+        // halving rounds the 2 x 2 average to nearest, ties up.
+        XCTAssertEqual((double)dst[sample], floor(expected[sample] + 0.5), @"%zu x %zu, sample %zu", width, height, sample);
+      } else {
+        XCTAssertLessThanOrEqual(fabs(dst[sample] - expected[sample]), 1.0, @"%zu x %zu, sample %zu", width, height, sample);
+      }
+    }
+
+    // the weights sum to one: uniform images keep their color.
+    for (size_t pixel = 0; pixel < srcWidth * srcHeight; ++pixel)
+      memcpy(src + pixel * 4, "\x80\x40\x00\x7f", 4);
+    XCTAssertTrue(WBIcnsDownsampleARGB(src, srcWidth, srcHeight, dst, width, height));
+    for (size_t pixel = 0; pixel < width * height; ++pixel)
+      XCTAssertTrue(memcmp(dst + pixel * 4, "\x80\x40\x00\x7f", 4) == 0, @"%zu x %zu, pixel %zu", width, height, pixel);
+
+    free(expected);
+    free(dst);
+    free(src);
+  }
+
+  uint8_t pixel[4];
+  XCTAssertFalse(WBIcnsDownsampleARGB(pixel, 1, 1, pixel, 2, 1));
+  XCTAssertFalse(WBIcnsDownsampleARGB(pixel, 1, 1, pixel, 1, 0));
+}
+
+- (void)testReaderCache {
+  const uint32_t types[] = { 'is32', 's8mk', 'il32', 'l8mk', 'ic04', 'ic05' };
+  enum { count = sizeof(types) / sizeof(*types) };
+  // the elements use the first size * size pixels.
+  uint8_t argb[32 * 32 * 4];
+  FillWithRuns(argb, sizeof(argb));
+  WBIcnsElement elements[count];
+  uint8_t *buffers[count];
+  for (size_t idx = 0; idx < count; ++idx) {
+    buffers[idx] = malloc(WBIcnsElementMaxEncodedLength(types[idx]));
+    elements[idx] = (WBIcnsElement){ types[idx], buffers[idx], WBIcnsEncodeElement(types[idx], argb, buffers[idx]) };
+  }
+  NSMutableData *data = [NSMutableData dataWithLength:WBIcnsContainerLength(elements, count)];
+  XCTAssertEqual(WBIcnsWriteContainer(elements, count, [data mutableBytes]), (size_t)[data length]);
+
+  NSError *error = nil;
+  XCTAssertNil([[WBIconFamilyReader alloc] initWithData:[data subdataWithRange:NSMakeRange(0, [data length] - 1)] error:&error]);
+  XCTAssertEqual([error code], (NSInteger)NSFileReadCorruptFileError);
+  WBIconFamilyReader *reader = [[WBIconFamilyReader alloc] initWithData:data error:&error];
+  XCTAssertNotNil(reader, @"%@", error);
+  XCTAssertEqual([[reader elementTypes] count], (NSUInteger)count);
+  XCTAssertEqualObjects([reader elementTypes][2], @('il32'));
+  XCTAssertEqualObjects([reader dataForIconFamilyElement:'ic05'], [NSData dataWithBytes:elements[5].data length:elements[5].length]);
+  XCTAssertFalse([reader containsElement:'ic08']);
+  XCTAssertNil([reader bitmapForIconFamilyElement:'ic08']);
+
+  // 16 x 16 bitmaps with alpha cost 1024 bytes, 32 x 32 ones 4096 bytes.
+  [reader setCacheLimit:6144];
+  NSBitmapImageRep *ic04 = [reader bitmapForIconFamilyElement:'ic04'];
+  NSBitmapImageRep *il32 = [reader bitmapForIconFamilyElement:'il32'];
+  NSBitmapImageRep *is32 = [reader bitmapForIconFamilyElement:'is32'];
+  XCTAssertEqual([reader cacheSize], (NSUInteger)6144);
+  XCTAssertTrue([reader bitmapForIconFamilyElement:'ic04'] == ic04);
+
+  // the least recently used bitmaps are evicted.
+  XCTAssertNotNil([reader bitmapForIconFamilyElement:'ic05']);
+  XCTAssertEqual([reader cacheSize], (NSUInteger)6144);
+  XCTAssertTrue([reader bitmapForIconFamilyElement:'is32'] == is32);
+  XCTAssertTrue([reader bitmapForIconFamilyElement:'il32'] != il32);
+  XCTAssertEqual([reader cacheSize], (NSUInteger)5120);
+  XCTAssertTrue([reader bitmapForIconFamilyElement:'ic04'] != ic04);
+  XCTAssertTrue([reader bitmapForIconFamilyElement:'is32'] == is32);
+  XCTAssertEqual([reader cacheSize], (NSUInteger)6144);
+
+  // lowering the limit evicts, and bitmaps larger than the limit are not cached.
+  [reader setCacheLimit:1000];
+  XCTAssertEqual([reader cacheSize], (NSUInteger)0);
+  XCTAssertNotNil([reader bitmapForIconFamilyElement:'is32']);
+  XCTAssertEqual([reader cacheSize], (NSUInteger)0);
+  XCTAssertNotNil([reader bitmapForIconFamilyElement:'s8mk']);
+  XCTAssertEqual([reader cacheSize], (NSUInteger)256);
+  XCTAssertNotNil([reader bitmapForIconFamilyElement:'is32' withMask:NO]);
+  XCTAssertEqual([reader cacheSize], (NSUInteger)768);
+  [reader removeAllCachedBitmaps];
+  XCTAssertEqual([reader cacheSize], (NSUInteger)0);
+  [reader setCacheLimit:0];
+  XCTAssertNotNil([reader bitmapForIconFamilyElement:'ic04']);
+  XCTAssertEqual([reader cacheSize], (NSUInteger)0);
+
+  // 'is32' uses the mask of the same size, and is premultiplied.
+  unsigned char *planes[5];
+  NSBitmapImageRep *bitmap = [reader bitmapForIconFamilyElement:'is32'];
+  XCTAssertEqual([bitmap samplesPerPixel], (NSInteger)4);
+  [bitmap getBitmapDataPlanes:planes];
+  for (size_t pixel = 0; pixel < 16 * 16; ++pixel) {
+    const uint8_t *expected = argb + pixel * 4;
+    XCTAssertEqual(planes[3][pixel], expected[0]);
+    for (int c = 1; c < 4; ++c)
+      XCTAssertEqual(planes[c - 1][pixel], _WBIcnsTestPremultiply(expected[c], expected[0]), @"pixel %zu", pixel);
+  }
+  bitmap = [reader bitmapForIconFamilyElement:'is32' withMask:NO];
+  XCTAssertEqual([bitmap samplesPerPixel], (NSInteger)3);
+  [bitmap getBitmapDataPlanes:planes];
+  for (size_t pixel = 0; pixel < 16 * 16; ++pixel) {
+    for (int c = 1; c < 4; ++c)
+      XCTAssertEqual(planes[c - 1][pixel], argb[pixel * 4 + c], @"pixel %zu", pixel);
+  }
+
+  [reader release];
+  for (size_t idx = 0; idx < count; ++idx)
+    free(buffers[idx]);
+}
+
+@end
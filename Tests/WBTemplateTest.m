@@ -0,0 +1,480 @@
+//
+//  WBTemplateTest.m
+//  WonderBox
+//
+//  Created by Jean-Daniel Dupas.
+//
+//
+
+#import <XCTest/XCTest.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#import "WBTemplate.h"
+#import "WBCompiledTemplate.h"
+#import "WBTemplateParser.h"
+
+// nested blocks, a block with an empty body, a block never dumped, and an '@' without terminator.
+static NSString * const kWBTemplateTestContent =
+  @"<html>@title!\n"
+  @"@Start:row!<tr>@name!: @value!\n"
+  @"@Start:cell!<td>@text!</td>@End!</tr>\n"
+  @"@End!@Start:empty!never@End!@Start:blank!@End!footer @title! @missing";
+
+/* Records the parser callbacks */
+@interface WBTemplateTestRecorder : NSObject
+@property(nonatomic, readonly) NSMutableArray *events;
+@end
+
+@implementation WBTemplateTestRecorder
+
+- (instancetype)init {
+  if (self = [super init])
+    _events = [[NSMutableArray alloc] init];
+  return self;
+}
+
+- (void)dealloc {
+  [_events release];
+  [super dealloc];
+}
+
+- (void)templateParser:(WBTemplateParser *)parser foundCharacters:(NSString *)aString {
+  [_events addObject:[@"chars:" stringByAppendingString:aString]];
+}
+- (void)templateParser:(WBTemplateParser *)parser foundVariable:(NSString *)variable {
+  [_events addObject:[@"var:" stringByAppendingString:variable]];
+}
+- (void)templateParser:(WBTemplateParser *)parser didStartBlock:(NSString *)blockName {
+  [_events addObject:[@"start:" stringByAppendingString:blockName]];
+}
+- (void)templateParserDidEndBlock:(WBTemplateParser *)parser {
+  [_events addObject:@"end"];
+}
+- (void)templateParser:(WBTemplateParser *)parser warningOccured:(NSString *)warning {
+  [_events addObject:[@"warning:" stringByAppendingString:warning]];
+}
+
+@end
+
+/* Same events, from the UTF-8 byte ranges */
+@interface WBTemplateTestRangeRecorder : WBTemplateTestRecorder
+@end
+
+@implementation WBTemplateTestRangeRecorder
+
+static NSString *_WBTemplateTestString(WBTemplateParser *parser, NSRange range) {
+  return [[[NSString alloc] initWithBytes:[parser bytes] + range.location length:range.length encoding:NSUTF8StringEncoding] autorelease];
+}
+
+- (void)templateParser:(WBTemplateParser *)parser foundCharactersInRange:(NSRange)range {
+  [self templateParser:parser foundCharacters:_WBTemplateTestString(parser, range)];
+}
+- (void)templateParser:(WBTemplateParser *)parser foundVariableInRange:(NSRange)range {
+  [self templateParser:parser foundVariable:_WBTemplateTestString(parser, range)];
+}
+- (void)templateParser:(WBTemplateParser *)parser didStartBlockInRange:(NSRange)range {
+  [self templateParser:parser didStartBlock:_WBTemplateTestString(parser, range)];
+}
+
+@end
+
+typedef struct _WBTemplateTestOutput {
+  __unsafe_unretained NSMutableData *data;
+  NSUInteger calls;
+  /* fails after that many calls */
+  NSUInteger limit;
+} WBTemplateTestOutput;
+
+static BOOL _WBTemplateTestWrite(const struct iovec *buffers, int count, void *context) {
+  WBTemplateTestOutput *output = context;
+  if (output->calls++ >= output->limit) {
+    errno = ENOSPC;
+    return NO;
+  }
+  for (int idx = 0; idx < count; ++idx)
+    [output->data appendBytes:buffers[idx].iov_base length:buffers[idx].iov_len];
+  return YES;
+}
+
+typedef struct _WBTemplateTestRows {
+  const WBTemplateValue *names;
+  const WBTemplateValue *values;
+  NSUInteger name, value;
+  /* stops at this row */
+  NSUInteger stop;
+} WBTemplateTestRows;
+
+static BOOL _WBTemplateTestRow(NSUInteger row, WBTemplateValue *values, void *context) {
+  const WBTemplateTestRows *rows = context;
+  if (row == rows->stop)
+    return NO;
+  values[rows->name] = rows->names[row];
+  values[rows->value] = rows->values[row];
+  return YES;
+}
+
+@interface WBTemplateTest : XCTestCase
+
+@end
+
+@implementation WBTemplateTest {
+  NSMutableArray *_paths;
+}
+
+- (void)setUp {
+  [super setUp];
+  _paths = [[NSMutableArray alloc] init];
+}
+
+- (void)tearDown {
+  for (NSString *path in _paths)
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  [_paths release];
+  [super tearDown];
+}
+
+- (NSString *)writeTemplate:(NSString *)content encoding:(NSStringEncoding)encoding {
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+  XCTAssertTrue([content writeToFile:path atomically:NO encoding:encoding error:NULL]);
+  [_paths addObject:path];
+  return path;
+}
+
+- (NSArray *)parse:(NSString *)path encoding:(NSStringEncoding)encoding delegate:(WBTemplateTestRecorder *)recorder {
+  WBTemplateParser *parser = [[WBTemplateParser alloc] initWithFile:path encoding:encoding];
+  [parser setDelegate:recorder];
+  XCTAssertTrue([parser parse]);
+  [parser setDelegate:nil];
+  [parser release];
+  return [recorder events];
+}
+
+- (void)fillTemplate:(WBTemplate *)tpl {
+  WBTemplate *row = [tpl blockWithName:@"row"];
+  WBTemplate *cell = [row blockWithName:@"cell"];
+  for (NSUInteger idx = 0; idx < 3; ++idx) {
+    for (NSUInteger c = 0; c < idx; ++c) {
+      [cell setVariable:[NSString stringWithFormat:@"%lu", (unsigned long)c] forKey:@"text"];
+      [cell dumpBlock];
+    }
+    [row setVariable:[NSString stringWithFormat:@"row %lu", (unsigned long)idx] forKey:@"name"];
+    // the value of the last row is not set
+    if (idx < 2)
+      [row setVariable:@"déjà vu" forKey:@"value"];
+    [row dumpBlock];
+  }
+  [[tpl blockWithName:@"blank"] dumpBlock];
+  [[tpl blockWithName:@"blank"] dumpBlock];
+  [tpl setVariable:@"Title" forKey:@"title"];
+}
+
+- (void)fillRenderer:(WBTemplateRenderer *)renderer {
+  WBCompiledTemplate *tpl = [renderer compiledTemplate];
+  NSUInteger row = [tpl indexOfBlock:@"row"], cell = [tpl indexOfBlock:@"cell"];
+  XCTAssertNotEqual(row, (NSUInteger)NSNotFound);
+  XCTAssertNotEqual(cell, (NSUInteger)NSNotFound);
+  for (NSUInteger idx = 0; idx < 3; ++idx) {
+    for (NSUInteger c = 0; c < idx; ++c) {
+      [renderer setString:[NSString stringWithFormat:@"%lu", (unsigned long)c] forSlot:[tpl slotOfVariable:@"text" inBlock:cell]];
+      [renderer dumpBlock:cell];
+    }
+    [renderer setString:[NSString stringWithFormat:@"row %lu", (unsigned long)idx] forSlot:[tpl slotOfVariable:@"name" inBlock:row]];
+    if (idx < 2)
+      [renderer setString:@"déjà vu" forSlot:[tpl slotOfVariable:@"value" inBlock:row]];
+    [renderer dumpBlock:row];
+  }
+  [renderer dumpBlock:[tpl indexOfBlock:@"blank"]];
+  [renderer dumpBlock:[tpl indexOfBlock:@"blank"]];
+  [renderer setString:@"Title" forSlot:[tpl slotOfVariable:@"title" inBlock:kWBTemplateRootBlock]];
+}
+
+- (void)testCompiledRendering {
+  NSString *path = [self writeTemplate:kWBTemplateTestContent encoding:NSUTF8StringEncoding];
+  WBTemplate *tpl = [[WBTemplate alloc] initWithContentsOfFile:path encoding:NSUTF8StringEncoding];
+  XCTAssertTrue([tpl load]);
+  WBCompiledTemplate *compiled = [[WBCompiledTemplate alloc] initWithTemplate:tpl];
+  XCTAssertNotNil(compiled);
+  XCTAssertEqual([compiled numberOfBlocks], (NSUInteger)5);
+  XCTAssertEqual([compiled slotOfVariable:@"text" inBlock:[compiled indexOfBlock:@"row"]], (NSUInteger)NSNotFound);
+
+  [self fillTemplate:tpl];
+  NSString *expected = [tpl stringRepresentation];
+  XCTAssertTrue([expected hasPrefix:@"<html>Title\n<tr>row 0: déjà vu\n</tr>\n<tr>row 1: déjà vu\n<td>0</td></tr>\n"]);
+  XCTAssertTrue([expected hasSuffix:@"</tr>\nfooter Title @missing"]);
+
+  WBTemplateRenderer *renderer = [[WBTemplateRenderer alloc] initWithTemplate:compiled];
+  [self fillRenderer:renderer];
+  XCTAssertEqualObjects([renderer stringRepresentation], expected);
+
+  // the renderer is ready for a new output, and nothing is left from the previous one.
+  [self fillRenderer:renderer];
+  XCTAssertEqualObjects([renderer stringRepresentation], expected);
+  [renderer dumpBlock:[compiled indexOfBlock:@"row"]];
+  [renderer reset];
+  XCTAssertEqualObjects([renderer stringRepresentation], @"<html>\nfooter  @missing");
+
+  // empty template
+  path = [self writeTemplate:@"" encoding:NSUTF8StringEncoding];
+  tpl = [[WBTemplate alloc] initWithContentsOfFile:path encoding:NSUTF8StringEncoding];
+  compiled = [[WBCompiledTemplate alloc] initWithTemplate:tpl];
+  XCTAssertEqual([compiled numberOfBlocks], (NSUInteger)1);
+  XCTAssertEqualObjects([[[WBTemplateRenderer alloc] initWithTemplate:compiled] stringRepresentation], [tpl stringRepresentation]);
+}
+
+- (void)testParserEncodings {
+  // '@' ended by non ASCII whitespace (NBSP, ideographic space, line separator) are not variables,
+  // and the last '@' has no terminator.
+  NSString *content = @"a @x! b@y\u00a0c@Start:blk!@z\u3000!@w\u2028@End! @q! \u00e9@tail";
+  NSArray *expected = @[@"chars:a ", @"var:x", @"chars: b@y\u00a0c", @"start:blk", @"chars:@z\u3000!@w\u2028", @"end",
+                        @"chars: ", @"var:q", @"chars: \u00e9@tail"];
+
+  NSString *utf8 = [self writeTemplate:content encoding:NSUTF8StringEncoding];
+  // NSString writes UTF-16 with a byte order mark.
+  NSString *utf16 = [self writeTemplate:content encoding:NSUTF16StringEncoding];
+  NSMutableData *data = [NSMutableData dataWithBytes:"\xEF\xBB\xBF" length:3];
+  [data appendData:[content dataUsingEncoding:NSUTF8StringEncoding]];
+  NSString *bom = [self writeTemplate:@"" encoding:NSUTF8StringEncoding];
+  XCTAssertTrue([data writeToFile:bom atomically:NO]);
+
+  XCTAssertEqualObjects([self parse:utf16 encoding:NSUTF16StringEncoding delegate:[[WBTemplateTestRecorder new] autorelease]], expected);
+  XCTAssertEqualObjects([self parse:utf8 encoding:NSUTF8StringEncoding delegate:[[WBTemplateTestRecorder new] autorelease]], expected);
+  XCTAssertEqualObjects([self parse:utf8 encoding:NSUTF8StringEncoding delegate:[[WBTemplateTestRangeRecorder new] autorelease]], expected);
+  XCTAssertEqualObjects([self parse:bom encoding:NSUTF8StringEncoding delegate:[[WBTemplateTestRecorder new] autorelease]], expected);
+  XCTAssertEqualObjects([self parse:bom encoding:NSUTF8StringEncoding delegate:[[WBTemplateTestRangeRecorder new] autorelease]], expected);
+
+  // unbalanced blocks
+  NSArray *warnings = [self parse:[self writeTemplate:@"@End!@Start:a!" encoding:NSUTF8StringEncoding]
+                         encoding:NSUTF8StringEncoding delegate:[[WBTemplateTestRangeRecorder new] autorelease]];
+  XCTAssertEqualObjects(warnings, (@[@"chars:", @"warning:@End tag encounter but all blocks already closed.", @"chars:",
+                                     @"start:a", @"chars:", @"warning:1 blocks unclosed.", @"end"]));
+
+  // invalid UTF-8
+  NSString *invalid = [self writeTemplate:@"" encoding:NSUTF8StringEncoding];
+  XCTAssertTrue([[NSData dataWithBytes:"a @\xC3!" length:5] writeToFile:invalid atomically:NO]);
+  WBTemplateParser *parser = [[WBTemplateParser alloc] initWithFile:invalid encoding:NSUTF8StringEncoding];
+  XCTAssertFalse([parser parse]);
+
+  // UTF-8 templates are compiled from the byte ranges, others through WBTemplate: both give the same output.
+  WBCompiledTemplate *compiled[] = {
+    [[WBCompiledTemplate alloc] initWithContentsOfFile:bom encoding:NSUTF8StringEncoding],
+    [[WBCompiledTemplate alloc] initWithContentsOfFile:utf16 encoding:NSUTF16StringEncoding],
+  };
+  NSString *outputs[2];
+  for (NSUInteger idx = 0; idx < 2; ++idx) {
+    XCTAssertEqual([compiled[idx] numberOfBlocks], (NSUInteger)2);
+    XCTAssertEqual([compiled[idx] numberOfSlots], (NSUInteger)2);
+    WBTemplateRenderer *renderer = [[WBTemplateRenderer alloc] initWithTemplate:compiled[idx]];
+    [renderer setString:@"X" forSlot:[compiled[idx] slotOfVariable:@"x" inBlock:kWBTemplateRootBlock]];
+    [renderer setString:@"Q" forSlot:[compiled[idx] slotOfVariable:@"q" inBlock:kWBTemplateRootBlock]];
+    [renderer dumpBlock:[compiled[idx] indexOfBlock:@"blk"]];
+    [renderer dumpBlock:[compiled[idx] indexOfBlock:@"blk"]];
+    outputs[idx] = [renderer stringRepresentation];
+  }
+  XCTAssertEqualObjects(outputs[0], @"a X b@y\u00a0c@z\u3000!@w\u2028@z\u3000!@w\u2028 Q \u00e9@tail");
+  XCTAssertEqualObjects(outputs[0], outputs[1]);
+}
+
+- (NSString *)temporaryDirectory {
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+  XCTAssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:NO attributes:nil error:NULL]);
+  [_paths addObject:path];
+  return path;
+}
+
+- (void)testRendererOutputs {
+  // enough root slices for several writes: small ones are grouped by the sink, large values are written in place.
+  NSMutableString *content = [NSMutableString stringWithString:@"begin "];
+  NSMutableString *empty = [NSMutableString stringWithString:@"begin "];
+  for (NSUInteger idx = 0; idx < 600; ++idx) {
+    [content appendFormat:@"@v%lu!,", (unsigned long)idx];
+    [empty appendString:@","];
+  }
+  [content appendString:@"@Start:row!<@small!|@large!>\n@End!end @title!"];
+  [empty appendString:@"end "];
+  NSData *nothing = [empty dataUsingEncoding:NSUTF8StringEncoding];
+
+  NSString *path = [self writeTemplate:content encoding:NSUTF8StringEncoding];
+  WBCompiledTemplate *compiled = [[WBCompiledTemplate alloc] initWithContentsOfFile:path encoding:NSUTF8StringEncoding];
+  WBTemplateRenderer *renderer = [[WBTemplateRenderer alloc] initWithTemplate:compiled];
+  NSUInteger row = [compiled indexOfBlock:@"row"];
+  NSUInteger small = [compiled slotOfVariable:@"small" inBlock:row], large = [compiled slotOfVariable:@"large" inBlock:row];
+  NSString *value = [@"" stringByPaddingToLength:300 withString:@"0123456789" startingAtIndex:0];
+  void (^fill)(void) = ^{
+    for (NSUInteger idx = 0; idx < 600; ++idx) {
+      NSUInteger slot = [compiled slotOfVariable:[NSString stringWithFormat:@"v%lu", (unsigned long)idx] inBlock:kWBTemplateRootBlock];
+      [renderer setString:idx % 2 ? value : @"v" forSlot:slot];
+    }
+    for (NSUInteger idx = 0; idx < 2000; ++idx) {
+      [renderer setString:[NSString stringWithFormat:@"%lu", (unsigned long)idx] forSlot:small];
+      if (idx % 3)
+        [renderer setString:value forSlot:large];
+      [renderer dumpBlock:row];
+    }
+    [renderer setString:@"\u00e9t\u00e9" forSlot:[compiled slotOfVariable:@"title" inBlock:kWBTemplateRootBlock]];
+  };
+  fill();
+  NSData *expected = [renderer renderedData];
+  XCTAssertGreaterThan([expected length], (NSUInteger)(2000 * 200));
+
+  // callback
+  WBTemplateTestOutput output = { [NSMutableData data], 0, NSUIntegerMax };
+  fill();
+  XCTAssertTrue([renderer renderUsingFunction:_WBTemplateTestWrite context:&output]);
+  XCTAssertEqualObjects(output.data, expected);
+  XCTAssertGreaterThan(output.calls, (NSUInteger)1);
+
+  // failing callback: the error is reported, and the renderer is ready for a new output.
+  output = (WBTemplateTestOutput){ [NSMutableData data], 0, 1 };
+  fill();
+  BOOL ok = [renderer renderUsingFunction:_WBTemplateTestWrite context:&output];
+  int code = errno;
+  XCTAssertFalse(ok);
+  XCTAssertEqual(code, ENOSPC);
+  XCTAssertEqual(output.calls, (NSUInteger)2);
+  XCTAssertLessThan([output.data length], [expected length]);
+  XCTAssertEqualObjects([renderer renderedData], nothing);
+
+  NSString *dir = [self temporaryDirectory];
+  // file descriptor
+  NSString *file = [dir stringByAppendingPathComponent:@"fd"];
+  int fd = open([file fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  XCTAssertGreaterThanOrEqual(fd, 0);
+  fill();
+  NSError *error = nil;
+  XCTAssertTrue([renderer renderToFileDescriptor:fd error:&error], @"%@", error);
+  close(fd);
+  XCTAssertEqualObjects([NSData dataWithContentsOfFile:file], expected);
+
+  // FILE
+  file = [dir stringByAppendingPathComponent:@"file"];
+  FILE *f = fopen([file fileSystemRepresentation], "w");
+  XCTAssertTrue(f != NULL);
+  fill();
+  XCTAssertTrue([renderer renderToFILE:f error:&error], @"%@", error);
+  fclose(f);
+  XCTAssertEqualObjects([NSData dataWithContentsOfFile:file], expected);
+
+  // files, replacing an existing file keeps its mode.
+  file = [dir stringByAppendingPathComponent:@"path"];
+  for (NSUInteger atomically = 0; atomically < 2; ++atomically) {
+    XCTAssertTrue([[NSData data] writeToFile:file atomically:NO]);
+    chmod([file fileSystemRepresentation], 0640);
+    fill();
+    XCTAssertTrue([renderer renderToFile:file atomically:atomically != 0 error:&error], @"%@", error);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:file], expected);
+    struct stat st;
+    XCTAssertEqual(stat([file fileSystemRepresentation], &st), 0);
+    XCTAssertEqual(st.st_mode & 07777, (mode_t)0640);
+  }
+
+  // atomic failure: the destination is a directory, so the temporary file cannot be renamed and must be removed.
+  NSString *target = [dir stringByAppendingPathComponent:@"directory"];
+  XCTAssertTrue([[NSFileManager defaultManager] createDirectoryAtPath:target withIntermediateDirectories:NO attributes:nil error:NULL]);
+  XCTAssertTrue([[NSData data] writeToFile:[target stringByAppendingPathComponent:@"child"] atomically:NO]);
+  NSArray *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:dir error:NULL];
+  fill();
+  error = nil;
+  XCTAssertFalse([renderer renderToFile:target atomically:YES error:&error]);
+  XCTAssertEqualObjects([error domain], NSPOSIXErrorDomain);
+  XCTAssertEqualObjects([[[NSFileManager defaultManager] contentsOfDirectoryAtPath:dir error:NULL] sortedArrayUsingSelector:@selector(compare:)],
+                        [contents sortedArrayUsingSelector:@selector(compare:)]);
+  XCTAssertFalse([renderer renderToFile:[dir stringByAppendingPathComponent:@"missing/file"] atomically:NO error:&error]);
+  XCTAssertEqual([error code], (NSInteger)ENOENT);
+  XCTAssertEqualObjects([renderer renderedData], nothing);
+}
+
+- (void)testTemplateWriteFailure {
+  NSString *path = [self writeTemplate:@"value: @value!" encoding:NSASCIIStringEncoding];
+  NSString *dir = [self temporaryDirectory];
+  NSString *file = [dir stringByAppendingPathComponent:@"output"];
+  NSData *original = [@"original" dataUsingEncoding:NSASCIIStringEncoding];
+  for (NSUInteger atomically = 0; atomically < 2; ++atomically) {
+    XCTAssertTrue([original writeToFile:file atomically:NO]);
+    WBTemplate *tpl = [[WBTemplate alloc] initWithContentsOfFile:path encoding:NSASCIIStringEncoding];
+    // cannot be converted to ASCII: the file is left untouched.
+    [tpl setVariable:@"\u00e9" forKey:@"value"];
+    XCTAssertFalse([tpl writeToFile:file atomically:atomically != 0 andReset:YES]);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:file], original);
+    XCTAssertEqualObjects([[NSFileManager defaultManager] contentsOfDirectoryAtPath:dir error:NULL], @[@"output"]);
+
+    [tpl setVariable:@"e" forKey:@"value"];
+    XCTAssertTrue([tpl writeToFile:file atomically:atomically != 0 andReset:YES]);
+    XCTAssertEqualObjects([NSString stringWithContentsOfFile:file encoding:NSASCIIStringEncoding error:NULL], @"value: e");
+  }
+}
+
+- (void)testBulkRows {
+  NSString *path = [self writeTemplate:kWBTemplateTestContent encoding:NSUTF8StringEncoding];
+  WBCompiledTemplate *compiled = [[WBCompiledTemplate alloc] initWithContentsOfFile:path encoding:NSUTF8StringEncoding];
+  NSUInteger row = [compiled indexOfBlock:@"row"], cell = [compiled indexOfBlock:@"cell"];
+  NSRange slots = [compiled slotRangeOfBlock:row];
+  NSUInteger name = [compiled slotOfVariable:@"name" inBlock:row], value = [compiled slotOfVariable:@"value" inBlock:row];
+  XCTAssertEqual(slots.length, (NSUInteger)2);
+  XCTAssertTrue(NSLocationInRange(name, slots) && NSLocationInRange(value, slots));
+
+  enum { count = 1000 };
+  NSMutableArray *strings = [NSMutableArray array];
+  WBTemplateValue *names = calloc(count, sizeof(*names)), *values = calloc(count, sizeof(*values));
+  for (NSUInteger idx = 0; idx < count; ++idx) {
+    NSData *data = [[NSString stringWithFormat:@"row %lu", (unsigned long)idx] dataUsingEncoding:NSUTF8StringEncoding];
+    [strings addObject:data];
+    names[idx] = (WBTemplateValue){ [data bytes], [data length] };
+    // some rows have no value
+    data = idx % 5 ? [[NSString stringWithFormat:@"d\u00e9j\u00e0 vu %lu", (unsigned long)idx] dataUsingEncoding:NSUTF8StringEncoding] : [NSData data];
+    [strings addObject:data];
+    values[idx] = (WBTemplateValue){ [data bytes], [data length] };
+  }
+
+  WBTemplateRenderer *reference = [[WBTemplateRenderer alloc] initWithTemplate:compiled];
+  WBTemplateRenderer *renderer = [[WBTemplateRenderer alloc] initWithTemplate:compiled];
+  void (^dump)(NSUInteger, NSUInteger, BOOL) = ^(NSUInteger first, NSUInteger end, BOOL withValues) {
+    for (NSUInteger idx = first; idx < end; ++idx) {
+      [reference setUTF8String:names[idx].bytes length:names[idx].length forSlot:name];
+      if (withValues)
+        [reference setUTF8String:values[idx].bytes length:values[idx].length forSlot:value];
+      [reference dumpBlock:row];
+    }
+  };
+  // the pending sub-block instance goes to the first row.
+  for (WBTemplateRenderer *r in @[reference, renderer]) {
+    [r setString:@"c" forSlot:[compiled slotOfVariable:@"text" inBlock:cell]];
+    [r dumpBlock:cell];
+  }
+
+  // columns: the values set before are ignored, and cleared.
+  dump(0, count, YES);
+  [renderer setString:@"stale" forSlot:value];
+  const WBTemplateValue *columns[2];
+  columns[name - slots.location] = names;
+  columns[value - slots.location] = values;
+  [renderer dumpBlock:row rows:count columns:columns];
+
+  // function: stops when it returns NO.
+  dump(0, 600, YES);
+  WBTemplateTestRows rows = { names, values, name - slots.location, value - slots.location, 600 };
+  XCTAssertEqual([renderer dumpBlock:row rows:count function:_WBTemplateTestRow context:&rows], (NSUInteger)600);
+  rows.stop = NSNotFound;
+  XCTAssertEqual([renderer dumpBlock:row rows:0 function:_WBTemplateTestRow context:&rows], (NSUInteger)0);
+
+  // a NULL column is an empty variable.
+  dump(0, 3, NO);
+  columns[value - slots.location] = NULL;
+  [renderer dumpBlock:row rows:3 columns:columns];
+
+  for (WBTemplateRenderer *r in @[reference, renderer]) {
+    [r dumpBlock:row];
+    [r setString:@"Title" forSlot:[compiled slotOfVariable:@"title" inBlock:kWBTemplateRootBlock]];
+  }
+  NSString *expected = [reference stringRepresentation];
+  XCTAssertEqualObjects([renderer stringRepresentation], expected);
+  XCTAssertTrue([expected hasPrefix:@"<html>Title\n<tr>row 0: \n<td>c</td></tr>\n<tr>row 1: d\u00e9j\u00e0 vu 1\n</tr>\n"]);
+  XCTAssertFalse([expected containsString:@"stale"]);
+  XCTAssertEqual([[expected componentsSeparatedByString:@"<td>"] count], (NSUInteger)2);
+
+  free(values);
+  free(names);
+}
+
+@end
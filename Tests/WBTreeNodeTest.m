@@ -0,0 +1,607 @@
+//
+//  WBTreeNodeTest.m
+//  WonderBox
+//
+//  Created by Jean-Daniel Dupas.
+//
+//
+
+#import <XCTest/XCTest.h>
+
+#import <WonderBox/WBTreeNode.h>
+#import <WonderBox/WBTreeArchive.h>
+#import <WonderBox/WBTreeDiff.h>
+
+#include <stdatomic.h>
+
+@interface WBTreeNodeTest : XCTestCase
+
+@end
+
+@interface WBTreeNodeTestItem : WBTreeNode <WBTreeArchiving>
+@property(nonatomic, copy) NSString *name;
+@property(nonatomic) int64_t value;
+@property(nonatomic) double ratio;
+@end
+
+@implementation WBTreeNodeTestItem
+
+- (void)encodeWithTreeArchiver:(WBTreeArchiver *)archiver {
+  [archiver encodeString:_name];
+  [archiver encodeInteger:_value];
+  [archiver encodeDouble:_ratio];
+}
+
+- (instancetype)initWithTreeUnarchiver:(WBTreeUnarchiver *)unarchiver {
+  if (self = [super init]) {
+    _name = [[unarchiver decodeString] copy];
+    _value = [unarchiver decodeInteger];
+    _ratio = [unarchiver decodeDouble];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [_name release];
+  [super dealloc];
+}
+
+@end
+
+static NSInteger _WBTreeNodeCompareAddresses(id a, id b, void *context) {
+  if ((__bridge void *)a == (__bridge void *)b) return NSOrderedSame;
+  return (__bridge void *)a < (__bridge void *)b ? NSOrderedAscending : NSOrderedDescending;
+}
+
+typedef struct _WBTreeNodeTestStream {
+  const NSUInteger *depths;
+  NSUInteger count;
+  NSUInteger position;
+} WBTreeNodeTestStream;
+
+static BOOL _WBTreeNodeTestNext(NSUInteger *depth, void **payload, void *context) {
+  WBTreeNodeTestStream *stream = context;
+  if (stream->position >= stream->count)
+    return NO;
+  *depth = stream->depths[stream->position];
+  *payload = (void *)(stream->position + 1);
+  stream->position++;
+  return YES;
+}
+
+static void _WBTreeNodeTestInitialize(WBTreeNode *node, void *payload, void *context) {
+  [(__bridge NSMutableArray *)context addObject:node];
+}
+
+static WBTreeVisitResult _WBTreeNodeTestFilter(WBTreeNode *node, void *context) {
+  NSArray *nodes = (__bridge NSArray *)context;
+  if (node == nodes[1]) return kWBTreeVisitSkipChildren;
+  if (node == nodes[9]) return kWBTreeVisitStop;
+  return kWBTreeVisitContinue;
+}
+
+static void _WBTreeNodeTestVisit(id node, void *context) {
+  atomic_uintptr_t *checksum = context;
+  atomic_fetch_add(&checksum[0], 1);
+  atomic_fetch_xor(&checksum[1], (uintptr_t)(__bridge void *)node);
+}
+
+static id _WBTreeNodeTestKey(WBTreeNodeTestItem *node, void *context) {
+  return node.name;
+}
+
+static BOOL _WBTreeNodeTestCompare(WBTreeNodeTestItem *oldNode, WBTreeNodeTestItem *newNode, void *context) {
+  return oldNode.value != newNode.value;
+}
+
+static void _WBTreeNodeTestUpdate(WBTreeNodeTestItem *oldNode, WBTreeNodeTestItem *newNode, void *context) {
+  oldNode.value = newNode.value;
+}
+
+/* Applies the root level changes to an array of names */
+static void _WBTreeNodeTestApply(const WBTreeDiffChange *change, void *context) {
+  NSMutableDictionary *state = (__bridge NSMutableDictionary *)context;
+  if (change->parent != state[@"root"])
+    return;
+  NSMutableArray *names = state[@"names"];
+  NSMutableArray *pending = state[@"pending"];
+  switch (change->operation) {
+    case kWBTreeDiffRemove:
+      [names removeObjectAtIndex:change->fromIndex];
+      break;
+    case kWBTreeDiffMove:
+      // moved nodes are removed with the removed nodes, and inserted with the inserted ones
+      [state[@"moved"] addObject:[(WBTreeNodeTestItem *)change->node name]];
+      [pending addObject:@[@(change->index), [(WBTreeNodeTestItem *)change->node name]]];
+      break;
+    case kWBTreeDiffInsert:
+      [pending addObject:@[@(change->index), [(WBTreeNodeTestItem *)change->newNode name]]];
+      break;
+    case kWBTreeDiffUpdate:
+      [state[@"updates"] addObject:[(WBTreeNodeTestItem *)change->node name]];
+      break;
+  }
+}
+
+/* Records all the changes */
+static void _WBTreeNodeTestRecord(const WBTreeDiffChange *change, void *context) {
+  [(__bridge NSMutableArray *)context addObject:@[@(change->operation), @(change->fromIndex), @(change->index)]];
+}
+
+static WBTreeNodeTestItem *_WBTreeNodeTestItem(NSString *name, int64_t value) {
+  WBTreeNodeTestItem *item = [[WBTreeNodeTestItem alloc] init];
+  item.name = name;
+  item.value = value;
+  return item;
+}
+
+@implementation WBTreeNodeTest
+
+- (NSArray *)traverse:(WBTreeNode *)root order:(WBTreeTraversalOrder)order filter:(WBTreeTraversalFilter)filter context:(void *)context {
+  NSMutableArray *result = [NSMutableArray array];
+  WBTreeTraversal traversal;
+  WBTreeTraversalInitialize(root, order, filter, context, &traversal);
+  // a small buffer, so the traversal is resumed often.
+  WBTreeNode * __unsafe_unretained nodes[3];
+  NSUInteger count;
+  while ((count = WBTreeTraversalGetNodes(&traversal, nodes, 3))) {
+    for (NSUInteger idx = 0; idx < count; ++idx)
+      [result addObject:nodes[idx]];
+  }
+  WBTreeTraversalDestroy(&traversal);
+  return result;
+}
+
+- (void)assertNode:(WBTreeNode *)root matches:(NSArray *)expected {
+  XCTAssertEqual([root count], [expected count]);
+  XCTAssertEqual([root lastChild], [expected lastObject]);
+  XCTAssertEqualObjects([root children], expected);
+  for (NSUInteger idx = 0; idx < [expected count]; ++idx) {
+    XCTAssertEqual([root childAtIndex:idx], expected[idx]);
+    XCTAssertEqual([root indexOfChild:expected[idx]], idx);
+    XCTAssertEqual([expected[idx] siblingCount], [expected count]);
+  }
+  XCTAssertThrows([root childAtIndex:[expected count]]);
+}
+
+- (void)testIndexedChildren {
+  srandomdev();
+  // large enough to be indexed.
+  WBTreeNode *root = [WBTreeNode node];
+  NSMutableArray *expected = [NSMutableArray array];
+  for (NSUInteger idx = 0; idx < 200; ++idx) {
+    WBTreeNode *node = [WBTreeNode node];
+    [root appendChild:node];
+    [expected addObject:node];
+  }
+  [self assertNode:root matches:expected];
+
+  for (NSUInteger step = 0; step < 500; ++step) {
+    NSUInteger count = [expected count];
+    NSUInteger position = count ? random() % count : 0;
+    WBTreeNode *node = [WBTreeNode node];
+    switch (random() % 8) {
+      case 0:
+        [root insertChild:node atIndex:position];
+        [expected insertObject:node atIndex:position];
+        break;
+      case 1:
+        [root appendChild:node];
+        [expected addObject:node];
+        break;
+      case 2:
+        if (count) {
+          [root removeChildAtIndex:position];
+          [expected removeObjectAtIndex:position];
+        }
+        break;
+      case 3:
+        if (count) {
+          [root replaceChildAtIndex:position withChild:node];
+          [expected replaceObjectAtIndex:position withObject:node];
+        }
+        break;
+      case 4:
+        if (count) {
+          [expected[position] insertSibling:node];
+          [expected insertObject:node atIndex:position + 1];
+        }
+        break;
+      case 5:
+        if (count) {
+          [(WBTreeNode *)expected[position] remove];
+          [expected removeObjectAtIndex:position];
+        }
+        break;
+      case 6:
+        [root prependChild:node];
+        [expected insertObject:node atIndex:0];
+        break;
+      case 7:
+        [root sortUsingFunction:_WBTreeNodeCompareAddresses context:NULL];
+        [expected sortUsingFunction:_WBTreeNodeCompareAddresses context:NULL];
+        break;
+    }
+    // check a random child, and everything from time to time.
+    if ([expected count]) {
+      NSUInteger idx = random() % [expected count];
+      XCTAssertEqual([root indexOfChild:expected[idx]], idx);
+      XCTAssertEqual([root childAtIndex:idx], expected[idx]);
+    }
+    if (0 == step % 50)
+      [self assertNode:root matches:expected];
+  }
+  [self assertNode:root matches:expected];
+
+  // the copy and the archive must restore the cached count and last child.
+  WBTreeNode *copy = [root copy];
+  XCTAssertEqual([copy count], [expected count]);
+  XCTAssertEqual([[copy lastChild] parent], copy);
+  XCTAssertNil([[copy lastChild] nextSibling]);
+  XCTAssertEqual([[copy lastChild] index], [expected count] - 1);
+
+  WBTreeNode *decoded = [NSKeyedUnarchiver unarchiveObjectWithData:[NSKeyedArchiver archivedDataWithRootObject:root]];
+  XCTAssertEqual([decoded count], [expected count]);
+  XCTAssertNil([[decoded childAtIndex:[expected count] - 1] nextSibling]);
+  XCTAssertEqual([decoded lastChild], [decoded childAtIndex:[expected count] - 1]);
+
+  [root removeAllChildren];
+  [expected removeAllObjects];
+  [self assertNode:root matches:expected];
+}
+
+- (void)testRemoveAndInsert {
+  WBTreeNode *root = [WBTreeNode node];
+  for (NSUInteger idx = 0; idx < 100; ++idx)
+    [root appendChild:[WBTreeNode node]];
+  WBTreeNode *node = [root childAtIndex:42];
+  [node remove];
+  XCTAssertEqual([root indexOfChild:node], (NSUInteger)NSNotFound);
+  XCTAssertEqual([root count], (NSUInteger)99);
+  [root insertChild:node atIndex:7];
+  XCTAssertEqual([node index], (NSUInteger)7);
+  XCTAssertEqual([root childAtIndex:8], [[root childAtIndex:7] nextSibling]);
+}
+
+- (void)testBulkBuilding {
+  // root
+  // + 1
+  //   + 2
+  //   + 3
+  //     + 4
+  // + 5
+  const NSUInteger depths[] = { 0, 1, 2, 2, 3, 1 };
+  const WBTreeNodeRecord records[] = {
+    { NSNotFound, NULL }, { 0, NULL }, { 1, NULL }, { 1, NULL }, { 3, NULL }, { 0, NULL },
+  };
+  NSMutableArray *created = [NSMutableArray array];
+  WBTreeNode *root = [WBTreeNode nodeWithRecords:records count:6 initializer:_WBTreeNodeTestInitialize
+                                         context:(__bridge void *)created];
+  XCTAssertEqual([created count], (NSUInteger)6);
+  XCTAssertEqual(created[0], root);
+  XCTAssertEqualObjects([root children], (@[created[1], created[5]]));
+  XCTAssertEqualObjects([created[1] children], (@[created[2], created[3]]));
+  XCTAssertEqual([created[3] lastChild], created[4]);
+  XCTAssertEqual([created[4] parent], created[3]);
+  XCTAssertEqual([created[5] index], (NSUInteger)1);
+
+  [created removeAllObjects];
+  WBTreeNodeTestStream stream = { depths, 6, 0 };
+  WBTreeNode *streamed = [WBTreeNode nodeWithStream:_WBTreeNodeTestNext initializer:_WBTreeNodeTestInitialize
+                                            context:(__bridge void *)created];
+  XCTAssertEqual(created[0], streamed);
+  XCTAssertEqualObjects([streamed children], (@[created[1], created[5]]));
+  XCTAssertEqualObjects([created[1] children], (@[created[2], created[3]]));
+  XCTAssertEqual([created[3] lastChild], created[4]);
+
+  // built nodes can be mutated as usual.
+  [created[1] appendChild:[WBTreeNode node]];
+  XCTAssertEqual([created[1] count], (NSUInteger)3);
+
+  const WBTreeNodeRecord invalid[] = { { NSNotFound, NULL }, { 2, NULL }, { 0, NULL } };
+  XCTAssertThrows([WBTreeNode nodeWithRecords:invalid count:3 initializer:NULL context:NULL]);
+  XCTAssertNil([WBTreeNode nodeWithRecords:invalid count:0 initializer:NULL context:NULL]);
+  const NSUInteger jump[] = { 0, 2 };
+  stream = (WBTreeNodeTestStream){ jump, 2, 0 };
+  XCTAssertThrows([WBTreeNode nodeWithStream:_WBTreeNodeTestNext initializer:NULL context:&stream]);
+}
+
+- (void)testReleaseLargeTree {
+  // releasing the root must not recurse over the children list.
+  const NSUInteger count = 1000000;
+  WBTreeNodeRecord *records = malloc(count * sizeof(*records));
+  records[0].parent = NSNotFound;
+  for (NSUInteger idx = 1; idx < count; ++idx)
+    records[idx].parent = 0;
+  WBTreeNode *child = nil;
+  @autoreleasepool {
+    WBTreeNode *root = [WBTreeNode nodeWithRecords:records count:count initializer:NULL context:NULL];
+    XCTAssertEqual([root count], count - 1);
+    child = [[root childAtIndex:12] retain];
+  }
+  // a child that is still retained is detached.
+  XCTAssertNil([child parent]);
+  XCTAssertNil([child nextSibling]);
+  [child release];
+  free(records);
+}
+
+- (void)testTraversal {
+  // 0
+  // + 1
+  //   + 2
+  //   + 3
+  //     + 4
+  // + 5
+  //   + 6
+  //   + 7
+  //     + 8
+  // + 9
+  //   + 10
+  const WBTreeNodeRecord records[] = {
+    { NSNotFound, NULL }, { 0, NULL }, { 1, NULL }, { 1, NULL }, { 3, NULL }, { 0, NULL },
+    { 5, NULL }, { 5, NULL }, { 7, NULL }, { 0, NULL }, { 9, NULL },
+  };
+  NSMutableArray *n = [NSMutableArray array];
+  WBTreeNode *root = [WBTreeNode nodeWithRecords:records count:11 initializer:_WBTreeNodeTestInitialize
+                                         context:(__bridge void *)n];
+
+  XCTAssertEqualObjects([self traverse:root order:kWBTreeTraversalPreOrder filter:NULL context:NULL],
+                        (@[n[1], n[2], n[3], n[4], n[5], n[6], n[7], n[8], n[9], n[10]]));
+  XCTAssertEqualObjects([self traverse:root order:kWBTreeTraversalPostOrder filter:NULL context:NULL],
+                        (@[n[2], n[4], n[3], n[1], n[6], n[8], n[7], n[5], n[10], n[9]]));
+  XCTAssertEqualObjects([self traverse:root order:kWBTreeTraversalBreadthFirst filter:NULL context:NULL],
+                        (@[n[1], n[5], n[9], n[2], n[3], n[6], n[7], n[10], n[4], n[8]]));
+  XCTAssertEqualObjects([self traverse:n[7] order:kWBTreeTraversalPreOrder filter:NULL context:NULL], (@[n[8]]));
+  XCTAssertEqualObjects([self traverse:n[8] order:kWBTreeTraversalPostOrder filter:NULL context:NULL], (@[]));
+
+  // 1 is pruned, and the traversal stops at 9.
+  void *context = (__bridge void *)n;
+  XCTAssertEqualObjects([self traverse:root order:kWBTreeTraversalPreOrder filter:_WBTreeNodeTestFilter context:context],
+                        (@[n[1], n[5], n[6], n[7], n[8]]));
+  XCTAssertEqualObjects([self traverse:root order:kWBTreeTraversalPostOrder filter:_WBTreeNodeTestFilter context:context],
+                        (@[n[1], n[6], n[8], n[7], n[5]]));
+  XCTAssertEqualObjects([self traverse:root order:kWBTreeTraversalBreadthFirst filter:_WBTreeNodeTestFilter context:context],
+                        (@[n[1], n[5]]));
+
+  // fast enumeration
+  NSMutableArray *result = [NSMutableArray array];
+  for (WBTreeNode *child in root)
+    [result addObject:child];
+  XCTAssertEqualObjects(result, [root children]);
+
+  [result removeAllObjects];
+  for (WBTreeNode *node in [root deepChildEnumerator])
+    [result addObject:node];
+  XCTAssertEqualObjects(result, [[root deepChildEnumerator] allObjects]);
+  XCTAssertEqual([result count], (NSUInteger)10);
+
+  [result removeAllObjects];
+  for (WBTreeNode *node in [root childEnumerator])
+    [result addObject:node];
+  XCTAssertEqualObjects(result, [root children]);
+
+  XCTAssertThrows({
+    for (WBTreeNode *child in root)
+      [root appendChild:[WBTreeNode node]];
+  });
+  // replacing or sorting does not change the count, but still is a mutation.
+  XCTAssertThrows({
+    for (WBTreeNode *child in root)
+      [root replaceChildAtIndex:0 withChild:[WBTreeNode node]];
+  });
+  XCTAssertThrows({
+    for (WBTreeNode *child in root)
+      [root sortUsingFunction:_WBTreeNodeCompareAddresses context:NULL];
+  });
+}
+
+- (void)testDeepOperations {
+  // large enough to run concurrently.
+  const NSUInteger count = 50000;
+  WBTreeNodeRecord *records = malloc(count * sizeof(*records));
+  records[0].parent = NSNotFound;
+  for (NSUInteger idx = 1; idx < count; ++idx)
+    records[idx].parent = random() % idx;
+  NSMutableArray *nodes = [NSMutableArray array];
+  WBTreeNode *root = [WBTreeNode nodeWithRecords:records count:count initializer:_WBTreeNodeTestInitialize
+                                         context:(__bridge void *)nodes];
+  free(records);
+
+  atomic_uintptr_t checksum[2] = { 0, 0 };
+  [root visitDescendantsUsingFunction:_WBTreeNodeTestVisit context:checksum];
+  uintptr_t expected = 0;
+  for (NSUInteger idx = 1; idx < count; ++idx)
+    expected ^= (uintptr_t)(__bridge void *)nodes[idx];
+  XCTAssertEqual(atomic_load(&checksum[0]), (uintptr_t)(count - 1));
+  XCTAssertEqual(atomic_load(&checksum[1]), expected);
+
+  atomic_uintptr_t visited = 0;
+  atomic_uintptr_t *counter = &visited;
+  [root visitDescendantsUsingBlock:^(id node) {
+    atomic_fetch_add(counter, 1);
+  }];
+  XCTAssertEqual(atomic_load(&visited), (uintptr_t)(count - 1));
+
+  [root deepSortUsingFunction:_WBTreeNodeCompareAddresses context:NULL];
+  for (WBTreeNode *node in nodes) {
+    NSArray *children = [node children];
+    XCTAssertEqualObjects(children, [children sortedArrayUsingFunction:_WBTreeNodeCompareAddresses context:NULL]);
+    XCTAssertEqual([node lastChild], [children lastObject]);
+  }
+}
+
+- (void)testArchive {
+  WBTreeNodeTestItem *root = [[WBTreeNodeTestItem alloc] init];
+  root.name = @"root";
+  for (NSInteger idx = 0; idx < 40; ++idx) {
+    WBTreeNodeTestItem *item = [[WBTreeNodeTestItem alloc] init];
+    item.name = idx % 2 ? @"odd" : nil;
+    item.value = -idx * 1000;
+    item.ratio = idx / 3.;
+    [root appendChild:item];
+    // plain nodes are restored using -init
+    for (NSInteger child = 0; child < idx % 4; ++child)
+      [item appendChild:[WBTreeNode node]];
+  }
+
+  NSData *data = [WBTreeArchiver archivedDataWithRootNode:root];
+  NSError *error = nil;
+  WBTreeUnarchiver *unarchiver = [[WBTreeUnarchiver alloc] initWithData:data error:&error];
+  XCTAssertNotNil(unarchiver, @"%@", error);
+  XCTAssertEqual([unarchiver nodeCount], (NSUInteger)(1 + 40 + 60));
+
+  WBTreeNodeTestItem *copy = [unarchiver rootNode];
+  XCTAssertEqualObjects([copy class], [WBTreeNodeTestItem class]);
+  XCTAssertEqualObjects(copy.name, @"root");
+  XCTAssertEqual([copy count], [root count]);
+  NSUInteger idx = 0;
+  for (WBTreeNodeTestItem *item in copy) {
+    WBTreeNodeTestItem *original = [root childAtIndex:idx++];
+    XCTAssertEqualObjects(item.name, original.name);
+    XCTAssertEqual(item.value, original.value);
+    XCTAssertEqual(item.ratio, original.ratio);
+    XCTAssertEqual([item count], [original count]);
+    XCTAssertEqualObjects([[item firstChild] class], [original firstChild] ? [WBTreeNode class] : Nil);
+  }
+
+  // partial restoration
+  WBTreeArchiveNodeRef ref = [unarchiver referenceOfChildAtIndex:7 ofNode:[unarchiver rootReference]];
+  XCTAssertEqual([unarchiver countOfChildrenOfNode:ref], (NSUInteger)3);
+  WBTreeNodeTestItem *item = [unarchiver nodeWithReference:ref depth:0];
+  XCTAssertEqual(item.value, (int64_t)-7000);
+  XCTAssertEqual([item count], (NSUInteger)0);
+  item = [unarchiver nodeWithReference:ref depth:1];
+  XCTAssertEqual([item count], (NSUInteger)3);
+  XCTAssertEqual([unarchiver referenceOfChildAtIndex:40 ofNode:[unarchiver rootReference]], (WBTreeArchiveNodeRef)kWBTreeArchiveInvalidNode);
+
+  // corrupted archives
+  XCTAssertNil([[WBTreeUnarchiver alloc] initWithData:[data subdataWithRange:NSMakeRange(0, 6)] error:NULL]);
+  NSData *truncated = [data subdataWithRange:NSMakeRange(0, [data length] - 10)];
+  XCTAssertNil([[[WBTreeUnarchiver alloc] initWithData:truncated error:NULL] rootNode]);
+}
+
+- (void)testArchiveDeepChain {
+  // much deeper than what the call stack supports with recursion.
+  const NSUInteger depth = 500000;
+  WBTreeNode *root = [WBTreeNode node];
+  WBTreeNode *node = root;
+  for (NSUInteger idx = 0; idx < depth; ++idx) {
+    WBTreeNode *child = [WBTreeNode node];
+    [node appendChild:child];
+    node = child;
+  }
+  [node appendChild:[WBTreeNode node]];
+
+  NSData *data = [WBTreeArchiver archivedDataWithRootNode:root];
+  WBTreeUnarchiver *unarchiver = [[WBTreeUnarchiver alloc] initWithData:data error:NULL];
+  XCTAssertEqual([unarchiver nodeCount], depth + 2);
+  WBTreeNode *copy = [unarchiver rootNode];
+  XCTAssertNotNil(copy);
+  NSUInteger count = 0;
+  for (node = copy; [node firstChild]; node = [node firstChild])
+    count++;
+  XCTAssertEqual(count, depth + 1);
+
+  copy = [unarchiver nodeWithReference:[unarchiver rootReference] depth:10];
+  count = 0;
+  for (node = copy; [node firstChild]; node = [node firstChild])
+    count++;
+  XCTAssertEqual(count, (NSUInteger)10);
+}
+
+- (void)testDiff {
+  WBTreeNodeTestItem *root = _WBTreeNodeTestItem(@"root", 0);
+  WBTreeNodeTestItem *copy = _WBTreeNodeTestItem(@"root", 0);
+  // old: 0...39, new: shuffled, some removed, some added, 5 updated
+  NSMutableArray *names = [NSMutableArray array];
+  for (NSInteger idx = 0; idx < 40; ++idx) {
+    WBTreeNodeTestItem *item = _WBTreeNodeTestItem([NSString stringWithFormat:@"%ld", (long)idx], idx);
+    [item appendChild:_WBTreeNodeTestItem(@"a", 0)];
+    [item appendChild:_WBTreeNodeTestItem(@"b", 0)];
+    [root appendChild:item];
+    [names addObject:item.name];
+  }
+  NSMutableArray *expected = [names mutableCopy];
+  [expected removeObjectsInRange:NSMakeRange(30, 5)];
+  [expected exchangeObjectAtIndex:3 withObjectAtIndex:20];
+  [expected insertObject:@"new 1" atIndex:0];
+  [expected addObject:@"new 2"];
+  [expected insertObject:expected[10] atIndex:25];
+  [expected removeObjectAtIndex:10];
+  for (NSString *name in expected) {
+    WBTreeNodeTestItem *item = _WBTreeNodeTestItem(name, [name integerValue] + ([name integerValue] % 8 == 1 ? 100 : 0));
+    // children of the first node are reversed
+    [item appendChild:_WBTreeNodeTestItem([name isEqualToString:@"0"] ? @"b" : @"a", 0)];
+    [item appendChild:_WBTreeNodeTestItem([name isEqualToString:@"0"] ? @"a" : @"b", 0)];
+    [copy appendChild:item];
+  }
+
+  NSMutableDictionary *state = [@{ @"root": root, @"names": names, @"moved": [NSMutableArray array],
+                                   @"pending": [NSMutableArray array], @"updates": [NSMutableArray array] } mutableCopy];
+  WBTreeDiffCompute(root, copy, (WBTreeDiffKeyFunction)_WBTreeNodeTestKey, (WBTreeDiffCompareFunction)_WBTreeNodeTestCompare,
+                    _WBTreeNodeTestApply, (__bridge void *)state);
+  [names removeObjectsInArray:state[@"moved"]];
+  NSArray *pending = [state[@"pending"] sortedArrayUsingComparator:^NSComparisonResult(NSArray *a, NSArray *b) {
+    return [a[0] compare:b[0]];
+  }];
+  for (NSArray *insert in pending)
+    [names insertObject:insert[1] atIndex:[insert[0] unsignedIntegerValue]];
+  XCTAssertEqualObjects(names, expected);
+  // the exchange and the move need 3 moves at most
+  XCTAssertLessThanOrEqual([state[@"moved"] count], (NSUInteger)3);
+  XCTAssertEqualObjects([state[@"updates"] sortedArrayUsingSelector:@selector(compare:)], (@[@"1", @"17", @"25", @"9"]));
+
+  // merge
+  NSMutableArray *kept = [NSMutableArray array];
+  for (WBTreeNodeTestItem *item in root) {
+    if ([expected containsObject:item.name])
+      [kept addObject:item];
+  }
+  [root mergeNode:copy keyFunction:(WBTreeDiffKeyFunction)_WBTreeNodeTestKey
+   updateFunction:(WBTreeDiffUpdateFunction)_WBTreeNodeTestUpdate context:NULL];
+  XCTAssertEqual([root count], [expected count]);
+  XCTAssertFalse([copy hasChildren]);
+  NSUInteger idx = 0;
+  for (WBTreeNodeTestItem *item in root) {
+    XCTAssertEqualObjects(item.name, expected[idx++]);
+    XCTAssertEqual(item.value, [item.name integerValue] + ([item.name integerValue] % 8 == 1 ? 100 : 0));
+    XCTAssertEqual([item count], (NSUInteger)2);
+    XCTAssertEqualObjects([[item firstChild] name], [item.name isEqualToString:@"0"] ? @"b" : @"a");
+  }
+  for (WBTreeNodeTestItem *item in kept)
+    XCTAssertEqual([item parent], root);
+}
+
+- (void)testDiffDuplicatedKeys {
+  // below and above the size where siblings are matched using a hash table.
+  const NSUInteger counts[] = { 8, 40 };
+  for (size_t c = 0; c < sizeof(counts) / sizeof(*counts); ++c) {
+    WBTreeNodeTestItem *root = _WBTreeNodeTestItem(@"root", 0);
+    WBTreeNodeTestItem *copy = _WBTreeNodeTestItem(@"root", 0);
+    NSUInteger last = 0;
+    for (NSUInteger idx = 0; idx < counts[c]; ++idx) {
+      NSString *name = idx % 2 ? @"dup" : [NSString stringWithFormat:@"%lu", (unsigned long)idx];
+      [root appendChild:_WBTreeNodeTestItem(name, 0)];
+      if (idx % 2)
+        last = idx;
+    }
+    // same list without the last duplicated node
+    for (NSUInteger idx = 0; idx < counts[c]; ++idx) {
+      if (idx != last)
+        [copy appendChild:_WBTreeNodeTestItem([[root childAtIndex:idx] name], 0)];
+    }
+
+    NSMutableArray *changes = [NSMutableArray array];
+    WBTreeDiffCompute(root, copy, (WBTreeDiffKeyFunction)_WBTreeNodeTestKey, NULL,
+                      _WBTreeNodeTestRecord, (__bridge void *)changes);
+    XCTAssertEqualObjects(changes, (@[@[@(kWBTreeDiffRemove), @(last), @(NSNotFound)]]), @"%lu children", (unsigned long)counts[c]);
+
+    [changes removeAllObjects];
+    WBTreeDiffCompute(root, root, (WBTreeDiffKeyFunction)_WBTreeNodeTestKey, NULL,
+                      _WBTreeNodeTestRecord, (__bridge void *)changes);
+    XCTAssertEqualObjects(changes, @[]);
+  }
+}
+
+@end